@@ -335,6 +335,26 @@ struct ao *ao_init_best(struct mpv_global *global,
     return ao;
 }
 
+// Open the AO given as "driver[/device]" (the --audio-device syntax), without
+// looking at --ao or --audio-device. For secondary outputs, which must not
+// take over the main audio device.
+struct ao *ao_init_device(struct mpv_global *global, int init_flags,
+                          void (*wakeup_cb)(void *ctx), void *wakeup_ctx,
+                          const char *spec, int samplerate, int format,
+                          struct mp_chmap channels)
+{
+    void *tmp = talloc_new(NULL);
+    char *name, *dev;
+    split_ao_device(tmp, (char *)spec, &name, &dev);
+    struct ao *ao = NULL;
+    if (name) {
+        ao = ao_init(false, global, wakeup_cb, wakeup_ctx, NULL, init_flags,
+                     samplerate, format, channels, dev, name);
+    }
+    talloc_free(tmp);
+    return ao;
+}
+
 // Uninitialize and destroy the AO. Remaining audio must be dropped.
 void ao_uninit(struct ao *ao)
 {
@@ -88,6 +88,10 @@ struct ao *ao_init_best(struct mpv_global *global,
                         void (*wakeup_cb)(void *ctx), void *wakeup_ctx,
                         struct encode_lavc_context *encode_lavc_ctx,
                         int samplerate, int format, struct mp_chmap channels);
+struct ao *ao_init_device(struct mpv_global *global, int init_flags,
+                          void (*wakeup_cb)(void *ctx), void *wakeup_ctx,
+                          const char *spec, int samplerate, int format,
+                          struct mp_chmap channels);
 void ao_uninit(struct ao *ao);
 void ao_get_format(struct ao *ao,
                    int *samplerate, int *format, struct mp_chmap *channels);
@@ -0,0 +1,247 @@
+/*
+ * This file is part of mpv.
+ *
+ * mpv is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * mpv is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with mpv.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <inttypes.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "mpv_talloc.h"
+#include "common/common.h"
+#include "osdep/io.h"
+#include "osdep/timer.h"
+
+#include "frametrace.h"
+
+// Per thread, must be a power of 2.
+#define RING_SIZE 4096
+
+struct ring {
+    struct mp_frametrace_event ev[RING_SIZE];
+    atomic_ullong head;     // number of events ever written
+    bool in_use;            // owned by a live thread (rings_lock)
+    int index;
+};
+
+atomic_bool mp_frametrace_active = ATOMIC_VAR_INIT(false);
+
+static pthread_once_t init_once = PTHREAD_ONCE_INIT;
+static pthread_key_t ring_key;
+static pthread_mutex_t rings_lock = PTHREAD_MUTEX_INITIALIZER;
+static struct ring **rings;
+static int num_rings;
+
+static const char *const stage_names[MP_FT_STAGE_COUNT] = {
+    [MP_FT_DEMUX]       = "demux",
+    [MP_FT_DECODED]     = "decoded",
+    [MP_FT_FILTERED]    = "filtered",
+    [MP_FT_VO_QUEUE]    = "vo-queue",
+    [MP_FT_VO_DRAW]     = "vo-draw",
+    [MP_FT_VO_DRAW_END] = "vo-draw-end",
+    [MP_FT_VO_FLIP]     = "vo-flip",
+    [MP_FT_VO_FLIP_END] = "vo-flip-end",
+};
+
+const char *mp_frametrace_stage_name(enum mp_frametrace_stage stage)
+{
+    return stage < MP_FT_STAGE_COUNT ? stage_names[stage] : "unknown";
+}
+
+// The ring outlives its thread (the events stay readable), and is handed to
+// the next thread that starts recording.
+static void release_ring(void *p)
+{
+    struct ring *r = p;
+    pthread_mutex_lock(&rings_lock);
+    r->in_use = false;
+    pthread_mutex_unlock(&rings_lock);
+}
+
+static void init_key(void)
+{
+    pthread_key_create(&ring_key, release_ring);
+}
+
+static struct ring *get_ring(void)
+{
+    pthread_once(&init_once, init_key);
+    struct ring *r = pthread_getspecific(ring_key);
+    if (r)
+        return r;
+
+    pthread_mutex_lock(&rings_lock);
+    for (int n = 0; n < num_rings; n++) {
+        if (!rings[n]->in_use) {
+            r = rings[n];
+            break;
+        }
+    }
+    if (!r && num_rings < UINT16_MAX) {
+        r = talloc_zero(NULL, struct ring);
+        r->index = num_rings;
+        MP_TARRAY_APPEND(NULL, rings, num_rings, r);
+    }
+    if (r)
+        r->in_use = true;
+    pthread_mutex_unlock(&rings_lock);
+
+    if (r)
+        pthread_setspecific(ring_key, r);
+    return r;
+}
+
+void mp_frametrace_enable(bool enable)
+{
+    atomic_store(&mp_frametrace_active, enable);
+}
+
+void mp_frametrace_record(enum mp_frametrace_stage stage, double pts)
+{
+    struct ring *r = get_ring();
+    if (!r)
+        return;
+    // Only this thread writes head.
+    unsigned long long i = atomic_load_explicit(&r->head, memory_order_relaxed);
+    r->ev[i & (RING_SIZE - 1)] = (struct mp_frametrace_event){
+        .time = mp_time_us(),
+        .pts = pts,
+        .stage = stage,
+        .thread = r->index,
+    };
+    atomic_store(&r->head, i + 1);
+}
+
+static int compare_event(const void *pa, const void *pb)
+{
+    const struct mp_frametrace_event *a = pa, *b = pb;
+    return a->time < b->time ? -1 : a->time > b->time;
+}
+
+void mp_frametrace_collect(void *ta_parent, struct mp_frametrace_event **events,
+                           int *num_events)
+{
+    struct mp_frametrace_event *res = NULL;
+    int num = 0;
+
+    pthread_mutex_lock(&rings_lock);
+    for (int n = 0; n < num_rings; n++) {
+        struct ring *r = rings[n];
+        unsigned long long end = atomic_load(&r->head);
+        unsigned long long start = end > RING_SIZE ? end - RING_SIZE : 0;
+        MP_TARRAY_GROW(ta_parent, res, num + (int)(end - start));
+        for (unsigned long long i = start; i < end; i++)
+            res[num + (i - start)] = r->ev[i & (RING_SIZE - 1)];
+        // Drop what the writer may have overwritten while copying.
+        unsigned long long now = atomic_load(&r->head);
+        unsigned long long valid = now > RING_SIZE ? now - RING_SIZE : 0;
+        int skip = valid > start ? MPMIN(valid - start, end - start) : 0;
+        memmove(&res[num], &res[num + skip],
+                (end - start - skip) * sizeof(res[0]));
+        num += end - start - skip;
+    }
+    pthread_mutex_unlock(&rings_lock);
+
+    qsort(res, num, sizeof(res[0]), compare_event);
+    *events = res;
+    *num_events = num;
+}
+
+void mp_frametrace_frames(void *ta_parent, struct mp_frametrace_frame **frames,
+                          int *num_frames, int max)
+{
+    struct mp_frametrace_event *ev;
+    int num_ev;
+    mp_frametrace_collect(NULL, &ev, &num_ev);
+
+    struct mp_frametrace_frame *res = NULL;
+    int num = 0;
+    for (int n = 0; n < num_ev; n++) {
+        struct mp_frametrace_event *e = &ev[n];
+        if (e->pts == MP_NOPTS_VALUE)
+            continue;
+        // Recent frames are the likely match. A new demuxer packet with a
+        // known pts (e.g. after seeking back) starts a new frame.
+        struct mp_frametrace_frame *f = NULL;
+        for (int i = num - 1; i >= 0 && i >= num - 64; i--) {
+            if (res[i].pts == e->pts) {
+                f = &res[i];
+                break;
+            }
+        }
+        if (f && e->stage == MP_FT_DEMUX && f->time[MP_FT_DEMUX])
+            f = NULL;
+        if (!f) {
+            MP_TARRAY_GROW(ta_parent, res, num);
+            f = &res[num++];
+            *f = (struct mp_frametrace_frame){.pts = e->pts};
+        }
+        // Keep the first time; repeated draws of a frame are redraws.
+        if (!f->time[e->stage])
+            f->time[e->stage] = e->time;
+    }
+    talloc_free(ev);
+
+    if (num > max) {
+        memmove(res, res + num - max, max * sizeof(res[0]));
+        num = max;
+    }
+    *frames = res;
+    *num_frames = num;
+}
+
+static const char *const stage_phase[MP_FT_STAGE_COUNT] = {
+    [MP_FT_VO_DRAW]     = "B",
+    [MP_FT_VO_DRAW_END] = "E",
+    [MP_FT_VO_FLIP]     = "B",
+    [MP_FT_VO_FLIP_END] = "E",
+};
+
+bool mp_frametrace_write_json(const char *path)
+{
+    FILE *f = fopen(path, "wb");
+    if (!f)
+        return false;
+
+    struct mp_frametrace_event *ev;
+    int num_ev;
+    mp_frametrace_collect(NULL, &ev, &num_ev);
+
+    fprintf(f, "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n");
+    for (int n = 0; n < num_ev; n++) {
+        struct mp_frametrace_event *e = &ev[n];
+        const char *ph = stage_phase[e->stage] ? stage_phase[e->stage] : "i";
+        const char *name = stage_names[e->stage];
+        // Draw and flip are ranges, named after their start.
+        if (e->stage == MP_FT_VO_DRAW_END || e->stage == MP_FT_VO_FLIP_END)
+            name = stage_names[e->stage - 1];
+        fprintf(f, "%s{\"name\":\"%s\",\"cat\":\"frame\",\"ph\":\"%s\","
+                "\"ts\":%"PRId64",\"pid\":1,\"tid\":%d", n ? ",\n" : "",
+                name, ph, e->time, e->thread);
+        if (ph[0] == 'i')
+            fprintf(f, ",\"s\":\"t\"");
+        if (e->pts != MP_NOPTS_VALUE)
+            fprintf(f, ",\"args\":{\"pts\":%f}", e->pts);
+        fprintf(f, "}");
+    }
+    fprintf(f, "\n]}\n");
+    talloc_free(ev);
+
+    bool ok = !ferror(f);
+    ok &= fclose(f) == 0;
+    return ok;
+}
@@ -0,0 +1,86 @@
+/*
+ * This file is part of mpv.
+ *
+ * mpv is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * mpv is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with mpv.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef MP_FRAMETRACE_H_
+#define MP_FRAMETRACE_H_
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "osdep/atomic.h"
+
+// Per-frame pipeline tracing. Video frames are stamped with the time they
+// cross each stage; the frame is identified by its pts. Every thread writes
+// into its own ring buffer, so recording takes no locks, and when tracing is
+// disabled a stamp is a single relaxed load.
+//
+// The state is process-wide (like the tracing it is meant for), so multiple
+// libmpv instances share it.
+
+enum mp_frametrace_stage {
+    MP_FT_DEMUX,        // packet returned by the demuxer
+    MP_FT_DECODED,      // frame returned by the decoder
+    MP_FT_FILTERED,     // frame returned by the filter chain
+    MP_FT_VO_QUEUE,     // frame handed to the VO thread
+    MP_FT_VO_DRAW,      // VO draw_frame/draw_image start
+    MP_FT_VO_DRAW_END,
+    MP_FT_VO_FLIP,      // VO flip_page start
+    MP_FT_VO_FLIP_END,
+    MP_FT_STAGE_COUNT
+};
+
+struct mp_frametrace_event {
+    int64_t time;       // mp_time_us()
+    double pts;
+    uint16_t stage;
+    uint16_t thread;    // index of the recording thread's ring
+};
+
+extern atomic_bool mp_frametrace_active;
+
+void mp_frametrace_record(enum mp_frametrace_stage stage, double pts);
+
+static inline void mp_frametrace(enum mp_frametrace_stage stage, double pts)
+{
+    if (atomic_load_explicit(&mp_frametrace_active, memory_order_relaxed))
+        mp_frametrace_record(stage, pts);
+}
+
+void mp_frametrace_enable(bool enable);
+
+const char *mp_frametrace_stage_name(enum mp_frametrace_stage stage);
+
+// Copy the events still in the ring buffers, sorted by time. The array is
+// allocated as child of ta_parent.
+void mp_frametrace_collect(void *ta_parent, struct mp_frametrace_event **events,
+                           int *num_events);
+
+struct mp_frametrace_frame {
+    double pts;
+    int64_t time[MP_FT_STAGE_COUNT];    // 0 if the stage was not seen
+};
+
+// Group the recorded events by frame, and return the last max frames, oldest
+// first. The array is allocated as child of ta_parent.
+void mp_frametrace_frames(void *ta_parent, struct mp_frametrace_frame **frames,
+                          int *num_frames, int max);
+
+// Write all recorded events as Chrome trace event JSON (chrome://tracing,
+// Perfetto). Returns success.
+bool mp_frametrace_write_json(const char *path);
+
+#endif
@@ -0,0 +1,249 @@
+/*
+ * This file is part of mpv.
+ *
+ * mpv is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * mpv is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with mpv.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <assert.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <libavcodec/avcodec.h>
+
+#include "common/common.h"
+#include "common/msg.h"
+#include "options/path.h"
+#include "osdep/io.h"
+
+#include "cache.h"
+#include "packet.h"
+
+// The packet data is appended to a single file. Only the payload goes there;
+// metadata and side data stay with the packet in memory. Since the demuxer
+// cache mostly frees packets in the order they were added, file space is
+// reclaimed from the start of the file: freed data before the oldest live
+// packet is punched out, and the file is truncated when it is empty.
+
+// Min. amount of freed data at the start of the file to punch a hole for.
+#define PUNCH_SIZE (4 * 1024 * 1024)
+
+struct extent {
+    uint64_t pos;
+    int len;
+    bool freed;
+};
+
+struct demux_cache {
+    struct mp_log *log;
+    FILE *f;
+    uint64_t end;           // file size (append position)
+    uint64_t punched;       // start of the file that was punched out
+    uint64_t live_bytes;
+
+    // Written packet data in file order; extents[first] is the oldest one
+    // still in use.
+    struct extent *extents;
+    int first, num_extents;
+
+    bool write_failed;
+};
+
+static void cache_destroy(void *ptr)
+{
+    struct demux_cache *c = ptr;
+    if (c->f)
+        fclose(c->f);
+}
+
+struct demux_cache *demux_cache_create(void *ta_parent, struct mp_log *log,
+                                       const char *dir)
+{
+    struct demux_cache *c = talloc_zero(ta_parent, struct demux_cache);
+    talloc_set_destructor(c, cache_destroy);
+    c->log = log;
+
+    if (dir && dir[0]) {
+        char *path = mp_path_join(NULL, dir, "mpv-demux-cache-XXXXXX");
+        int fd = mkstemp(path);
+        if (fd >= 0) {
+            // Gone from the directory, but not from disk, until it's closed.
+            unlink(path);
+            c->f = fdopen(fd, "w+b");
+            if (!c->f)
+                close(fd);
+        }
+        if (!c->f)
+            MP_ERR(c, "can't create cache file in '%s': %s\n", dir,
+                   mp_strerror(errno));
+        talloc_free(path);
+    } else {
+        c->f = tmpfile();
+        if (!c->f)
+            MP_ERR(c, "can't create cache file: %s\n", mp_strerror(errno));
+    }
+
+    if (!c->f) {
+        talloc_free(c);
+        return NULL;
+    }
+    return c;
+}
+
+bool demux_cache_spill(struct demux_cache *c, struct demux_packet *dp)
+{
+    if (dp->is_cached)
+        return true;
+    AVPacket *avpkt = dp->avpacket;
+    // Packets not allocated by us, or not refcounted.
+    if (!avpkt || (!avpkt->buf && !dp->pooled) || avpkt->data != dp->buffer)
+        return false;
+
+    if (!dp->has_cache_copy) {
+        if (c->write_failed)
+            return false;
+        if (fseeko(c->f, c->end, SEEK_SET) ||
+            fwrite(dp->buffer, dp->len, 1, c->f) != 1)
+        {
+            MP_ERR(c, "error writing cache file: %s\n",
+                   mp_strerror(errno));
+            c->write_failed = true;
+            return false;
+        }
+        MP_TARRAY_APPEND(c, c->extents, c->num_extents, (struct extent){
+            .pos = c->end,
+            .len = dp->len,
+        });
+        dp->cache_pos = c->end;
+        dp->has_cache_copy = true;
+        c->end += dp->len;
+        c->live_bytes += dp->len;
+    }
+
+    demux_packet_unref_data(dp);
+    dp->is_cached = true;
+    return true;
+}
+
+static bool read_data(struct demux_cache *c, struct demux_packet *dp,
+                      uint8_t *dst)
+{
+    if (fseeko(c->f, dp->cache_pos, SEEK_SET) == 0 &&
+        fread(dst, dp->len, 1, c->f) == 1)
+        return true;
+    // Not much we can do; let the decoder deal with the broken packet.
+    MP_ERR(c, "error reading cache file: %s\n", mp_strerror(errno));
+    memset(dst, 0, dp->len);
+    return false;
+}
+
+bool demux_cache_page_in(struct demux_cache *c, struct demux_packet *dp)
+{
+    if (!dp->is_cached)
+        return true;
+    AVBufferRef *buf = av_buffer_alloc(dp->len + AV_INPUT_BUFFER_PADDING_SIZE);
+    if (!buf)
+        return false;
+    memset(buf->data + dp->len, 0, AV_INPUT_BUFFER_PADDING_SIZE);
+    if (!read_data(c, dp, buf->data)) {
+        av_buffer_unref(&buf);
+        return false;
+    }
+    dp->avpacket->buf = buf;
+    dp->avpacket->data = buf->data;
+    dp->buffer = buf->data;
+    dp->is_cached = false;
+    return true;
+}
+
+struct demux_packet *demux_cache_read(struct demux_cache *c,
+                                      struct demux_packet *dp)
+{
+    assert(dp->is_cached);
+    struct demux_packet *new = new_demux_packet(dp->len);
+    if (!new)
+        return NULL;
+    read_data(c, dp, new->buffer);
+    if (av_packet_copy_props(new->avpacket, dp->avpacket) < 0) {
+        talloc_free(new);
+        return NULL;
+    }
+    demux_packet_copy_attribs(new, dp);
+    return new;
+}
+
+static void reclaim(struct demux_cache *c)
+{
+    while (c->first < c->num_extents && c->extents[c->first].freed)
+        c->first++;
+
+    if (c->first == c->num_extents) {
+        // Nothing left; start over with an empty file.
+        fflush(c->f);
+        if (ftruncate(fileno(c->f), 0))
+            MP_VERBOSE(c, "truncating cache file failed\n");
+        c->end = c->punched = 0;
+        c->first = c->num_extents = 0;
+        return;
+    }
+
+    uint64_t start = c->extents[c->first].pos & ~(uint64_t)4095;
+    if (start - c->punched >= PUNCH_SIZE) {
+#ifdef FALLOC_FL_PUNCH_HOLE
+        fflush(c->f);
+        if (fallocate(fileno(c->f), FALLOC_FL_PUNCH_HOLE | FALLOC_FL_KEEP_SIZE,
+                      c->punched, start - c->punched))
+            MP_VERBOSE(c, "punching cache file failed\n");
+#endif
+        c->punched = start;
+    }
+
+    if (c->first > 64 && c->first > c->num_extents / 2) {
+        c->num_extents -= c->first;
+        memmove(c->extents, c->extents + c->first,
+                c->num_extents * sizeof(c->extents[0]));
+        c->first = 0;
+    }
+}
+
+void demux_cache_release(struct demux_cache *c, struct demux_packet *dp)
+{
+    if (!dp->has_cache_copy)
+        return;
+
+    int lo = c->first, hi = c->num_extents - 1;
+    while (lo < hi) {
+        int mid = lo + (hi - lo) / 2;
+        if (c->extents[mid].pos < dp->cache_pos) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+    assert(lo < c->num_extents && c->extents[lo].pos == dp->cache_pos);
+    c->extents[lo].freed = true;
+    c->live_bytes -= dp->len;
+    dp->has_cache_copy = false;
+
+    if (lo == c->first)
+        reclaim(c);
+}
+
+uint64_t demux_cache_get_size(struct demux_cache *c)
+{
+    return c->live_bytes;
+}
@@ -0,0 +1,54 @@
+/*
+ * This file is part of mpv.
+ *
+ * mpv is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * mpv is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with mpv.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef MP_DEMUX_CACHE_H
+#define MP_DEMUX_CACHE_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+struct demux_packet;
+struct mp_log;
+
+// Disk cache for the packet data of the demuxer cache (see demux.c). Not
+// thread-safe; demux.c uses it with its lock held.
+struct demux_cache;
+
+// dir==NULL or "" uses an anonymous temporary file. Returns NULL on errors.
+struct demux_cache *demux_cache_create(void *ta_parent, struct mp_log *log,
+                                       const char *dir);
+
+// Move the packet data to the cache, and free it in memory. Sets
+// dp->is_cached. Returns false on errors, in which case dp is unchanged.
+bool demux_cache_spill(struct demux_cache *c, struct demux_packet *dp);
+
+// Read the data of a spilled packet back into memory (clears dp->is_cached).
+// The copy on disk is kept, so spilling it again is free.
+bool demux_cache_page_in(struct demux_cache *c, struct demux_packet *dp);
+
+// Like demux_copy_packet(), but for spilled packets. Returns NULL on OOM.
+struct demux_packet *demux_cache_read(struct demux_cache *c,
+                                      struct demux_packet *dp);
+
+// Release the disk space used by the packet. Must be called before freeing a
+// packet that was spilled.
+void demux_cache_release(struct demux_cache *c, struct demux_packet *dp);
+
+// Bytes of packet data in the cache that were not released yet.
+uint64_t demux_cache_get_size(struct demux_cache *c);
+
+#endif
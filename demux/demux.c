@@ -32,6 +32,7 @@
 #include "config.h"
 #include "options/m_config.h"
 #include "options/m_option.h"
+#include "options/path.h"
 #include "mpv_talloc.h"
 #include "common/msg.h"
 #include "common/global.h"
@@ -42,7 +43,9 @@
 #include "demux.h"
 #include "timeline.h"
 #include "stheader.h"
+#include "cache.h"
 #include "cue.h"
+#include "common/frametrace.h"
 
 // Demuxer list
 extern const struct demuxer_desc demuxer_desc_edl;
@@ -94,6 +97,9 @@ struct demux_opts {
     int access_references;
     int seekable_cache;
     int create_ccs;
+    int disk_cache;
+    char *cache_dir;
+    int64_t max_bytes_mem;
 };
 
 #define OPT_BASE_STRUCT struct demux_opts
@@ -113,6 +119,9 @@ const struct m_sub_options demux_conf = {
         OPT_CHOICE("demuxer-seekable-cache", seekable_cache, 0,
                    ({"auto", -1}, {"no", 0}, {"yes", 1})),
         OPT_FLAG("sub-create-cc-track", create_ccs, 0),
+        OPT_FLAG("demuxer-disk-cache", disk_cache, 0),
+        OPT_STRING("demuxer-cache-dir", cache_dir, M_OPT_FILE),
+        OPT_BYTE_SIZE("demuxer-max-memory", max_bytes_mem, 0, 0, MAX_BYTES),
         {0}
     },
     .size = sizeof(struct demux_opts),
@@ -123,6 +132,7 @@ const struct m_sub_options demux_conf = {
         .min_secs_cache = 10.0 * 60 * 60,
         .seekable_cache = -1,
         .access_references = 1,
+        .max_bytes_mem = 100 * 1024 * 1024,
     },
 };
 
@@ -201,6 +211,15 @@ struct demux_internal {
     size_t total_bytes;         // total sum of packet data buffered
     size_t fw_bytes;            // sum of forward packet data in current_range
 
+    // Allocator for the packets of the demuxer (demuxer->packet_pool).
+    struct demux_packet_pool *pool;
+
+    // If non-NULL, the data of packets the reader is not going to need soon
+    // is moved to this file while more than max_bytes_mem are in memory.
+    struct demux_cache *cache;
+    size_t mem_bytes;           // sum of packet data in memory
+    size_t max_bytes_mem;
+
     // Range from which decoder is reading, and to which demuxer is appending.
     // This is never NULL. This is always ranges[num_ranges - 1].
     struct demux_cached_range *current_range;
@@ -234,7 +253,12 @@ struct demux_cached_range {
     bool is_eof;            // set if the file ends with this range
 };
 
-#define MAX_INDEX_ENTRIES 16
+// Keyframe index entry.
+struct index_entry {
+    struct demux_packet *dp;
+    // Value of demux_queue.in_bytes/in_packs before dp was appended.
+    size_t bytes, packs;
+};
 
 // A continuous list of cached packets for a single stream/range. There is one
 // for each stream and range. Also contains some state for use during demuxing
@@ -247,6 +271,7 @@ struct demux_queue {
     struct demux_packet *tail;
 
     struct demux_packet *next_prune_target; // cached value for faster pruning
+    struct demux_packet *spill_last;        // last packet checked for spilling
 
     bool correct_dts;       // packet DTS is strictly monotonically increasing
     bool correct_pos;       // packet pos is strictly monotonically increasing
@@ -265,11 +290,13 @@ struct demux_queue {
     bool is_bof;            // started demuxing at beginning of file
     bool is_eof;            // received true EOF here
 
-    // incomplete index to somewhat speed up seek operations
-    // the entries in index[] must be in packet queue append/removal order
-    int num_index;          // valid index[] entries
-    double index_distance;  // minimum keyframe distance to add index element
-    struct demux_packet *index[MAX_INDEX_ENTRIES];
+    // sum of packet sizes/number of packets ever appended to the queue
+    size_t in_bytes, in_packs;
+
+    // keyframe index for seeking; index[index_head..num_index) are keyframes
+    // in packet queue order, with strictly increasing kf_seek_pts
+    struct index_entry *index;
+    int index_head, num_index;
 };
 
 struct demux_stream {
@@ -350,6 +377,7 @@ static void check_queue_consistency(struct demux_internal *in)
 {
     size_t total_bytes = 0;
     size_t total_fw_bytes = 0;
+    size_t mem_bytes = 0;
 
     assert(in->current_range && in->num_ranges > 0);
     assert(in->current_range == in->ranges[in->num_ranges - 1]);
@@ -370,7 +398,7 @@ static void check_queue_consistency(struct demux_internal *in)
             bool is_forward = false;
             bool kf_found = false;
             bool npt_found = false;
-            int next_index = 0;
+            int next_index = queue->index_head;
             for (struct demux_packet *dp = queue->head; dp; dp = dp->next) {
                 is_forward |= dp == queue->ds->reader_head;
                 kf_found |= dp == queue->keyframe_latest;
@@ -378,6 +406,8 @@ static void check_queue_consistency(struct demux_internal *in)
 
                 size_t bytes = demux_packet_estimate_total_size(dp);
                 total_bytes += bytes;
+                if (!dp->is_cached)
+                    mem_bytes += dp->len;
                 if (is_forward) {
                     fw_bytes += bytes;
                     fw_packs += 1;
@@ -389,7 +419,8 @@ static void check_queue_consistency(struct demux_internal *in)
                 if (!dp->next)
                     assert(queue->tail == dp);
 
-                if (next_index < queue->num_index && queue->index[next_index] == dp)
+                if (next_index < queue->num_index &&
+                    queue->index[next_index].dp == dp)
                     next_index += 1;
             }
             if (!queue->head)
@@ -426,6 +457,7 @@ static void check_queue_consistency(struct demux_internal *in)
 
     assert(in->total_bytes == total_bytes);
     assert(in->fw_bytes == total_fw_bytes);
+    assert(in->mem_bytes == mem_bytes);
 }
 #endif
 
@@ -560,6 +592,17 @@ static void update_seek_ranges(struct demux_cached_range *range)
         range->seek_start = range->seek_end = MP_NOPTS_VALUE;
 }
 
+// Free a packet removed from a queue, and update the buffer sizes.
+static void free_queue_packet(struct demux_internal *in, struct demux_packet *dp)
+{
+    in->total_bytes -= demux_packet_estimate_total_size(dp);
+    if (!dp->is_cached)
+        in->mem_bytes -= dp->len;
+    if (in->cache)
+        demux_cache_release(in->cache, dp);
+    free_demux_packet(dp);
+}
+
 // Remove queue->head from the queue. Does not update in->fw_bytes/in->fw_packs.
 static void remove_head_packet(struct demux_queue *queue)
 {
@@ -570,18 +613,19 @@ static void remove_head_packet(struct demux_queue *queue)
         queue->next_prune_target = NULL;
     if (queue->keyframe_latest == dp)
         queue->keyframe_latest = NULL;
+    if (queue->spill_last == dp)
+        queue->spill_last = NULL;
     queue->is_bof = false;
 
-    queue->ds->in->total_bytes -= demux_packet_estimate_total_size(dp);
-
-    if (queue->num_index && queue->index[0] == dp)
-        MP_TARRAY_REMOVE_AT(queue->index, queue->num_index, 0);
+    if (queue->index_head < queue->num_index &&
+        queue->index[queue->index_head].dp == dp)
+        queue->index_head++;
 
     queue->head = dp->next;
     if (!queue->head)
         queue->tail = NULL;
 
-    talloc_free(dp);
+    free_queue_packet(queue->ds->in, dp);
 }
 
 static void clear_queue(struct demux_queue *queue)
@@ -592,18 +636,18 @@ static void clear_queue(struct demux_queue *queue)
     struct demux_packet *dp = queue->head;
     while (dp) {
         struct demux_packet *dn = dp->next;
-        in->total_bytes -= demux_packet_estimate_total_size(dp);
         assert(ds->reader_head != dp);
-        talloc_free(dp);
+        free_queue_packet(in, dp);
         dp = dn;
     }
     queue->head = queue->tail = NULL;
     queue->next_prune_target = NULL;
+    queue->spill_last = NULL;
     queue->keyframe_latest = NULL;
     queue->seek_start = queue->seek_end = queue->last_pruned = MP_NOPTS_VALUE;
 
-    queue->num_index = 0;
-    queue->index_distance = 1.0;
+    TA_FREEP(&queue->index);
+    queue->index_head = queue->num_index = 0;
 
     queue->correct_dts = queue->correct_pos = true;
     queue->last_pos = -1;
@@ -939,6 +983,7 @@ void free_demuxer(demuxer_t *demuxer)
 
     demux_flush(demuxer);
     assert(in->total_bytes == 0);
+    assert(in->mem_bytes == 0);
 
     for (int n = 0; n < in->num_streams; n++)
         talloc_free(in->streams[n]);
@@ -1043,25 +1088,55 @@ void demuxer_feed_caption(struct sh_stream *stream, demux_packet_t *dp)
     demux_add_packet(sh, dp);
 }
 
-// Add the keyframe to the end of the index. Not all packets are actually added.
-static void add_index_entry(struct demux_queue *queue, struct demux_packet *dp)
+static void append_index_entry(struct demux_queue *queue,
+                               struct demux_packet *dp,
+                               size_t bytes, size_t packs)
 {
     assert(dp->keyframe && dp->kf_seek_pts != MP_NOPTS_VALUE);
 
-    if (queue->num_index) {
-        double prev = queue->index[queue->num_index - 1]->kf_seek_pts;
-        if (dp->kf_seek_pts < prev + queue->index_distance)
-            return;
+    // Keyframes with unordered timestamps are left out, which keeps the index
+    // sorted. They can still be found by walking the queue.
+    if (queue->index_head < queue->num_index &&
+        dp->kf_seek_pts <= queue->index[queue->num_index - 1].dp->kf_seek_pts)
+        return;
+
+    // Drop the entries of pruned packets once they make up half of the array.
+    if (queue->index_head && queue->index_head >= queue->num_index / 2) {
+        queue->num_index -= queue->index_head;
+        memmove(queue->index, queue->index + queue->index_head,
+                queue->num_index * sizeof(queue->index[0]));
+        queue->index_head = 0;
     }
 
-    if (queue->num_index == MAX_INDEX_ENTRIES) {
-        for (int n = 0; n < MAX_INDEX_ENTRIES / 2; n++)
-            queue->index[n] = queue->index[n * 2];
-        queue->num_index = MAX_INDEX_ENTRIES / 2;
-        queue->index_distance *= 2;
+    MP_TARRAY_APPEND(queue, queue->index, queue->num_index,
+                     (struct index_entry){dp, bytes, packs});
+}
+
+// Add the keyframe, which must be in the queue, to the end of the index.
+static void add_index_entry(struct demux_queue *queue, struct demux_packet *dp)
+{
+    // (The packet is usually at most a keyframe interval from the end.)
+    size_t bytes = queue->in_bytes, packs = queue->in_packs;
+    for (struct demux_packet *cur = dp; cur; cur = cur->next) {
+        bytes -= demux_packet_estimate_total_size(cur);
+        packs -= 1;
     }
+    append_index_entry(queue, dp, bytes, packs);
+}
 
-    queue->index[queue->num_index++] = dp;
+// Return the last index entry with kf_seek_pts <= pts, or -1 if none.
+static int find_index_entry(struct demux_queue *queue, double pts)
+{
+    int lo = queue->index_head, hi = queue->num_index;
+    while (lo < hi) {
+        int mid = lo + (hi - lo) / 2;
+        if (queue->index[mid].dp->kf_seek_pts > pts) {
+            hi = mid;
+        } else {
+            lo = mid + 1;
+        }
+    }
+    return lo > queue->index_head ? lo - 1 : -1;
 }
 
 // Check whether the next range in the list is, and if it appears to overlap,
@@ -1182,6 +1257,17 @@ static void attempt_range_joining(struct demux_internal *in)
 
         struct demux_stream *ds = in->streams[n]->ds;
 
+        // Index q2's packets at their new position.
+        int i = q2->index_head;
+        for (struct demux_packet *dp = q2->head; dp; dp = dp->next) {
+            if (i < q2->num_index && q2->index[i].dp == dp) {
+                append_index_entry(q1, dp, q1->in_bytes, q1->in_packs);
+                i++;
+            }
+            q1->in_bytes += demux_packet_estimate_total_size(dp);
+            q1->in_packs += 1;
+        }
+
         if (q2->head) {
             if (q1->head) {
                 q1->tail->next = q2->head;
@@ -1204,11 +1290,9 @@ static void attempt_range_joining(struct demux_internal *in)
 
         q2->head = q2->tail = NULL;
         q2->next_prune_target = NULL;
+        q2->spill_last = NULL;
         q2->keyframe_latest = NULL;
-
-        for (int i = 0; i < q2->num_index; i++)
-            add_index_entry(q1, q2->index[i]);
-        q2->num_index = 0;
+        q2->index_head = q2->num_index = 0;
 
         recompute_buffers(ds);
         in->fw_bytes += ds->fw_bytes;
@@ -1286,11 +1370,41 @@ static void adjust_seek_range_on_packet(struct demux_stream *ds,
         attempt_range_joining(ds->in);
 }
 
+// Move the data of packets the reader won't need soon to the disk cache, until
+// the packet data in memory is well below the limit. These are the packets
+// behind the reader in the current range, and all packets of other ranges.
+static void spill_packets(struct demux_internal *in)
+{
+    if (!in->cache || in->mem_bytes <= in->max_bytes_mem)
+        return;
+
+    size_t target = in->max_bytes_mem / 4 * 3;
+
+    // (Start from least recently used range.)
+    for (int n = 0; n < in->num_ranges; n++) {
+        struct demux_cached_range *range = in->ranges[n];
+        for (int i = 0; i < range->num_streams; i++) {
+            struct demux_queue *queue = range->streams[i];
+            struct demux_packet *end =
+                range == in->current_range ? queue->ds->reader_head : NULL;
+            struct demux_packet *dp =
+                queue->spill_last ? queue->spill_last->next : queue->head;
+            for (; dp && dp != end; dp = dp->next) {
+                if (!dp->is_cached && demux_cache_spill(in->cache, dp))
+                    in->mem_bytes -= dp->len;
+                queue->spill_last = dp;
+                if (in->mem_bytes <= target)
+                    return;
+            }
+        }
+    }
+}
+
 void demux_add_packet(struct sh_stream *stream, demux_packet_t *dp)
 {
     struct demux_stream *ds = stream ? stream->ds : NULL;
     if (!dp || !dp->len || !ds || demux_cancel_test(ds->in->d_thread)) {
-        talloc_free(dp);
+        free_demux_packet(dp);
         return;
     }
     struct demux_internal *in = ds->in;
@@ -1325,7 +1439,7 @@ void demux_add_packet(struct sh_stream *stream, demux_packet_t *dp)
 
     if (drop) {
         pthread_mutex_unlock(&in->lock);
-        talloc_free(dp);
+        free_demux_packet(dp);
         return;
     }
 
@@ -1349,6 +1463,7 @@ void demux_add_packet(struct sh_stream *stream, demux_packet_t *dp)
 
     size_t bytes = demux_packet_estimate_total_size(dp);
     ds->in->total_bytes += bytes;
+    in->mem_bytes += dp->len;
     if (ds->reader_head) {
         ds->fw_packs++;
         ds->fw_bytes += bytes;
@@ -1363,6 +1478,8 @@ void demux_add_packet(struct sh_stream *stream, demux_packet_t *dp)
         // first packet in stream
         queue->head = queue->tail = dp;
     }
+    queue->in_bytes += bytes;
+    queue->in_packs += 1;
 
     if (!ds->ignore_eof) {
         // obviously not true anymore
@@ -1385,6 +1502,7 @@ void demux_add_packet(struct sh_stream *stream, demux_packet_t *dp)
              dp->len, dp->pts, dp->dts, dp->pos, ds->fw_packs, ds->fw_bytes);
 
     adjust_seek_range_on_packet(ds, dp);
+    spill_packets(in);
 
     // Possible update duration based on highest TS demuxed (but ignore subs).
     if (stream->type != STREAM_SUB) {
@@ -1701,7 +1819,8 @@ static struct demux_packet *dequeue_packet(struct demux_stream *ds)
     ds->last_ret_dts = pkt->dts;
 
     // The returned packet is mutated etc. and will be owned by the user.
-    pkt = demux_copy_packet(pkt);
+    pkt = pkt->is_cached ? demux_cache_read(ds->in->cache, pkt)
+                         : demux_copy_packet(pkt);
     if (!pkt)
         abort();
     pkt->next = NULL;
@@ -1738,6 +1857,9 @@ static struct demux_packet *dequeue_packet(struct demux_stream *ds)
         pkt->end = MP_ADD_PTS(pkt->end, ds->in->ts_offset);
     }
 
+    if (ds->type == STREAM_VIDEO)
+        mp_frametrace(MP_FT_DEMUX, pkt->pts);
+
     // Apply timed metadata when packet is returned to user.
     // (The tags_init thing is a microopt. to not do refcounting for sane files.)
     struct mp_packet_tags *metadata = pkt->metadata;
@@ -2210,6 +2332,7 @@ static struct demuxer *open_given_type(struct mpv_global *global,
         .seeking_in_progress = MP_NOPTS_VALUE,
         .demux_ts = MP_NOPTS_VALUE,
     };
+    in->pool = demuxer->packet_pool = demux_packet_pool_create(in);
     pthread_mutex_init(&in->lock, NULL);
     pthread_cond_init(&in->wakeup, NULL);
 
@@ -2269,6 +2392,12 @@ static struct demuxer *open_given_type(struct mpv_global *global,
                 seekable = 1;
         }
         in->seekable_cache = seekable == 1;
+        if (in->seekable_cache && opts->disk_cache) {
+            char *dir = mp_get_user_path(NULL, global, opts->cache_dir);
+            in->cache = demux_cache_create(in, in->log, dir);
+            in->max_bytes_mem = opts->max_bytes_mem;
+            talloc_free(dir);
+        }
         if (!(params && params->disable_timeline)) {
             struct timeline *tl = timeline_load(global, log, demuxer);
             if (tl) {
@@ -2446,12 +2575,8 @@ static void switch_current_range(struct demux_internal *in,
 static struct demux_packet *find_seek_target(struct demux_queue *queue,
                                              double pts, int flags)
 {
-    struct demux_packet *start = queue->head;
-    for (int n = 0; n < queue->num_index; n++) {
-        if (queue->index[n]->kf_seek_pts > pts)
-            break;
-        start = queue->index[n];
-    }
+    int n = find_index_entry(queue, pts);
+    struct demux_packet *start = n >= 0 ? queue->index[n].dp : queue->head;
 
     struct demux_packet *target = NULL;
     double target_diff = MP_NOPTS_VALUE;
@@ -2511,6 +2636,50 @@ static struct demux_cached_range *find_cache_seek_target(struct demux_internal *
     return NULL;
 }
 
+// Like recompute_buffers(), but for a reader_head just found with
+// find_seek_target() in the given queue. Uses the index instead of walking the
+// whole forward buffer.
+static void set_buffers_from_index(struct demux_stream *ds,
+                                   struct demux_queue *queue)
+{
+    struct demux_packet *target = ds->reader_head;
+    int n = target ? find_index_entry(queue, target->kf_seek_pts) : -1;
+    if (n < 0) {
+        recompute_buffers(ds);
+        return;
+    }
+
+    size_t bytes = queue->index[n].bytes, packs = queue->index[n].packs;
+    for (struct demux_packet *dp = queue->index[n].dp; dp != target;
+         dp = dp->next)
+    {
+        if (!dp) {
+            // target is before the entry (unordered timestamps)
+            recompute_buffers(ds);
+            return;
+        }
+        bytes += demux_packet_estimate_total_size(dp);
+        packs += 1;
+    }
+
+    ds->fw_bytes = queue->in_bytes - bytes;
+    ds->fw_packs = queue->in_packs - packs;
+}
+
+// Read the spilled packets at the start of the new reader position back from
+// the disk cache, so the decoder doesn't have to wait for them one by one.
+static void page_in_packets(struct demux_internal *in, struct demux_packet *dp)
+{
+    size_t budget = in->max_bytes_mem / 4 / MPMAX(in->num_streams, 1);
+    size_t bytes = 0;
+    for (; dp && bytes < budget; dp = dp->next) {
+        if (dp->is_cached && demux_cache_page_in(in->cache, dp)) {
+            in->mem_bytes += dp->len;
+            bytes += dp->len;
+        }
+    }
+}
+
 // must be called locked
 // range must be non-NULL and from find_cache_seek_target() using the same pts
 // and flags, before any other changes to the cached state
@@ -2557,9 +2726,14 @@ static void execute_cache_seek(struct demux_internal *in,
         if (ds->reader_head)
             ds->base_ts = PTS_OR_DEF(ds->reader_head->pts, ds->reader_head->dts);
 
-        recompute_buffers(ds);
+        set_buffers_from_index(ds, queue);
         in->fw_bytes += ds->fw_bytes;
 
+        // The reader may now be behind packets checked for spilling.
+        queue->spill_last = NULL;
+        if (in->cache)
+            page_in_packets(in, target);
+
         MP_VERBOSE(in, "seeking stream %d (%s) to ",
                    n, stream_type_name(ds->type));
 
@@ -3000,6 +3174,7 @@ static int cached_demux_control(struct demux_internal *in, int cmd, void *arg)
             .seeking = in->seeking_in_progress,
             .low_level_seeks = in->low_level_seeks,
             .ts_last = in->demux_ts,
+            .file_cache_bytes = in->cache ? demux_cache_get_size(in->cache) : -1,
         };
         bool any_packets = false;
         for (int n = 0; n < in->num_streams; n++) {
@@ -56,6 +56,7 @@ struct demux_ctrl_reader_state {
     double seeking; // current low level seek target, or NOPTS
     int low_level_seeks; // number of started low level seeks
     double ts_last; // approx. timestamp of demuxer position
+    int64_t file_cache_bytes; // packet data in the disk cache, -1 if disabled
     // Positions that can be seeked to without incurring the latency of a low
     // level seek.
     int num_seek_ranges;
@@ -224,6 +225,9 @@ typedef struct demuxer {
     struct mp_tags *metadata;
 
     void *priv;   // demuxer-specific internal data
+    // For new_demux_packet_pooled(), which is the cheapest way to allocate
+    // small packets passed to demux_add_packet().
+    struct demux_packet_pool *packet_pool;
     struct mpv_global *global;
     struct mp_log *log, *glog;
     struct demuxer_params *params;
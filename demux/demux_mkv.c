@@ -53,6 +53,7 @@
 #include "stheader.h"
 #include "ebml.h"
 #include "matroska.h"
+#include "mkv_index.h"
 #include "codec_tags.h"
 
 #include "common/msg.h"
@@ -160,7 +161,7 @@ struct block_info {
     int64_t timecode;
     mkv_track_t *track;
     // Actual packet data.
-    AVBufferRef *laces[MAX_NUM_LACES];
+    struct demux_packet *laces[MAX_NUM_LACES];
     int num_laces;
     int64_t filepos;
     struct ebml_block_additions *additions;
@@ -187,6 +188,7 @@ typedef struct mkv_demuxer {
     size_t num_indexes;
     bool index_complete;
     int index_mode;
+    struct mkv_indexer *indexer;    // background index scan, or NULL
 
     int edition_id;
 
@@ -219,6 +221,8 @@ struct demux_mkv_opts {
     double subtitle_preroll_secs_index;
     int probe_duration;
     int probe_start_time;
+    int background_index;
+    int index_cache;
 };
 
 const struct m_sub_options demux_mkv_conf = {
@@ -232,6 +236,8 @@ const struct m_sub_options demux_mkv_conf = {
         OPT_CHOICE("probe-video-duration", probe_duration, 0,
                    ({"no", 0}, {"yes", 1}, {"full", 2})),
         OPT_FLAG("probe-start-time", probe_start_time, 0),
+        OPT_FLAG("background-index", background_index, 0),
+        OPT_FLAG("index-cache", index_cache, 0),
         {0}
     },
     .size = sizeof(struct demux_mkv_opts),
@@ -239,6 +245,7 @@ const struct m_sub_options demux_mkv_conf = {
         .subtitle_preroll = 2,
         .subtitle_preroll_secs = 1.0,
         .subtitle_preroll_secs_index = 10.0,
+        .background_index = 1,
     },
 };
 
@@ -829,6 +836,15 @@ static void cue_index_add(demuxer_t *demuxer, int track_id, uint64_t filepos,
     mkv_d->num_indexes++;
 }
 
+static struct mkv_track *find_track_by_num(struct mkv_demuxer *d, int64_t num)
+{
+    for (int i = 0; i < d->num_tracks; i++) {
+        if (d->tracks[i]->tnum == num)
+            return d->tracks[i];
+    }
+    return NULL;
+}
+
 static void add_block_position(demuxer_t *demuxer, struct mkv_track *track,
                                uint64_t filepos,
                                int64_t timecode, int64_t duration)
@@ -1310,6 +1326,73 @@ static void read_deferred_cues(demuxer_t *demuxer)
     }
 }
 
+// Add the entries the background indexer found since the last call.
+static void fetch_indexer_entries(demuxer_t *demuxer)
+{
+    mkv_demuxer_t *mkv_d = demuxer->priv;
+
+    if (!mkv_d->indexer)
+        return;
+
+    int num;
+    struct mkv_indexer_status status;
+    struct mkv_indexer_entry *entries =
+        mkv_indexer_fetch(mkv_d->indexer, &num, &status);
+    for (int n = 0; n < num; n++) {
+        struct mkv_indexer_entry *e = &entries[n];
+        add_block_position(demuxer, find_track_by_num(mkv_d, e->tnum),
+                           e->filepos, e->timecode, e->duration);
+    }
+
+    if (status.done) {
+        if (status.complete) {
+            MP_VERBOSE(demuxer, "Background index complete.\n");
+            mkv_d->index_complete = true;
+        }
+        TA_FREEP(&mkv_d->indexer);
+    }
+}
+
+// Files without cues: build the index on a separate thread, instead of
+// scanning the file on the first seek.
+static void start_indexer(demuxer_t *demuxer)
+{
+    mkv_demuxer_t *mkv_d = demuxer->priv;
+    stream_t *s = demuxer->stream;
+
+    if (!mkv_d->opts->background_index || mkv_d->index_mode != 1 ||
+        mkv_d->index_complete || !mkv_d->cluster_start)
+        return;
+    if (!s->seekable || !s->is_local_file || s->streaming || !s->path)
+        return;
+    // Deferred cues will probably make the scan unnecessary.
+    for (int n = 0; n < mkv_d->num_headers; n++) {
+        if (mkv_d->headers[n].id == MATROSKA_ID_CUES)
+            return;
+    }
+
+    struct mkv_indexer_params params = {
+        .url = s->url,
+        .path = s->path,
+        .first_cluster = mkv_d->cluster_start,
+        .segment_end = mkv_d->segment_end,
+    };
+    char *cache_file = NULL;
+    if (mkv_d->opts->index_cache) {
+        cache_file = mkv_indexer_get_cache_file(NULL, demuxer->global, &params);
+        params.cache_file = cache_file;
+    }
+    mkv_d->indexer = mkv_indexer_create(mkv_d, demuxer->global, demuxer->log,
+                                        &params);
+    talloc_free(cache_file);
+    if (!mkv_d->indexer) {
+        MP_WARN(demuxer, "Could not start the background index scan.\n");
+        return;
+    }
+    MP_VERBOSE(demuxer, "Building the index in the background.\n");
+    fetch_indexer_entries(demuxer); // might have been loaded from the cache
+}
+
 static void add_coverart(struct demuxer *demuxer)
 {
     for (int n = 0; n < demuxer->num_attachments; n++) {
@@ -1913,7 +1996,7 @@ static void probe_x264_garbage(demuxer_t *demuxer)
         if (!block || block->num_laces < 1)
             continue;
 
-        bstr sblock = {block->laces[0]->data, block->laces[0]->size};
+        bstr sblock = {block->laces[0]->buffer, block->laces[0]->len};
         bstr nblock = demux_mkv_decode(demuxer->log, track, sblock, 1);
 
         sh->codec->first_packet = new_demux_packet_from(nblock.start, nblock.len);
@@ -2114,6 +2197,7 @@ static int demux_mkv_open(demuxer_t *demuxer, enum demux_check check)
 
     MP_VERBOSE(demuxer, "All headers are parsed!\n");
 
+    start_indexer(demuxer);
     display_create_tracks(demuxer);
     add_coverart(demuxer);
     process_tags(demuxer);
@@ -2128,7 +2212,8 @@ static int demux_mkv_open(demuxer_t *demuxer, enum demux_check check)
 
 // Read the laced block data at the current stream position (until endpos as
 // indicated by the block length field) into individual buffers.
-static int demux_mkv_read_block_lacing(struct block_info *block, int type,
+static int demux_mkv_read_block_lacing(struct demuxer *demuxer,
+                                       struct block_info *block, int type,
                                        struct stream *s, uint64_t endpos)
 {
     int laces;
@@ -2197,17 +2282,16 @@ static int demux_mkv_read_block_lacing(struct block_info *block, int type,
         uint32_t size = lace_size[i];
         if (stream_tell(s) + size > endpos || size > (1 << 30))
             goto error;
-        int pad = MPMAX(AV_INPUT_BUFFER_PADDING_SIZE, AV_LZO_INPUT_PADDING);
-        AVBufferRef *buf = av_buffer_alloc(size + pad);
-        if (!buf)
+        // (AV_LZO_INPUT_PADDING is smaller than the packet padding.)
+        struct demux_packet *dp =
+            new_demux_packet_pooled(demuxer->packet_pool, size);
+        if (!dp)
             goto error;
-        buf->size = size;
-        if (stream_read(s, buf->data, buf->size) != buf->size) {
-            av_buffer_unref(&buf);
+        if (stream_read(s, dp->buffer, dp->len) != dp->len) {
+            free_demux_packet(dp);
             goto error;
         }
-        memset(buf->data + buf->size, 0, pad);
-        block->laces[block->num_laces++] = buf;
+        block->laces[block->num_laces++] = dp;
     }
 
     if (stream_tell(s) != endpos)
@@ -2317,7 +2401,7 @@ static bool handle_realaudio(demuxer_t *demuxer, mkv_track_t *track,
     }
 
 error:
-    talloc_free(orig);
+    free_demux_packet(orig);
     return true;
 }
 
@@ -2439,7 +2523,7 @@ static void mkv_parse_and_add_packet(demuxer_t *demuxer, mkv_track_t *track,
             struct demux_packet *new = new_demux_packet_from(parsed, size);
             if (new) {
                 demux_packet_copy_attribs(new, dp);
-                talloc_free(dp);
+                free_demux_packet(dp);
                 demux_add_packet(stream, new);
                 return;
             }
@@ -2454,7 +2538,7 @@ static void mkv_parse_and_add_packet(demuxer_t *demuxer, mkv_track_t *track,
             AV_WB32(new->buffer + 4, MKBETAG('i', 'c', 'p', 'f'));
             memcpy(new->buffer + 8, dp->buffer, dp->len);
             demux_packet_copy_attribs(new, dp);
-            talloc_free(dp);
+            free_demux_packet(dp);
             demux_add_packet(stream, new);
             return;
         }
@@ -2511,14 +2595,16 @@ static void mkv_parse_and_add_packet(demuxer_t *demuxer, mkv_track_t *track,
     if (dp->len) {
         demux_add_packet(stream, dp);
     } else {
-        talloc_free(dp);
+        free_demux_packet(dp);
     }
 }
 
 static void free_block(struct block_info *block)
 {
-    for (int n = 0; n < block->num_laces; n++)
-        av_buffer_unref(&block->laces[n]);
+    for (int n = 0; n < block->num_laces; n++) {
+        free_demux_packet(block->laces[n]);
+        block->laces[n] = NULL;
+    }
     block->num_laces = 0;
     TA_FREEP(&block->additions);
 }
@@ -2526,7 +2612,9 @@ static void free_block(struct block_info *block)
 static void index_block(demuxer_t *demuxer, struct block_info *block)
 {
     mkv_demuxer_t *mkv_d = (mkv_demuxer_t *) demuxer->priv;
-    if (block->keyframe) {
+    // The background indexer adds its entries in file order; mixing in the
+    // ones found while reading would drop some of them.
+    if (block->keyframe && !mkv_d->indexer) {
         add_block_position(demuxer, block->track, mkv_d->cluster_start,
                            block->timecode / mkv_d->tc_scale,
                            block->duration / mkv_d->tc_scale);
@@ -2567,18 +2655,13 @@ static int read_block(demuxer_t *demuxer, int64_t end, struct block_info *block)
     block->filepos = stream_tell(s);
 
     int lace_type = (header_flags >> 1) & 0x03;
-    if (demux_mkv_read_block_lacing(block, lace_type, s, endpos))
+    if (demux_mkv_read_block_lacing(demuxer, block, lace_type, s, endpos))
         goto exit;
 
     if (block->simple)
         block->keyframe = header_flags & 0x80;
     block->timecode = time * mkv_d->tc_scale + mkv_d->cluster_tc;
-    for (int i = 0; i < mkv_d->num_tracks; i++) {
-        if (mkv_d->tracks[i]->tnum == num) {
-            block->track = mkv_d->tracks[i];
-            break;
-        }
-    }
+    block->track = find_track_by_num(mkv_d, num);
     if (!block->track) {
         res = 0;
         goto exit;
@@ -2655,17 +2738,17 @@ static int handle_block(demuxer_t *demuxer, struct block_info *block_info)
         uint64_t filepos = block_info->filepos;
 
         for (int i = 0; i < block_info->num_laces; i++) {
-            AVBufferRef *data = block_info->laces[i];
-            demux_packet_t *dp = NULL;
+            demux_packet_t *dp = block_info->laces[i];
+            size_t size = dp->len;
 
-            bstr block = {data->data, data->size};
+            bstr block = {dp->buffer, dp->len};
             bstr nblock = demux_mkv_decode(demuxer->log, track, block, 1);
 
             if (block.start != nblock.start || block.len != nblock.len) {
                 // (avoidable copy of the entire data)
                 dp = new_demux_packet_from(nblock.start, nblock.len);
             } else {
-                dp = new_demux_packet_from_buf(data);
+                block_info->laces[i] = NULL; // now owned by the packet queue
             }
             if (!dp)
                 break;
@@ -2701,7 +2784,7 @@ static int handle_block(demuxer_t *demuxer, struct block_info *block_info)
 
             mkv_parse_and_add_packet(demuxer, track, dp);
             talloc_free_children(track->parser_tmp);
-            filepos += data->size;
+            filepos += size;
         }
 
         if (stream->type == STREAM_VIDEO) {
@@ -2938,12 +3021,25 @@ static int create_index_until(struct demuxer *demuxer, int64_t timecode)
 
     read_deferred_cues(demuxer);
 
+    while (mkv_d->indexer) {
+        fetch_indexer_entries(demuxer);
+        if (!mkv_d->indexer || mkv_d->index_complete ||
+            demux_cancel_test(demuxer))
+            break;
+        mkv_index_t *index = get_highest_index_entry(demuxer);
+        if (index && index->timecode * mkv_d->tc_scale >= timecode)
+            break;
+        mkv_indexer_wait(mkv_d->indexer, timecode / mkv_d->tc_scale, 0.05);
+    }
+
     if (mkv_d->index_complete)
         return 0;
 
     mkv_index_t *index = get_highest_index_entry(demuxer);
 
-    if (!index || index->timecode * mkv_d->tc_scale < timecode) {
+    if (!mkv_d->indexer &&
+        (!index || index->timecode * mkv_d->tc_scale < timecode))
+    {
         stream_seek(s, index ? index->filepos : mkv_d->cluster_start);
         MP_VERBOSE(demuxer, "creating index until TC %"PRId64"\n", timecode);
         for (;;) {
@@ -3096,6 +3192,7 @@ static void demux_mkv_seek(demuxer_t *demuxer, double seek_pts, int flags)
         stream_t *s = demuxer->stream;
 
         read_deferred_cues(demuxer);
+        fetch_indexer_entries(demuxer);
 
         int64_t size = stream_get_size(s);
         int64_t target_filepos = size * MPCLAMP(seek_pts, 0, 1);
@@ -3229,6 +3326,7 @@ static void mkv_free(struct demuxer *demuxer)
     struct mkv_demuxer *mkv_d = demuxer->priv;
     if (!mkv_d)
         return;
+    TA_FREEP(&mkv_d->indexer);
     mkv_seek_reset(demuxer);
     for (int i = 0; i < mkv_d->num_tracks; i++)
         demux_mkv_free_trackentry(mkv_d->tracks[i]);
@@ -0,0 +1,571 @@
+/*
+ * This file is part of mpv.
+ *
+ * mpv is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * mpv is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with mpv.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <dirent.h>
+#include <errno.h>
+#include <limits.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <unistd.h>
+
+#include <libavutil/intreadwrite.h>
+#include <libavutil/md5.h>
+
+#include "common/common.h"
+#include "common/msg.h"
+#include "misc/bstr.h"
+#include "options/path.h"
+#include "osdep/io.h"
+#include "osdep/threads.h"
+#include "osdep/timer.h"
+#include "stream/stream.h"
+
+#include "ebml.h"
+#include "mkv_index.h"
+
+// The entries are the same as the ones demux_mkv.c adds while reading the
+// file, except that only the first keyframe of each track in a cluster is
+// kept (they all have the same file position anyway). Blocks with a duration
+// are always kept, as they are needed for subtitle preroll.
+
+// Cache file: header, followed by the entries. All numbers are little endian.
+//  magic[8], file size, file mtime, first cluster position, number of entries
+#define CACHE_MAGIC "mpvmkvi1"
+#define CACHE_HEADER_SIZE (8 + 4 * 8)
+//  track number (32 bit), timecode, duration, file position
+#define CACHE_ENTRY_SIZE (4 + 3 * 8)
+// Number of cache files kept; the oldest ones are deleted beyond this.
+#define CACHE_MAX_FILES 200
+
+struct track_state {
+    int tnum;
+    int64_t last_tc;        // timecode of the last entry
+    uint64_t last_cluster;  // cluster of the last entry
+};
+
+struct block {
+    int tnum;
+    int64_t timecode, duration;
+    bool keyframe;
+};
+
+struct mkv_indexer {
+    struct mp_log *log;
+    struct mkv_indexer_params params;
+    int64_t file_size, mtime;
+
+    pthread_t thread;
+    bool thread_valid;
+    struct mp_cancel *cancel;
+
+    // Accessed by the indexer thread only (while it runs).
+    void *ta_thread;
+    struct stream *s;
+    struct track_state *tracks;
+    int num_tracks;
+    uint64_t cluster_pos;
+    int64_t cluster_tc;
+    struct mkv_indexer_entry *batch;    // new entries of the current cluster
+    int num_batch;
+
+    pthread_mutex_t lock;
+    pthread_cond_t wakeup;
+    // Protected by lock. (entries is allocated from ta_thread.)
+    struct mkv_indexer_entry *entries;
+    int num_entries;
+    struct mkv_indexer_status status;
+
+    // Accessed by the user only.
+    void *ta_user;
+    struct mkv_indexer_entry *fetched;
+    int num_fetched;
+};
+
+static void add_block(struct mkv_indexer *ix, struct block *b)
+{
+    if (!b->keyframe)
+        return;
+
+    struct track_state *t = NULL;
+    for (int n = 0; n < ix->num_tracks; n++) {
+        if (ix->tracks[n].tnum == b->tnum)
+            t = &ix->tracks[n];
+    }
+    if (!t) {
+        MP_TARRAY_APPEND(ix->ta_thread, ix->tracks, ix->num_tracks,
+                         (struct track_state){ .tnum = b->tnum });
+        t = &ix->tracks[ix->num_tracks - 1];
+    } else if (t->last_tc >= b->timecode ||
+               (t->last_cluster == ix->cluster_pos && !b->duration))
+    {
+        return;
+    }
+    t->last_tc = b->timecode;
+    t->last_cluster = ix->cluster_pos;
+
+    MP_TARRAY_APPEND(ix->ta_thread, ix->batch, ix->num_batch,
+        (struct mkv_indexer_entry){
+            .tnum = b->tnum,
+            .timecode = b->timecode,
+            .duration = b->duration,
+            .filepos = ix->cluster_pos,
+        });
+}
+
+// Make the entries of the current cluster available to the user.
+static void publish_batch(struct mkv_indexer *ix)
+{
+    pthread_mutex_lock(&ix->lock);
+    for (int n = 0; n < ix->num_batch; n++) {
+        struct mkv_indexer_entry *e = &ix->batch[n];
+        MP_TARRAY_APPEND(ix->ta_thread, ix->entries, ix->num_entries, *e);
+        ix->status.timecode = MPMAX(ix->status.timecode, e->timecode);
+    }
+    pthread_cond_broadcast(&ix->wakeup);
+    pthread_mutex_unlock(&ix->lock);
+    ix->num_batch = 0;
+}
+
+// Read the header of a Block or SimpleBlock, and skip its data.
+static bool read_block_header(struct mkv_indexer *ix, int64_t end,
+                              struct block *b, bool simple)
+{
+    struct stream *s = ix->s;
+
+    uint64_t length = ebml_read_length(s);
+    int64_t start = stream_tell(s);
+    if (length == EBML_UINT_INVALID || start + length > end)
+        return false;
+    uint64_t num = ebml_read_length(s);
+    if (num == EBML_UINT_INVALID || num > INT_MAX ||
+        stream_tell(s) + 3 > start + length)
+        return false;
+    uint8_t c1 = stream_read_char(s);
+    uint8_t c2 = stream_read_char(s);
+    int flags = stream_read_char(s);
+    if (flags < 0)
+        return false;
+
+    b->tnum = num;
+    b->timecode = ix->cluster_tc + (int16_t)(c1 << 8 | c2);
+    if (simple)
+        b->keyframe = flags & 0x80;
+    return stream_seek(s, start + length);
+}
+
+static bool scan_block_group(struct mkv_indexer *ix, int64_t cluster_end)
+{
+    struct stream *s = ix->s;
+
+    uint64_t length = ebml_read_length(s);
+    if (length == EBML_UINT_INVALID || stream_tell(s) + length > cluster_end)
+        return false;
+    int64_t end = stream_tell(s) + length;
+
+    struct block b = { .keyframe = true };
+    bool have_block = false;
+    while (stream_tell(s) < end) {
+        switch (ebml_read_id(s)) {
+        case MATROSKA_ID_BLOCK:
+            if (!read_block_header(ix, end, &b, false))
+                return false;
+            have_block = true;
+            break;
+        case MATROSKA_ID_BLOCKDURATION: {
+            uint64_t duration = ebml_read_uint(s);
+            if (duration == EBML_UINT_INVALID)
+                return false;
+            b.duration = duration;
+            break;
+        }
+        case MATROSKA_ID_REFERENCEBLOCK:
+            if (ebml_read_int(s) == EBML_INT_INVALID)
+                return false;
+            b.keyframe = false;
+            break;
+        case EBML_ID_INVALID:
+            return false;
+        default:
+            if (ebml_read_skip(ix->log, end, s) != 0)
+                return false;
+        }
+    }
+
+    if (have_block)
+        add_block(ix, &b);
+    return true;
+}
+
+// The cluster ID at pos was just read.
+static bool scan_cluster(struct mkv_indexer *ix, int64_t pos)
+{
+    struct stream *s = ix->s;
+
+    uint64_t length = ebml_read_length(s);
+    // Clusters of unknown size ("live" files) end at the next level 1 element.
+    bool unknown_size = length == EBML_UINT_INVALID;
+    int64_t end = unknown_size ? INT64_MAX : stream_tell(s) + length;
+    ix->cluster_pos = pos;
+
+    while (stream_tell(s) < end) {
+        int64_t elem_pos = stream_tell(s);
+        stream_peek(s, 4); // guarantee we can undo ebml_read_id() below
+        uint32_t id = ebml_read_id(s);
+        if (s->eof) {
+            if (!unknown_size)
+                return false;
+            break;
+        }
+        if (unknown_size && (ebml_is_mkv_level1_id(id) || id == EBML_ID_EBML)) {
+            stream_seek(s, elem_pos);
+            break;
+        }
+
+        switch (id) {
+        case MATROSKA_ID_TIMECODE: {
+            uint64_t num = ebml_read_uint(s);
+            if (num == EBML_UINT_INVALID)
+                return false;
+            ix->cluster_tc = num;
+            break;
+        }
+        case MATROSKA_ID_SIMPLEBLOCK: {
+            struct block b = {0};
+            if (!read_block_header(ix, end, &b, true))
+                return false;
+            add_block(ix, &b);
+            break;
+        }
+        case MATROSKA_ID_BLOCKGROUP:
+            if (!scan_block_group(ix, end))
+                return false;
+            break;
+        case EBML_ID_INVALID:
+            return false;
+        default:
+            if (ebml_read_skip(ix->log, end, s) != 0)
+                return false;
+        }
+    }
+
+    publish_batch(ix);
+    return true;
+}
+
+// Return whether the entire segment was scanned.
+static bool scan_file(struct mkv_indexer *ix)
+{
+    struct stream *s = ix->s;
+
+    if (!stream_seek(s, ix->params.first_cluster))
+        return false;
+
+    while (!mp_cancel_test(ix->cancel)) {
+        int64_t pos = stream_tell(s);
+        if (ix->params.segment_end > 0 && pos >= ix->params.segment_end)
+            return true;
+        uint32_t id = ebml_read_id(s);
+        if (s->eof)
+            return true;
+        if (id == MATROSKA_ID_CLUSTER) {
+            if (!scan_cluster(ix, pos))
+                break;
+        } else if (id == EBML_ID_EBML) {
+            return true; // appended segment
+        } else if ((!ebml_is_mkv_level1_id(id) && id != EBML_ID_VOID) ||
+                   ebml_read_skip(ix->log, -1, s) != 0)
+        {
+            break;
+        }
+    }
+
+    if (!mp_cancel_test(ix->cancel))
+        MP_WARN(ix, "Stopping at broken data at %"PRId64".\n", stream_tell(s));
+    return false;
+}
+
+struct cache_entry {
+    char *path;
+    time_t mtime;
+};
+
+static int cmp_cache_entry(const void *a, const void *b)
+{
+    const struct cache_entry *e1 = a, *e2 = b;
+    return e1->mtime < e2->mtime ? 1 : (e1->mtime > e2->mtime ? -1 : 0);
+}
+
+// Delete the oldest cache files if there are more than CACHE_MAX_FILES.
+static void prune_cache(struct mkv_indexer *ix, const char *dir)
+{
+    void *tmp = talloc_new(NULL);
+    DIR *d = opendir(dir);
+    if (!d)
+        goto done;
+    struct cache_entry *entries = NULL;
+    int num_entries = 0;
+    struct dirent *ep;
+    while ((ep = readdir(d))) {
+        // Only touch files named like the ones we create (32 hex digits).
+        if (strlen(ep->d_name) != 32 || strspn(ep->d_name,
+                                               "0123456789ABCDEF") != 32)
+            continue;
+        char *path = mp_path_join(tmp, dir, ep->d_name);
+        struct stat st;
+        if (stat(path, &st) != 0)
+            continue;
+        struct cache_entry e = {path, st.st_mtime};
+        MP_TARRAY_APPEND(tmp, entries, num_entries, e);
+    }
+    closedir(d);
+    if (num_entries <= CACHE_MAX_FILES)
+        goto done;
+    qsort(entries, num_entries, sizeof(entries[0]), cmp_cache_entry);
+    for (int n = CACHE_MAX_FILES; n < num_entries; n++) {
+        MP_VERBOSE(ix, "Removing old index %s.\n", entries[n].path);
+        unlink(entries[n].path);
+    }
+done:
+    talloc_free(tmp);
+}
+
+static void save_cache(struct mkv_indexer *ix)
+{
+    const char *file = ix->params.cache_file;
+    void *tmp = talloc_new(NULL);
+
+    char *dir = bstrto0(tmp, mp_dirname(file));
+    mp_mkdirp(dir);
+    char *tmp_file = talloc_asprintf(tmp, "%s.tmp", file);
+    FILE *f = fopen(tmp_file, "wb");
+    if (!f) {
+        MP_WARN(ix, "Can't write %s: %s\n", tmp_file, mp_strerror(errno));
+        goto done;
+    }
+
+    uint8_t header[CACHE_HEADER_SIZE];
+    memcpy(header, CACHE_MAGIC, 8);
+    AV_WL64(header + 8, ix->file_size);
+    AV_WL64(header + 16, ix->mtime);
+    AV_WL64(header + 24, ix->params.first_cluster);
+    AV_WL64(header + 32, ix->num_entries);
+    bool ok = fwrite(header, sizeof(header), 1, f) == 1;
+    for (int n = 0; n < ix->num_entries && ok; n++) {
+        struct mkv_indexer_entry *e = &ix->entries[n];
+        uint8_t data[CACHE_ENTRY_SIZE];
+        AV_WL32(data, e->tnum);
+        AV_WL64(data + 4, e->timecode);
+        AV_WL64(data + 12, e->duration);
+        AV_WL64(data + 20, e->filepos);
+        ok = fwrite(data, sizeof(data), 1, f) == 1;
+    }
+    ok &= fclose(f) == 0;
+
+    if (ok && rename(tmp_file, file) == 0) {
+        MP_VERBOSE(ix, "Saved index to %s.\n", file);
+        prune_cache(ix, dir);
+    } else {
+        MP_WARN(ix, "Can't write %s.\n", file);
+        unlink(tmp_file);
+    }
+
+done:
+    talloc_free(tmp);
+}
+
+static bool load_cache(struct mkv_indexer *ix)
+{
+    FILE *f = fopen(ix->params.cache_file, "rb");
+    if (!f)
+        return false;
+
+    bool ok = false;
+    uint8_t header[CACHE_HEADER_SIZE];
+    if (fread(header, sizeof(header), 1, f) != 1 ||
+        memcmp(header, CACHE_MAGIC, 8) != 0 ||
+        AV_RL64(header + 8) != ix->file_size ||
+        AV_RL64(header + 16) != ix->mtime ||
+        AV_RL64(header + 24) != ix->params.first_cluster ||
+        AV_RL64(header + 32) > INT_MAX / CACHE_ENTRY_SIZE)
+        goto done;
+
+    int num = AV_RL64(header + 32);
+    MP_TARRAY_GROW(ix->ta_thread, ix->entries, num);
+    for (int n = 0; n < num; n++) {
+        uint8_t data[CACHE_ENTRY_SIZE];
+        if (fread(data, sizeof(data), 1, f) != 1)
+            goto done;
+        ix->entries[n] = (struct mkv_indexer_entry){
+            .tnum = AV_RL32(data),
+            .timecode = AV_RL64(data + 4),
+            .duration = AV_RL64(data + 12),
+            .filepos = AV_RL64(data + 20),
+        };
+    }
+    ix->num_entries = num;
+    ok = true;
+
+done:
+    fclose(f);
+    if (!ok)
+        MP_WARN(ix, "Ignoring invalid or outdated %s.\n", ix->params.cache_file);
+    return ok;
+}
+
+static void *indexer_thread(void *arg)
+{
+    struct mkv_indexer *ix = arg;
+    mpthread_set_name("mkv-index");
+
+    int64_t start = mp_time_us();
+    bool complete = scan_file(ix);
+
+    pthread_mutex_lock(&ix->lock);
+    ix->status.done = true;
+    ix->status.complete = complete;
+    pthread_cond_broadcast(&ix->wakeup);
+    pthread_mutex_unlock(&ix->lock);
+
+    if (complete) {
+        MP_VERBOSE(ix, "Indexed %d entries in %.3f seconds.\n",
+                   ix->num_entries, (mp_time_us() - start) / 1e6);
+        if (ix->params.cache_file)
+            save_cache(ix);
+    }
+    return NULL;
+}
+
+static void indexer_destroy(void *ptr)
+{
+    struct mkv_indexer *ix = ptr;
+    if (ix->thread_valid) {
+        mp_cancel_trigger(ix->cancel);
+        pthread_join(ix->thread, NULL);
+    }
+    free_stream(ix->s);
+    talloc_free(ix->ta_thread);
+    talloc_free(ix->ta_user);
+    pthread_cond_destroy(&ix->wakeup);
+    pthread_mutex_destroy(&ix->lock);
+}
+
+struct mkv_indexer *mkv_indexer_create(void *ta_parent,
+                                       struct mpv_global *global,
+                                       struct mp_log *log,
+                                       struct mkv_indexer_params *params)
+{
+    struct mkv_indexer *ix = talloc_zero(ta_parent, struct mkv_indexer);
+    ix->log = log;
+    ix->params = *params;
+    ix->params.url = talloc_strdup(ix, params->url);
+    ix->params.path = talloc_strdup(ix, params->path);
+    ix->params.cache_file = talloc_strdup(ix, params->cache_file);
+    ix->ta_thread = talloc_new(NULL);
+    ix->ta_user = talloc_new(NULL);
+    pthread_mutex_init(&ix->lock, NULL);
+    pthread_cond_init(&ix->wakeup, NULL);
+    talloc_set_destructor(ix, indexer_destroy);
+
+    struct stat st;
+    if (ix->params.cache_file) {
+        if (stat(ix->params.path, &st) == 0) {
+            ix->file_size = st.st_size;
+            ix->mtime = st.st_mtime;
+        } else {
+            ix->params.cache_file = NULL;
+        }
+    }
+
+    if (ix->params.cache_file && load_cache(ix)) {
+        MP_VERBOSE(ix, "Loaded index from %s.\n", ix->params.cache_file);
+        ix->status.done = ix->status.complete = true;
+        return ix;
+    }
+
+    ix->cancel = mp_cancel_new(ix);
+    ix->s = stream_create(ix->params.url, STREAM_READ, ix->cancel, global);
+    if (!ix->s)
+        goto error;
+
+    if (pthread_create(&ix->thread, NULL, indexer_thread, ix))
+        goto error;
+    ix->thread_valid = true;
+
+    return ix;
+
+error:
+    talloc_free(ix);
+    return NULL;
+}
+
+void mkv_indexer_wait(struct mkv_indexer *ix, int64_t timecode, double timeout)
+{
+    struct timespec ts = mp_rel_time_to_timespec(timeout);
+    pthread_mutex_lock(&ix->lock);
+    while (!ix->status.done && ix->status.timecode < timecode) {
+        if (pthread_cond_timedwait(&ix->wakeup, &ix->lock, &ts))
+            break;
+    }
+    pthread_mutex_unlock(&ix->lock);
+}
+
+struct mkv_indexer_entry *mkv_indexer_fetch(struct mkv_indexer *ix, int *num,
+                                            struct mkv_indexer_status *status)
+{
+    pthread_mutex_lock(&ix->lock);
+    *num = ix->num_entries - ix->num_fetched;
+    if (*num) {
+        MP_TARRAY_GROW(ix->ta_user, ix->fetched, *num);
+        memcpy(ix->fetched, ix->entries + ix->num_fetched,
+               *num * sizeof(ix->fetched[0]));
+    }
+    ix->num_fetched = ix->num_entries;
+    *status = ix->status;
+    pthread_mutex_unlock(&ix->lock);
+    return ix->fetched;
+}
+
+char *mkv_indexer_get_cache_file(void *ta_parent, struct mpv_global *global,
+                                 struct mkv_indexer_params *params)
+{
+    void *tmp = talloc_new(NULL);
+    char *res = NULL;
+
+    char *cwd = mp_getcwd(tmp);
+    char *dir = mp_find_user_config_file(tmp, global, "mkv-index");
+    if (!cwd || !dir)
+        goto done;
+
+    // Files can contain multiple segments.
+    char *key = talloc_asprintf(tmp, "%s:%"PRId64,
+                                mp_path_join(tmp, cwd, params->path),
+                                params->first_cluster);
+    uint8_t md5[16];
+    av_md5_sum(md5, key, strlen(key));
+    char *name = talloc_strdup(tmp, "");
+    for (int i = 0; i < 16; i++)
+        name = talloc_asprintf_append(name, "%02X", md5[i]);
+    res = mp_path_join(ta_parent, dir, name);
+
+done:
+    talloc_free(tmp);
+    return res;
+}
@@ -0,0 +1,72 @@
+/*
+ * This file is part of mpv.
+ *
+ * mpv is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * mpv is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with mpv.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef MP_DEMUX_MKV_INDEX_H
+#define MP_DEMUX_MKV_INDEX_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+struct mp_log;
+struct mpv_global;
+
+// Builds a seek index for Matroska files without cues on a separate thread,
+// using its own stream. Only the cluster timecodes and the block headers are
+// read. The index can be saved to and loaded from a cache file.
+struct mkv_indexer;
+
+struct mkv_indexer_params {
+    const char *url;        // file to open
+    const char *path;       // local filename of url
+    int64_t first_cluster;  // file position of the first cluster
+    int64_t segment_end;    // end of the segment, or 0 if unknown
+    const char *cache_file; // if non-NULL, load/save the index from/to it
+};
+
+struct mkv_indexer_entry {
+    int tnum;
+    int64_t timecode, duration;     // in TimecodeScale units
+    uint64_t filepos;               // position of the cluster
+};
+
+struct mkv_indexer_status {
+    int64_t timecode;       // highest block timecode scanned so far
+    bool done;              // no further entries will be added
+    bool complete;          // done, and the entire segment was scanned
+};
+
+// Returns NULL if the file can't be opened.
+struct mkv_indexer *mkv_indexer_create(void *ta_parent,
+                                       struct mpv_global *global,
+                                       struct mp_log *log,
+                                       struct mkv_indexer_params *params);
+
+// Wait until the indexer scanned past the timecode, is done, or the timeout
+// (in seconds) passed.
+void mkv_indexer_wait(struct mkv_indexer *ix, int64_t timecode, double timeout);
+
+// Return the entries added since the last call, and set *num to their number.
+// The entries of a track have increasing timecodes. They are valid until the
+// next call.
+struct mkv_indexer_entry *mkv_indexer_fetch(struct mkv_indexer *ix, int *num,
+                                            struct mkv_indexer_status *status);
+
+// Name of the cache file for params->path and params->first_cluster, or NULL.
+char *mkv_indexer_get_cache_file(void *ta_parent, struct mpv_global *global,
+                                 struct mkv_indexer_params *params);
+
+#endif
@@ -19,6 +19,7 @@
 #include <stdio.h>
 #include <string.h>
 #include <assert.h>
+#include <pthread.h>
 
 #include <libavcodec/avcodec.h>
 #include <libavutil/intreadwrite.h>
@@ -114,9 +115,15 @@ void demux_packet_shorten(struct demux_packet *dp, size_t len)
     dp->len = dp->avpacket->size;
 }
 
+static void pool_free(struct demux_packet *dp);
+
 void free_demux_packet(struct demux_packet *dp)
 {
-    talloc_free(dp);
+    if (dp && dp->pooled) {
+        pool_free(dp);
+    } else {
+        talloc_free(dp);
+    }
 }
 
 void demux_packet_copy_attribs(struct demux_packet *dst, struct demux_packet *src)
@@ -134,10 +141,17 @@ void demux_packet_copy_attribs(struct demux_packet *dst, struct demux_packet *sr
     mp_packet_tags_setref(&dst->metadata, src->metadata);
 }
 
+static AVBufferRef *pool_packet_buf(struct demux_packet *dp);
+
 struct demux_packet *demux_copy_packet(struct demux_packet *dp)
 {
     struct demux_packet *new = NULL;
-    if (dp->avpacket) {
+    if (dp->pooled) {
+        // Reference the pool chunk instead of copying the data.
+        AVPacket pkt = *dp->avpacket;
+        pkt.buf = pool_packet_buf(dp);
+        new = new_demux_packet_from_avpacket(&pkt);
+    } else if (dp->avpacket) {
         new = new_demux_packet_from_avpacket(dp->avpacket);
     } else {
         // Some packets might be not created by new_demux_packet*().
@@ -151,6 +165,213 @@ struct demux_packet *demux_copy_packet(struct demux_packet *dp)
 
 #define ROUND_ALLOC(s) MP_ALIGN_UP(s, 64)
 
+// Allocator for the packets of a demuxer. The packet headers come from slabs
+// via a free list, and small payloads are allocated from large refcounted
+// chunks by bumping a pointer. Packets returned to decoders reference the
+// chunk (see demux_copy_packet()), so no data is copied. Since the demuxer
+// cache mostly frees packets in the order they were added, chunks become
+// empty and are released (or reused) in turn.
+
+#define POOL_SLAB_SLOTS 256
+#define POOL_CHUNK_SIZE (1024 * 1024)
+// Larger packets are allocated normally.
+#define POOL_MAX_PACKET (16 * 1024)
+
+struct pool_chunk {
+    AVBufferRef *buf;           // also referenced by packets given to decoders
+    size_t used;
+    int live;                   // number of pooled packets with data in it
+};
+
+struct pool_slot {
+    struct demux_packet dp;     // must be first
+    AVPacket avpkt;
+    struct demux_packet_pool *pool;
+    struct pool_chunk *chunk;   // where dp.buffer is, or NULL
+    struct pool_slot *next_free;
+};
+
+struct demux_packet_pool {
+    // Packets are allocated by the demuxer, and freed by the demuxer cache.
+    pthread_mutex_t lock;
+    struct pool_slot *free_slots;
+    struct pool_chunk *cur;     // chunk new data is put into
+    struct pool_chunk *spare;   // empty chunk kept for reuse
+};
+
+static size_t pool_data_size(size_t len)
+{
+    return ROUND_ALLOC(len + AV_INPUT_BUFFER_PADDING_SIZE);
+}
+
+static void pool_chunk_free(struct pool_chunk *c)
+{
+    if (c) {
+        av_buffer_unref(&c->buf);
+        talloc_free(c);
+    }
+}
+
+static void pool_destroy(void *ptr)
+{
+    struct demux_packet_pool *pool = ptr;
+    pool_chunk_free(pool->cur);
+    pool_chunk_free(pool->spare);
+    pthread_mutex_destroy(&pool->lock);
+}
+
+struct demux_packet_pool *demux_packet_pool_create(void *ta_parent)
+{
+    struct demux_packet_pool *pool =
+        talloc_zero(ta_parent, struct demux_packet_pool);
+    pthread_mutex_init(&pool->lock, NULL);
+    talloc_set_destructor(pool, pool_destroy);
+    return pool;
+}
+
+// Called with pool->lock held, for chunks that are not pool->cur anymore.
+static void pool_chunk_release(struct demux_packet_pool *pool,
+                               struct pool_chunk *c)
+{
+    // Decoders might still reference the data.
+    if (!pool->spare && av_buffer_is_writable(c->buf)) {
+        c->used = 0;
+        pool->spare = c;
+    } else {
+        pool_chunk_free(c);
+    }
+}
+
+static void pool_chunk_unref(struct demux_packet_pool *pool,
+                             struct pool_chunk *c)
+{
+    c->live -= 1;
+    if (!c->live && c != pool->cur)
+        pool_chunk_release(pool, c);
+}
+
+// Called with pool->lock held.
+static uint8_t *pool_alloc_data(struct demux_packet_pool *pool, size_t len,
+                                struct pool_chunk **out_chunk)
+{
+    size_t size = pool_data_size(len);
+    struct pool_chunk *c = pool->cur;
+    if (!c || c->used + size > POOL_CHUNK_SIZE) {
+        if (c && !c->live && av_buffer_is_writable(c->buf)) {
+            c->used = 0; // reuse it right away
+        } else {
+            // The old chunk is released by its last packet.
+            if (c && !c->live)
+                pool_chunk_release(pool, c);
+            c = pool->spare;
+            pool->spare = NULL;
+            if (!c) {
+                c = talloc_zero(pool, struct pool_chunk);
+                c->buf = av_buffer_alloc(POOL_CHUNK_SIZE);
+                if (!c->buf) {
+                    talloc_free(c);
+                    pool->cur = NULL;
+                    return NULL;
+                }
+            }
+        }
+        pool->cur = c;
+    }
+    uint8_t *data = c->buf->data + c->used;
+    c->used += size;
+    c->live += 1;
+    *out_chunk = c;
+    return data;
+}
+
+static AVBufferRef *pool_packet_buf(struct demux_packet *dp)
+{
+    struct pool_chunk *c = ((struct pool_slot *)dp)->chunk;
+    return c ? c->buf : NULL;
+}
+
+// Like new_demux_packet(), but small packets are allocated from the pool.
+// pool can be NULL. The packet must be freed with free_demux_packet().
+struct demux_packet *new_demux_packet_pooled(struct demux_packet_pool *pool,
+                                             size_t len)
+{
+    if (!pool || len > POOL_MAX_PACKET)
+        return new_demux_packet(len);
+
+    pthread_mutex_lock(&pool->lock);
+    struct pool_chunk *chunk = NULL;
+    uint8_t *data = pool_alloc_data(pool, len, &chunk);
+    struct pool_slot *s = NULL;
+    if (data) {
+        s = pool->free_slots;
+        if (!s) {
+            struct pool_slot *slab =
+                talloc_array(pool, struct pool_slot, POOL_SLAB_SLOTS);
+            for (int n = 0; n < POOL_SLAB_SLOTS; n++)
+                slab[n].next_free = n + 1 < POOL_SLAB_SLOTS ? &slab[n + 1] : NULL;
+            s = slab;
+        }
+        pool->free_slots = s->next_free;
+    }
+    pthread_mutex_unlock(&pool->lock);
+    if (!s)
+        return new_demux_packet(len);
+
+    *s = (struct pool_slot){
+        .dp = {
+            .pts = MP_NOPTS_VALUE,
+            .dts = MP_NOPTS_VALUE,
+            .duration = -1,
+            .pos = -1,
+            .start = MP_NOPTS_VALUE,
+            .end = MP_NOPTS_VALUE,
+            .stream = -1,
+            .kf_seek_pts = MP_NOPTS_VALUE,
+            .pooled = true,
+        },
+        .pool = pool,
+        .chunk = chunk,
+    };
+    av_init_packet(&s->avpkt);
+    s->avpkt.data = data;
+    s->avpkt.size = len;
+    memset(data + len, 0, AV_INPUT_BUFFER_PADDING_SIZE);
+    s->dp.avpacket = &s->avpkt;
+    s->dp.buffer = data;
+    s->dp.len = len;
+    return &s->dp;
+}
+
+static void pool_free(struct demux_packet *dp)
+{
+    struct pool_slot *s = (struct pool_slot *)dp;
+    struct demux_packet_pool *pool = s->pool;
+    packet_destroy(dp);
+    pthread_mutex_lock(&pool->lock);
+    if (s->chunk)
+        pool_chunk_unref(pool, s->chunk);
+    s->next_free = pool->free_slots;
+    pool->free_slots = s;
+    pthread_mutex_unlock(&pool->lock);
+}
+
+// Free the packet data (but not the side data). dp->buffer is NULL afterwards.
+void demux_packet_unref_data(struct demux_packet *dp)
+{
+    if (dp->pooled) {
+        struct pool_slot *s = (struct pool_slot *)dp;
+        if (s->chunk) {
+            pthread_mutex_lock(&s->pool->lock);
+            pool_chunk_unref(s->pool, s->chunk);
+            pthread_mutex_unlock(&s->pool->lock);
+        }
+        s->chunk = NULL;
+    }
+    av_buffer_unref(&dp->avpacket->buf);
+    dp->avpacket->data = NULL;
+    dp->buffer = NULL;
+}
+
 // Attempt to estimate the total memory consumption of the given packet.
 // This is important if we store thousands of packets and not to exceed
 // user-provided limits. Of course we can't know how much memory internal
@@ -161,6 +382,13 @@ struct demux_packet *demux_copy_packet(struct demux_packet *dp)
 // memory wasted due to internal fragmentation.)
 size_t demux_packet_estimate_total_size(struct demux_packet *dp)
 {
+    if (dp->pooled) {
+        // Exact, except for the side data.
+        size_t size = sizeof(struct pool_slot) + pool_data_size(dp->len);
+        for (int n = 0; n < dp->avpacket->side_data_elems; n++)
+            size += ROUND_ALLOC(dp->avpacket->side_data[n].size);
+        return size;
+    }
     size_t size = ROUND_ALLOC(sizeof(struct demux_packet));
     size += ROUND_ALLOC(dp->len);
     if (dp->avpacket) {
@@ -45,6 +45,12 @@ typedef struct demux_packet {
     struct AVPacket *avpacket;   // keep the buffer allocation and sidedata
     double kf_seek_pts; // demux.c internal: seek pts for keyframe range
     struct mp_packet_tags *metadata; // timed metadata (demux.c internal)
+    bool pooled;        // allocated by new_demux_packet_pooled()
+
+    // demux.c internal: disk cache (demux/cache.c)
+    bool is_cached;         // data is in the disk cache only, buffer is NULL
+    bool has_cache_copy;    // data was written to the disk cache at cache_pos
+    uint64_t cache_pos;
 } demux_packet_t;
 
 struct AVBufferRef;
@@ -60,6 +66,12 @@ size_t demux_packet_estimate_total_size(struct demux_packet *dp);
 
 void demux_packet_copy_attribs(struct demux_packet *dst, struct demux_packet *src);
 
+void demux_packet_unref_data(struct demux_packet *dp);
+
+struct demux_packet_pool *demux_packet_pool_create(void *ta_parent);
+struct demux_packet *new_demux_packet_pooled(struct demux_packet_pool *pool,
+                                             size_t len);
+
 int demux_packet_set_padding(struct demux_packet *dp, int start, int end);
 int demux_packet_add_blockadditional(struct demux_packet *dp, uint64_t id,
                                      void *data, size_t size);
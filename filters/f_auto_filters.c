@@ -4,6 +4,7 @@
 #include "common/msg.h"
 #include "options/m_config.h"
 #include "options/options.h"
+#include "video/dirty.h"
 #include "video/mp_image.h"
 
 #include "f_auto_filters.h"
@@ -267,6 +268,72 @@ struct mp_filter *mp_autorotate_create(struct mp_filter *parent)
     return f;
 }
 
+struct dirty_priv {
+    struct mp_dirty_tracker *tracker;
+};
+
+static void dirty_process(struct mp_filter *f)
+{
+    struct dirty_priv *p = f->priv;
+
+    if (!mp_pin_can_transfer_data(f->ppins[1], f->ppins[0]))
+        return;
+
+    struct mp_frame frame = mp_pin_out_read(f->ppins[0]);
+
+    if (frame.type == MP_FRAME_VIDEO) {
+        struct mp_stream_info *info = mp_filter_find_stream_info(f);
+        if (info && info->dirty) {
+            mp_dirty_tracker_process(p->tracker, frame.data);
+        } else {
+            mp_dirty_tracker_reset(p->tracker);
+        }
+    }
+
+    mp_pin_in_write(f->ppins[1], frame);
+}
+
+static void dirty_reset(struct mp_filter *f)
+{
+    struct dirty_priv *p = f->priv;
+
+    mp_dirty_tracker_reset(p->tracker);
+}
+
+static bool dirty_command(struct mp_filter *f, struct mp_filter_command *cmd)
+{
+    if (cmd->type == MP_FILTER_COMMAND_IS_ACTIVE) {
+        struct mp_stream_info *info = mp_filter_find_stream_info(f);
+        cmd->is_active = info && info->dirty;
+        return true;
+    }
+    return false;
+}
+
+static const struct mp_filter_info dirty_filter = {
+    .name = "autodirty",
+    .priv_size = sizeof(struct dirty_priv),
+    .command = dirty_command,
+    .process = dirty_process,
+    .reset = dirty_reset,
+    .destroy = dirty_reset,
+};
+
+struct mp_filter *mp_autodirty_create(struct mp_filter *parent)
+{
+    struct mp_filter *f = mp_filter_create(parent, &dirty_filter);
+    if (!f)
+        return NULL;
+
+    struct dirty_priv *p = f->priv;
+    p->tracker = mp_dirty_tracker_create(f);
+
+    mp_filter_add_pin(f, MP_PIN_IN, "in");
+    mp_filter_add_pin(f, MP_PIN_OUT, "out");
+
+    return f;
+}
+
 struct aspeed_priv {
     struct mp_subfilter sub;
     double cur_speed;
@@ -9,5 +9,8 @@ struct mp_filter *mp_deint_create(struct mp_filter *parent);
 // Rotate according to mp_image.rotate and VO capabilities.
 struct mp_filter *mp_autorotate_create(struct mp_filter *parent);
 
+// Attach dirty maps to the frames if the VO wants them (mp_stream_info.dirty).
+struct mp_filter *mp_autodirty_create(struct mp_filter *parent);
+
 // Insert a filter that inserts scaletempo depending on speed settings.
 struct mp_filter *mp_autoaspeed_create(struct mp_filter *parent);
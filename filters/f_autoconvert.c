@@ -29,6 +29,7 @@ struct priv {
 
     // Enable special conversion for the final stage before the VO.
     bool vo_convert;
+    bool vo_dr;
 
     // sws state
     int in_imgfmt, in_subfmt;
@@ -133,6 +134,13 @@ void mp_autoconvert_add_vo_hwdec_subfmts(struct mp_autoconvert *c,
     p->vo_convert = true;
 }
 
+void mp_autoconvert_set_vo_dr(struct mp_autoconvert *c, bool enable)
+{
+    struct priv *p = c->f->priv;
+
+    p->vo_dr = enable;
+}
+
 void mp_autoconvert_add_afmt(struct mp_autoconvert *c, int afmt)
 {
     struct priv *p = c->f->priv;
@@ -263,6 +271,9 @@ static void handle_video_frame(struct mp_filter *f)
             talloc_free(sws->f);
         } else {
             sws->out_format = out;
+            // (Not if the result is uploaded to a hw surface afterwards.)
+            if (p->vo_dr && !filters[1] && info)
+                sws->dr_vo = info->dr_vo;
             MP_INFO(p, "Converting %s -> %s\n", mp_imgfmt_to_name(img->imgfmt),
                     mp_imgfmt_to_name(sws->out_format));
             filters[0] = sws->f;
@@ -36,6 +36,11 @@ struct mp_hwdec_devices;
 void mp_autoconvert_add_vo_hwdec_subfmts(struct mp_autoconvert *c,
                                          struct mp_hwdec_devices *devs);
 
+// Let software conversions allocate their output with the VO's get_image
+// (mp_stream_info.dr_vo), if it has one. Only makes sense if the output goes
+// to the VO without further filtering.
+void mp_autoconvert_set_vo_dr(struct mp_autoconvert *c, bool enable);
+
 // Add afmt (an AF_FORMAT_* value) as allowed audio format.
 // See mp_autoconvert_add_imgfmt() for other remarks.
 void mp_autoconvert_add_afmt(struct mp_autoconvert *c, int afmt);
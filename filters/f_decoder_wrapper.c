@@ -35,6 +35,7 @@
 
 #include "common/codecs.h"
 #include "common/global.h"
+#include "common/frametrace.h"
 #include "common/recorder.h"
 
 #include "audio/aframe.h"
@@ -530,6 +531,7 @@ static bool process_decoded_frame(struct priv *p, struct mp_frame *frame)
         struct mp_image *mpi = frame->data;
 
         process_video_frame(p, mpi);
+        mp_frametrace(MP_FT_DECODED, mpi->pts);
 
         if (mpi->pts != MP_NOPTS_VALUE) {
             double vpts = mpi->pts;
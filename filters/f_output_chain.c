@@ -92,6 +92,10 @@ static void update_output_caps(struct chain *p)
         if (p->vo->hwdec_devs)
             mp_autoconvert_add_vo_hwdec_subfmts(p->convert, p->vo->hwdec_devs);
     }
+
+    // The converter is the last filter that writes pixels, so its output can
+    // go to VO memory.
+    mp_autoconvert_set_vo_dr(p->convert, !!p->vo);
 }
 
 static void check_in_format_change(struct mp_user_filter *u,
@@ -367,6 +371,7 @@ void mp_output_chain_set_vo(struct mp_output_chain *c, struct vo *vo)
     p->stream_info.hwdec_devs = vo ? vo->hwdec_devs : NULL;
     p->stream_info.osd = vo ? vo->osd : NULL;
     p->stream_info.rotate90 = vo ? vo->driver->caps & VO_CAP_ROTATE90 : false;
+    p->stream_info.dirty = vo ? vo->driver->caps & VO_CAP_DIRTY : false;
     p->stream_info.dr_vo = vo;
     p->vo = vo;
     update_output_caps(p);
@@ -719,6 +724,16 @@ struct mp_output_chain *mp_output_chain_create(struct mp_filter *parent,
     p->convert_wrapper->f = p->convert->f;
     MP_TARRAY_APPEND(p, p->post_filters, p->num_post_filters, p->convert_wrapper);
 
+    if (type == MP_OUTPUT_CHAIN_VIDEO) {
+        // After the conversion, so the maps are in the VO's format.
+        struct mp_user_filter *u = create_wrapper_filter(p);
+        u->name = "autodirty";
+        u->f = mp_autodirty_create(u->wrapper);
+        if (!u->f)
+            abort();
+        MP_TARRAY_APPEND(p, p->post_filters, p->num_post_filters, u);
+    }
+
     if (type == MP_OUTPUT_CHAIN_AUDIO) {
         p->convert->on_audio_format_change = on_audio_format_change;
         p->convert->on_audio_format_change_opaque = p;
@@ -35,6 +35,7 @@
 #include "video/mp_image_pool.h"
 #include "video/sws_utils.h"
 #include "video/fmt-conversion.h"
+#include "video/out/vo.h"
 
 #include "f_swscale.h"
 #include "filter.h"
@@ -69,6 +70,16 @@ bool mp_sws_supports_input(int imgfmt)
     return sws_isSupportedInput(imgfmt2pixfmt(imgfmt));
 }
 
+static struct mp_image *alloc_image(void *ctx, int fmt, int w, int h)
+{
+    struct mp_sws_filter *s = ctx;
+
+    struct mp_image *img = NULL;
+    if (s->dr_vo)
+        img = vo_get_image(s->dr_vo, fmt, w, h, SWS_MIN_BYTE_ALIGN);
+    return img ? img : mp_image_alloc(fmt, w, h);
+}
+
 static void process(struct mp_filter *f)
 {
     struct mp_sws_filter *s = f->priv;
@@ -141,6 +152,7 @@ struct mp_sws_filter *mp_sws_filter_create(struct mp_filter *parent)
     s->sws = mp_sws_alloc(s);
     s->sws->log = f->log;
     s->pool = mp_image_pool_new(s);
+    mp_image_pool_set_allocator(s->pool, alloc_image, s);
 
     mp_sws_set_from_cmdline(s->sws, f->global);
 
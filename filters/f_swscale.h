@@ -6,6 +6,9 @@ struct mp_sws_filter {
     struct mp_filter *f;
     // Desired output imgfmt. If 0, uses the input format.
     int out_format;
+    // If set, output images are allocated with vo_get_image() where the VO
+    // supports it, so the conversion writes directly into VO memory.
+    struct vo *dr_vo;
     // private state
     struct mp_sws_context *sws;
     struct mp_image_pool *pool;
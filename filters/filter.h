@@ -390,6 +390,7 @@ struct mp_stream_info {
     struct mp_hwdec_devices *hwdec_devs;
     struct osd_state *osd;
     bool rotate90;
+    bool dirty; // attach dirty maps (video/dirty.h) to the output
     struct vo *dr_vo; // for calling vo_get_image()
 };
 
@@ -80,9 +80,7 @@ const struct mp_user_filter_entry *vf_list[] = {
     &vf_d3d11vpp,
 #endif
     &vf_vectorraster,
-#if HAVE_OPENCV
     &vf_vector,
-#endif
 };
 
 static bool get_vf_desc(struct m_obj_desc *dst, int index)
@@ -123,6 +123,7 @@ typedef struct MPOpts {
     int property_print_help;
     int use_terminal;
     char *dump_stats;
+    int frame_trace;
     int verbose;
     int msg_really_quiet;
     char **msg_levels;
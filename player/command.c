@@ -34,6 +34,7 @@
 #include "client.h"
 #include "common/av_common.h"
 #include "common/codecs.h"
+#include "common/frametrace.h"
 #include "common/msg.h"
 #include "common/msg_control.h"
 #include "filters/f_decoder_wrapper.h"
@@ -1773,6 +1774,8 @@ static int mp_property_demuxer_cache_state(void *ctx, struct m_property *prop,
     node_map_add_flag(r, "idle", s.idle);
     node_map_add_int64(r, "total-bytes", s.total_bytes);
     node_map_add_int64(r, "fw-bytes", s.fw_bytes);
+    if (s.file_cache_bytes >= 0)
+        node_map_add_int64(r, "file-cache-bytes", s.file_cache_bytes);
     if (s.seeking != MP_NOPTS_VALUE)
         node_map_add_double(r, "debug-seeking", s.seeking);
     node_map_add_int64(r, "debug-low-level-seeks", s.low_level_seeks);
@@ -2870,6 +2873,80 @@ static char *asprint_perf(char *res, struct mp_frame_perf *perf)
     return res;
 }
 
+// Stage times of the most recent frames, in ms relative to the first stage
+// the frame was seen at (normally the demuxer).
+static int mp_property_frame_timings(void *ctx, struct m_property *prop,
+                                     int action, void *arg)
+{
+    MPContext *mpctx = ctx;
+    if (!mpctx->opts->frame_trace)
+        return M_PROPERTY_UNAVAILABLE;
+
+    if (action == M_PROPERTY_GET_TYPE) {
+        *(struct m_option *)arg = (struct m_option){.type = CONF_TYPE_NODE};
+        return M_PROPERTY_OK;
+    }
+    if (action != M_PROPERTY_GET)
+        return M_PROPERTY_NOT_IMPLEMENTED;
+
+    struct mp_frametrace_frame *frames;
+    int num_frames;
+    mp_frametrace_frames(NULL, &frames, &num_frames, 64);
+
+    struct mpv_node *r = (struct mpv_node *)arg;
+    node_init(r, MPV_FORMAT_NODE_ARRAY, NULL);
+    for (int n = 0; n < num_frames; n++) {
+        struct mp_frametrace_frame *f = &frames[n];
+        int64_t first = 0, last = 0;
+        for (int s = 0; s < MP_FT_STAGE_COUNT; s++) {
+            if (f->time[s] && (!first || f->time[s] < first))
+                first = f->time[s];
+            last = MPMAX(last, f->time[s]);
+        }
+        struct mpv_node *entry = node_array_add(r, MPV_FORMAT_NODE_MAP);
+        node_map_add_double(entry, "pts", f->pts);
+        for (int s = 0; s < MP_FT_STAGE_COUNT; s++) {
+            if (f->time[s]) {
+                node_map_add_double(entry, mp_frametrace_stage_name(s),
+                                    (f->time[s] - first) / 1000.0);
+            }
+        }
+        node_map_add_double(entry, "total", (last - first) / 1000.0);
+    }
+    talloc_free(frames);
+    return M_PROPERTY_OK;
+}
+
+static int mp_property_vo_rate_control(void *ctx, struct m_property *prop,
+                                       int action, void *arg)
+{
+    MPContext *mpctx = ctx;
+    if (!mpctx->video_out)
+        return M_PROPERTY_UNAVAILABLE;
+
+    if (action == M_PROPERTY_GET_TYPE) {
+        *(struct m_option *)arg = (struct m_option){.type = CONF_TYPE_NODE};
+        return M_PROPERTY_OK;
+    }
+    if (action != M_PROPERTY_GET)
+        return M_PROPERTY_NOT_IMPLEMENTED;
+
+    struct voctrl_rate_control rc;
+    if (vo_control(mpctx->video_out, VOCTRL_GET_RATE_CONTROL, &rc) <= 0)
+        return M_PROPERTY_UNAVAILABLE;
+
+    struct mpv_node *r = (struct mpv_node *)arg;
+    node_init(r, MPV_FORMAT_NODE_MAP, NULL);
+    node_map_add_int64(r, "level", rc.level);
+    node_map_add_int64(r, "num-levels", rc.num_levels);
+    node_map_add_int64(r, "threshold", rc.threshold);
+    node_map_add_string(r, "depth", rc.depth);
+    node_map_add_int64(r, "skip", rc.skip);
+    node_map_add_double(r, "rate", rc.rate);
+    node_map_add_double(r, "latency", rc.latency);
+    return M_PROPERTY_OK;
+}
+
 static int mp_property_vo_passes(void *ctx, struct m_property *prop,
                                  int action, void *arg)
 {
@@ -3949,6 +4026,8 @@ static const struct m_property mp_properties_base[] = {
     {"window-scale", mp_property_window_scale},
     {"vo-configured", mp_property_vo_configured},
     {"vo-passes", mp_property_vo_passes},
+    {"vo-rate-control", mp_property_vo_rate_control},
+    {"frame-timings", mp_property_frame_timings},
     {"current-vo", mp_property_vo},
     {"container-fps", mp_property_fps},
     {"estimated-vf-fps", mp_property_vf_fps},
@@ -5533,6 +5612,20 @@ static void cmd_screenshot_raw(void *p)
     talloc_steal(ba, img);
 }
 
+static void cmd_dump_frame_trace(void *p)
+{
+    struct mp_cmd_ctx *cmd = p;
+    struct MPContext *mpctx = cmd->mpctx;
+    void *tmp = talloc_new(NULL);
+    char *filename = mp_get_user_path(tmp, mpctx->global, cmd->args[0].v.s);
+
+    if (!mp_frametrace_write_json(filename)) {
+        MP_ERR(mpctx, "Could not write frame trace to '%s'.\n", filename);
+        cmd->success = false;
+    }
+    talloc_free(tmp);
+}
+
 static void cmd_run(void *p)
 {
     struct mp_cmd_ctx *cmd = p;
@@ -5933,6 +6026,7 @@ const struct mp_cmd_def mp_cmds[] = {
                         {"window", 1},
                         {"subtitles", 2})),
     }},
+    { "dump-frame-trace", cmd_dump_frame_trace, { ARG_STRING } },
     { "loadfile", cmd_loadfile, {
         ARG_STRING,
         OARG_CHOICE(0, ({"replace", 0},
@@ -36,6 +36,7 @@
 #include "common/av_log.h"
 #include "common/codecs.h"
 #include "common/encode.h"
+#include "common/frametrace.h"
 #include "options/m_config.h"
 #include "options/m_option.h"
 #include "options/m_property.h"
@@ -118,6 +119,8 @@ void mp_update_logging(struct MPContext *mpctx, bool preinit)
 
     mp_msg_update_msglevels(mpctx->global);
 
+    mp_frametrace_enable(mpctx->opts->frame_trace);
+
     bool enable = mpctx->opts->use_terminal;
     bool enabled = cas_terminal_owner(mpctx, mpctx);
     if (enable != enabled) {
@@ -30,6 +30,7 @@
 #include "options/m_option.h"
 #include "common/common.h"
 #include "common/encode.h"
+#include "common/frametrace.h"
 #include "options/m_property.h"
 #include "osdep/timer.h"
 
@@ -475,6 +476,7 @@ static int video_output_image(struct MPContext *mpctx)
             r = VD_EOF;
         } else if (frame.type == MP_FRAME_VIDEO) {
             img = frame.data;
+            mp_frametrace(MP_FT_FILTERED, img->pts);
         } else {
             MP_ERR(mpctx, "unexpected frame type %s\n",
                    mp_frame_type_str(frame.type));
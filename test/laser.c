@@ -0,0 +1,371 @@
+/*
+ * Tests for the laser output: beam path resampling and dwell, ILDA frames,
+ * and streaming to an in-process stand-in for an Ether Dream DAC.
+ */
+
+#include <errno.h>
+#include <pthread.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+
+#include "test_helpers.h"
+#include "mpv_talloc.h"
+#include "common/common.h"
+#include "common/msg.h"
+#include "osdep/timer.h"
+#include "video/points.h"
+#include "video/out/laser/etherdream.h"
+#include "video/out/laser/ilda.h"
+#include "video/out/laser/path.h"
+
+static const struct laser_path_opts path_opts = {
+    .max_step = 1000,
+    .blank_step = 3000,
+    .corner_dwell = 4,
+    .corner_angle = 60,
+    .blank_dwell = 2,
+};
+
+static const struct laser_transform unit = {.sx = 1, .sy = 1};
+
+static double dist(const struct laser_point *a, const struct laser_point *b)
+{
+    return hypot(a->x - b->x, a->y - b->y);
+}
+
+static int count_at(const struct laser_path *lp, int x, int y, bool blank)
+{
+    int n = 0;
+    for (int i = 0; i < lp->num_points; i++) {
+        const struct laser_point *p = &lp->points[i];
+        n += p->x == x && p->y == y && p->blank == blank;
+    }
+    return n;
+}
+
+// Closed square of 10000 units, drawn as a dense chain of 100 unit steps.
+static int make_square(struct mp_point *pts, int x0, int y0)
+{
+    static const int dir[4][2] = {{1, 0}, {0, 1}, {-1, 0}, {0, -1}};
+    int n = 0;
+    int x = x0, y = y0;
+    pts[n++] = (struct mp_point){x, y, .flags = MP_POINT_BLANK};
+    for (int side = 0; side < 4; side++) {
+        for (int i = 0; i < 100; i++) {
+            x += dir[side][0] * 100;
+            y += dir[side][1] * 100;
+            pts[n++] = (struct mp_point){x, y, 255, 128, 0};
+        }
+    }
+    return n;
+}
+
+static void test_path_square(void **state)
+{
+    void *ctx = talloc_new(NULL);
+    struct mp_point src[401];
+    int num = make_square(src, -5000, -5000);
+
+    struct laser_path lp = {0};
+    laser_path_build(&lp, ctx, &path_opts, &unit, src, num);
+
+    // Blanked move from the origin, with dwell on both ends.
+    int i = 0;
+    for (; i < lp.num_points && lp.points[i].blank; i++) {
+        assert_int_equal(lp.points[i].r, 0);
+        if (i)
+            assert_true(dist(&lp.points[i - 1], &lp.points[i]) <= 3000 + 1);
+    }
+    assert_int_equal(count_at(&lp, 0, 0, true), path_opts.blank_dwell);
+    assert_int_equal(count_at(&lp, -5000, -5000, true), path_opts.blank_dwell + 1);
+
+    // Lit points evenly spaced at the step size, instead of every source
+    // point; the corners are hit exactly and held.
+    int lit = 0;
+    for (; i < lp.num_points; i++) {
+        assert_false(lp.points[i].blank);
+        assert_int_equal(lp.points[i].r, 255);
+        assert_int_equal(lp.points[i].g, 128);
+        assert_true(dist(&lp.points[i - 1], &lp.points[i]) <= 1000 + 1);
+        lit++;
+    }
+    assert_int_equal(count_at(&lp, 5000, -5000, false), 1 + path_opts.corner_dwell);
+    assert_int_equal(count_at(&lp, 5000, 5000, false), 1 + path_opts.corner_dwell);
+    assert_int_equal(count_at(&lp, -5000, 5000, false), 1 + path_opts.corner_dwell);
+    assert_int_equal(lit, 40 + 3 * path_opts.corner_dwell);
+    assert_int_equal(lp.x, -5000);
+    assert_int_equal(lp.y, -5000);
+
+    // The next frame starts from where the beam is.
+    laser_path_build(&lp, ctx, &path_opts, &unit, src, num);
+    assert_int_equal(count_at(&lp, -5000, -5000, true), 2 * path_opts.blank_dwell);
+
+    talloc_free(ctx);
+}
+
+static void test_path_staircase(void **state)
+{
+    void *ctx = talloc_new(NULL);
+    // A diagonal made of 8-connected pixel steps is not a row of corners.
+    struct mp_point src[201];
+    src[0] = (struct mp_point){0, 0, .flags = MP_POINT_BLANK};
+    for (int i = 1; i < 201; i++) {
+        src[i] = src[i - 1];
+        src[i].flags = 0;
+        src[i].r = 255;
+        if (i & 1) {
+            src[i].x++;
+        } else {
+            src[i].y++;
+        }
+    }
+    struct laser_transform t = {.sx = 50, .sy = 50};
+
+    struct laser_path lp = {0};
+    laser_path_build(&lp, ctx, &path_opts, &t, src, 201);
+    for (int i = 1; i < lp.num_points; i++) {
+        if (!lp.points[i].blank)
+            assert_true(dist(&lp.points[i - 1], &lp.points[i]) > 0);
+    }
+
+    // Nothing to draw still gives the DAC a (blank) point.
+    laser_path_build(&lp, ctx, &path_opts, &t, NULL, 0);
+    assert_int_equal(lp.num_points, 1);
+    assert_true(lp.points[0].blank);
+
+    talloc_free(ctx);
+}
+
+static void test_ilda(void **state)
+{
+    const struct laser_point pts[2] = {
+        {.x = -32768, .y = 1, .blank = true},
+        {.x = 0x1234, .y = -2, .r = 1, .g = 2, .b = 3},
+    };
+    uint8_t buf[LASER_ILDA_HEADER + 2 * LASER_ILDA_RECORD];
+    assert_int_equal(laser_ilda_write_frame(buf, pts, 2, 7), sizeof(buf));
+    assert_memory_equal(buf, "ILDA\0\0\0\5", 8);
+    assert_int_equal(buf[24] << 8 | buf[25], 2);    // records
+    assert_int_equal(buf[26] << 8 | buf[27], 7);    // frame number
+
+    static const uint8_t rec[2][LASER_ILDA_RECORD] = {
+        {0x80, 0x00, 0x00, 0x01, 0x40, 0, 0, 0},
+        {0x12, 0x34, 0xFF, 0xFE, 0x80, 3, 2, 1},
+    };
+    assert_memory_equal(buf + LASER_ILDA_HEADER, rec, sizeof(rec));
+
+    assert_int_equal(laser_ilda_write_end(buf, 8), LASER_ILDA_HEADER);
+    assert_int_equal(buf[24] << 8 | buf[25], 0);
+}
+
+// Minimal Ether Dream: a 1799 point buffer that drains at the point rate
+// once playback was started.
+#define DAC_BUFFER 1799
+#define DAC_PPS 30000
+#define MAX_RECEIVED 20000
+
+struct dac {
+    int listen_fd, fd;
+    int port;
+    pthread_t thread;
+
+    int playback;               // 0 idle, 1 prepared, 2 playing
+    double fullness;
+    int64_t last_us;
+    int rate;
+    bool overrun;               // 'F' was returned
+
+    pthread_mutex_t lock;
+    int16_t received_x[MAX_RECEIVED];
+    int num_received;
+    int num_prepare;
+};
+
+static void dac_update(struct dac *d)
+{
+    int64_t now = mp_time_us();
+    if (d->playback == 2)
+        d->fullness = MPMAX(d->fullness - (now - d->last_us) * d->rate / 1e6, 0);
+    d->last_us = now;
+}
+
+static bool dac_recv(int fd, void *buf, size_t len)
+{
+    uint8_t *b = buf;
+    while (len) {
+        ssize_t r = recv(fd, b, len, 0);
+        if (r <= 0)
+            return false;
+        b += r;
+        len -= r;
+    }
+    return true;
+}
+
+static void dac_respond(struct dac *d, char resp, char cmd)
+{
+    dac_update(d);
+    int fullness = ceil(d->fullness);
+    uint8_t r[22] = {resp, cmd, 0, 0, d->playback};
+    r[12] = fullness;
+    r[13] = fullness >> 8;
+    memcpy(r + 14, &(uint32_t){d->rate}, 4); // test runs on little endian
+    (void)!send(d->fd, r, sizeof(r), MSG_NOSIGNAL);
+}
+
+static void *dac_thread(void *arg)
+{
+    struct dac *d = arg;
+    d->fd = accept(d->listen_fd, NULL, NULL);
+    if (d->fd < 0)
+        return NULL;
+    dac_respond(d, 'a', '?');
+
+    uint8_t cmd;
+    while (dac_recv(d->fd, &cmd, 1)) {
+        dac_update(d);
+        switch (cmd) {
+        case 'p':
+            d->playback = 1;
+            pthread_mutex_lock(&d->lock);
+            d->num_prepare++;
+            pthread_mutex_unlock(&d->lock);
+            dac_respond(d, 'a', cmd);
+            break;
+        case 'b': {
+            uint8_t b[6];
+            if (!dac_recv(d->fd, b, sizeof(b)))
+                return NULL;
+            d->rate = b[2] | b[3] << 8 | b[4] << 16 | b[5] << 24;
+            d->playback = d->playback ? 2 : 0;
+            dac_respond(d, d->playback == 2 ? 'a' : 'I', cmd);
+            break;
+        }
+        case 'd': {
+            uint8_t n[2];
+            if (!dac_recv(d->fd, n, 2))
+                return NULL;
+            int num = n[0] | n[1] << 8;
+            uint8_t pt[18];
+            bool full = d->fullness + num > DAC_BUFFER;
+            for (int i = 0; i < num; i++) {
+                if (!dac_recv(d->fd, pt, sizeof(pt)))
+                    return NULL;
+                pthread_mutex_lock(&d->lock);
+                if (!full && d->num_received < MAX_RECEIVED)
+                    d->received_x[d->num_received++] = (int16_t)(pt[2] | pt[3] << 8);
+                pthread_mutex_unlock(&d->lock);
+            }
+            if (full) {
+                d->overrun = true;
+            } else {
+                d->fullness += num;
+            }
+            dac_respond(d, full ? 'F' : 'a', cmd);
+            break;
+        }
+        case 's':
+            d->playback = 0;
+            d->fullness = 0;
+            dac_respond(d, 'a', cmd);
+            break;
+        default:
+            dac_respond(d, 'a', cmd);
+        }
+    }
+    close(d->fd);
+    return NULL;
+}
+
+static int dac_count(struct dac *d)
+{
+    pthread_mutex_lock(&d->lock);
+    int n = d->num_received;
+    pthread_mutex_unlock(&d->lock);
+    return n;
+}
+
+static bool dac_wait(struct dac *d, int num)
+{
+    int64_t end = mp_time_us() + 5 * 1000 * 1000;
+    while (dac_count(d) < num) {
+        if (mp_time_us() > end)
+            return false;
+        mp_sleep_us(1000);
+    }
+    return true;
+}
+
+static void make_frame(struct laser_point *pts, int num, int16_t base)
+{
+    for (int i = 0; i < num; i++)
+        pts[i] = (struct laser_point){.x = base + i, .r = 255};
+}
+
+static void test_etherdream(void **state)
+{
+    struct dac *d = talloc_zero(NULL, struct dac);
+    pthread_mutex_init(&d->lock, NULL);
+    d->listen_fd = socket(AF_INET, SOCK_STREAM, 0);
+    struct sockaddr_in sa = {
+        .sin_family = AF_INET,
+        .sin_addr.s_addr = htonl(INADDR_LOOPBACK),
+    };
+    socklen_t len = sizeof(sa);
+    assert_int_equal(bind(d->listen_fd, (struct sockaddr *)&sa, sizeof(sa)), 0);
+    assert_int_equal(listen(d->listen_fd, 1), 0);
+    getsockname(d->listen_fd, (struct sockaddr *)&sa, &len);
+    d->port = ntohs(sa.sin_port);
+    assert_int_equal(pthread_create(&d->thread, NULL, dac_thread, d), 0);
+
+    struct laser_etherdream *ed =
+        laser_etherdream_create(NULL, mp_null_log, "127.0.0.1", d->port, DAC_PPS);
+    assert_non_null(ed);
+
+    // The frame is repeated until the next one is set.
+    enum { A = 700, B = 300 };
+    struct laser_point a[A], b[B];
+    make_frame(a, A, 0);
+    make_frame(b, B, 10000);
+    laser_etherdream_set_frame(ed, a, A);
+    assert_true(dac_wait(d, 3 * A));
+
+    laser_etherdream_set_frame(ed, b, B);
+    int start = dac_count(d);
+    assert_true(dac_wait(d, start + A + 3 * B));
+
+    talloc_free(ed);
+    pthread_join(d->thread, NULL);
+    close(d->listen_fd);
+
+    // Frames were switched at the end of a pass only.
+    int i = 0;
+    for (; i < d->num_received && d->received_x[i] < 10000; i++)
+        assert_int_equal(d->received_x[i], i % A);
+    assert_int_equal(i % A, 0);
+    assert_true(i >= 3 * A);
+    for (int switched = i; i < d->num_received; i++)
+        assert_int_equal(d->received_x[i], 10000 + (i - switched) % B);
+
+    // Buffer was never overrun, and playback did not underrun and restart.
+    assert_false(d->overrun);
+    assert_int_equal(d->num_prepare, 1);
+    assert_int_equal(d->rate, DAC_PPS);
+
+    pthread_mutex_destroy(&d->lock);
+    talloc_free(d);
+}
+
+int main(void) {
+    const struct CMUnitTest tests[] = {
+        cmocka_unit_test(test_path_square),
+        cmocka_unit_test(test_path_staircase),
+        cmocka_unit_test(test_ilda),
+        cmocka_unit_test(test_etherdream),
+    };
+    return cmocka_run_group_tests(tests, NULL, NULL);
+}
@@ -0,0 +1,129 @@
+#include <limits.h>
+#include <string.h>
+
+#include "test_helpers.h"
+#include "mpv_talloc.h"
+#include "video/out/pixelflut/format.h"
+
+#define W 1920
+#define H 1080
+
+static uint8_t *make_pixels(void *ta_parent, int n)
+{
+    uint8_t *px = talloc_size(ta_parent, n * 3);
+    uint32_t s = 0x12345678;
+    for (int i = 0; i < n * 3; i++) {
+        s = s * 1103515245 + 12345;
+        px[i] = s >> 16;
+    }
+    // Some gray pixels for the grayscale path.
+    for (int i = 0; i < n; i += 7)
+        px[i * 3 + 1] = px[i * 3 + 2] = px[i * 3];
+    return px;
+}
+
+static size_t format_sprintf(char *d, const uint8_t *px, int x, int y, int n,
+                             const struct pf_format_opts *opts)
+{
+    size_t len = 0;
+    for (int i = 0; i < n; i++) {
+        const uint8_t *c = px + i * 3;
+        int cx = opts->offset_x + x + i, cy = opts->offset_y + y;
+        if (opts->grayscale && c[0] == c[1] && c[1] == c[2]) {
+            len += sprintf(d + len, "PX %i %i %02x\n", cx, cy, c[0]);
+        } else {
+            len += sprintf(d + len, "PX %i %i %02x%02x%02x\n", cx, cy,
+                           c[0], c[1], c[2]);
+        }
+    }
+    return len;
+}
+
+static void test_text_matches_sprintf(void **state)
+{
+    void *ctx = talloc_new(NULL);
+    uint8_t *px = make_pixels(ctx, W);
+    char *a = talloc_size(ctx, W * PF_FORMAT_MAX_CMD);
+    char *b = talloc_size(ctx, W * PF_FORMAT_MAX_CMD);
+
+    for (int gray = 0; gray < 2; gray++) {
+        struct pf_format_opts opts = {
+            .offset_x = 17, .offset_y = 995, .grayscale = gray,
+        };
+        struct pf_format f = {0};
+        pf_format_init(&f, ctx, W, H, &opts);
+        for (int y = 0; y < H; y += 97) {
+            size_t la = pf_format_run(&f, a, px, 0, y, W);
+            size_t lb = format_sprintf(b, px, 0, y, W, &opts);
+            assert_int_equal(la, lb);
+            assert_memory_equal(a, b, la);
+        }
+    }
+    talloc_free(ctx);
+}
+
+static void test_offset_and_binary(void **state)
+{
+    void *ctx = talloc_new(NULL);
+    struct pf_format_opts opts = {
+        .offset_x = 300, .offset_y = 2, .offset_cmd = true,
+    };
+    struct pf_format f = {0};
+    pf_format_init(&f, ctx, 16, 16, &opts);
+
+    char buf[PF_FORMAT_MAX_CMD * 2];
+    size_t len = pf_format_header(&f, buf);
+    assert_int_equal(len, strlen("OFFSET 300 2\n"));
+    assert_memory_equal(buf, "OFFSET 300 2\n", len);
+
+    const uint8_t px[3] = {0xab, 0x01, 0xff};
+    len = pf_format_run(&f, buf, px, 5, 7, 1);
+    assert_int_equal(len, strlen("PX 5 7 ab01ff\n"));
+    assert_memory_equal(buf, "PX 5 7 ab01ff\n", len);
+
+    opts.protocol = PF_PROTO_BINARY;
+    opts.offset_cmd = false;
+    pf_format_init(&f, ctx, 16, 16, &opts);
+    len = pf_format_run(&f, buf, px, 5, 7, 1);
+    const uint8_t pb[10] = {'P', 'B', 0x31, 0x01, 9, 0, 0xab, 0x01, 0xff, 0xff};
+    assert_int_equal(len, 10);
+    assert_memory_equal(buf, pb, 10);
+    talloc_free(ctx);
+}
+
+static void test_large_coordinates(void **state)
+{
+    void *ctx = talloc_new(NULL);
+    struct pf_format_opts opts = {
+        .offset_x = -2000000000, .offset_y = 2000000000,
+    };
+    struct pf_format f = {0};
+    assert_int_equal(pf_format_init(&f, ctx, 16, 16, &opts), 0);
+
+    char buf[PF_FORMAT_MAX_CMD];
+    const uint8_t px[3] = {0xab, 0x01, 0xff};
+    const char *cmd = "PX -1999999995 2000000007 ab01ff\n";
+    size_t len = pf_format_run(&f, buf, px, 5, 7, 1);
+    assert_int_equal(len, strlen(cmd));
+    assert_memory_equal(buf, cmd, len);
+
+    opts.offset_y = INT_MAX - 10;
+    assert_int_equal(pf_format_init(&f, ctx, 16, 16, &opts), -1);
+
+    opts = (struct pf_format_opts){
+        .protocol = PF_PROTO_BINARY, .offset_x = 65000,
+    };
+    assert_int_equal(pf_format_init(&f, ctx, 1000, 16, &opts), -1);
+    opts.offset_cmd = true;
+    assert_int_equal(pf_format_init(&f, ctx, 1000, 16, &opts), 0);
+    talloc_free(ctx);
+}
+
+int main(void) {
+    const struct CMUnitTest tests[] = {
+        cmocka_unit_test(test_text_matches_sprintf),
+        cmocka_unit_test(test_offset_and_binary),
+        cmocka_unit_test(test_large_coordinates),
+    };
+    return cmocka_run_group_tests(tests, NULL, NULL);
+}
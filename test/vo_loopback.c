@@ -0,0 +1,487 @@
+/*
+ * Loopback benchmark for the network VOs. Each test starts an in-process
+ * stand-in for the receiving side (pixelflut TCP and UDP servers, the eth0
+ * binary format, an Art-Net node, a Matelight), plays a synthetic lavfi
+ * source through the VO, and reconstructs the canvas from what arrives.
+ * Reported are pixels/s and bytes per frame as seen by the receiver, the
+ * frame transfer time (first to last byte of a frame), and the PSNR of the
+ * reconstructed canvas against the last frame the VO was given.
+ *
+ * This takes several seconds and binds the fixed Matelight port, so it only
+ * runs if the MPV_TEST_LOOPBACK environment variable is set.
+ */
+
+#include <errno.h>
+#include <inttypes.h>
+#include <poll.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+
+#include "test_helpers.h"
+#include "config.h"
+#include "mpv_talloc.h"
+#include "common/common.h"
+#include "libmpv/client.h"
+#include "osdep/timer.h"
+
+#define W 160
+#define H 90
+#define FPS 25
+#define SECONDS 2
+
+// Receive gap that separates two frames.
+#define FRAME_GAP_US 8000
+
+#define MATELIGHT_W 40
+#define MATELIGHT_H 16
+#define MATELIGHT_PORT 1337 // not configurable in the VO
+
+enum server_type {
+    SRV_PIXELFLUT,      // TCP, text or binary commands
+    SRV_PIXELFLUT_UDP,  // x, y, width header followed by RGB lines
+    SRV_ETH0,           // format 2: 12 bit x and y, then RGB, per pixel
+    SRV_ARTNET,         // ArtDmx, 170 LEDs per universe, row major
+    SRV_MATELIGHT,      // one datagram per frame
+};
+
+struct conn {
+    int fd;
+    char buf[4096];
+    size_t len;
+};
+
+struct server {
+    enum server_type type;
+    int fd;
+    int port;
+    int w, h;
+    int offset_x, offset_y;
+
+    pthread_t thread;
+    pthread_mutex_t lock;
+    bool stop;
+
+    uint8_t *canvas;                // RGB24
+    int64_t bytes, pixels, frames;
+    int64_t first_us, last_us, frame_start_us, transfer_us;
+
+    struct conn conns[16];
+    int num_conns;
+};
+
+static void set_pixel(struct server *s, int x, int y, int r, int g, int b)
+{
+    x += s->offset_x;
+    y += s->offset_y;
+    if (x < 0 || y < 0 || x >= s->w || y >= s->h)
+        return;
+    uint8_t *d = s->canvas + (y * s->w + x) * 3;
+    d[0] = r;
+    d[1] = g;
+    d[2] = b;
+    s->pixels++;
+}
+
+static void account(struct server *s, size_t len)
+{
+    int64_t now = mp_time_us();
+    if (!s->first_us || now - s->last_us > FRAME_GAP_US) {
+        if (s->first_us)
+            s->transfer_us += s->last_us - s->frame_start_us;
+        if (!s->first_us)
+            s->first_us = now;
+        s->frame_start_us = now;
+        s->frames++;
+    }
+    s->last_us = now;
+    s->bytes += len;
+}
+
+static void pixelflut_line(struct server *s, struct conn *c, char *line)
+{
+    int x, y, n;
+    unsigned v;
+    char hex[16];
+    if (sscanf(line, "PX %d %d %15s", &x, &y, hex) == 3) {
+        n = strlen(hex);
+        v = strtoul(hex, NULL, 16);
+        if (n == 2) {
+            set_pixel(s, x, y, v, v, v);
+        } else if (n == 6) {
+            set_pixel(s, x, y, v >> 16, (v >> 8) & 0xFF, v & 0xFF);
+        } else if (n == 8) {
+            set_pixel(s, x, y, v >> 24, (v >> 16) & 0xFF, (v >> 8) & 0xFF);
+        }
+    } else if (sscanf(line, "PX %d %d", &x, &y) == 2) {
+        x += s->offset_x;
+        y += s->offset_y;
+        if (x < 0 || y < 0 || x >= s->w || y >= s->h)
+            return;
+        uint8_t *p = s->canvas + (y * s->w + x) * 3;
+        char reply[64];
+        n = snprintf(reply, sizeof(reply), "PX %d %d %02x%02x%02x\n",
+                     x - s->offset_x, y - s->offset_y, p[0], p[1], p[2]);
+        (void)!send(c->fd, reply, n, MSG_NOSIGNAL);
+    } else if (sscanf(line, "OFFSET %d %d", &x, &y) == 2) {
+        s->offset_x = x;
+        s->offset_y = y;
+    } else if (strncmp(line, "SIZE", 4) == 0) {
+        char reply[64];
+        n = snprintf(reply, sizeof(reply), "SIZE %d %d\n", s->w, s->h);
+        (void)!send(c->fd, reply, n, MSG_NOSIGNAL);
+    }
+}
+
+static void pixelflut_parse(struct server *s, struct conn *c)
+{
+    size_t pos = 0;
+    while (pos < c->len) {
+        char *d = c->buf + pos;
+        size_t left = c->len - pos;
+        if (left >= 2 && d[0] == 'P' && d[1] == 'B') {
+            if (left < 10)
+                break;
+            const uint8_t *u = (const uint8_t *)d;
+            set_pixel(s, u[2] | (u[3] << 8), u[4] | (u[5] << 8),
+                      u[6], u[7], u[8]);
+            pos += 10;
+            continue;
+        }
+        char *nl = memchr(d, '\n', left);
+        if (!nl)
+            break;
+        *nl = '\0';
+        pixelflut_line(s, c, d);
+        pos += nl - d + 1;
+    }
+    memmove(c->buf, c->buf + pos, c->len - pos);
+    c->len -= pos;
+}
+
+static void datagram(struct server *s, const uint8_t *d, size_t len)
+{
+    switch (s->type) {
+    case SRV_PIXELFLUT_UDP: {
+        if (len < 6)
+            return;
+        uint16_t hdr[3];
+        memcpy(hdr, d, sizeof(hdr));
+        int width = hdr[2];
+        if (!width)
+            return;
+        int n = (len - 6) / 3;
+        for (int i = 0; i < n; i++) {
+            const uint8_t *c = d + 6 + i * 3;
+            set_pixel(s, hdr[0] + i % width, hdr[1] + i / width,
+                      c[0], c[1], c[2]);
+        }
+        break;
+    }
+    case SRV_ETH0:
+        if (len < 2 || d[0] != 2)
+            return;
+        for (size_t i = 2; i + 6 <= len; i += 6) {
+            const uint8_t *c = d + i;
+            set_pixel(s, c[0] | ((c[1] & 0xF) << 8), (c[1] >> 4) | (c[2] << 4),
+                      c[3], c[4], c[5]);
+        }
+        break;
+    case SRV_ARTNET: {
+        if (len < 18 || memcmp(d, "Art-Net\0", 8) || (d[8] | (d[9] << 8)) != 0x5000)
+            return;
+        int universe = d[14] | ((d[15] & 0x7F) << 8);
+        int n = MPMIN((d[16] << 8) | d[17], (int)len - 18);
+        for (int ch = 0; ch + 3 <= MPMIN(n, 510); ch += 3) {
+            int led = universe * 170 + ch / 3;
+            const uint8_t *c = d + 18 + ch;
+            set_pixel(s, led % s->w, led / s->w, c[0], c[1], c[2]);
+        }
+        break;
+    }
+    case SRV_MATELIGHT:
+        if (len < s->w * s->h * 3)
+            return;
+        for (int i = 0; i < s->w * s->h; i++)
+            set_pixel(s, i % s->w, i / s->w, d[i * 3], d[i * 3 + 1], d[i * 3 + 2]);
+        break;
+    default:
+        break;
+    }
+}
+
+static void *server_thread(void *arg)
+{
+    struct server *s = arg;
+    uint8_t buf[65536];
+
+    while (1) {
+        pthread_mutex_lock(&s->lock);
+        bool stop = s->stop;
+        pthread_mutex_unlock(&s->lock);
+        if (stop)
+            break;
+
+        struct pollfd fds[MP_ARRAY_SIZE(s->conns) + 1];
+        fds[0] = (struct pollfd){.fd = s->fd, .events = POLLIN};
+        for (int n = 0; n < s->num_conns; n++)
+            fds[n + 1] = (struct pollfd){.fd = s->conns[n].fd, .events = POLLIN};
+        if (poll(fds, s->num_conns + 1, 10) <= 0)
+            continue;
+
+        pthread_mutex_lock(&s->lock);
+        if (fds[0].revents & POLLIN) {
+            if (s->type == SRV_PIXELFLUT) {
+                int fd = accept(s->fd, NULL, NULL);
+                if (fd >= 0 && s->num_conns < MP_ARRAY_SIZE(s->conns)) {
+                    s->conns[s->num_conns++] = (struct conn){.fd = fd};
+                } else if (fd >= 0) {
+                    close(fd);
+                }
+            } else {
+                ssize_t r;
+                while ((r = recv(s->fd, buf, sizeof(buf), MSG_DONTWAIT)) >= 0) {
+                    account(s, r);
+                    datagram(s, buf, r);
+                }
+            }
+        }
+        for (int n = s->num_conns - 1; n >= 0; n--) {
+            if (!(fds[n + 1].revents & (POLLIN | POLLHUP | POLLERR)))
+                continue;
+            struct conn *c = &s->conns[n];
+            ssize_t r = recv(c->fd, c->buf + c->len, sizeof(c->buf) - c->len,
+                             MSG_DONTWAIT);
+            if (r <= 0 && !(r < 0 && errno == EAGAIN)) {
+                close(c->fd);
+                MP_TARRAY_REMOVE_AT(s->conns, s->num_conns, n);
+                continue;
+            }
+            if (r > 0) {
+                account(s, r);
+                c->len += r;
+                pixelflut_parse(s, c);
+            }
+        }
+        pthread_mutex_unlock(&s->lock);
+    }
+    return NULL;
+}
+
+static struct server *server_start(void *ta_parent, enum server_type type,
+                                   int w, int h, int port)
+{
+    struct server *s = talloc_zero(ta_parent, struct server);
+    s->type = type;
+    s->w = w;
+    s->h = h;
+    s->canvas = talloc_zero_size(s, w * h * 3);
+    pthread_mutex_init(&s->lock, NULL);
+
+    bool tcp = type == SRV_PIXELFLUT;
+    s->fd = socket(AF_INET, tcp ? SOCK_STREAM : SOCK_DGRAM, 0);
+    assert_true(s->fd >= 0);
+    int on = 1;
+    setsockopt(s->fd, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on));
+    int rcvbuf = 16 * 1024 * 1024;
+    setsockopt(s->fd, SOL_SOCKET, SO_RCVBUF, &rcvbuf, sizeof(rcvbuf));
+
+    struct sockaddr_in sa = {
+        .sin_family = AF_INET,
+        .sin_port = htons(port),
+        .sin_addr.s_addr = htonl(INADDR_LOOPBACK),
+    };
+    if (bind(s->fd, (struct sockaddr *)&sa, sizeof(sa)) < 0) {
+        close(s->fd);
+        talloc_free(s);
+        return NULL;
+    }
+    socklen_t sa_len = sizeof(sa);
+    getsockname(s->fd, (struct sockaddr *)&sa, &sa_len);
+    s->port = ntohs(sa.sin_port);
+    if (tcp)
+        assert_int_equal(listen(s->fd, 16), 0);
+
+    assert_int_equal(pthread_create(&s->thread, NULL, server_thread, s), 0);
+    return s;
+}
+
+static void server_stop(struct server *s)
+{
+    pthread_mutex_lock(&s->lock);
+    s->stop = true;
+    pthread_mutex_unlock(&s->lock);
+    pthread_join(s->thread, NULL);
+    if (s->frames)
+        s->transfer_us += s->last_us - s->frame_start_us;
+    for (int n = 0; n < s->num_conns; n++)
+        close(s->conns[n].fd);
+    close(s->fd);
+    pthread_mutex_destroy(&s->lock);
+}
+
+static double psnr(struct server *s, mpv_node *shot)
+{
+    int64_t w = 0, h = 0, stride = 0;
+    mpv_byte_array *data = NULL;
+    for (int n = 0; shot->format == MPV_FORMAT_NODE_MAP &&
+                    n < shot->u.list->num; n++)
+    {
+        const char *key = shot->u.list->keys[n];
+        mpv_node *v = &shot->u.list->values[n];
+        if (!strcmp(key, "w")) w = v->u.int64;
+        if (!strcmp(key, "h")) h = v->u.int64;
+        if (!strcmp(key, "stride")) stride = v->u.int64;
+        if (!strcmp(key, "data")) data = v->u.ba;
+    }
+    assert_non_null(data);
+    assert_int_equal(w, s->w);
+    assert_int_equal(h, s->h);
+
+    double sse = 0;
+    for (int y = 0; y < h; y++) {
+        const uint8_t *ref = (const uint8_t *)data->data + y * stride;  // bgr0
+        const uint8_t *got = s->canvas + y * s->w * 3;                 // rgb
+        for (int x = 0; x < w; x++) {
+            for (int c = 0; c < 3; c++) {
+                double d = ref[x * 4 + 2 - c] - got[x * 3 + c];
+                sse += d * d;
+            }
+        }
+    }
+    double mse = sse / (w * h * 3);
+    return mse > 0 ? 10 * log10(255.0 * 255.0 / mse) : INFINITY;
+}
+
+static void run(const char *name, enum server_type type, int w, int h,
+                int port, const char *vo_fmt)
+{
+    void *ctx = talloc_new(NULL);
+    struct server *s = server_start(ctx, type, w, h, port);
+    if (!s) {
+        talloc_free(ctx);
+        skip();
+    }
+
+    mpv_handle *mpv = mpv_create();
+    assert_non_null(mpv);
+    char *vo = talloc_asprintf(ctx, vo_fmt, s->port);
+    mpv_set_option_string(mpv, "vo", vo);
+    mpv_set_option_string(mpv, "audio", "no");
+    mpv_set_option_string(mpv, "keep-open", "yes");
+    mpv_set_option_string(mpv, "msg-level", "all=warn");
+    assert_int_equal(mpv_initialize(mpv), 0);
+    mpv_observe_property(mpv, 0, "eof-reached", MPV_FORMAT_FLAG);
+
+    char *url = talloc_asprintf(ctx, "av://lavfi:testsrc2=size=%dx%d:rate=%d:"
+                                "duration=%d", w, h, FPS, SECONDS);
+    const char *load[] = {"loadfile", url, NULL};
+    assert_int_equal(mpv_command(mpv, load), 0);
+
+    int64_t deadline = mp_time_us() + (SECONDS + 30) * 1000000LL;
+    bool eof = false, failed = false;
+    while (!eof && !failed && mp_time_us() < deadline) {
+        mpv_event *ev = mpv_wait_event(mpv, 1);
+        if (ev->event_id == MPV_EVENT_PROPERTY_CHANGE) {
+            mpv_event_property *prop = ev->data;
+            if (prop->format == MPV_FORMAT_FLAG && *(int *)prop->data)
+                eof = true;
+        } else if (ev->event_id == MPV_EVENT_END_FILE ||
+                   ev->event_id == MPV_EVENT_SHUTDOWN)
+        {
+            failed = true;
+        }
+    }
+    assert_true(eof);
+
+    // Let the last frame arrive.
+    mp_sleep_us(200 * 1000);
+
+    mpv_node args[2] = {
+        {.format = MPV_FORMAT_STRING, .u.string = "screenshot-raw"},
+        {.format = MPV_FORMAT_STRING, .u.string = "video"},
+    };
+    mpv_node_list list = {.num = 2, .values = args};
+    mpv_node cmd = {.format = MPV_FORMAT_NODE_ARRAY, .u.list = &list};
+    mpv_node shot;
+    assert_int_equal(mpv_command_node(mpv, &cmd, &shot), 0);
+
+    int64_t dropped = 0;
+    mpv_get_property(mpv, "frame-drop-count", MPV_FORMAT_INT64, &dropped);
+
+    server_stop(s);
+    double q = psnr(s, &shot);
+    mpv_free_node_contents(&shot);
+    mpv_terminate_destroy(mpv);
+
+    double secs = MPMAX(s->last_us - s->first_us, 1) / 1e6;
+    int64_t frames = MPMAX(s->frames, 1);
+    printf("%-14s %8.2f Mpx/s %9.0f bytes/frame %7.2f ms/frame %6.1f dB "
+           "(%"PRId64" frames received, %"PRId64" dropped)\n",
+           name, s->pixels / secs / 1e6, (double)s->bytes / frames,
+           s->transfer_us / 1e3 / frames, q, s->frames, dropped);
+
+    assert_true(s->frames > 0);
+    assert_true(q > 30);
+    talloc_free(ctx);
+}
+
+static void test_pixelflut(void **state)
+{
+    run("pixelflut", SRV_PIXELFLUT, W, H, 0,
+        "pixelflut:server=127.0.0.1:port=%d");
+}
+
+static void test_pixelflut_binary(void **state)
+{
+    run("pixelflut/bin", SRV_PIXELFLUT, W, H, 0,
+        "pixelflut:server=127.0.0.1:port=%d:protocol=binary");
+}
+
+static void test_pixelflutudp(void **state)
+{
+    run("pixelflutudp", SRV_PIXELFLUT_UDP, W, H, 0,
+        "pixelflutudp:hostname=127.0.0.1:port=%d");
+}
+
+static void test_pixelfluteth0(void **state)
+{
+    run("pixelfluteth0", SRV_ETH0, W, H, 0,
+        "pixelfluteth0:hostname=127.0.0.1:port=%d");
+}
+
+static void test_artnet(void **state)
+{
+    run("led/artnet", SRV_ARTNET, W, H, 0,
+        "led:hostname=127.0.0.1:port=%d:protocol=artnet:width=160:height=90");
+}
+
+static void test_matelight(void **state)
+{
+    run("matelight", SRV_MATELIGHT, MATELIGHT_W, MATELIGHT_H, MATELIGHT_PORT,
+        "matelight:hostname=127.0.0.1");
+}
+
+int main(void) {
+#if !HAVE_LIBAVDEVICE
+    // The source is a lavfi graph opened through libavdevice.
+    return 0;
+#else
+    if (!getenv("MPV_TEST_LOOPBACK"))
+        return 0;
+    const struct CMUnitTest tests[] = {
+        cmocka_unit_test(test_pixelflut),
+        cmocka_unit_test(test_pixelflut_binary),
+        cmocka_unit_test(test_pixelflutudp),
+        cmocka_unit_test(test_pixelfluteth0),
+        cmocka_unit_test(test_artnet),
+        cmocka_unit_test(test_matelight),
+    };
+    return cmocka_run_group_tests(tests, NULL, NULL);
+#endif
+}
@@ -0,0 +1,195 @@
+/*
+ * This file is part of mpv.
+ *
+ * mpv is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation; either version 2.1 of the License, or
+ * (at your option) any later version.
+ *
+ * mpv is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with mpv.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <string.h>
+
+#include <libavutil/buffer.h>
+
+#include "mpv_talloc.h"
+#include "common/common.h"
+
+#include "dirty.h"
+#include "img_format.h"
+#include "mp_image.h"
+
+struct mp_dirty_tracker {
+    struct mp_image *last;      // previous frame, without map
+};
+
+static void free_dirty(void *opaque, uint8_t *data)
+{
+    talloc_free(data);
+}
+
+void mp_image_set_dirty(struct mp_image *img, struct mp_dirty *d)
+{
+    av_buffer_unref(&img->dirty);
+    img->dirty = av_buffer_create((uint8_t *)d, sizeof(*d), free_dirty, NULL,
+                                  AV_BUFFER_FLAG_READONLY);
+    if (!img->dirty)
+        talloc_free(d);
+}
+
+struct mp_dirty *mp_image_get_dirty(struct mp_image *img, struct mp_image *ref)
+{
+    if (!img->dirty || !ref)
+        return NULL;
+    struct mp_dirty *d = (struct mp_dirty *)img->dirty->data;
+    if (d->imgfmt != img->imgfmt || d->w != img->w || d->h != img->h)
+        return NULL;
+    // ref keeps its buffers alive, so the same plane pointer means the same
+    // frame.
+    for (int n = 0; n < img->num_planes; n++) {
+        if (d->prev->planes[n] != ref->planes[n] ||
+            d->prev->stride[n] != ref->stride[n])
+            return NULL;
+    }
+    return d;
+}
+
+static bool is_trackable(struct mp_image *img)
+{
+    int flags = img->fmt.flags;
+    return !(flags & MP_IMGFLAG_HWACCEL) && (flags & MP_IMGFLAG_BYTE_ALIGNED);
+}
+
+static bool same_buffers(struct mp_image *a, struct mp_image *b)
+{
+    for (int n = 0; n < a->num_planes; n++) {
+        if (a->planes[n] != b->planes[n] || a->stride[n] != b->stride[n])
+            return false;
+    }
+    return true;
+}
+
+// Mark the tiles in which plane p of cur and prev differ.
+static void compare_plane(struct mp_dirty *d, struct mp_image *cur,
+                          struct mp_image *prev, int p)
+{
+    int bytes = cur->fmt.bytes[p];
+    int tile_w = MP_DIRTY_TILE >> cur->fmt.xs[p];
+    int tile_h = MP_DIRTY_TILE >> cur->fmt.ys[p];
+    int w = mp_image_plane_w(cur, p);
+    int h = mp_image_plane_h(cur, p);
+
+    for (int y = 0; y < h; y++) {
+        const uint8_t *a = cur->planes[p] + (ptrdiff_t)y * cur->stride[p];
+        const uint8_t *b = prev->planes[p] + (ptrdiff_t)y * prev->stride[p];
+        if (!memcmp(a, b, (size_t)w * bytes))
+            continue;
+        uint8_t *tiles = &d->tiles[(y / tile_h) * d->tiles_w];
+        for (int tx = 0; tx < d->tiles_w; tx++) {
+            if (tiles[tx])
+                continue;
+            int x = tx * tile_w;
+            size_t len = (size_t)MPMIN(tile_w, w - x) * bytes;
+            if (memcmp(a + (size_t)x * bytes, b + (size_t)x * bytes, len)) {
+                tiles[tx] = 1;
+                d->num_dirty++;
+            }
+        }
+    }
+}
+
+// Collect the runs of changed tiles of each tile row.
+static void find_runs(struct mp_dirty *d)
+{
+    int num_runs = 0;
+    d->row_runs = talloc_array(d, int, d->tiles_h + 1);
+    for (int ty = 0; ty < d->tiles_h; ty++) {
+        const uint8_t *tiles = &d->tiles[ty * d->tiles_w];
+        d->row_runs[ty] = num_runs;
+        int tx = 0;
+        while (tx < d->tiles_w) {
+            if (!tiles[tx]) {
+                tx++;
+                continue;
+            }
+            int start = tx;
+            while (tx < d->tiles_w && tiles[tx])
+                tx++;
+            struct mp_dirty_run run = {
+                .x0 = start * MP_DIRTY_TILE,
+                .x1 = MPMIN(tx * MP_DIRTY_TILE, d->w),
+            };
+            MP_TARRAY_APPEND(d, d->runs, num_runs, run);
+        }
+    }
+    d->row_runs[d->tiles_h] = num_runs;
+}
+
+static struct mp_dirty *compute_map(struct mp_image *cur, struct mp_image *prev)
+{
+    struct mp_dirty *d = talloc_zero(NULL, struct mp_dirty);
+    d->imgfmt = cur->imgfmt;
+    d->w = cur->w;
+    d->h = cur->h;
+    d->tiles_w = (cur->w + MP_DIRTY_TILE - 1) / MP_DIRTY_TILE;
+    d->tiles_h = (cur->h + MP_DIRTY_TILE - 1) / MP_DIRTY_TILE;
+    d->tiles = talloc_zero_array(d, uint8_t, d->tiles_w * d->tiles_h);
+    d->prev = talloc_steal(d, mp_image_new_ref(prev));
+    if (!d->prev) {
+        talloc_free(d);
+        return NULL;
+    }
+
+    if (!same_buffers(cur, prev)) {
+        for (int p = 0; p < cur->num_planes; p++)
+            compare_plane(d, cur, prev, p);
+    }
+    find_runs(d);
+    return d;
+}
+
+static void tracker_destroy(void *ptr)
+{
+    mp_dirty_tracker_reset(ptr);
+}
+
+struct mp_dirty_tracker *mp_dirty_tracker_create(void *ta_parent)
+{
+    struct mp_dirty_tracker *t = talloc_zero(ta_parent, struct mp_dirty_tracker);
+    talloc_set_destructor(t, tracker_destroy);
+    return t;
+}
+
+void mp_dirty_tracker_process(struct mp_dirty_tracker *t, struct mp_image *img)
+{
+    struct mp_image *last = t->last;
+
+    av_buffer_unref(&img->dirty);
+    if (last && is_trackable(img) && last->imgfmt == img->imgfmt &&
+        last->w == img->w && last->h == img->h)
+    {
+        struct mp_dirty *d = compute_map(img, last);
+        if (d)
+            mp_image_set_dirty(img, d);
+    }
+
+    mp_dirty_tracker_reset(t);
+    if (is_trackable(img)) {
+        t->last = mp_image_new_ref(img);
+        // Don't chain up all earlier frames through the maps.
+        if (t->last)
+            av_buffer_unref(&t->last->dirty);
+    }
+}
+
+void mp_dirty_tracker_reset(struct mp_dirty_tracker *t)
+{
+    mp_image_unrefp(&t->last);
+}
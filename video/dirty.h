@@ -0,0 +1,92 @@
+/*
+ * This file is part of mpv.
+ *
+ * mpv is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation; either version 2.1 of the License, or
+ * (at your option) any later version.
+ *
+ * mpv is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with mpv.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef MP_DIRTY_H_
+#define MP_DIRTY_H_
+
+#include <stdbool.h>
+#include <stdint.h>
+
+struct mp_image;
+
+/*
+ * Changed regions of a frame relative to the frame before it, as a grid of
+ * MP_DIRTY_TILE x MP_DIRTY_TILE pixel tiles. The map is computed once in the
+ * filter chain, after the conversion to the VO's format, and travels with the
+ * image. VOs which send only changed pixels use it to skip unchanged tiles
+ * instead of comparing whole frames against their last one.
+ */
+
+#define MP_DIRTY_TILE 16
+
+struct mp_dirty {
+    int imgfmt, w, h;       // image the map was computed for
+    int tiles_w, tiles_h;
+    uint8_t *tiles;         // tiles_w * tiles_h entries, nonzero if changed
+    int num_dirty;          // number of changed tiles
+    struct mp_image *prev;  // the frame the map is relative to
+    // Runs of changed tiles; those of tile row ty are
+    // runs[row_runs[ty]] .. runs[row_runs[ty + 1] - 1].
+    struct mp_dirty_run *runs;
+    int *row_runs;          // tiles_h + 1 entries
+};
+
+// A run of changed tiles in a row, in pixels: columns x0 .. x1-1.
+struct mp_dirty_run {
+    int x0, x1;
+};
+
+// Attach d to img, replacing any previous map. Takes ownership of d, which
+// must be a talloc allocation (with no parent).
+void mp_image_set_dirty(struct mp_image *img, struct mp_dirty *d);
+
+// Return the map of img if it is relative to ref, i.e. ref is a reference to
+// the frame the map was computed against. Otherwise (including if img has no
+// map) return NULL, and img has to be compared against ref in full.
+struct mp_dirty *mp_image_get_dirty(struct mp_image *img, struct mp_image *ref);
+
+// Return whether the tile containing pixel (x, y) changed.
+static inline bool mp_dirty_test(const struct mp_dirty *d, int x, int y)
+{
+    return d->tiles[(y / MP_DIRTY_TILE) * d->tiles_w + x / MP_DIRTY_TILE];
+}
+
+// Set *runs to the runs of changed tiles in the tile row containing pixel row
+// y, and return their number.
+static inline int mp_dirty_row_runs(const struct mp_dirty *d, int y,
+                                    const struct mp_dirty_run **runs)
+{
+    int ty = y / MP_DIRTY_TILE;
+    *runs = &d->runs[d->row_runs[ty]];
+    return d->row_runs[ty + 1] - d->row_runs[ty];
+}
+
+// Computes the maps of consecutive frames.
+struct mp_dirty_tracker;
+
+struct mp_dirty_tracker *mp_dirty_tracker_create(void *ta_parent);
+
+// Attach a map relative to the previous frame passed to this function, if
+// that frame has the same format and size. Frames which share their buffers
+// with the previous one (repeated frames) are unchanged without looking at
+// the pixels. Hardware and bit-packed formats are not tracked.
+void mp_dirty_tracker_process(struct mp_dirty_tracker *t, struct mp_image *img);
+
+// Forget the previous frame, e.g. on seeks.
+void mp_dirty_tracker_reset(struct mp_dirty_tracker *t);
+
+#endif
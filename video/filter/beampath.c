@@ -0,0 +1,335 @@
+/*
+ * This file is part of mpv.
+ *
+ * mpv is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * mpv is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with mpv.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <math.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "mpv_talloc.h"
+#include "common/common.h"
+
+#include "beampath.h"
+#include "contour.h"
+
+// How far (in steps) a 2-opt move may reach. Keeps the refinement linear in
+// the number of contours.
+#define TWO_OPT_WINDOW 48
+
+struct pt {
+    float x, y;
+};
+
+// Uniform grid over point indices, for nearest neighbour queries.
+struct grid {
+    int gw, gh, cell;
+    int *start;         // gw * gh + 1 offsets into items
+    int *items;
+    int *alive;         // per cell number of items not yet dead
+};
+
+struct mp_beampath_priv {
+    struct grid grid, prev_grid;
+
+    struct pt *ends;            // start and end point of each contour
+    uint8_t *visited;
+    struct mp_beam_step *tmp;
+    struct key { int rank; float d2; int contour; bool reversed; } *keys;
+
+    // Order of the previous frame: where each step entered its contour.
+    struct pt *prev_entry;
+    int num_prev;
+    int prev_w, prev_h;
+};
+
+static float dist(struct pt a, struct pt b)
+{
+    return sqrtf((a.x - b.x) * (a.x - b.x) + (a.y - b.y) * (a.y - b.y));
+}
+
+static void grid_build(void *ta, struct grid *g, const struct pt *pts, int n,
+                       int w, int h)
+{
+    g->cell = MPMAX(8, (int)sqrt((double)w * h / MPMAX(n, 1)));
+    g->gw = MPMAX(1, (w + g->cell - 1) / g->cell);
+    g->gh = MPMAX(1, (h + g->cell - 1) / g->cell);
+    int cells = g->gw * g->gh;
+
+    MP_RESIZE_ARRAY(ta, g->start, cells + 1);
+    MP_RESIZE_ARRAY(ta, g->alive, cells);
+    MP_RESIZE_ARRAY(ta, g->items, MPMAX(n, 1));
+
+    memset(g->alive, 0, cells * sizeof(g->alive[0]));
+    int *idx = talloc_array(NULL, int, MPMAX(n, 1));
+    for (int i = 0; i < n; i++) {
+        int cx = MPCLAMP((int)pts[i].x / g->cell, 0, g->gw - 1);
+        int cy = MPCLAMP((int)pts[i].y / g->cell, 0, g->gh - 1);
+        idx[i] = cy * g->gw + cx;
+        g->alive[idx[i]]++;
+    }
+    int pos = 0;
+    for (int c = 0; c < cells; c++) {
+        g->start[c] = pos;
+        pos += g->alive[c];
+    }
+    g->start[cells] = pos;
+    for (int i = n - 1; i >= 0; i--)
+        g->items[g->start[idx[i]] + --g->alive[idx[i]]] = i;
+    for (int c = 0; c < cells; c++)
+        g->alive[c] = g->start[c + 1] - g->start[c];
+    talloc_free(idx);
+}
+
+static int grid_cell(struct grid *g, struct pt p)
+{
+    int cx = MPCLAMP((int)p.x / g->cell, 0, g->gw - 1);
+    int cy = MPCLAMP((int)p.y / g->cell, 0, g->gh - 1);
+    return cy * g->gw + cx;
+}
+
+// Nearest item to p whose dead[item >> shift] is not set (dead may be NULL).
+// Returns -1 if there is none.
+static int grid_nearest(struct grid *g, const struct pt *pts,
+                        const uint8_t *dead, int shift, struct pt p,
+                        float *out_d2)
+{
+    int cx = MPCLAMP((int)p.x / g->cell, 0, g->gw - 1);
+    int cy = MPCLAMP((int)p.y / g->cell, 0, g->gh - 1);
+    int max_r = MPMAX(g->gw, g->gh);
+    int best = -1;
+    float best_d2 = INFINITY;
+
+    for (int r = 0; r <= max_r; r++) {
+        // Everything in ring r is at least (r - 1) cells away.
+        float min_d = (float)(r - 1) * g->cell;
+        if (best >= 0 && r > 0 && best_d2 <= min_d * min_d)
+            break;
+        for (int y = cy - r; y <= cy + r; y++) {
+            if (y < 0 || y >= g->gh)
+                continue;
+            bool edge = y == cy - r || y == cy + r;
+            int step = edge ? 1 : MPMAX(2 * r, 1);
+            for (int x = cx - r; x <= cx + r; x += step) {
+                if (x < 0 || x >= g->gw)
+                    continue;
+                int c = y * g->gw + x;
+                if (!g->alive[c])
+                    continue;
+                for (int i = g->start[c]; i < g->start[c + 1]; i++) {
+                    int item = g->items[i];
+                    if (dead && dead[item >> shift])
+                        continue;
+                    struct pt q = pts[item];
+                    float d2 = (q.x - p.x) * (q.x - p.x) + (q.y - p.y) * (q.y - p.y);
+                    if (d2 < best_d2) {
+                        best_d2 = d2;
+                        best = item;
+                    }
+                }
+            }
+        }
+    }
+    *out_d2 = best_d2;
+    return best;
+}
+
+static struct pt entry_pt(struct mp_beampath_priv *p, struct mp_beam_step s)
+{
+    return p->ends[s.contour * 2 + s.reversed];
+}
+
+static struct pt exit_pt(struct mp_beampath_priv *p, struct mp_beam_step s)
+{
+    return p->ends[s.contour * 2 + !s.reversed];
+}
+
+static double path_length(struct mp_beampath_priv *p,
+                          const struct mp_beam_step *steps, int n)
+{
+    double len = 0;
+    struct pt cur = {0, 0};
+    for (int i = 0; i < n; i++) {
+        len += dist(cur, entry_pt(p, steps[i]));
+        cur = exit_pt(p, steps[i]);
+    }
+    return len;
+}
+
+static void order_greedy(struct mp_beampath_priv *p, struct mp_beam_step *out,
+                         int n)
+{
+    struct grid *g = &p->grid;
+    memset(p->visited, 0, n);
+    struct pt cur = {0, 0};
+    for (int i = 0; i < n; i++) {
+        float d2;
+        int item = grid_nearest(g, p->ends, p->visited, 1, cur, &d2);
+        if (item < 0)
+            break;
+        struct mp_beam_step s = {item >> 1, item & 1};
+        out[i] = s;
+        p->visited[s.contour] = 1;
+        g->alive[grid_cell(g, p->ends[s.contour * 2])]--;
+        g->alive[grid_cell(g, p->ends[s.contour * 2 + 1])]--;
+        cur = exit_pt(p, s);
+    }
+}
+
+static int compare_key(const void *a, const void *b)
+{
+    const struct key *ka = a, *kb = b;
+    if (ka->rank != kb->rank)
+        return ka->rank < kb->rank ? -1 : 1;
+    if (ka->d2 != kb->d2)
+        return ka->d2 < kb->d2 ? -1 : 1;
+    return ka->contour - kb->contour;
+}
+
+// Sort the contours by the position in the previous order of the step that
+// entered closest to one of their end points.
+static void order_previous(struct mp_beampath_priv *p,
+                           struct mp_beam_step *out, int n)
+{
+    for (int i = 0; i < n; i++) {
+        float d2[2];
+        int rank[2];
+        for (int e = 0; e < 2; e++) {
+            rank[e] = grid_nearest(&p->prev_grid, p->prev_entry, NULL, 0,
+                                   p->ends[i * 2 + e], &d2[e]);
+        }
+        int e = d2[1] < d2[0];
+        p->keys[i] = (struct key){rank[e], d2[e], i, e};
+    }
+    qsort(p->keys, n, sizeof(p->keys[0]), compare_key);
+    for (int i = 0; i < n; i++)
+        out[i] = (struct mp_beam_step){p->keys[i].contour, p->keys[i].reversed};
+}
+
+// Reverse steps[i..j], which also reverses the direction of each contour.
+static void reverse_steps(struct mp_beam_step *steps, int i, int j)
+{
+    for (; i < j; i++, j--) {
+        struct mp_beam_step t = steps[i];
+        steps[i] = steps[j];
+        steps[j] = t;
+        steps[i].reversed = !steps[i].reversed;
+        steps[j].reversed = !steps[j].reversed;
+    }
+    if (i == j)
+        steps[i].reversed = !steps[i].reversed;
+}
+
+static void two_opt(struct mp_beampath_priv *p, struct mp_beam_step *steps,
+                    int n, int passes)
+{
+    for (int pass = 0; pass < passes; pass++) {
+        bool improved = false;
+        for (int i = 0; i < n; i++) {
+            struct pt before = i ? exit_pt(p, steps[i - 1]) : (struct pt){0, 0};
+            int last = MPMIN(n - 1, i + TWO_OPT_WINDOW);
+            for (int j = i + 1; j <= last; j++) {
+                struct pt a = entry_pt(p, steps[i]);
+                struct pt b = exit_pt(p, steps[j]);
+                float old_len = dist(before, a), new_len = dist(before, b);
+                if (j + 1 < n) {
+                    struct pt after = entry_pt(p, steps[j + 1]);
+                    old_len += dist(b, after);
+                    new_len += dist(a, after);
+                }
+                if (new_len < old_len - 1e-3f) {
+                    reverse_steps(steps, i, j);
+                    improved = true;
+                }
+            }
+        }
+        if (!improved)
+            break;
+    }
+}
+
+struct mp_beampath *mp_beampath_alloc(void *ta_parent)
+{
+    struct mp_beampath *bp = talloc_zero(ta_parent, struct mp_beampath);
+    bp->p = talloc_zero(bp, struct mp_beampath_priv);
+    return bp;
+}
+
+void mp_beampath_reset(struct mp_beampath *bp)
+{
+    bp->p->num_prev = 0;
+}
+
+void mp_beampath_update(struct mp_beampath *bp, const struct mp_contours *c,
+                        int w, int h, enum mp_beampath_mode mode, int passes)
+{
+    struct mp_beampath_priv *p = bp->p;
+    int n = c->num_contours;
+
+    MP_RESIZE_ARRAY(bp, bp->steps, MPMAX(n, 1));
+    MP_RESIZE_ARRAY(p, p->ends, MPMAX(n * 2, 1));
+    bp->num_steps = n;
+
+    for (int i = 0; i < n; i++) {
+        const struct mp_contour *ct = &c->contours[i];
+        const struct mp_contour_point *first = &c->points[ct->first];
+        const struct mp_contour_point *last = &c->points[ct->first + ct->num - 1];
+        p->ends[i * 2 + 0] = (struct pt){first->x, first->y};
+        p->ends[i * 2 + 1] = (struct pt){last->x, last->y};
+        bp->steps[i] = (struct mp_beam_step){i, false};
+    }
+    bp->jump_unsorted = path_length(p, bp->steps, n);
+    bp->jump_sorted = bp->jump_unsorted;
+
+    if (mode == MP_BEAMPATH_NONE || n < 2) {
+        p->num_prev = 0;
+        return;
+    }
+
+    MP_RESIZE_ARRAY(p, p->visited, n);
+    MP_RESIZE_ARRAY(p, p->tmp, n);
+    grid_build(p, &p->grid, p->ends, n * 2, w, h);
+    order_greedy(p, bp->steps, n);
+    double len = path_length(p, bp->steps, n);
+
+    if (p->num_prev && p->prev_w == w && p->prev_h == h) {
+        MP_RESIZE_ARRAY(p, p->keys, n);
+        order_previous(p, p->tmp, n);
+        if (mode == MP_BEAMPATH_2OPT)
+            two_opt(p, p->tmp, n, passes);
+        double prev_len = path_length(p, p->tmp, n);
+        if (mode == MP_BEAMPATH_2OPT)
+            two_opt(p, bp->steps, n, passes);
+        len = path_length(p, bp->steps, n);
+        if (prev_len <= len) {
+            memcpy(bp->steps, p->tmp, n * sizeof(bp->steps[0]));
+            len = prev_len;
+        }
+    } else if (mode == MP_BEAMPATH_2OPT) {
+        two_opt(p, bp->steps, n, passes);
+        len = path_length(p, bp->steps, n);
+    }
+    bp->jump_sorted = len;
+
+    // Remember the order for the next frame.
+    MP_RESIZE_ARRAY(p, p->prev_entry, n);
+    for (int i = 0; i < n; i++)
+        p->prev_entry[i] = entry_pt(p, bp->steps[i]);
+    p->num_prev = n;
+    p->prev_w = w;
+    p->prev_h = h;
+    grid_build(p, &p->prev_grid, p->prev_entry, n, w, h);
+}
@@ -0,0 +1,63 @@
+/*
+ * This file is part of mpv.
+ *
+ * mpv is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * mpv is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with mpv.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef MP_BEAMPATH_H_
+#define MP_BEAMPATH_H_
+
+#include <stdbool.h>
+
+struct mp_contours;
+
+// Drawing order for the contours of a frame, chosen to keep the blanked beam
+// jumps between them short. The beam starts at (0, 0).
+
+enum mp_beampath_mode {
+    MP_BEAMPATH_NONE,       // trace order
+    MP_BEAMPATH_GREEDY,     // nearest next contour
+    MP_BEAMPATH_2OPT,       // greedy, then refined with 2-opt moves
+};
+
+struct mp_beam_step {
+    int contour;            // index into mp_contours.contours
+    bool reversed;          // draw the points last to first
+};
+
+struct mp_beampath {
+    struct mp_beam_step *steps;
+    int num_steps;
+
+    // Total jump length (in source pixels) of the last frame, in trace order
+    // and in the chosen order.
+    double jump_unsorted;
+    double jump_sorted;
+
+    // Internal.
+    struct mp_beampath_priv *p;
+};
+
+struct mp_beampath *mp_beampath_alloc(void *ta_parent);
+
+// Order the contours of a w x h frame. passes bounds the number of 2-opt
+// sweeps. The order of the previous frame is used as a starting point, if it
+// beats the greedy order.
+void mp_beampath_update(struct mp_beampath *bp, const struct mp_contours *c,
+                        int w, int h, enum mp_beampath_mode mode, int passes);
+
+// Forget the previous frame.
+void mp_beampath_reset(struct mp_beampath *bp);
+
+#endif
@@ -0,0 +1,193 @@
+/*
+ * This file is part of mpv.
+ *
+ * mpv is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * mpv is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with mpv.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <assert.h>
+#include <string.h>
+
+#include "mpv_talloc.h"
+#include "common/common.h"
+
+#include "contour.h"
+
+// Border marks. The paper stores them in the image itself (NBD / -NBD); the
+// sequence numbers are only needed for the hierarchy, which is not built.
+enum {
+    MARK_NONE = 0,      // not on a traced border (f == 1)
+    MARK_POS,           // on a traced border (f == NBD)
+    MARK_NEG,           // ... and the right neighbour is background (-NBD)
+};
+
+// Neighbour offsets, counter-clockwise starting with east (y points down).
+static const int dir_x[8] = {1,  1,  0, -1, -1, -1, 0, 1};
+static const int dir_y[8] = {0, -1, -1, -1,  0,  1, 1, 1};
+
+#define DIR_E 0
+#define DIR_W 4
+
+struct tracer {
+    struct mp_contours *c;
+    const uint8_t *data;
+    ptrdiff_t stride;
+    int w, h;
+    uint8_t threshold;
+    int min_points;
+};
+
+static inline bool is_fg(struct tracer *t, int x, int y)
+{
+    if (x < 0 || y < 0 || x >= t->w || y >= t->h)
+        return false;
+    return t->data[y * t->stride + x] > t->threshold;
+}
+
+static void end_contour(struct tracer *t, struct mp_contour *ct)
+{
+    struct mp_contours *c = t->c;
+    if (ct->num < t->min_points) {
+        // Drop it; the marks stay, so it is not traced again.
+        c->num_points = ct->first;
+        return;
+    }
+    MP_TARRAY_APPEND(c, c->contours, c->num_contours, *ct);
+}
+
+static inline void add_point(struct tracer *t, struct mp_contour *ct,
+                             int x, int y)
+{
+    struct mp_contours *c = t->c;
+    MP_TARRAY_APPEND(c, c->points, c->num_points,
+                     (struct mp_contour_point){x, y});
+    ct->brightness += t->data[y * t->stride + x];
+    ct->num++;
+}
+
+// Follow the border through the foreground pixel (x0, y0), whose neighbour
+// in direction start is background. Step 3 of the paper.
+static void trace(struct tracer *t, int x0, int y0, int start, bool hole)
+{
+    struct mp_contours *c = t->c;
+    uint8_t *marks = c->marks;
+    int w = t->w;
+
+    struct mp_contour ct = {.first = c->num_points, .hole = hole};
+
+    // 3.1: first foreground neighbour, looking clockwise.
+    int d1 = -1;
+    for (int i = 0; i < 8; i++) {
+        int d = (start - i) & 7;
+        if (is_fg(t, x0 + dir_x[d], y0 + dir_y[d])) {
+            d1 = d;
+            break;
+        }
+    }
+    if (d1 < 0) {
+        // Isolated pixel.
+        marks[y0 * w + x0] = MARK_NEG;
+        add_point(t, &ct, x0, y0);
+        end_contour(t, &ct);
+        return;
+    }
+    int x1 = x0 + dir_x[d1], y1 = y0 + dir_y[d1];
+
+    // 3.2 - 3.5: (x3, y3) is the current pixel, and prev the direction from
+    // it to the previous one.
+    int x3 = x0, y3 = y0;
+    int prev = d1;
+    while (1) {
+        add_point(t, &ct, x3, y3);
+
+        // 3.3: next foreground neighbour, counter-clockwise after prev.
+        bool east_bg = false;
+        int d = prev;
+        for (int i = 0; i < 8; i++) {
+            d = (d + 1) & 7;
+            if (is_fg(t, x3 + dir_x[d], y3 + dir_y[d]))
+                break;
+            if (d == DIR_E)
+                east_bg = true;
+        }
+        int x4 = x3 + dir_x[d], y4 = y3 + dir_y[d];
+
+        // 3.4
+        uint8_t *m = &marks[y3 * w + x3];
+        if (east_bg) {
+            *m = MARK_NEG;
+        } else if (*m == MARK_NONE) {
+            *m = MARK_POS;
+        }
+
+        // 3.5: back at the start, about to repeat the first step.
+        if (x4 == x0 && y4 == y0 && x3 == x1 && y3 == y1)
+            break;
+        x3 = x4;
+        y3 = y4;
+        prev = (d + 4) & 7;
+    }
+
+    end_contour(t, &ct);
+}
+
+struct mp_contours *mp_contours_alloc(void *ta_parent)
+{
+    return talloc_zero(ta_parent, struct mp_contours);
+}
+
+void mp_contours_find(struct mp_contours *c, const uint8_t *data,
+                      ptrdiff_t stride, int w, int h, uint8_t threshold,
+                      int min_points)
+{
+    assert(w >= 0 && h >= 0 && w <= INT16_MAX && h <= INT16_MAX);
+
+    c->num_contours = 0;
+    c->num_points = 0;
+
+    size_t size = (size_t)w * h;
+    if (c->marks_size < size) {
+        talloc_free(c->marks);
+        c->marks = talloc_array(c, uint8_t, size);
+        c->marks_size = size;
+    }
+    memset(c->marks, MARK_NONE, size);
+
+    struct tracer t = {
+        .c = c,
+        .data = data,
+        .stride = stride,
+        .w = w,
+        .h = h,
+        .threshold = threshold,
+        .min_points = min_points,
+    };
+
+    for (int y = 0; y < h; y++) {
+        const uint8_t *line = data + y * stride;
+        const uint8_t *marks = c->marks + (size_t)y * w;
+        bool prev_fg = false;
+        for (int x = 0; x < w; x++) {
+            bool fg = line[x] > threshold;
+            if (fg) {
+                bool next_fg = x + 1 < w && line[x + 1] > threshold;
+                if (!prev_fg && marks[x] == MARK_NONE) {
+                    trace(&t, x, y, DIR_W, false);
+                } else if (!next_fg && marks[x] != MARK_NEG) {
+                    trace(&t, x, y, DIR_E, true);
+                }
+            }
+            prev_fg = fg;
+        }
+    }
+}
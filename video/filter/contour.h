@@ -0,0 +1,63 @@
+/*
+ * This file is part of mpv.
+ *
+ * mpv is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * mpv is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with mpv.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef MP_CONTOUR_H_
+#define MP_CONTOUR_H_
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+// Border following (Suzuki & Abe, 1985) on 8 bit planes, for the vector
+// output filters. Pixels above a threshold are foreground; every outer and
+// hole border of the foreground is returned as a closed list of 8-connected
+// points, like cvFindContours(CV_RETR_LIST, CV_CHAIN_APPROX_NONE). Pixels
+// outside of the plane count as background.
+
+struct mp_contour_point {
+    int16_t x, y;
+};
+
+struct mp_contour {
+    int first;              // index into mp_contours.points
+    int num;                // number of points
+    uint64_t brightness;    // sum of the source values of all points
+    bool hole;              // hole border (inside of a foreground region)
+};
+
+struct mp_contours {
+    struct mp_contour *contours;
+    int num_contours;
+    struct mp_contour_point *points;
+    int num_points;
+
+    // Internal.
+    uint8_t *marks;
+    size_t marks_size;
+};
+
+// The arrays are kept and reused by all following mp_contours_find() calls.
+struct mp_contours *mp_contours_alloc(void *ta_parent);
+
+// Trace all borders in the w x h plane at data, which is not modified.
+// Contours with fewer than min_points points are dropped. Replaces the
+// previous results in c. w and h must not exceed INT16_MAX.
+void mp_contours_find(struct mp_contours *c, const uint8_t *data,
+                      ptrdiff_t stride, int w, int h, uint8_t threshold,
+                      int min_points);
+
+#endif
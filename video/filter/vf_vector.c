@@ -17,7 +17,7 @@
 
 /*
  * -- Naming --
- * Contour:   List of adjacent points as outputed by cvFindContours
+ * Contour:   List of adjacent points as outputed by mp_contours_find
  * Point:     Point in a contour
  * Distance:  Distance between two points (typically end of one contour to begging of the next)
  * Time:      (unscaled) Scanout time of the Point (input image values, 0-255), contour (sum of point times), or travel delay time (between contours)
@@ -39,12 +39,15 @@
 
 #include "video/mp_image.h"
 #include "video/mp_image_pool.h"
+#include "video/points.h"
 
 #include "video/out/vo.h"
 
 #include "options/m_option.h"
+#include "common/tags.h"
 
-#include <cv.h>
+#include "beampath.h"
+#include "contour.h"
 
 struct vf_vector_opts{
     int width, height;
@@ -52,12 +55,17 @@ struct vf_vector_opts{
     double cfg_blank_scale;
     double min_length;
     int cfg_sort;
+    int cfg_sort_passes;
     int dithering;    
+    int points;
 };
 
 struct vf_priv_s {
     struct vf_vector_opts *opts;
     struct mp_image_pool *pool;
+    struct mp_contours *contours;
+    struct mp_beampath *path;
+    double blank_saved; //Share of the scanout time saved on beam moves by sorting (last frame)
 };
 /*const vf_priv_dflt = {
     800, 600,
@@ -77,32 +85,45 @@ typedef union vector{
     uint32_t pattern;
 } vector_t;
 
-//static unsigned long jump_to(vector_t** path, IplImage* ocv_in, unsigned long total_time , struct vf_priv_s* config, CvPoint* location);
-static unsigned long calculate_move_time(CvSeq* contour, CvPoint* current_point, double move_speed);
-static unsigned long calculate_contour_time(IplImage* image, CvSeq* contour, CvPoint* current_point, double move_speed);
-static vector_t* add_points(struct vf_priv_s* priv, vector_t* p, IplImage* image , unsigned long length, CvPoint* point, unsigned int z);
+static unsigned long calculate_move_time(struct mp_contour_point* first_point, struct mp_contour_point* current_point, double move_speed);
+static vector_t* add_points(struct vf_priv_s* priv, vector_t* p, struct mp_image* image, unsigned long length, struct mp_contour_point* point, unsigned int z);
 
-static void mp_to_ocv_image(IplImage* out, struct mp_image* in)
-{
-    assert(in->num_planes == 1);    
-    out->nSize = sizeof(IplImage);
-    out->ID = 0;
-    out->roi = 0;
-    out->maskROI = 0;
-    out->origin = 0; //top-left origin
-    out->dataOrder = 0; //Interleaved pixel data: R,G,B,R,G,B,...
-    out->imageId = 0;
-    out->tileInfo = 0;
-    out->align = 4;
-    
-    out->depth = IPL_DEPTH_8U; //8 Bits per color channel, unsigned
-    out->height = in->h;
-    out->width = in->w;
-    out->imageData = in->planes[0];
-    out->imageDataOrigin = in->planes[0];
-    out->nChannels = in->fmt.bpp[0] / 8; //Bytes per pixel
-    out->widthStep = in->stride[0]; //(mp_image_plane_w(in, 0) * in->fmt.bpp[0] + 7) / 8;
-    out->imageSize = out->widthStep * out->height;
+/**
+ * Output the sorted contours as IMGFMT_POINTS point list in source coordinates:
+ * a blanked move to the start of each contour, then its points (closed) with
+ * the source brightness as colour. Timing is left to the output.
+ */
+static struct mp_image* make_point_list(struct vf_priv_s* priv, struct mp_image* mpi_in){
+    const uint8_t* src = mpi_in->planes[0];
+    ptrdiff_t src_stride = mpi_in->stride[0];
+    struct mp_contours* contours = priv->contours;
+    struct mp_beampath* path = priv->path;
+
+    struct mp_point_list* list = talloc_zero(NULL, struct mp_point_list);
+    list->points = talloc_array(list, struct mp_point, contours->num_points + path->num_steps * 2);
+
+    for (int n = 0; n < path->num_steps; n++){
+        struct mp_contour* c = &contours->contours[path->steps[n].contour];
+        struct mp_contour_point* points = &contours->points[c->first];
+        bool reversed = path->steps[n].reversed;
+        int num_points = c->num;
+
+        for (int i = 0; i <= num_points; i++){
+            struct mp_contour_point* point = &points[reversed ? num_points - 1 - i % num_points : i % num_points];
+            uint8_t brightness = src[point->x + point->y * src_stride];
+            if (i == 0) brightness = 0;
+            list->points[list->num_points++] = (struct mp_point){
+                .x = point->x,
+                .y = point->y,
+                .r = brightness, .g = brightness, .b = brightness,
+                .flags = i == 0 ? MP_POINT_BLANK : 0,
+            };
+        }
+    }
+
+    priv->blank_saved = path->jump_unsorted > 0 ? MPMAX(path->jump_unsorted - path->jump_sorted, 0) / path->jump_unsorted : 0;
+
+    return mp_points_wrap(list, mpi_in->w, mpi_in->h);
 }
 
 static void vf_vector_process(struct mp_filter *vf){
@@ -126,144 +147,118 @@ static void vf_vector_process(struct mp_filter *vf){
     }
     
     struct mp_image *mpi_in = frame.data;
-    
-    struct mp_image* mpi_out = mp_image_pool_get(priv->pool, IMGFMT_RGB0, opts->width, opts->height);
-    if (!mpi_out || !mp_image_make_writeable(mpi_out)) {
+    if (mpi_in->fmt.bpp[0] != 8 || mpi_in->w > INT16_MAX || mpi_in->h > INT16_MAX) {
+        MP_ERR(vf, "input needs an 8 bit luma/gray plane, use format=y8\n");
         mp_frame_unref(&frame);
         mp_filter_internal_mark_failed(vf);
         return;
     }
-    mp_image_clear(mpi_out,0,0,mpi_out->w, mpi_out->h);
+    
+    if (opts->points){
+        mp_contours_find(priv->contours, mpi_in->planes[0], mpi_in->stride[0], mpi_in->w, mpi_in->h, 0, ceil(opts->min_length));
+        mp_beampath_update(priv->path, priv->contours, mpi_in->w, mpi_in->h, opts->cfg_sort, opts->cfg_sort_passes);
+        struct mp_image* points = make_point_list(priv, mpi_in);
+        if (!points) {
+            mp_frame_unref(&frame);
+            mp_filter_internal_mark_failed(vf);
+            return;
+        }
+        mp_image_copy_attributes(points, mpi_in);
+        mp_frame_unref(&frame);
+        mp_pin_in_write(vf->ppins[1], (struct mp_frame){MP_FRAME_VIDEO, points});
+        return;
+    }
 
-    struct mp_image* mpi_work = mp_image_pool_get(priv->pool, IMGFMT_Y8, mpi_in->w, mpi_in->h);
-    if (!mpi_work || !mp_image_make_writeable(mpi_work)) {
+    struct mp_image* mpi_out = mp_image_pool_get(priv->pool, IMGFMT_RGB0, opts->width, opts->height);
+    if (!mpi_out || !mp_image_make_writeable(mpi_out)) {
         mp_frame_unref(&frame);
         mp_filter_internal_mark_failed(vf);
         return;
     }
-    mp_image_copy_attributes(mpi_work, mpi_in);
-    mp_image_copy(mpi_work, mpi_in);
-    //struct mp_image* mpi_work = mp_image_new_copy(mpi_in); //cvFindContours modifies the input, take a copy because we don't own the input image.
-    
-    IplImage ocv_in;
-    IplImage ocv_work;
-    IplImage ocv_out;
-    mp_to_ocv_image(&ocv_in,   mpi_in);
-    mp_to_ocv_image(&ocv_work, mpi_work);
-    mp_to_ocv_image(&ocv_out,  mpi_out);
-    
-    unsigned int max_time = ocv_out.width * ocv_out.height;
-    vector_t* dst = (vector_t*)ocv_out.imageData;
-    vector_t* end = (vector_t*)(ocv_out.imageData + ocv_out.imageSize);
 
+    const uint8_t* src = mpi_in->planes[0];
+    ptrdiff_t src_stride = mpi_in->stride[0];
     
-    CvMemStorage *storage = cvCreateMemStorage(0);
-    CvSeq* contours;
-    cvFindContours(&ocv_work, storage, &contours, sizeof(CvContour), CV_RETR_LIST, CV_CHAIN_APPROX_NONE, cvPoint(0, 0));
-    
-//     if(opts->cfg_sort && contours){
-//         CvMemStorage *storage_sort = cvCreateMemStorage(0);
-//         CvSeq* contours_sort = cvCreateSeq(1117343756, 128, sizeof(CvSeq*), storage_sort);
-//         CvSeq* c = 0;
-//         CvPoint* last_point = 0;
-//         
-//         do {
-//             CvSeq* min_move_seq = 0;
-//             unsigned int min_move_time = 0xFFFFFFFF;
-//         
-//             CvSeq* d = contours;
-//             
-//             do {
-//                 if (d != c){
-//                     int move_time = calculate_move_time(d, last_point, 1);
-//                     if (move_time < min_move_time) min_move_seq = d;
-//                 }
-//             } while ((d = d->h_next));
-//             
-//             if (min_move_seq){
-//                 cvSeqPush(contours_sort, min_move_seq);
-//                 last_point = CV_GET_SEQ_ELEM(CvPoint, c, min_move_seq->total - 1);
-//             }
-//             
-//         } while ((c = d->h_next));
-//         
-//         cvReleaseMemStorage(&storage);
-//         storage = storage_sort;
-//         contours = contours_sort;
-//     }
-    
-//    printf("Min Length: %f\n", opts->min_length);
+    unsigned int max_time = mpi_out->w * mpi_out->h;
+    vector_t* dst = (vector_t*)mpi_out->planes[0];
+    vector_t* end = (vector_t*)(mpi_out->planes[0] + mpi_out->stride[0] * mpi_out->h);
+
+    //Traces the borders and sums their brightness in one go, the input is only read.
+    struct mp_contours* contours = priv->contours;
+    mp_contours_find(contours, src, src_stride, mpi_in->w, mpi_in->h, 0, ceil(opts->min_length));
+
+    //Draw order, shortest beam moves first
+    struct mp_beampath* path = priv->path;
+    mp_beampath_update(path, contours, mpi_in->w, mpi_in->h, opts->cfg_sort, opts->cfg_sort_passes);
 
     unsigned long total_time = 0;
     
-    CvPoint* last_point = 0;
-
-    if (contours){
-        //Count the number of vectors to draw
-        CvSeq* c = contours;
-        do {
-            int num_points = c->total;
-            if (num_points >= opts->min_length){
-                total_time += calculate_contour_time(&ocv_in,c, last_point, opts->cfg_move_scale);
-                last_point =  CV_GET_SEQ_ELEM(CvPoint, c, -1);
-            }
-        } while ((c = c->h_next));
+    struct mp_contour_point* last_point = 0;
+
+    //Count the number of vectors to draw
+    for (int n = 0; n < path->num_steps; n++){
+        struct mp_contour* c = &contours->contours[path->steps[n].contour];
+        struct mp_contour_point* points = &contours->points[c->first];
+        bool reversed = path->steps[n].reversed;
+        total_time += calculate_move_time(&points[reversed ? c->num - 1 : 0], last_point, opts->cfg_move_scale);
+        total_time += c->brightness;
+        last_point = &points[reversed ? 0 : c->num - 1];
     }
 
+    double saved_time = (path->jump_unsorted - path->jump_sorted) * opts->cfg_move_scale;
+    priv->blank_saved = saved_time > 0 ? saved_time / (total_time + saved_time) : 0;
+
+    last_point = 0;
+
     if ((total_time > 0)){
         float scale = (float)max_time / (float)total_time;
         float remain = 0;
         
-        CvSeq* c = contours;
-        do {
-            int num_points = c->total;           
+        for (int n = 0; n < path->num_steps; n++){
+            struct mp_contour* c = &contours->contours[path->steps[n].contour];
+            struct mp_contour_point* points = &contours->points[c->first];
+            bool reversed = path->steps[n].reversed;
+            int num_points = c->num;
             
-            if (num_points >= opts->min_length){
-                if (opts->cfg_move_scale){
-                    //Beam move/fill
-                    CvPoint* first_point = CV_GET_SEQ_ELEM(CvPoint, c, 0);
-                    unsigned long move_points = calculate_move_time(c, last_point, opts->cfg_move_scale) * scale;
-                    unsigned long off_points  = move_points * opts->cfg_blank_scale;
-                    unsigned long on_points   = move_points - off_points;
-                    if (dst+move_points >= end) {printf("Overflow2!\n"); break;}
-                    dst = add_points(priv, dst, &ocv_in, off_points, first_point, 0x00);
-                    dst = add_points(priv, dst, &ocv_in, on_points,  first_point, 0xFF);
-                }
-                if (dst >= end) {printf("Overflow1!\n"); break;}
-                
-                for (int i = 0; i < num_points; i++){
-                    CvPoint* point = CV_GET_SEQ_ELEM(CvPoint, c, i);
-                    uint8_t brightness = (uint8_t)ocv_in.imageData[point->x * ocv_in.nChannels + point->y * ocv_in.widthStep];
-                    //Can only draw full vectors, accumulate rounding errors and draw one additional vector when > 1
-                    float pscale = scale  * brightness;
-                    int   iscale = pscale + remain;
-                    remain += pscale - iscale;
-
-                    if (dst+iscale > end) {printf("Overflow3 by %i!\n", (dst+iscale) - end); break;}
-                    dst = add_points(priv, dst, &ocv_in, iscale,  point, 0xFF);
-                }
-                last_point = CV_GET_SEQ_ELEM(CvPoint, c, -1);
-                if (dst > end) {printf("Overflow4 by %i!\n", dst-end); break;}
+            if (opts->cfg_move_scale){
+                //Beam move/fill
+                struct mp_contour_point* first_point = &points[reversed ? num_points - 1 : 0];
+                unsigned long move_points = calculate_move_time(first_point, last_point, opts->cfg_move_scale) * scale;
+                unsigned long off_points  = move_points * opts->cfg_blank_scale;
+                unsigned long on_points   = move_points - off_points;
+                if (dst+move_points >= end) {MP_DBG(vf, "Overflow2!\n"); break;}
+                dst = add_points(priv, dst, mpi_in, off_points, first_point, 0x00);
+                dst = add_points(priv, dst, mpi_in, on_points,  first_point, 0xFF);
+            }
+            if (dst >= end) {MP_DBG(vf, "Overflow1!\n"); break;}
+            
+            for (int i = 0; i < num_points; i++){
+                struct mp_contour_point* point = &points[reversed ? num_points - 1 - i : i];
+                uint8_t brightness = src[point->x + point->y * src_stride];
+                //Can only draw full vectors, accumulate rounding errors and draw one additional vector when > 1
+                float pscale = scale  * brightness;
+                int   iscale = pscale + remain;
+                remain += pscale - iscale;
+
+                if (dst+iscale > end) {MP_DBG(vf, "Overflow3 by %i!\n", (int)((dst+iscale) - end)); break;}
+                dst = add_points(priv, dst, mpi_in, iscale,  point, 0xFF);
             }
-        } while ((c = c->h_next));
+            last_point = &points[reversed ? 0 : num_points - 1];
+            if (dst > end) {MP_DBG(vf, "Overflow4 by %i!\n", (int)(dst-end)); break;}
+        }
     }
     // Fill unused pixels
-//     printf("Fill: %li\n", ocv_out.imageSize - ((char*)dst - ocv_out.imageData));
-    memset((char*)dst, 0x0,  ocv_out.imageSize - ((char*)dst - ocv_out.imageData));
+    memset((char*)dst, 0x0, (char*)end - (char*)dst);
     
     mpi_out->pts = mpi_in->pts;
     
-    cvReleaseMemStorage(&storage);
-
-    talloc_free(mpi_work);
-    
     mp_frame_unref(&frame);
     frame = (struct mp_frame){MP_FRAME_VIDEO, mpi_out};
     mp_pin_in_write(vf->ppins[1], frame);
 }
 
 
-static vector_t* add_points(struct vf_priv_s* priv, vector_t* dst, IplImage* src_image , unsigned long length, CvPoint* point, unsigned int z){
+static vector_t* add_points(struct vf_priv_s* priv, vector_t* dst, struct mp_image* src_image, unsigned long length, struct mp_contour_point* point, unsigned int z){
     if (priv->opts->dithering){
         const unsigned int width = 512;
         const unsigned int height = 512;
@@ -272,8 +267,8 @@ static vector_t* add_points(struct vf_priv_s* priv, vector_t* dst, IplImage* src
         unsigned int y;
         
         if (point){
-            x = (point->x * width / src_image->width); //Scale to full "color" depth
-            y = (point->y * height / src_image->height);
+            x = (point->x * width / src_image->w); //Scale to full "color" depth
+            y = (point->y * height / src_image->h);
         } else {
             x = 0;
             y = 0;
@@ -294,8 +289,8 @@ static vector_t* add_points(struct vf_priv_s* priv, vector_t* dst, IplImage* src
         vector_t v;
         v.z = z;
         if (point){
-            v.x = (point->x * 256 / src_image->width); //Scale to full "color" depth
-            v.y = 255 - (point->y * 256 / src_image->height);
+            v.x = (point->x * 256 / src_image->w); //Scale to full "color" depth
+            v.y = 255 - (point->y * 256 / src_image->h);
         } else {
             v.x = 0;
             v.y = 255;
@@ -311,15 +306,12 @@ static vector_t* add_points(struct vf_priv_s* priv, vector_t* dst, IplImage* src
 }
 
 /**
- * Calculate the (unscaled) scanout time to move the beam to the begin of the given countour from the current starting point.
+ * Calculate the (unscaled) scanout time to move the beam to the given countour start point from the current point.
  */
-static unsigned long calculate_move_time(CvSeq* contour, CvPoint* current_point, double move_speed){
+static unsigned long calculate_move_time(struct mp_contour_point* first_point, struct mp_contour_point* current_point, double move_speed){
     if (move_speed){
         double move_distance;
         
-        //Beam move time
-        CvPoint* first_point = CV_GET_SEQ_ELEM(CvPoint, contour, 0);
-        
         if (current_point){ //Move from current beam point
             move_distance = sqrt((current_point->x - first_point->x)*(current_point->x - first_point->x) + (current_point->y - first_point->y)*(current_point->y - first_point->y));
         } else { //Move from (0,0) (h/vblank)
@@ -331,27 +323,38 @@ static unsigned long calculate_move_time(CvSeq* contour, CvPoint* current_point,
     }
 }
 
-/**
- * Calculate the (unscaled) scanout time to draw the countour from current starting point.
- */
-static unsigned long calculate_contour_time(IplImage* src_image, CvSeq* contour, CvPoint* current_point, double move_speed){
-    unsigned long contour_time = calculate_move_time(contour, current_point, move_speed);
-    
-    //Count Contour points
-    for (int i = 0; i < contour->total; i++){
-        CvPoint* point = CV_GET_SEQ_ELEM(CvPoint, contour, i);
-        //Draw length (^= draw time) proportional to brightness
-        contour_time += (uint8_t)src_image->imageData[point->x * src_image->nChannels + point->y * src_image->widthStep];
-    }
-    return contour_time;
-}
-
 
 
 //-------------------------------- MPV Functions -------------------------------
+static void vf_vector_reset(struct mp_filter *vf)
+{
+    struct vf_priv_s *priv = vf->priv;
+    mp_beampath_reset(priv->path);
+}
+
+static bool vf_vector_command(struct mp_filter *vf, struct mp_filter_command *cmd)
+{
+    struct vf_priv_s *priv = vf->priv;
+
+    switch (cmd->type) {
+    case MP_FILTER_COMMAND_GET_META: {
+        struct mp_tags *tags = talloc_zero(NULL, struct mp_tags);
+        mp_tags_set_str(tags, "jump-unsorted", mp_tprintf(32, "%.0f", priv->path->jump_unsorted));
+        mp_tags_set_str(tags, "jump-sorted", mp_tprintf(32, "%.0f", priv->path->jump_sorted));
+        mp_tags_set_str(tags, "blank-time-saved", mp_tprintf(32, "%.2f", priv->blank_saved * 100));
+        *(struct mp_tags **)cmd->res = tags;
+        return true;
+    }
+    default:
+        return false;
+    }
+}
+
 static const struct mp_filter_info vf_vector_filter = {
     .name = "vector",
     .process = vf_vector_process,
+    .reset = vf_vector_reset,
+    .command = vf_vector_command,
     .priv_size = sizeof(struct vf_priv_s),
 };
 
@@ -369,6 +372,8 @@ static struct mp_filter *vf_vector_create(struct mp_filter *parent, void *option
     struct vf_priv_s *priv = f->priv;
     priv->opts = talloc_steal(priv, options);
     priv->pool = mp_image_pool_new(priv);
+    priv->contours = mp_contours_alloc(priv);
+    priv->path = mp_beampath_alloc(priv);
 
     return f;
 }
@@ -382,6 +387,13 @@ static const m_option_t vf_opts_fields[] = {
     OPT_DOUBLE("blank",      cfg_blank_scale, 0, .min=0, .max=1),
     OPT_DOUBLE("min_length", min_length,  0, .min = 0, OPTDEF_DOUBLE(3)),
     OPT_INT(   "dither",     dithering,      0, .min = 0, .max=1, OPTDEF_INT(1)),
+    OPT_FLAG(  "points",     points,      0),
+    OPT_CHOICE("sort",       cfg_sort,    0,
+               ({"no", MP_BEAMPATH_NONE},
+                {"greedy", MP_BEAMPATH_GREEDY},
+                {"2opt", MP_BEAMPATH_2OPT}),
+               OPTDEF_INT(MP_BEAMPATH_GREEDY)),
+    OPT_INTRANGE("sort_passes", cfg_sort_passes, 0, 0, 100, OPTDEF_INT(4)),
     {0}
 };
 
@@ -37,11 +37,8 @@
 struct vf_vectorraster_opts {
     int cfg_width;
     int cfg_height;
-};
-
-struct vf_priv_s {
-    struct vf_vectorraster_opts *opts;
-    struct mp_image_pool *pool;
+    int cfg_scan_width;
+    int cfg_scan_height;
 };
 
 typedef union vector{
@@ -54,11 +51,76 @@ typedef union vector{
     uint32_t pattern;
 } vector_t;
 
-static const unsigned long scan_width   = 512;
-static const unsigned long scan_height  = 256;
+struct vf_priv_s {
+    struct vf_vectorraster_opts *opts;
+    struct mp_image_pool *pool;
+
+    // Input layout the lookup tables were built for
+    int in_w, in_h, in_stride, in_bytes;
+
+    ptrdiff_t* row_offset;  // byte offset of the source row, per scan line
+    uint32_t* col_offset;   // byte offset within the source row, per scan column
+    vector_t* patterns;     // 2 dithering vectors per scan column and line parity
+    uint8_t*  samples;      // brightness per scan position, in scan order
+};
 
 #define BRIGHTNESS2LENGTH(x) ((x+1)*(x+1)*(x+1)) //Increased
 
+// Scan positions depend on the input size only, so sample addresses and output
+// vectors are computed once instead of twice per sample and frame.
+static void build_luts(struct vf_priv_s* priv, struct mp_image* mpi)
+{
+    unsigned int scan_width  = priv->opts->cfg_scan_width;
+    unsigned int scan_height = priv->opts->cfg_scan_height;
+
+    priv->in_w      = mpi->w;
+    priv->in_h      = mp_image_plane_h(mpi, 0);
+    priv->in_stride = mpi->stride[0];
+    priv->in_bytes  = mpi->fmt.bpp[0] / 8;
+
+    talloc_free(priv->row_offset);
+    talloc_free(priv->col_offset);
+    talloc_free(priv->patterns);
+    talloc_free(priv->samples);
+    priv->row_offset = talloc_array(priv, ptrdiff_t, scan_height);
+    priv->col_offset = talloc_array(priv, uint32_t, scan_width);
+    priv->patterns   = talloc_array(priv, vector_t, scan_width * 2);
+    priv->samples    = talloc_array(priv, uint8_t, scan_width * scan_height);
+
+    for (unsigned int y = 0; y < scan_height; y++)
+        priv->row_offset[y] = (ptrdiff_t)priv->in_stride * (priv->in_h - 1 - (int)(y * priv->in_h / scan_height));
+    for (unsigned int sx = 0; sx < scan_width; sx++){
+        priv->col_offset[sx] = (unsigned long)sx * priv->in_w * priv->in_bytes / scan_width;
+        //Temporal dithering 50%/50% between neighbouring positions at twice the output resolution
+        unsigned int hx = sx * 512 / scan_width;
+        vector_t* v = &priv->patterns[sx * 2];
+        v[0] = (vector_t){{hx/2, 0, 0xFF}};
+        v[1] = (vector_t){{((hx & 1) == 0) || (sx == (scan_width -1)) ? hx/2 : hx/2+1, 0, 0xFF}};
+    }
+}
+
+// Write n vectors alternating between v0 and v1 the way the dithering always did:
+// by pointer-sized groups of the output buffer (pos is the index of dst in it).
+static vector_t* fill_run(vector_t* dst, size_t pos, size_t n, vector_t v0, vector_t v1)
+{
+    if (v0.pattern == v1.pattern){
+        for (size_t i = 0; i < n; i++)
+            dst[i] = v0;
+        return dst + n;
+    }
+
+    //The period is a power of two, so no division per vector
+    enum { GROUP = sizeof(void*) >= sizeof(vector_t) ? sizeof(void*) / sizeof(vector_t) : 1 };
+    vector_t period[GROUP * 2];
+    for (size_t j = 0; j < GROUP; j++){
+        period[j] = v0;
+        period[GROUP + j] = v1;
+    }
+    for (size_t i = 0; i < n; i++)
+        dst[i] = period[(pos + i) & (GROUP * 2 - 1)];
+    return dst + n;
+}
+
 static void vf_vectorraster_process(struct mp_filter *vf){
     
     struct vf_priv_s *priv = vf->priv;
@@ -82,7 +144,6 @@ static void vf_vectorraster_process(struct mp_filter *vf){
 
     struct mp_image *mpi = frame.data;
    
-    //struct mp_image *out_image = mp_image_alloc(IMGFMT_RGB0, priv->cfg_width, priv->cfg_height);
     struct mp_image *out_image = mp_image_pool_get(priv->pool, IMGFMT_RGB0, priv->opts->cfg_width, priv->opts->cfg_height);
     if (!out_image){
         mp_frame_unref(&frame);
@@ -90,54 +151,73 @@ static void vf_vectorraster_process(struct mp_filter *vf){
         return;
     }
     mp_image_make_writeable(out_image);
-        
-    uint8_t* src = mpi->planes[0];
-    int in_stepwidth = mpi->stride[0];
-    unsigned int in_height = mp_image_plane_h(mpi, 0);
-    vector_t* dst = (vector_t*) out_image->planes[0];
-    unsigned long out_stepwidth = out_image->stride[0];  
-    
-        
-    unsigned long max_length = out_image->w * out_image->h;
-    unsigned long total_length = 0;
-    
-    for (unsigned long y = 0; y < scan_height; y++){
-        for (unsigned long x = 0; x < scan_width; x++){
-            unsigned long sx = (y & 1) ? (scan_width - 1 - x) : x; //Avoid scan back after each line by changing scan direction
-            unsigned long brightness = src[in_stepwidth * (in_height - 1 - (y * in_height / scan_height)) + (sx * mpi->w * (mpi->fmt.bpp[0] / 8) / scan_width)];
-            if (sx == 0 || (sx == (scan_width-1))) brightness = 0xF0; //Ensure leftmost pixel is drawn, to force the beam to scan the entire line and don't start in the middle
-            total_length += BRIGHTNESS2LENGTH(brightness);
+
+    if (!priv->samples || mpi->w != priv->in_w || mp_image_plane_h(mpi, 0) != priv->in_h ||
+        mpi->stride[0] != priv->in_stride || mpi->fmt.bpp[0] / 8 != priv->in_bytes)
+        build_luts(priv, mpi);
+
+    const unsigned int scan_width  = priv->opts->cfg_scan_width;
+    const unsigned int scan_height = priv->opts->cfg_scan_height;
+    const uint8_t* src = mpi->planes[0];
+    vector_t* const start = (vector_t*) out_image->planes[0];
+    vector_t* const end = (vector_t*) (out_image->planes[0] + out_image->stride[0] * out_image->h);
+    vector_t* dst = start;
+
+    //Pass 1: sample in scan order and build the brightness histogram
+    uint32_t hist[4][256] = {{0}};
+    uint8_t* samples = priv->samples;
+    for (unsigned int y = 0; y < scan_height; y++){
+        const uint8_t* row = src + priv->row_offset[y];
+        uint8_t* line = samples + y * scan_width;
+        //Avoid scan back after each line by changing scan direction
+        if (y & 1){
+            for (unsigned int x = 0; x < scan_width; x++)
+                line[x] = row[priv->col_offset[scan_width - 1 - x]];
+        } else {
+            for (unsigned int x = 0; x < scan_width; x++)
+                line[x] = row[priv->col_offset[x]];
+        }
+        //Ensure leftmost pixel is drawn, to force the beam to scan the entire line and don't start in the middle
+        line[0] = line[scan_width - 1] = 0xF0;
+        unsigned int x = 0;
+        for (; x + 4 <= scan_width; x += 4){
+            hist[0][line[x + 0]]++;
+            hist[1][line[x + 1]]++;
+            hist[2][line[x + 2]]++;
+            hist[3][line[x + 3]]++;
         }
+        for (; x < scan_width; x++)
+            hist[0][line[x]]++;
     }
-    
+
+    uint64_t total_length = 0;
+    for (int b = 0; b < 256; b++)
+        total_length += (uint64_t)(hist[0][b] + hist[1][b] + hist[2][b] + hist[3][b]) * BRIGHTNESS2LENGTH((uint64_t)b);
+
     if (total_length > 0){
-        
-        for (unsigned long y = 0; y < scan_height; y++){
-            
-            for (unsigned long x = 0; x < scan_width; x++){
-                unsigned long sx = (y & 1) ? (scan_width - 1 - x) : x; //Avoid scan back after each line by changing scan direction
-                unsigned long brightness = src[in_stepwidth * (in_height - 1 - (y * in_height / scan_height)) + (sx * mpi->w * (mpi->fmt.bpp[0] / 8) / scan_width)];
-                if (sx == 0 || (sx == (scan_width-1))) brightness = 0xF0; //Ensure leftmost pixel is drawn, to force the beam to scan the entire line and don't start in the middle
-                unsigned long length = BRIGHTNESS2LENGTH(brightness) * max_length / total_length;
-                
-                //Temporal dithering 50%/50%
-                vector_t v[2] = {{{sx/2,y,0xFF}}, {{((sx & 1) == 0) || (sx == (scan_width -1)) ? sx/2 : sx/2+1,y,0xFF}}};
-                for (long i = 0; i < length; i++){
-                    if ((void*)dst > (void*)(out_image->planes[0] + (out_stepwidth * out_image->h))){
-                        printf("overflow im\n");
-                        break;
-                    }
-                    *dst = v[(((unsigned long)((uint8_t*)dst-out_image->planes[0]))/(sizeof(void*))) &1];
-                    dst++;
-                }
+        //Run length per brightness, instead of two divisions per sample
+        uint64_t max_length = out_image->w * out_image->h;
+        uint32_t length[256];
+        for (int b = 0; b < 256; b++)
+            length[b] = BRIGHTNESS2LENGTH((uint64_t)b) * max_length / total_length;
+
+        //Pass 2: one run of vectors per sample. The runs sum up to at most
+        //max_length, so only the (padded) buffer end needs to be checked per run.
+        for (unsigned int y = 0; y < scan_height && dst < end; y++){
+            const uint8_t* line = samples + y * scan_width;
+            uint8_t vy = y * 256 / scan_height;
+            for (unsigned int x = 0; x < scan_width; x++){
+                unsigned int sx = (y & 1) ? (scan_width - 1 - x) : x;
+                size_t n = MPMIN(length[line[x]], (size_t)(end - dst));
+                vector_t v0 = priv->patterns[sx * 2 + 0], v1 = priv->patterns[sx * 2 + 1];
+                v0.y = v1.y = vy;
+                dst = fill_run(dst, dst - start, n, v0, v1);
             }
         }
     }
         
     // Fill unused pixels
-    if ((void*)dst < (void*)(out_image->planes[0] + (out_stepwidth * out_image->h))){
-        memset((char*)dst, 0x0, (out_stepwidth * out_image->h) - ((char*)dst - (char*)out_image->planes[0]));
-    }
+    memset((char*)dst, 0x0, (char*)end - (char*)dst);
     
     out_image->pts = mpi->pts;
     
@@ -176,6 +256,8 @@ static struct mp_filter *vf_vectorraster_create(struct mp_filter *parent, void *
 static const m_option_t vf_opts_fields[] = {
     OPT_INTRANGE("width",  cfg_width,  0, 0, 4096, OPTDEF_INT(800)),
     OPT_INTRANGE("height", cfg_height, 0, 0, 4096, OPTDEF_INT(600)),
+    OPT_INTRANGE("scan_width",  cfg_scan_width,  0, 2, 512, OPTDEF_INT(512)),
+    OPT_INTRANGE("scan_height", cfg_scan_height, 0, 1, 256, OPTDEF_INT(256)),
     {0}
 };
 
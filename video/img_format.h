@@ -203,6 +203,10 @@ enum mp_imgfmt {
     IMGFMT_DRMPRIME,        // AVDRMFrameDescriptor
     IMGFMT_CUDA,            // CUDA Buffer
 
+    // Point list for vector displays, struct mp_point_list in plane 0 (see
+    // video/points.h). Not pixel data, so it is flagged as hwaccel format.
+    IMGFMT_POINTS,
+
     // Generic pass-through of AV_PIX_FMT_*. Used for formats which don't have
     // a corresponding IMGFMT_ value.
     IMGFMT_AVPIXFMT_START,
@@ -122,6 +122,8 @@ typedef struct mp_image {
     struct AVBufferRef *icc_profile;
     // Closed captions packet, if any (only after decoder)
     struct AVBufferRef *a53_cc;
+    // Changed tiles relative to an earlier frame, if any (see video/dirty.h)
+    struct AVBufferRef *dirty;
     // Other side data we don't care about.
     struct mp_ff_side_data *ff_side_data;
     int num_ff_side_data;
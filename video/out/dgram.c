@@ -0,0 +1,366 @@
+/*
+ * This file is part of mpv.
+ *
+ * mpv is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * mpv is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with mpv.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <errno.h>
+#include <limits.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+
+#include "config.h"
+
+#if defined(__linux__)
+#include <netinet/udp.h>
+#endif
+
+#include "mpv_talloc.h"
+#include "common/common.h"
+#include "common/msg.h"
+#include "osdep/timer.h"
+
+#include "dgram.h"
+
+#ifndef IOV_MAX
+#define IOV_MAX 1024
+#endif
+
+// Maximum number of datagrams per sendmmsg() call.
+#define MAX_BATCH 256
+// Kernel limits for a single GSO send.
+#define GSO_MAX_SEGMENTS 64
+#define GSO_MAX_BYTES 65000
+
+struct dgram_msg {
+    int iov_start, iov_count;
+    size_t bytes;
+    int addr;               // index into mp_dgram.addrs, or -1 for default
+};
+
+struct dgram_addr {
+    struct sockaddr_storage ss;
+    socklen_t len;
+};
+
+struct mp_dgram {
+    struct mp_log *log;
+    int fd;
+
+    struct dgram_addr dest;
+
+    struct iovec *iov;
+    int num_iov;
+    struct dgram_msg *msgs;
+    int num_msgs;
+    struct dgram_addr *addrs;
+    int num_addrs;
+    int64_t queued_bytes;
+
+    int64_t rate, burst;
+    double tokens;
+    int64_t last_refill;
+
+    bool gso;
+
+#if HAVE_SENDMMSG
+    struct mmsghdr hdrs[MAX_BATCH];
+#endif
+};
+
+struct mp_dgram *mp_dgram_create(void *ta_parent, struct mp_log *log, int fd)
+{
+    struct mp_dgram *d = talloc_zero(ta_parent, struct mp_dgram);
+    d->log = log;
+    d->fd = fd;
+    return d;
+}
+
+void mp_dgram_set_dest(struct mp_dgram *d, const void *addr, int addrlen)
+{
+    d->dest.len = 0;
+    if (addr && addrlen > 0 && addrlen <= sizeof(d->dest.ss)) {
+        memcpy(&d->dest.ss, addr, addrlen);
+        d->dest.len = addrlen;
+    }
+}
+
+void mp_dgram_set_rate(struct mp_dgram *d, int64_t rate, int64_t burst)
+{
+    d->rate = rate;
+    d->burst = MPMAX(burst, 1);
+    d->tokens = d->burst;
+    d->last_refill = mp_time_us();
+}
+
+void mp_dgram_set_gso(struct mp_dgram *d, bool enable)
+{
+#ifdef UDP_SEGMENT
+    d->gso = enable;
+#endif
+}
+
+void mp_dgram_add_to(struct mp_dgram *d, const struct iovec *iov, int iovcnt,
+                     const void *addr, int addrlen)
+{
+    struct dgram_msg msg = {.iov_start = d->num_iov, .addr = -1};
+
+    for (int n = 0; n < iovcnt; n++) {
+        if (!iov[n].iov_len)
+            continue;
+        // Coalesce entries that are adjacent in memory (e.g. image rows
+        // without padding), so large datagrams stay below IOV_MAX.
+        if (msg.iov_count) {
+            struct iovec *last = &d->iov[d->num_iov - 1];
+            if ((char *)last->iov_base + last->iov_len == iov[n].iov_base) {
+                last->iov_len += iov[n].iov_len;
+                msg.bytes += iov[n].iov_len;
+                continue;
+            }
+        }
+        MP_TARRAY_APPEND(d, d->iov, d->num_iov, iov[n]);
+        msg.iov_count++;
+        msg.bytes += iov[n].iov_len;
+    }
+
+    if (addr && addrlen > 0 && addrlen <= sizeof(struct sockaddr_storage)) {
+        struct dgram_addr a = {.len = addrlen};
+        memcpy(&a.ss, addr, addrlen);
+        msg.addr = d->num_addrs;
+        MP_TARRAY_APPEND(d, d->addrs, d->num_addrs, a);
+    }
+
+    MP_TARRAY_APPEND(d, d->msgs, d->num_msgs, msg);
+    d->queued_bytes += msg.bytes;
+}
+
+void mp_dgram_add(struct mp_dgram *d, const struct iovec *iov, int iovcnt)
+{
+    mp_dgram_add_to(d, iov, iovcnt, NULL, 0);
+}
+
+int64_t mp_dgram_queued_bytes(struct mp_dgram *d)
+{
+    return d->queued_bytes;
+}
+
+int mp_dgram_queued_count(struct mp_dgram *d)
+{
+    return d->num_msgs;
+}
+
+// Block until size bytes may be sent according to the token bucket.
+static void pace(struct mp_dgram *d, size_t size)
+{
+    if (d->rate <= 0)
+        return;
+
+    int64_t now = mp_time_us();
+    d->tokens = MPMIN(d->tokens + (now - d->last_refill) * d->rate / 1e6,
+                      (double)d->burst);
+    d->last_refill = now;
+
+    if (d->tokens < size) {
+        mp_sleep_us((size - d->tokens) * 1e6 / d->rate);
+        now = mp_time_us();
+        d->tokens += (now - d->last_refill) * d->rate / 1e6;
+        d->last_refill = now;
+    }
+    // May go negative if a single datagram is larger than the burst size;
+    // the debt is paid back before the next one.
+    d->tokens -= size;
+}
+
+static struct dgram_addr *msg_addr(struct mp_dgram *d, struct dgram_msg *msg)
+{
+    return msg->addr >= 0 ? &d->addrs[msg->addr] : &d->dest;
+}
+
+static void fill_msghdr(struct mp_dgram *d, struct msghdr *mh,
+                        struct dgram_msg *msg, int iov_count)
+{
+    struct dgram_addr *a = msg_addr(d, msg);
+    *mh = (struct msghdr){
+        .msg_name = a->len ? &a->ss : NULL,
+        .msg_namelen = a->len,
+        .msg_iov = &d->iov[msg->iov_start],
+        .msg_iovlen = iov_count,
+    };
+}
+
+// Number of datagrams starting at msgs[first] that can go out as one GSO
+// send: same destination, same size (except for the last one).
+static int gso_group(struct mp_dgram *d, int first)
+{
+    struct dgram_msg *m0 = &d->msgs[first];
+    size_t total = m0->bytes;
+    int iovs = m0->iov_count;
+    int n = 1;
+    while (first + n < d->num_msgs && n < GSO_MAX_SEGMENTS) {
+        struct dgram_msg *m = &d->msgs[first + n];
+        if (m->bytes > m0->bytes || total + m->bytes > GSO_MAX_BYTES ||
+            iovs + m->iov_count > IOV_MAX ||
+            (d->rate > 0 && total + m->bytes > d->burst))
+            break;
+        struct dgram_addr *a0 = msg_addr(d, m0), *a = msg_addr(d, m);
+        if (a0->len != a->len || memcmp(&a0->ss, &a->ss, a->len) != 0)
+            break;
+        total += m->bytes;
+        iovs += m->iov_count;
+        n++;
+        if (m->bytes < m0->bytes)
+            break; // a short segment can only be the last one
+    }
+    return n;
+}
+
+// Returns 1 on success, 0 if GSO is not usable (and was disabled), -1 on
+// other errors.
+static int send_gso(struct mp_dgram *d, int first, int n)
+{
+#ifdef UDP_SEGMENT
+    struct dgram_msg *m0 = &d->msgs[first];
+    int iovs = 0;
+    size_t total = 0;
+    for (int i = 0; i < n; i++) {
+        iovs += d->msgs[first + i].iov_count;
+        total += d->msgs[first + i].bytes;
+    }
+
+    struct msghdr mh;
+    fill_msghdr(d, &mh, m0, iovs);
+
+    char ctrl[CMSG_SPACE(sizeof(uint16_t))] = {0};
+    mh.msg_control = ctrl;
+    mh.msg_controllen = sizeof(ctrl);
+    struct cmsghdr *cm = CMSG_FIRSTHDR(&mh);
+    cm->cmsg_level = IPPROTO_UDP;
+    cm->cmsg_type = UDP_SEGMENT;
+    cm->cmsg_len = CMSG_LEN(sizeof(uint16_t));
+    uint16_t seg = m0->bytes;
+    memcpy(CMSG_DATA(cm), &seg, sizeof(seg));
+
+    pace(d, total);
+    while (sendmsg(d->fd, &mh, 0) < 0) {
+        if (errno == EINTR)
+            continue;
+        if (errno == EINVAL || errno == EIO || errno == ENOPROTOOPT ||
+            errno == EOPNOTSUPP || errno == EMSGSIZE)
+        {
+            MP_VERBOSE(d, "UDP GSO not usable (%s), disabling.\n",
+                       mp_strerror(errno));
+            d->gso = false;
+            // Give the tokens back; the datagrams are sent normally.
+            d->tokens += total;
+            return 0;
+        }
+        MP_DBG(d, "sendmsg: %s\n", mp_strerror(errno));
+        d->tokens += total;
+        return -1;
+    }
+    return 1;
+#else
+    return 0;
+#endif
+}
+
+// Send up to n datagrams starting at msgs[first]. Returns the number of
+// datagrams sent, or -1 if msgs[first] failed.
+static int send_batch(struct mp_dgram *d, int first, int n)
+{
+#if HAVE_SENDMMSG
+    n = MPMIN(n, MAX_BATCH);
+    for (int i = 0; i < n; i++) {
+        struct dgram_msg *msg = &d->msgs[first + i];
+        d->hdrs[i] = (struct mmsghdr){0};
+        fill_msghdr(d, &d->hdrs[i].msg_hdr, msg, msg->iov_count);
+    }
+    int r;
+    do {
+        r = sendmmsg(d->fd, d->hdrs, n, 0);
+    } while (r < 0 && errno == EINTR);
+    if (r <= 0) {
+        MP_DBG(d, "sendmmsg: %s\n", mp_strerror(errno));
+        return -1;
+    }
+    return r;
+#else
+    for (int i = 0; i < n; i++) {
+        struct dgram_msg *msg = &d->msgs[first + i];
+        struct msghdr mh;
+        fill_msghdr(d, &mh, msg, msg->iov_count);
+        ssize_t r;
+        do {
+            r = sendmsg(d->fd, &mh, 0);
+        } while (r < 0 && errno == EINTR);
+        if (r < 0) {
+            MP_DBG(d, "sendmsg: %s\n", mp_strerror(errno));
+            return i ? i : -1;
+        }
+    }
+    return n;
+#endif
+}
+
+int mp_dgram_flush(struct mp_dgram *d)
+{
+    int failed = 0;
+    int i = 0;
+
+    while (i < d->num_msgs) {
+        if (d->gso) {
+            int n = gso_group(d, i);
+            if (n > 1) {
+                int r = send_gso(d, i, n);
+                if (r != 0) {
+                    failed += r < 0 ? n : 0;
+                    i += n;
+                    continue;
+                }
+            }
+        }
+
+        // Without pacing, submit as many as possible per syscall. With
+        // pacing, keep each batch within the burst size.
+        int n = 1;
+        size_t bytes = d->msgs[i].bytes;
+        while (i + n < d->num_msgs && n < MAX_BATCH) {
+            size_t next = d->msgs[i + n].bytes;
+            if (d->rate > 0 && bytes + next > d->burst)
+                break;
+            bytes += next;
+            n++;
+        }
+
+        pace(d, bytes);
+        int sent = send_batch(d, i, n);
+        // Return the tokens of the datagrams that were not sent, so errors
+        // don't lower the rate for the following ones.
+        for (int k = MPMAX(sent, 0); k < n; k++)
+            d->tokens += d->msgs[i + k].bytes;
+        if (sent < 0) {
+            failed++;
+            i++;
+            continue;
+        }
+        i += sent;
+    }
+
+    d->num_iov = 0;
+    d->num_msgs = 0;
+    d->num_addrs = 0;
+    d->queued_bytes = 0;
+    return failed;
+}
@@ -0,0 +1,66 @@
+/*
+ * This file is part of mpv.
+ *
+ * mpv is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * mpv is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with mpv.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef MP_VO_DGRAM_H
+#define MP_VO_DGRAM_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <sys/uio.h>
+
+struct mp_log;
+
+// Batched datagram transmission for the UDP based VOs. Datagrams are queued
+// as iovec lists that point directly into caller memory (typically mp_image
+// planes), and submitted in as few syscalls as possible on flush.
+struct mp_dgram;
+
+// fd must be a UDP socket. If it is not connected, set a destination with
+// mp_dgram_set_dest().
+struct mp_dgram *mp_dgram_create(void *ta_parent, struct mp_log *log, int fd);
+
+// Default destination for datagrams queued without one (NULL for connected
+// sockets). The address is copied.
+void mp_dgram_set_dest(struct mp_dgram *d, const void *addr, int addrlen);
+
+// Token bucket pacing: sustain at most rate bytes/s, with bursts of at most
+// burst bytes. rate <= 0 disables pacing.
+void mp_dgram_set_rate(struct mp_dgram *d, int64_t rate, int64_t burst);
+
+// Allow UDP generic segmentation offload (Linux UDP_SEGMENT) for runs of
+// equally sized datagrams. It is disabled automatically if the kernel or the
+// route rejects it.
+void mp_dgram_set_gso(struct mp_dgram *d, bool enable);
+
+// Queue one datagram consisting of iov[0..iovcnt-1]. The iovec array is
+// copied, but the memory it points to must stay valid until mp_dgram_flush().
+void mp_dgram_add(struct mp_dgram *d, const struct iovec *iov, int iovcnt);
+
+// Like mp_dgram_add(), with a per-datagram destination (for unconnected
+// sockets). The address is copied.
+void mp_dgram_add_to(struct mp_dgram *d, const struct iovec *iov, int iovcnt,
+                     const void *addr, int addrlen);
+
+// Send all queued datagrams, blocking as needed for pacing. Returns the
+// number of datagrams that could not be sent.
+int mp_dgram_flush(struct mp_dgram *d);
+
+// Number of bytes/datagrams queued since the last flush.
+int64_t mp_dgram_queued_bytes(struct mp_dgram *d);
+int mp_dgram_queued_count(struct mp_dgram *d);
+
+#endif
@@ -0,0 +1,437 @@
+/*
+ * This file is part of mpv.
+ *
+ * mpv is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * mpv is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with mpv.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <errno.h>
+#include <netdb.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+
+#include "mpv_talloc.h"
+#include "common/common.h"
+#include "common/msg.h"
+#include "osdep/threads.h"
+#include "osdep/timer.h"
+
+#include "etherdream.h"
+#include "path.h"
+
+#define ED_RESPONSE_SIZE 22
+#define ED_POINT_SIZE 18
+#define ED_BUFFER_POINTS 1799   // capacity of the DAC's point buffer
+#define ED_MAX_BATCH 512        // points per data command
+#define ED_MIN_BATCH 64         // don't bother sending fewer points
+#define ED_START_POINTS 512     // buffered points before playback starts
+
+#define ED_RESP_ACK 'a'
+#define ED_RESP_FULL 'F'
+#define ED_RESP_INVALID 'I'
+#define ED_RESP_ESTOP '!'
+
+enum {
+    ED_LIGHT_READY,
+    ED_LIGHT_WARMUP,
+    ED_LIGHT_COOLDOWN,
+    ED_LIGHT_ESTOP,
+};
+
+enum {
+    ED_PLAYBACK_IDLE,
+    ED_PLAYBACK_PREPARED,
+    ED_PLAYBACK_PLAYING,
+};
+
+#define IO_TIMEOUT_US (1000 * 1000)
+#define BACKOFF_MIN_US (100 * 1000)
+#define BACKOFF_MAX_US (5 * 1000 * 1000)
+
+struct ed_status {
+    int light_engine;
+    int playback;
+    int fullness;               // points in the DAC buffer
+    int64_t time;               // when the status was received
+};
+
+struct laser_etherdream {
+    struct mp_log *log;
+    struct sockaddr_storage addr;
+    socklen_t addrlen;
+    int pps;
+
+    pthread_t thread;
+    bool thread_valid;
+    pthread_mutex_t lock;
+    pthread_cond_t wakeup;
+    bool quit;                  // under lock
+    struct laser_point *next;   // under lock
+    int num_next;
+    bool have_next;
+
+    // Streaming thread only.
+    int fd;
+    struct ed_status st;
+    int64_t backoff;
+    struct laser_point *cur;
+    int num_cur;
+    int pos;                    // next point of cur to send
+    uint8_t *buf;               // command buffer
+};
+
+static void put16le(uint8_t *d, unsigned v)
+{
+    d[0] = v;
+    d[1] = v >> 8;
+}
+
+static void put32le(uint8_t *d, uint32_t v)
+{
+    put16le(d, v & 0xFFFF);
+    put16le(d + 2, v >> 16);
+}
+
+static unsigned get16le(const uint8_t *d)
+{
+    return d[0] | (d[1] << 8);
+}
+
+// Wait for up to us microseconds, or until quit. Returns false on quit.
+static bool ed_wait(struct laser_etherdream *ed, int64_t us)
+{
+    struct timespec ts = mp_rel_time_to_timespec(us / 1e6);
+    pthread_mutex_lock(&ed->lock);
+    if (!ed->quit)
+        pthread_cond_timedwait(&ed->wakeup, &ed->lock, &ts);
+    bool quit = ed->quit;
+    pthread_mutex_unlock(&ed->lock);
+    return !quit;
+}
+
+static void ed_disconnect(struct laser_etherdream *ed, const char *what, int err)
+{
+    MP_WARN(ed, "%s: %s\n", what, err ? mp_strerror(err) : "protocol error");
+    if (ed->fd >= 0)
+        close(ed->fd);
+    ed->fd = -1;
+}
+
+static bool send_all(int fd, const uint8_t *buf, size_t len)
+{
+    while (len) {
+        ssize_t r = send(fd, buf, len, MSG_NOSIGNAL);
+        if (r < 0 && errno == EINTR)
+            continue;
+        if (r <= 0)
+            return false;
+        buf += r;
+        len -= r;
+    }
+    return true;
+}
+
+static bool recv_all(int fd, uint8_t *buf, size_t len)
+{
+    while (len) {
+        ssize_t r = recv(fd, buf, len, 0);
+        if (r < 0 && errno == EINTR)
+            continue;
+        if (r <= 0) {
+            if (!r)
+                errno = ECONNRESET;
+            return false;
+        }
+        buf += r;
+        len -= r;
+    }
+    return true;
+}
+
+// Read a response and update the status from it. Returns the response code,
+// or 0 on failure (the connection is closed then).
+static int read_response(struct laser_etherdream *ed, int cmd)
+{
+    uint8_t r[ED_RESPONSE_SIZE];
+    if (!recv_all(ed->fd, r, sizeof(r))) {
+        ed_disconnect(ed, "Receive failed", errno);
+        return 0;
+    }
+    if (r[1] != cmd) {
+        ed_disconnect(ed, "Unexpected response", 0);
+        return 0;
+    }
+    ed->st = (struct ed_status){
+        .light_engine = r[3],
+        .playback = r[4],
+        .fullness = get16le(r + 12),
+        .time = mp_time_us(),
+    };
+    return r[0];
+}
+
+// Send a command of len bytes from ed->buf and wait for the response.
+static int command(struct laser_etherdream *ed, size_t len)
+{
+    if (!send_all(ed->fd, ed->buf, len)) {
+        ed_disconnect(ed, "Send failed", errno);
+        return 0;
+    }
+    return read_response(ed, ed->buf[0]);
+}
+
+static int simple_command(struct laser_etherdream *ed, char cmd)
+{
+    ed->buf[0] = cmd;
+    return command(ed, 1);
+}
+
+static bool ed_connect(struct laser_etherdream *ed)
+{
+    ed->fd = socket(ed->addr.ss_family, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (ed->fd < 0) {
+        MP_ERR(ed, "Could not create socket: %s\n", mp_strerror(errno));
+        return false;
+    }
+    // Bounds connect() too, so a missing DAC doesn't block uninit for long.
+    struct timeval tv = {.tv_sec = IO_TIMEOUT_US / 1000000,
+                         .tv_usec = IO_TIMEOUT_US % 1000000};
+    setsockopt(ed->fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+    setsockopt(ed->fd, SOL_SOCKET, SO_SNDTIMEO, &tv, sizeof(tv));
+    int on = 1;
+    setsockopt(ed->fd, IPPROTO_TCP, TCP_NODELAY, &on, sizeof(on));
+
+    if (connect(ed->fd, (struct sockaddr *)&ed->addr, ed->addrlen) < 0) {
+        MP_VERBOSE(ed, "Could not connect: %s\n", mp_strerror(errno));
+        close(ed->fd);
+        ed->fd = -1;
+        return false;
+    }
+    // The DAC greets with its status.
+    if (!read_response(ed, '?'))
+        return false;
+    MP_VERBOSE(ed, "Connected.\n");
+    return true;
+}
+
+// Points in the DAC buffer now, assuming it played since the last status.
+static int estimate_fullness(struct laser_etherdream *ed)
+{
+    int fullness = ed->st.fullness;
+    if (ed->st.playback == ED_PLAYBACK_PLAYING)
+        fullness -= (mp_time_us() - ed->st.time) * ed->pps / 1000000;
+    return MPMAX(fullness, 0);
+}
+
+// Make cur the frame to continue with: the next one at the end of a pass.
+static void next_frame(struct laser_etherdream *ed)
+{
+    if (ed->pos < ed->num_cur)
+        return;
+    ed->pos = 0;
+    pthread_mutex_lock(&ed->lock);
+    if (ed->have_next) {
+        MPSWAP(struct laser_point *, ed->cur, ed->next);
+        MPSWAP(int, ed->num_cur, ed->num_next);
+        ed->have_next = false;
+    }
+    pthread_mutex_unlock(&ed->lock);
+}
+
+static int send_points(struct laser_etherdream *ed, int num)
+{
+    uint8_t *d = ed->buf;
+    d[0] = 'd';
+    put16le(d + 1, num);
+    d += 3;
+    for (int n = 0; n < num; n++) {
+        const struct laser_point *p = &ed->cur[ed->pos + n];
+        int i = MPMAX(p->r, MPMAX(p->g, p->b));
+        put16le(d + 0, 0);                  // control
+        put16le(d + 2, (uint16_t)p->x);
+        put16le(d + 4, (uint16_t)p->y);
+        put16le(d + 6, p->r * 257);
+        put16le(d + 8, p->g * 257);
+        put16le(d + 10, p->b * 257);
+        put16le(d + 12, i * 257);           // intensity
+        put16le(d + 14, 0);                 // user 1
+        put16le(d + 16, 0);                 // user 2
+        d += ED_POINT_SIZE;
+    }
+    return command(ed, d - ed->buf);
+}
+
+// One step of the streaming loop. Returns false if the connection was lost.
+static bool stream(struct laser_etherdream *ed)
+{
+    if (ed->st.light_engine == ED_LIGHT_ESTOP) {
+        MP_WARN(ed, "DAC is in emergency stop, trying to clear it.\n");
+        if (!simple_command(ed, 'c'))
+            return false;
+        if (ed->st.light_engine == ED_LIGHT_ESTOP)
+            ed_wait(ed, BACKOFF_MAX_US);
+        return true;
+    }
+
+    if (ed->st.playback == ED_PLAYBACK_IDLE) {
+        if (!simple_command(ed, 'p'))
+            return false;
+    }
+
+    next_frame(ed);
+    if (!ed->num_cur) {
+        ed_wait(ed, 100 * 1000);
+        return true;
+    }
+
+    int left = ed->num_cur - ed->pos;
+    int space = ED_BUFFER_POINTS - estimate_fullness(ed);
+    int num = MPMIN(MPMIN(left, space), ED_MAX_BATCH);
+    if (num < MPMIN(left, ED_MIN_BATCH)) {
+        // Wait until the DAC played enough for a useful batch.
+        int need = MPMIN(left, ED_MIN_BATCH) - MPMAX(space, 0);
+        ed_wait(ed, need * (int64_t)1000000 / ed->pps + 1000);
+        return simple_command(ed, '?');
+    }
+
+    int r = send_points(ed, num);
+    if (!r)
+        return false;
+    if (r == ED_RESP_ACK) {
+        ed->pos += num;
+    } else {
+        // Buffer overrun or state change (e.g. underflow stopped playback);
+        // the status is up to date now, so just retry.
+        MP_VERBOSE(ed, "Data not accepted (%c).\n", r);
+    }
+
+    if (ed->st.playback == ED_PLAYBACK_PREPARED &&
+        ed->st.fullness >= MPMIN(ED_START_POINTS, ed->num_cur))
+    {
+        uint8_t *d = ed->buf;
+        d[0] = 'b';
+        put16le(d + 1, 0);                  // low water mark, unused
+        put32le(d + 3, ed->pps);
+        r = command(ed, 7);
+        if (!r)
+            return false;
+        if (r != ED_RESP_ACK)
+            MP_VERBOSE(ed, "Playback not started (%c).\n", r);
+    }
+    return true;
+}
+
+static void *ed_thread(void *arg)
+{
+    struct laser_etherdream *ed = arg;
+    mpthread_set_name("etherdream");
+
+    while (1) {
+        pthread_mutex_lock(&ed->lock);
+        bool quit = ed->quit;
+        pthread_mutex_unlock(&ed->lock);
+        if (quit)
+            break;
+
+        if (ed->fd < 0) {
+            if (!ed_connect(ed)) {
+                ed_wait(ed, ed->backoff);
+                ed->backoff = MPMIN(ed->backoff * 2, BACKOFF_MAX_US);
+                continue;
+            }
+            ed->backoff = BACKOFF_MIN_US;
+        }
+
+        if (!stream(ed))
+            ed_wait(ed, ed->backoff);
+    }
+
+    if (ed->fd >= 0) {
+        simple_command(ed, 's');
+        if (ed->fd >= 0)
+            close(ed->fd);
+    }
+    return NULL;
+}
+
+static void destroy_ed(void *ptr)
+{
+    struct laser_etherdream *ed = ptr;
+    if (ed->thread_valid) {
+        pthread_mutex_lock(&ed->lock);
+        ed->quit = true;
+        pthread_cond_signal(&ed->wakeup);
+        pthread_mutex_unlock(&ed->lock);
+        pthread_join(ed->thread, NULL);
+    }
+    pthread_cond_destroy(&ed->wakeup);
+    pthread_mutex_destroy(&ed->lock);
+}
+
+struct laser_etherdream *laser_etherdream_create(void *ta_parent,
+                                                 struct mp_log *log,
+                                                 const char *host, int port,
+                                                 int pps)
+{
+    struct laser_etherdream *ed = talloc_zero(ta_parent, struct laser_etherdream);
+    ed->log = log;
+    ed->pps = MPMAX(pps, 1);
+    ed->fd = -1;
+    ed->backoff = BACKOFF_MIN_US;
+    ed->buf = talloc_size(ed, 3 + ED_MAX_BATCH * ED_POINT_SIZE);
+    pthread_mutex_init(&ed->lock, NULL);
+    pthread_cond_init(&ed->wakeup, NULL);
+    talloc_set_destructor(ed, destroy_ed);
+
+    char service[16];
+    snprintf(service, sizeof(service), "%d", port);
+    struct addrinfo hints = {
+        .ai_family = AF_UNSPEC,
+        .ai_socktype = SOCK_STREAM,
+    };
+    struct addrinfo *ai = NULL;
+    int r = getaddrinfo(host, service, &hints, &ai);
+    if (r || !ai) {
+        MP_ERR(ed, "Could not resolve %s: %s\n", host, gai_strerror(r));
+        goto error;
+    }
+    memcpy(&ed->addr, ai->ai_addr, MPMIN(ai->ai_addrlen, sizeof(ed->addr)));
+    ed->addrlen = ai->ai_addrlen;
+    freeaddrinfo(ai);
+
+    if (pthread_create(&ed->thread, NULL, ed_thread, ed))
+        goto error;
+    ed->thread_valid = true;
+    return ed;
+
+error:
+    talloc_free(ed);
+    return NULL;
+}
+
+void laser_etherdream_set_frame(struct laser_etherdream *ed,
+                                const struct laser_point *pts, int num)
+{
+    pthread_mutex_lock(&ed->lock);
+    MP_TARRAY_GROW(ed, ed->next, num);
+    memcpy(ed->next, pts, num * sizeof(pts[0]));
+    ed->num_next = num;
+    ed->have_next = true;
+    pthread_mutex_unlock(&ed->lock);
+}
@@ -0,0 +1,45 @@
+/*
+ * This file is part of mpv.
+ *
+ * mpv is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * mpv is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with mpv.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef MP_LASER_ETHERDREAM_H
+#define MP_LASER_ETHERDREAM_H
+
+struct mp_log;
+struct laser_point;
+
+/*
+ * Streaming to an Ether Dream DAC. The DAC plays points from its own buffer
+ * at a fixed rate, so a thread keeps that buffer filled by looping the
+ * current frame until the next one is set; frames are switched only at the
+ * end of a pass. Lost connections are re-established with backoff.
+ */
+struct laser_etherdream;
+
+#define LASER_ETHERDREAM_PORT 7765
+
+// Resolve host and start the streaming thread with pps points per second.
+// Returns NULL on failure. Free with talloc_free(), which stops the thread.
+struct laser_etherdream *laser_etherdream_create(void *ta_parent,
+                                                 struct mp_log *log,
+                                                 const char *host, int port,
+                                                 int pps);
+
+// Play pts (copied) after the current pass of the previous frame.
+void laser_etherdream_set_frame(struct laser_etherdream *ed,
+                                const struct laser_point *pts, int num);
+
+#endif
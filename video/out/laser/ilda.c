@@ -0,0 +1,69 @@
+/*
+ * This file is part of mpv.
+ *
+ * mpv is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * mpv is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with mpv.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <string.h>
+
+#include "ilda.h"
+#include "path.h"
+
+#define ILDA_FORMAT_2D_TRUE_COLOR 5
+#define ILDA_STATUS_LAST 0x80
+#define ILDA_STATUS_BLANK 0x40
+
+static void put16be(uint8_t *d, unsigned v)
+{
+    d[0] = v >> 8;
+    d[1] = v;
+}
+
+static void write_header(uint8_t *buf, int num, int frame_number)
+{
+    memset(buf, 0, LASER_ILDA_HEADER);
+    memcpy(buf, "ILDA", 4);
+    buf[7] = ILDA_FORMAT_2D_TRUE_COLOR;
+    memcpy(buf + 8, "mpv", 3);              // frame name
+    memcpy(buf + 16, "mpv", 3);             // company name
+    put16be(buf + 24, num);
+    put16be(buf + 26, frame_number);
+    put16be(buf + 28, 0);                   // total frames, unknown
+    buf[30] = 0;                            // projector
+}
+
+size_t laser_ilda_write_frame(uint8_t *buf, const struct laser_point *pts,
+                              int num, int frame_number)
+{
+    write_header(buf, num, frame_number);
+    uint8_t *d = buf + LASER_ILDA_HEADER;
+    for (int n = 0; n < num; n++) {
+        const struct laser_point *p = &pts[n];
+        put16be(d + 0, (uint16_t)p->x);
+        put16be(d + 2, (uint16_t)p->y);
+        d[4] = (p->blank ? ILDA_STATUS_BLANK : 0) |
+               (n == num - 1 ? ILDA_STATUS_LAST : 0);
+        d[5] = p->b;
+        d[6] = p->g;
+        d[7] = p->r;
+        d += LASER_ILDA_RECORD;
+    }
+    return d - buf;
+}
+
+size_t laser_ilda_write_end(uint8_t *buf, int frame_number)
+{
+    write_header(buf, 0, frame_number);
+    return LASER_ILDA_HEADER;
+}
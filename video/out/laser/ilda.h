@@ -0,0 +1,42 @@
+/*
+ * This file is part of mpv.
+ *
+ * mpv is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * mpv is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with mpv.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef MP_LASER_ILDA_H
+#define MP_LASER_ILDA_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+struct laser_point;
+
+// ILDA Image Data Transfer Format, format 5 (2D coordinates, true colour).
+// A file is a sequence of frames, terminated by a header without records.
+
+#define LASER_ILDA_HEADER 32
+#define LASER_ILDA_RECORD 8
+#define LASER_ILDA_MAX_POINTS 65535
+
+// Write a frame of num points (at most LASER_ILDA_MAX_POINTS) to buf, which
+// must have room for LASER_ILDA_HEADER + num * LASER_ILDA_RECORD bytes.
+// Returns the number of bytes written.
+size_t laser_ilda_write_frame(uint8_t *buf, const struct laser_point *pts,
+                              int num, int frame_number);
+
+// Write the end of file header (LASER_ILDA_HEADER bytes).
+size_t laser_ilda_write_end(uint8_t *buf, int frame_number);
+
+#endif
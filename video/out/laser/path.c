@@ -0,0 +1,211 @@
+/*
+ * This file is part of mpv.
+ *
+ * mpv is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * mpv is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with mpv.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <math.h>
+
+#include "common/common.h"
+#include "mpv_talloc.h"
+#include "video/points.h"
+
+#include "path.h"
+
+// Max. number of source points looked at to either side of a point for the
+// direction of the path there. Keeps pixel staircases from being corners.
+#define CORNER_WINDOW 32
+
+struct builder {
+    struct laser_path *lp;
+    void *ta_parent;
+    const struct laser_path_opts *opts;
+    const struct laser_transform *t;
+    const struct mp_point *src;
+    int num_src;
+
+    float x, y;                 // beam position
+    float travel;               // lit distance since the last output point
+    uint8_t r, g, b;            // colour of the current segment
+};
+
+static void emit(struct builder *b, float x, float y, bool blank)
+{
+    struct laser_path *lp = b->lp;
+    MP_TARRAY_APPEND(b->ta_parent, lp->points, lp->num_points,
+        (struct laser_point){
+            .x = MPCLAMP(lrintf(x), INT16_MIN, INT16_MAX),
+            .y = MPCLAMP(lrintf(y), INT16_MIN, INT16_MAX),
+            .r = blank ? 0 : b->r,
+            .g = blank ? 0 : b->g,
+            .b = blank ? 0 : b->b,
+            .blank = blank,
+        });
+}
+
+static void map_point(struct builder *b, int i, float *x, float *y)
+{
+    *x = b->src[i].x * b->t->sx + b->t->ox;
+    *y = b->src[i].y * b->t->sy + b->t->oy;
+}
+
+static bool is_blank(struct builder *b, int i)
+{
+    return i == 0 || (b->src[i].flags & MP_POINT_BLANK);
+}
+
+// Direction change of the lit path at source point i in degrees, or -1 at
+// the ends of a lit run. The directions are taken between points at least
+// half a step away, within the same lit run.
+static float turn_angle(struct builder *b, int i)
+{
+    const struct laser_path_opts *o = b->opts;
+    if (i < 1 || i + 1 >= b->num_src || is_blank(b, i) || is_blank(b, i + 1))
+        return -1;
+
+    float x, y;
+    map_point(b, i, &x, &y);
+    float min_dist = MPMAX(o->max_step / 2.0f, 1.0f);
+
+    float ix = 0, iy = 0;
+    for (int j = i - 1; j >= MPMAX(i - CORNER_WINDOW, 0); j--) {
+        map_point(b, j, &ix, &iy);
+        ix = x - ix;
+        iy = y - iy;
+        if (hypotf(ix, iy) >= min_dist || is_blank(b, j))
+            break;
+    }
+    float ox = 0, oy = 0;
+    for (int k = i + 1; k < MPMIN(i + 1 + CORNER_WINDOW, b->num_src); k++) {
+        if (is_blank(b, k))
+            break;
+        map_point(b, k, &ox, &oy);
+        ox -= x;
+        oy -= y;
+        if (hypotf(ox, oy) >= min_dist)
+            break;
+    }
+
+    float li = hypotf(ix, iy), lo = hypotf(ox, oy);
+    if (li <= 0 || lo <= 0)
+        return -1;
+    float c = MPCLAMP((ix * ox + iy * oy) / (li * lo), -1.0f, 1.0f);
+    return acosf(c) * (float)(180.0 / M_PI);
+}
+
+// Whether the path turns by more than corner_angle at point i. The windows of
+// the points next to a corner see it too, so only the sharpest one counts.
+static bool is_corner(struct builder *b, int i)
+{
+    if (b->opts->corner_dwell <= 0)
+        return false;
+    float a = turn_angle(b, i);
+    return a >= b->opts->corner_angle && a > turn_angle(b, i - 1) &&
+           a >= turn_angle(b, i + 1);
+}
+
+// Output the exact beam position, unless the last point already is there.
+static void flush_lit(struct builder *b)
+{
+    if (b->travel >= 0.5f)
+        emit(b, b->x, b->y, false);
+    b->travel = 0;
+}
+
+static void move_blank(struct builder *b, float x, float y)
+{
+    const struct laser_path_opts *o = b->opts;
+
+    for (int n = 0; n < o->blank_dwell; n++)
+        emit(b, b->x, b->y, true);
+
+    float len = hypotf(x - b->x, y - b->y);
+    int steps = ceilf(len / MPMAX(o->blank_step, 1));
+    for (int n = 1; n <= steps; n++) {
+        float f = n / (float)steps;
+        emit(b, b->x + (x - b->x) * f, b->y + (y - b->y) * f, true);
+    }
+
+    for (int n = 0; n < o->blank_dwell; n++)
+        emit(b, x, y, true);
+    // The beam must be switched on at the start of the contour, even if the
+    // next segment is shorter than a step.
+    if (!steps && !o->blank_dwell)
+        emit(b, x, y, true);
+
+    b->x = x;
+    b->y = y;
+    b->travel = 0;
+}
+
+// Output points spaced max_step apart along the line to (x, y), continuing
+// the spacing of the previous segment.
+static void move_lit(struct builder *b, float x, float y)
+{
+    float step = MPMAX(b->opts->max_step, 1);
+    float len = hypotf(x - b->x, y - b->y);
+    float d = step - b->travel;
+    for (; d <= len; d += step) {
+        float f = d / len;
+        emit(b, b->x + (x - b->x) * f, b->y + (y - b->y) * f, false);
+    }
+    b->travel = len - (d - step);
+    b->x = x;
+    b->y = y;
+}
+
+void laser_path_build(struct laser_path *lp, void *ta_parent,
+                      const struct laser_path_opts *opts,
+                      const struct laser_transform *t,
+                      const struct mp_point *src, int num_src)
+{
+    struct builder b = {
+        .lp = lp,
+        .ta_parent = ta_parent,
+        .opts = opts,
+        .t = t,
+        .src = src,
+        .num_src = num_src,
+        .x = lp->x,
+        .y = lp->y,
+    };
+    lp->num_points = 0;
+
+    for (int i = 0; i < num_src; i++) {
+        float x, y;
+        map_point(&b, i, &x, &y);
+        if (is_blank(&b, i)) {
+            flush_lit(&b);
+            move_blank(&b, x, y);
+        } else {
+            b.r = src[i].r;
+            b.g = src[i].g;
+            b.b = src[i].b;
+            move_lit(&b, x, y);
+            if (is_corner(&b, i)) {
+                flush_lit(&b);
+                for (int n = 0; n < opts->corner_dwell; n++)
+                    emit(&b, x, y, false);
+            }
+        }
+    }
+    flush_lit(&b);
+
+    // Keep the DAC busy with something harmless.
+    if (!lp->num_points)
+        emit(&b, b.x, b.y, true);
+
+    lp->x = MPCLAMP(lrintf(b.x), INT16_MIN, INT16_MAX);
+    lp->y = MPCLAMP(lrintf(b.y), INT16_MIN, INT16_MAX);
+}
@@ -0,0 +1,67 @@
+/*
+ * This file is part of mpv.
+ *
+ * mpv is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * mpv is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with mpv.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef MP_LASER_PATH_H
+#define MP_LASER_PATH_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+struct mp_point;
+
+// Turns the point lists of vf_vector into the point stream of a laser DAC.
+// The galvos can only travel a limited distance per output point, so long
+// lines are interpolated and dense pixel chains are resampled to an even
+// spacing. Sharp corners and blanked moves get extra points ("dwell"), so the
+// mirrors settle and the laser switches before the beam moves on.
+
+struct laser_point {
+    int16_t x, y;               // full deflection range, y pointing up
+    uint8_t r, g, b;
+    bool blank;
+};
+
+struct laser_path_opts {
+    int max_step;               // max. lit travel per point, DAC units
+    int blank_step;             // max. blanked travel per point
+    int corner_dwell;           // extra points at corners
+    double corner_angle;        // min. direction change of a corner, degrees
+    int blank_dwell;            // points held before and after blanked moves
+};
+
+// Mapping of the point list coordinates to DAC units: out = in * scale + offset.
+struct laser_transform {
+    float sx, sy;
+    float ox, oy;
+};
+
+struct laser_path {
+    struct laser_point *points;
+    int num_points;
+
+    // Beam position at the end of the last frame; the next frame starts with
+    // a blanked move from there.
+    int16_t x, y;
+};
+
+// Replace the contents of lp with the output points for the given list.
+void laser_path_build(struct laser_path *lp, void *ta_parent,
+                      const struct laser_path_opts *opts,
+                      const struct laser_transform *t,
+                      const struct mp_point *src, int num_src);
+
+#endif
@@ -0,0 +1,104 @@
+/*
+ * This file is part of mpv.
+ *
+ * mpv is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * mpv is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with mpv.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <math.h>
+
+#include "common/common.h"
+#include "mpv_talloc.h"
+#include "video/points.h"
+
+#include "path.h"
+#include "scope.h"
+
+static void put_sample(struct scope_render *s, float *out, float x, float y,
+                       float z)
+{
+    out[0] = x * s->opts.size;
+    out[1] = y * s->opts.size;
+    if (s->channels > 2)
+        out[2] = s->opts.z_invert ? 1.0f - z : z;
+}
+
+void scope_render_vectors(struct scope_render *s, const uint8_t *vectors,
+                          size_t num_vectors, float *out, int num)
+{
+    if (!num_vectors) {
+        for (int j = 0; j < num; j++)
+            put_sample(s, out + j * s->channels, s->x, s->y, 0);
+        return;
+    }
+
+    // Like the VGA DAC did: every vector holds its value for the same time.
+    for (int j = 0; j < num; j++) {
+        const uint8_t *v = vectors + (uint64_t)j * num_vectors / num * 4;
+        s->x = v[0] * (2.0f / 255) - 1;
+        s->y = v[1] * (2.0f / 255) - 1;
+        put_sample(s, out + j * s->channels, s->x, s->y, v[2] / 255.0f);
+    }
+}
+
+void scope_render_points(struct scope_render *s, void *ta_parent,
+                         const struct laser_transform *t,
+                         const struct mp_point *pts, int num_pts,
+                         float *out, int num)
+{
+    if (!num_pts) {
+        for (int j = 0; j < num; j++)
+            put_sample(s, out + j * s->channels, s->x, s->y, 0);
+        return;
+    }
+
+    // Time at the end of the segment leading to each point, from the last
+    // beam position through all points.
+    MP_TARRAY_GROW(ta_parent, s->cum, num_pts);
+    double total = 0;
+    float px = s->x, py = s->y;
+    for (int i = 0; i < num_pts; i++) {
+        float x = pts[i].x * t->sx + t->ox;
+        float y = pts[i].y * t->sy + t->oy;
+        bool blank = i == 0 || (pts[i].flags & MP_POINT_BLANK);
+        total += hypotf(x - px, y - py) * (blank ? s->opts.blank_time : 1.0f);
+        s->cum[i] = total;
+        px = x;
+        py = y;
+    }
+    bool uniform = total <= 0;
+
+    float x0 = s->x, y0 = s->y;
+    int i = 0;
+    for (int j = 0; j < num; j++) {
+        double pos = (j + 1.0) / num * (uniform ? num_pts : total);
+        while (i < num_pts - 1 && (uniform ? i + 1 : s->cum[i]) < pos) {
+            x0 = pts[i].x * t->sx + t->ox;
+            y0 = pts[i].y * t->sy + t->oy;
+            i++;
+        }
+        const struct mp_point *p = &pts[i];
+        float x1 = p->x * t->sx + t->ox;
+        float y1 = p->y * t->sy + t->oy;
+        double start = uniform ? i : (i ? s->cum[i - 1] : 0);
+        double len = (uniform ? i + 1 : s->cum[i]) - start;
+        float f = len > 0 ? MPCLAMP((pos - start) / len, 0, 1) : 1;
+        bool blank = i == 0 || (p->flags & MP_POINT_BLANK);
+        float z = blank ? 0 : MPMAX(p->r, MPMAX(p->g, p->b)) / 255.0f;
+        put_sample(s, out + j * s->channels, x0 + (x1 - x0) * f,
+                   y0 + (y1 - y0) * f, z);
+    }
+
+    s->x = pts[num_pts - 1].x * t->sx + t->ox;
+    s->y = pts[num_pts - 1].y * t->sy + t->oy;
+}
@@ -0,0 +1,61 @@
+/*
+ * This file is part of mpv.
+ *
+ * mpv is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * mpv is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with mpv.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef MP_LASER_SCOPE_H
+#define MP_LASER_SCOPE_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+struct mp_point;
+struct laser_transform;
+
+// Rendering of beam paths as audio samples for XY oscilloscopes: X and Y
+// deflection in the first two channels, optionally beam intensity (Z) in the
+// third. Output is interleaved float, within [-1, 1] for X/Y and [0, 1] for Z.
+
+struct scope_render_opts {
+    float size;             // X/Y scale, 1 = full range
+    float blank_time;       // time of blanked moves relative to lit ones
+    bool z_invert;          // Z is 1 for beam off, 0 for beam on
+};
+
+struct scope_render {
+    struct scope_render_opts opts;
+    int channels;           // 2 or 3
+
+    // Beam position at the end of the last rendered frame.
+    float x, y;
+
+    // Internal.
+    double *cum;            // cumulative segment time per point
+};
+
+// Render a vf_vector/vf_vectorraster frame: num_vectors vector_t entries
+// (x, y, z, padding bytes) shown for equal time, into num samples at out.
+void scope_render_vectors(struct scope_render *s, const uint8_t *vectors,
+                          size_t num_vectors, float *out, int num);
+
+// Render a point list (IMGFMT_POINTS) into num samples at out. The beam moves
+// at constant speed, and t maps the point coordinates to [-1, 1].
+void scope_render_points(struct scope_render *s, void *ta_parent,
+                         const struct laser_transform *t,
+                         const struct mp_point *pts, int num_pts,
+                         float *out, int num);
+
+#endif
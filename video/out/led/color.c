@@ -0,0 +1,85 @@
+/*
+ * This file is part of mpv.
+ *
+ * mpv is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * mpv is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with mpv.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <math.h>
+#include <string.h>
+
+#include "mpv_talloc.h"
+#include "common/common.h"
+
+#include "color.h"
+
+void led_color_init(struct led_color *c, void *ta_parent,
+                    const struct led_color_params *par, int num)
+{
+    c->identity = true;
+    for (int k = 0; k < 3; k++) {
+        double gain = MPCLAMP(par->gain[k], 0, 1);
+        double limit = MPCLAMP(par->limit[k], 0, 1);
+        for (int i = 0; i < 256; i++) {
+            double v = MPMIN(pow(i / 255.0, par->gamma) * gain, limit);
+            c->lut[k][i] = lrint(v * (255 << 8));
+            c->identity &= c->lut[k][i] == i << 8;
+        }
+    }
+    c->dither = par->dither;
+
+    if (num != c->num) {
+        talloc_free(c->residue);
+        talloc_free(c->tmp);
+        c->residue = talloc_array(ta_parent, uint8_t, num * 3);
+        c->tmp = talloc_array(ta_parent, uint16_t, num * 3);
+        c->num = num;
+    }
+    // Start half way, so that the first frame is rounded rather than
+    // truncated.
+    memset(c->residue, 128, num * 3);
+}
+
+void led_color_apply(struct led_color *c, uint8_t *rgb, int offset, int num)
+{
+    if (c->identity)
+        return;
+
+    assert(offset >= 0 && offset + num <= c->num);
+
+    // Table lookups first; what remains are plain 16 bit loops over the
+    // whole row, which the compiler turns into vector code.
+    uint16_t *restrict tmp = c->tmp;
+    for (int i = 0; i < num; i++) {
+        tmp[i * 3 + 0] = c->lut[0][rgb[i * 3 + 0]];
+        tmp[i * 3 + 1] = c->lut[1][rgb[i * 3 + 1]];
+        tmp[i * 3 + 2] = c->lut[2][rgb[i * 3 + 2]];
+    }
+
+    uint8_t *restrict dst = rgb;
+    int len = num * 3;
+    if (c->dither) {
+        // Temporal error diffusion: the fraction lost now is added to the
+        // same channel in the next frame. Cannot overflow: the LUT tops out
+        // at 255 << 8.
+        uint8_t *restrict res = c->residue + offset * 3;
+        for (int i = 0; i < len; i++) {
+            uint16_t v = tmp[i] + res[i];
+            dst[i] = v >> 8;
+            res[i] = v & 0xFF;
+        }
+    } else {
+        for (int i = 0; i < len; i++)
+            dst[i] = (tmp[i] + 128) >> 8;
+    }
+}
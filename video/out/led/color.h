@@ -0,0 +1,57 @@
+/*
+ * This file is part of mpv.
+ *
+ * mpv is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * mpv is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with mpv.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef MP_LED_COLOR_H
+#define MP_LED_COLOR_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+/*
+ * Colour correction for LED outputs: per channel gamma, white balance gain
+ * and output limit (e.g. to stay within the power budget), as 8 bit in to
+ * 8.8 fixed point out lookup tables. With dithering, the fractional part of
+ * every LED channel is carried over to the next frame, so dark fades get
+ * intermediate levels on average instead of banding.
+ */
+
+struct led_color_params {
+    float gamma;            // 1 = linear
+    float gain[3];          // white balance, 0-1 per R/G/B
+    float limit[3];         // maximum output, 0-1 per R/G/B
+    bool dither;
+};
+
+struct led_color {
+    uint16_t lut[3][256];   // 8.8 fixed point, at most 255 << 8
+    bool identity;          // lut is a no-op, so there is nothing to dither
+    bool dither;
+    uint8_t *residue;       // per LED channel, fraction carried to the next frame
+    uint16_t *tmp;
+    int num;
+};
+
+// (Re)initialize for num packed RGB pixels per frame. c must be
+// zero-initialized before the first call.
+void led_color_init(struct led_color *c, void *ta_parent,
+                    const struct led_color_params *par, int num);
+
+// Correct num * 3 bytes of packed RGB in place. The dithering state is kept
+// per position, so rows must always be passed at the same offset.
+void led_color_apply(struct led_color *c, uint8_t *rgb, int offset, int num);
+
+#endif
@@ -0,0 +1,306 @@
+/*
+ * This file is part of mpv.
+ *
+ * mpv is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * mpv is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with mpv.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <limits.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "mpv_talloc.h"
+#include "common/common.h"
+#include "common/msg.h"
+#include "options/path.h"
+#include "stream/stream.h"
+
+#include "map.h"
+
+#define MAX_FILE_SIZE (16 * 1024 * 1024)
+#define MAX_UNIVERSE 65535
+
+enum {
+    LAYOUT_ROWS,
+    LAYOUT_COLUMNS,
+};
+
+struct panel {
+    int x, y, w, h;
+    int universe, channel;
+    int layout;
+    bool serpentine;
+    int rotate;
+};
+
+static bool parse_int(bstr val, int min, int max, int *out)
+{
+    bstr rest;
+    long long v = bstrtoll(val, &rest, 10);
+    if (!val.len || rest.len || v < min || v > max)
+        return false;
+    *out = v;
+    return true;
+}
+
+static bool parse_panel(struct mp_log *log, bstr args, struct panel *pa,
+                        const char *loc)
+{
+    *pa = (struct panel){.w = -1, .h = -1};
+
+    while (1) {
+        bstr arg = bstr_split(args, WHITESPACE, &args);
+        if (!arg.len)
+            break;
+        bstr key, val;
+        if (!bstr_split_tok(arg, "=", &key, &val)) {
+            mp_err(log, "Expected key=value, got '%.*s' at %s\n", BSTR_P(arg),
+                   loc);
+            return false;
+        }
+        bool ok = true;
+        if (bstr_equals0(key, "x")) {
+            ok = parse_int(val, 0, UINT16_MAX, &pa->x);
+        } else if (bstr_equals0(key, "y")) {
+            ok = parse_int(val, 0, UINT16_MAX, &pa->y);
+        } else if (bstr_equals0(key, "w")) {
+            ok = parse_int(val, 1, UINT16_MAX, &pa->w);
+        } else if (bstr_equals0(key, "h")) {
+            ok = parse_int(val, 1, UINT16_MAX, &pa->h);
+        } else if (bstr_equals0(key, "universe")) {
+            ok = parse_int(val, 0, MAX_UNIVERSE, &pa->universe);
+        } else if (bstr_equals0(key, "channel")) {
+            ok = parse_int(val, 0, INT_MAX, &pa->channel);
+        } else if (bstr_equals0(key, "rotate")) {
+            ok = parse_int(val, 0, 270, &pa->rotate) && pa->rotate % 90 == 0;
+        } else if (bstr_equals0(key, "layout")) {
+            if (bstr_equals0(val, "rows")) {
+                pa->layout = LAYOUT_ROWS;
+            } else if (bstr_equals0(val, "columns")) {
+                pa->layout = LAYOUT_COLUMNS;
+            } else {
+                ok = false;
+            }
+        } else if (bstr_equals0(key, "wiring")) {
+            if (bstr_equals0(val, "zigzag")) {
+                pa->serpentine = false;
+            } else if (bstr_equals0(val, "serpentine")) {
+                pa->serpentine = true;
+            } else {
+                ok = false;
+            }
+        } else {
+            mp_err(log, "Unknown panel parameter '%.*s' at %s\n", BSTR_P(key),
+                   loc);
+            return false;
+        }
+        if (!ok) {
+            mp_err(log, "Invalid value for '%.*s' at %s\n", BSTR_P(key), loc);
+            return false;
+        }
+    }
+
+    if (pa->w < 0 || pa->h < 0) {
+        mp_err(log, "Panel without size at %s\n", loc);
+        return false;
+    }
+    if (pa->x + pa->w > UINT16_MAX || pa->y + pa->h > UINT16_MAX) {
+        mp_err(log, "Panel too large at %s\n", loc);
+        return false;
+    }
+    return true;
+}
+
+// Canvas position of LED k of the panel.
+static void panel_pos(struct panel *pa, int k, int *x, int *y)
+{
+    bool swap = pa->rotate == 90 || pa->rotate == 270;
+    int lw = swap ? pa->h : pa->w; // panel size before the rotation
+    int lh = swap ? pa->w : pa->h;
+
+    int line, pos, len;
+    if (pa->layout == LAYOUT_ROWS) {
+        len = lw;
+    } else {
+        len = lh;
+    }
+    line = k / len;
+    pos = k % len;
+    if (pa->serpentine && (line & 1))
+        pos = len - 1 - pos;
+    int lx = pa->layout == LAYOUT_ROWS ? pos : line;
+    int ly = pa->layout == LAYOUT_ROWS ? line : pos;
+
+    int cx, cy;
+    switch (pa->rotate) {
+    case 90:  cx = pa->w - 1 - ly; cy = lx;              break;
+    case 180: cx = pa->w - 1 - lx; cy = pa->h - 1 - ly;  break;
+    case 270: cx = ly;             cy = pa->h - 1 - lx;  break;
+    default:  cx = lx;             cy = ly;
+    }
+    *x = pa->x + cx;
+    *y = pa->y + cy;
+}
+
+static int compare_int(const void *a, const void *b)
+{
+    int ia = *(const int *)a, ib = *(const int *)b;
+    return ia < ib ? -1 : ia > ib;
+}
+
+static int find_packet(struct led_map *m, int universe)
+{
+    int lo = 0, hi = m->num_packets - 1;
+    while (lo <= hi) {
+        int mid = (lo + hi) / 2;
+        if (m->packets[mid].universe == universe)
+            return mid;
+        if (m->packets[mid].universe < universe) {
+            lo = mid + 1;
+        } else {
+            hi = mid - 1;
+        }
+    }
+    return -1;
+}
+
+static bool compile(struct led_map *m, struct mp_log *log, struct panel *panels,
+                    int num_panels)
+{
+    int *universes = NULL;
+    int num_universes = 0;
+
+    for (int n = 0; n < num_panels; n++) {
+        struct panel *pa = &panels[n];
+        m->w = MPMAX(m->w, pa->x + pa->w);
+        m->h = MPMAX(m->h, pa->y + pa->h);
+
+        int universe = pa->universe, channel = pa->channel;
+        for (int k = 0; k < pa->w * pa->h; k++) {
+            if (channel + 3 > m->channels) {
+                universe++;
+                channel = 0;
+            }
+            if (universe > MAX_UNIVERSE) {
+                mp_err(log, "Panel %d runs past the last universe.\n", n + 1);
+                talloc_free(universes);
+                return false;
+            }
+            struct led_map_entry e = {.packet = universe, .channel = channel};
+            int x, y;
+            panel_pos(pa, k, &x, &y);
+            e.x = x;
+            e.y = y;
+            MP_TARRAY_APPEND(m, m->leds, m->num_leds, e);
+            if (!num_universes || universes[num_universes - 1] != universe)
+                MP_TARRAY_APPEND(NULL, universes, num_universes, universe);
+            channel += 3;
+        }
+    }
+
+    qsort(universes, num_universes, sizeof(universes[0]), compare_int);
+    for (int n = 0; n < num_universes; n++) {
+        if (n && universes[n] == universes[n - 1])
+            continue;
+        struct led_map_packet p = {.universe = universes[n]};
+        MP_TARRAY_APPEND(m, m->packets, m->num_packets, p);
+    }
+    talloc_free(universes);
+
+    for (int n = 0; n < m->num_leds; n++) {
+        struct led_map_entry *e = &m->leds[n];
+        e->packet = find_packet(m, e->packet);
+        struct led_map_packet *p = &m->packets[e->packet];
+        p->length = MPMAX(p->length, e->channel + 3);
+    }
+    return true;
+}
+
+struct led_map *led_map_parse(void *ta_parent, struct mp_log *log, bstr data,
+                              const char *location, int max_channels)
+{
+    struct led_map *m = talloc_zero(ta_parent, struct led_map);
+    m->channels = MPMIN(510, max_channels);
+
+    struct panel *panels = NULL;
+    int num_panels = 0;
+    int line_no = 0;
+    bool ok = true;
+
+    while (data.len) {
+        line_no++;
+        char loc[80];
+        snprintf(loc, sizeof(loc), "%s:%d", location, line_no);
+
+        bstr line = bstr_strip_linebreaks(bstr_getline(data, &data));
+        bstr_split_tok(line, "#", &line, &(bstr){0});
+        line = bstr_strip(line);
+        if (!line.len)
+            continue;
+
+        bstr args;
+        bstr cmd = bstr_split(line, WHITESPACE, &args);
+        args = bstr_strip(args);
+        if (bstr_equals0(cmd, "channels")) {
+            if (!parse_int(args, 3, max_channels, &m->channels)) {
+                mp_err(log, "Channels must be between 3 and %d at %s\n",
+                       max_channels, loc);
+                ok = false;
+            }
+        } else if (bstr_equals0(cmd, "panel")) {
+            struct panel pa;
+            if (parse_panel(log, args, &pa, loc)) {
+                MP_TARRAY_APPEND(NULL, panels, num_panels, pa);
+            } else {
+                ok = false;
+            }
+        } else {
+            mp_err(log, "Unknown command '%.*s' at %s\n", BSTR_P(cmd), loc);
+            ok = false;
+        }
+    }
+
+    if (ok && !num_panels) {
+        mp_err(log, "No panels in %s\n", location);
+        ok = false;
+    }
+    if (ok)
+        ok = compile(m, log, panels, num_panels);
+
+    talloc_free(panels);
+    if (!ok) {
+        talloc_free(m);
+        return NULL;
+    }
+    mp_verbose(log, "LED map: %dx%d canvas, %d LEDs in %d universes.\n",
+               m->w, m->h, m->num_leds, m->num_packets);
+    return m;
+}
+
+struct led_map *led_map_load(void *ta_parent, struct mp_log *log,
+                             struct mpv_global *global, const char *path,
+                             int max_channels)
+{
+    void *tmp = talloc_new(NULL);
+    char *file = mp_get_user_path(tmp, global, path);
+    bstr data = stream_read_file(file, tmp, global, MAX_FILE_SIZE);
+    struct led_map *m = NULL;
+    if (data.start) {
+        m = led_map_parse(ta_parent, log, data, path, max_channels);
+    } else {
+        mp_err(log, "Can't read LED map '%s'.\n", path);
+    }
+    talloc_free(tmp);
+    return m;
+}
@@ -0,0 +1,81 @@
+/*
+ * This file is part of mpv.
+ *
+ * mpv is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * mpv is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with mpv.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef MP_LED_MAP_H
+#define MP_LED_MAP_H
+
+#include <stdint.h>
+
+#include "misc/bstr.h"
+
+struct mp_log;
+struct mpv_global;
+
+/*
+ * Pixel mapping of an LED installation: which canvas pixel drives which
+ * channels of which universe. The mapping file is line based, '#' starts a
+ * comment:
+ *
+ *   channels 510
+ *   panel x=0 y=0 w=17 h=10 universe=0 channel=0 layout=columns wiring=serpentine
+ *   panel x=17 y=0 w=17 h=10 universe=1 rotate=180
+ *
+ * "channels" sets the number of data channels used per universe (default
+ * 510, i.e. 170 RGB LEDs). Each "panel" maps the w x h canvas rectangle at
+ * x/y to a chain of LEDs starting at the given universe and channel (0-based);
+ * LEDs that do not fit into a universe continue at channel 0 of the next.
+ *
+ *   layout    rows (default) or columns: the direction the chain runs in
+ *   wiring    zigzag (default, every line starts at the same side) or
+ *             serpentine (every other line runs backwards)
+ *   rotate    0, 90, 180 or 270: clockwise rotation of the panel; the chain
+ *             is described in panel coordinates before the rotation
+ *
+ * The canvas is the bounding box of all panels.
+ */
+
+struct led_map_entry {
+    uint16_t x, y;          // canvas pixel
+    int packet;             // index into led_map.packets
+    int channel;            // first of the 3 channels within the universe
+};
+
+struct led_map_packet {
+    int universe;
+    int length;             // number of channels used
+};
+
+struct led_map {
+    int w, h;
+    int channels;
+    struct led_map_entry *leds;
+    int num_leds;
+    struct led_map_packet *packets;     // sorted by universe
+    int num_packets;
+};
+
+// Parse a mapping. location is used for error messages. Returns NULL on
+// errors. max_channels limits the channels setting.
+struct led_map *led_map_parse(void *ta_parent, struct mp_log *log, bstr data,
+                              const char *location, int max_channels);
+
+// Read and parse a mapping file.
+struct led_map *led_map_load(void *ta_parent, struct mp_log *log,
+                             struct mpv_global *global, const char *path,
+                             int max_channels);
+
+#endif
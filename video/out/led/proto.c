@@ -0,0 +1,215 @@
+/*
+ * This file is part of mpv.
+ *
+ * mpv is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * mpv is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with mpv.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <stdio.h>
+#include <string.h>
+
+#include <libavutil/random_seed.h>
+
+#include "common/common.h"
+
+#include "proto.h"
+
+#define ARTNET_HEADER 18
+#define ARTNET_SYNC 14
+#define ARTNET_OP_DMX 0x5000
+#define ARTNET_OP_SYNC 0x5200
+#define ARTNET_VERSION 14
+
+#define SACN_HEADER 126
+#define SACN_SYNC 49
+#define SACN_VECTOR_ROOT_DATA 0x00000004
+#define SACN_VECTOR_ROOT_EXTENDED 0x00000008
+#define SACN_VECTOR_FRAME_DATA 0x00000002
+#define SACN_VECTOR_FRAME_SYNC 0x00000001
+#define SACN_VECTOR_DMP_SET 0x02
+#define SACN_PRIORITY 100
+
+#define DDP_HEADER 10
+#define DDP_FLAGS_V1 0x40
+#define DDP_FLAGS_PUSH 0x01
+#define DDP_TYPE_RGB8 0x0B
+#define DDP_ID_DISPLAY 1
+
+static void put16be(uint8_t *d, unsigned v)
+{
+    d[0] = v >> 8;
+    d[1] = v;
+}
+
+static void put32be(uint8_t *d, uint32_t v)
+{
+    d[0] = v >> 24;
+    d[1] = v >> 16;
+    d[2] = v >> 8;
+    d[3] = v;
+}
+
+// Flags (0x7) and PDU length from the given offset to the packet end.
+static void put_pdu_len(uint8_t *d, int len)
+{
+    put16be(d, 0x7000 | len);
+}
+
+void led_proto_init(struct led_proto *p)
+{
+    p->seq = 0;
+    p->sync_seq = 0;
+    for (int n = 0; n < sizeof(p->cid); n += 4)
+        put32be(p->cid + n, av_get_random_seed());
+    // RFC 4122 version 4 UUID.
+    p->cid[6] = (p->cid[6] & 0x0F) | 0x40;
+    p->cid[8] = (p->cid[8] & 0x3F) | 0x80;
+}
+
+int led_proto_header_size(enum led_proto_type type)
+{
+    switch (type) {
+    case LED_PROTO_ARTNET: return ARTNET_HEADER;
+    case LED_PROTO_SACN:   return SACN_HEADER;
+    case LED_PROTO_DDP:    return DDP_HEADER;
+    }
+    return 0;
+}
+
+int led_proto_max_channels(enum led_proto_type type)
+{
+    // DDP has no universes; 1440 bytes is the usual payload size that fits
+    // into an Ethernet frame.
+    return type == LED_PROTO_DDP ? 1440 : 512;
+}
+
+int led_proto_max_universe(enum led_proto_type type)
+{
+    switch (type) {
+    case LED_PROTO_ARTNET: return 32767; // 15 bit port address
+    case LED_PROTO_SACN:   return 63999;
+    case LED_PROTO_DDP:    return 65535;
+    }
+    return 0;
+}
+
+int led_proto_default_port(enum led_proto_type type)
+{
+    switch (type) {
+    case LED_PROTO_ARTNET: return 6454;
+    case LED_PROTO_SACN:   return 5568;
+    case LED_PROTO_DDP:    return 4048;
+    }
+    return 0;
+}
+
+void led_proto_next_frame(struct led_proto *p)
+{
+    p->seq++;
+    if (p->type == LED_PROTO_ARTNET && !p->seq)
+        p->seq = 1; // 0 disables sequence checking
+    if (p->type == LED_PROTO_DDP && !(p->seq & 0xF))
+        p->seq++;   // 4 bits, 0 means "not used"
+}
+
+static void sacn_root(struct led_proto *p, uint8_t *d, int size,
+                      uint32_t vector)
+{
+    put16be(d + 0, 0x0010);                 // preamble size
+    put16be(d + 2, 0x0000);                 // postamble size
+    memcpy(d + 4, "ASC-E1.17\0\0\0", 12);   // ACN packet identifier
+    put_pdu_len(d + 16, size - 16);
+    put32be(d + 18, vector);
+    memcpy(d + 22, p->cid, 16);
+}
+
+int led_proto_write_header(struct led_proto *p, uint8_t *buf, int universe,
+                           int len, bool last)
+{
+    switch (p->type) {
+    case LED_PROTO_ARTNET: {
+        len = MPMAX(len + (len & 1), 2); // even, at least 2
+        memcpy(buf, "Art-Net\0", 8);
+        buf[8] = ARTNET_OP_DMX & 0xFF;      // opcode, little endian
+        buf[9] = ARTNET_OP_DMX >> 8;
+        put16be(buf + 10, ARTNET_VERSION);
+        buf[12] = p->seq;
+        buf[13] = 0;                        // physical
+        buf[14] = universe & 0xFF;          // SubUni
+        buf[15] = (universe >> 8) & 0x7F;   // Net
+        put16be(buf + 16, len);
+        return ARTNET_HEADER + len;
+    }
+    case LED_PROTO_SACN: {
+        int size = SACN_HEADER + len;
+        sacn_root(p, buf, size, SACN_VECTOR_ROOT_DATA);
+        // Framing layer
+        put_pdu_len(buf + 38, size - 38);
+        put32be(buf + 40, SACN_VECTOR_FRAME_DATA);
+        memset(buf + 44, 0, 64);
+        snprintf((char *)buf + 44, 64, "mpv");
+        buf[108] = SACN_PRIORITY;
+        put16be(buf + 109, p->sync ? p->sync_universe : 0);
+        buf[111] = p->seq;
+        buf[112] = 0;                       // options
+        put16be(buf + 113, universe);
+        // DMP layer
+        put_pdu_len(buf + 115, size - 115);
+        buf[117] = SACN_VECTOR_DMP_SET;
+        buf[118] = 0xA1;                    // address and data type
+        put16be(buf + 119, 0);              // first property address
+        put16be(buf + 121, 1);              // address increment
+        put16be(buf + 123, len + 1);        // property value count
+        buf[125] = 0;                       // DMX512 start code
+        return size;
+    }
+    case LED_PROTO_DDP: {
+        buf[0] = DDP_FLAGS_V1 | (last && p->sync ? DDP_FLAGS_PUSH : 0);
+        buf[1] = p->seq & 0xF;
+        buf[2] = DDP_TYPE_RGB8;
+        buf[3] = DDP_ID_DISPLAY;
+        put32be(buf + 4, (uint32_t)universe * p->channels);
+        put16be(buf + 8, len);
+        return DDP_HEADER + len;
+    }
+    }
+    return 0;
+}
+
+int led_proto_write_sync(struct led_proto *p, uint8_t *buf)
+{
+    if (!p->sync)
+        return 0;
+
+    switch (p->type) {
+    case LED_PROTO_ARTNET:
+        memcpy(buf, "Art-Net\0", 8);
+        buf[8] = ARTNET_OP_SYNC & 0xFF;
+        buf[9] = ARTNET_OP_SYNC >> 8;
+        put16be(buf + 10, ARTNET_VERSION);
+        buf[12] = 0;                        // Aux1
+        buf[13] = 0;                        // Aux2
+        return ARTNET_SYNC;
+    case LED_PROTO_SACN:
+        sacn_root(p, buf, SACN_SYNC, SACN_VECTOR_ROOT_EXTENDED);
+        put_pdu_len(buf + 38, SACN_SYNC - 38);
+        put32be(buf + 40, SACN_VECTOR_FRAME_SYNC);
+        buf[44] = p->sync_seq++;
+        put16be(buf + 45, p->sync_universe);
+        put16be(buf + 47, 0);               // reserved
+        return SACN_SYNC;
+    case LED_PROTO_DDP:
+        return 0; // push flag on the last data packet
+    }
+    return 0;
+}
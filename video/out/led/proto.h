@@ -0,0 +1,70 @@
+/*
+ * This file is part of mpv.
+ *
+ * mpv is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * mpv is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with mpv.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef MP_LED_PROTO_H
+#define MP_LED_PROTO_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+// Packet formats of the LED network protocols. The VO keeps one packet per
+// universe with the channel data right behind a header of
+// led_proto_header_size() bytes, and rewrites only the headers per frame.
+
+enum led_proto_type {
+    LED_PROTO_ARTNET,       // Art-Net 4 ArtDmx, ArtSync
+    LED_PROTO_SACN,         // ANSI E1.31 (streaming ACN), with E1.31 sync
+    LED_PROTO_DDP,          // Distributed Display Protocol, push flag
+};
+
+#define LED_PROTO_MAX_HEADER 126
+#define LED_PROTO_MAX_SYNC 49
+
+struct led_proto {
+    enum led_proto_type type;
+    bool sync;              // send sync packets / push flags
+    int sync_universe;      // E1.31 synchronization address
+    int channels;           // DDP: data offset of a universe is universe * channels
+    uint8_t seq;
+    uint8_t sync_seq;       // E1.31 sync packets count separately
+    uint8_t cid[16];        // E1.31 component identifier
+};
+
+// Initialize p (type, sync, sync_universe and channels must be set).
+void led_proto_init(struct led_proto *p);
+
+int led_proto_header_size(enum led_proto_type type);
+int led_proto_max_channels(enum led_proto_type type);
+int led_proto_max_universe(enum led_proto_type type);
+int led_proto_default_port(enum led_proto_type type);
+
+// Start a new frame (advances the sequence number).
+void led_proto_next_frame(struct led_proto *p);
+
+// Write the header of the data packet for universe, with len channels of
+// data following it, to buf. last marks the last packet of the frame.
+// Returns the size of the whole packet; the data may need padding up to it
+// (which must be zeroed by the caller).
+int led_proto_write_header(struct led_proto *p, uint8_t *buf, int universe,
+                           int len, bool last);
+
+// Write the sync packet that makes receivers show the frame (once per frame;
+// E1.31 sync packets have their own sequence number). Returns its size, or 0
+// if the protocol does not use one.
+int led_proto_write_sync(struct led_proto *p, uint8_t *buf);
+
+#endif
@@ -0,0 +1,332 @@
+/*
+ * This file is part of mpv.
+ *
+ * mpv is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * mpv is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with mpv.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <limits.h>
+#include <stddef.h>
+#include <stdlib.h>
+#include <pthread.h>
+
+#include "mpv_talloc.h"
+#include "common/common.h"
+#include "osdep/compiler.h"
+#include "video/dirty.h"
+#include "video/mp_image.h"
+
+#include "diff.h"
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#define DIFF_SSE2 1
+#endif
+
+#if (defined(__x86_64__) || defined(__i386__)) && defined(__GNUC__)
+#include <immintrin.h>
+#define DIFF_AVX2 1
+#endif
+
+#if defined(__aarch64__)
+#include <arm_neon.h>
+#endif
+
+// Largest number of pixels a SIMD kernel processes at once.
+#define BLOCK_MAX 32
+
+// Compares one block of pixels (3 bytes each). Stores the per-byte absolute
+// difference to ad, and returns false if no byte differs by more than lim,
+// i.e. no pixel in the block can exceed a threshold of 3 * lim.
+typedef bool (*block_fn)(const uint8_t *a, const uint8_t *b, uint8_t *ad,
+                         int lim);
+
+struct run_state {
+    struct pf_span *out;
+    int num;
+    int start;      // -1 if no span is open
+    int keyed;
+    int y;
+};
+
+static MP_ALWAYS_INLINE void run_close(struct run_state *s, int x)
+{
+    if (s->start >= 0) {
+        s->out[s->num++] = (struct pf_span){
+            .x = s->start,
+            .y = s->y,
+            .len = x - s->start,
+            .keyed = s->keyed,
+        };
+        s->start = -1;
+    }
+}
+
+// state: 0 = not sent, 1 = dirty, 2 = dirty and keyed
+static MP_ALWAYS_INLINE void run_pixel(struct run_state *s, int x, int state)
+{
+    if (!state) {
+        run_close(s, x);
+        return;
+    }
+    int keyed = state == 2;
+    if (s->start >= 0 && s->keyed != keyed)
+        run_close(s, x);
+    if (s->start < 0) {
+        s->start = x;
+        s->keyed = keyed;
+    }
+}
+
+static MP_ALWAYS_INLINE int classify(const struct pf_diff_params *par,
+                                     const uint8_t *px, int diff)
+{
+    if (diff <= par->threshold)
+        return 0;
+    if (par->colorkey >= 0) {
+        int key = par->colorkey;
+        int kd = abs((key & 0xFF) - px[0]) +
+                 abs(((key >> 8) & 0xFF) - px[1]) +
+                 abs(((key >> 16) & 0xFF) - px[2]);
+        if (kd <= par->key_threshold)
+            return par->key_emit ? 2 : 0;
+    }
+    return 1;
+}
+
+static MP_ALWAYS_INLINE int pixel_diff(const uint8_t *a, const uint8_t *b)
+{
+    return abs(a[0] - b[0]) + abs(a[1] - b[1]) + abs(a[2] - b[2]);
+}
+
+static int diff_row_full(const struct pf_diff_params *par, const uint8_t *cur,
+                         int w, int y, struct pf_span *out)
+{
+    if (par->colorkey < 0) {
+        if (!w)
+            return 0;
+        out[0] = (struct pf_span){.x = 0, .y = y, .len = w};
+        return 1;
+    }
+    struct run_state s = {.out = out, .start = -1, .y = y};
+    for (int x = 0; x < w; x++)
+        run_pixel(&s, x, classify(par, cur + x * 3, INT_MAX));
+    run_close(&s, w);
+    return s.num;
+}
+
+static MP_ALWAYS_INLINE int diff_row_template(const struct pf_diff_params *par,
+                                              const uint8_t *cur,
+                                              const uint8_t *prev, int w, int y,
+                                              struct pf_span *out,
+                                              block_fn fn, int block)
+{
+    struct run_state s = {.out = out, .start = -1, .y = y};
+    uint8_t ad[BLOCK_MAX * 3];
+    int lim = par->threshold / 3;
+    int x = 0;
+
+    if (fn) {
+        for (; x + block <= w; x += block) {
+            const uint8_t *c = cur + x * 3;
+            if (!fn(c, prev + x * 3, ad, lim)) {
+                run_close(&s, x);
+                continue;
+            }
+            for (int i = 0; i < block; i++) {
+                int d = ad[i * 3 + 0] + ad[i * 3 + 1] + ad[i * 3 + 2];
+                run_pixel(&s, x + i, classify(par, c + i * 3, d));
+            }
+        }
+    }
+    for (; x < w; x++) {
+        int d = pixel_diff(cur + x * 3, prev + x * 3);
+        run_pixel(&s, x, classify(par, cur + x * 3, d));
+    }
+    run_close(&s, w);
+    return s.num;
+}
+
+static int diff_row_c(const struct pf_diff_params *par, const uint8_t *cur,
+                      const uint8_t *prev, int w, int y, struct pf_span *out)
+{
+    return diff_row_template(par, cur, prev, w, y, out, NULL, 1);
+}
+
+#if DIFF_SSE2
+static MP_ALWAYS_INLINE bool block16_sse2(const uint8_t *a, const uint8_t *b,
+                                          uint8_t *ad, int lim)
+{
+    __m128i vlim = _mm_set1_epi8(lim);
+    __m128i any = _mm_setzero_si128();
+    __m128i d[3];
+    for (int n = 0; n < 3; n++) {
+        __m128i va = _mm_loadu_si128((const __m128i *)(a + n * 16));
+        __m128i vb = _mm_loadu_si128((const __m128i *)(b + n * 16));
+        d[n] = _mm_or_si128(_mm_subs_epu8(va, vb), _mm_subs_epu8(vb, va));
+        any = _mm_or_si128(any, _mm_subs_epu8(d[n], vlim));
+    }
+    if (_mm_movemask_epi8(_mm_cmpeq_epi8(any, _mm_setzero_si128())) == 0xFFFF)
+        return false;
+    for (int n = 0; n < 3; n++)
+        _mm_storeu_si128((__m128i *)(ad + n * 16), d[n]);
+    return true;
+}
+
+static int diff_row_sse2(const struct pf_diff_params *par, const uint8_t *cur,
+                         const uint8_t *prev, int w, int y, struct pf_span *out)
+{
+    return diff_row_template(par, cur, prev, w, y, out, block16_sse2, 16);
+}
+#endif
+
+#if DIFF_AVX2
+__attribute__((target("avx2")))
+static MP_ALWAYS_INLINE bool block32_avx2(const uint8_t *a, const uint8_t *b,
+                                          uint8_t *ad, int lim)
+{
+    __m256i vlim = _mm256_set1_epi8(lim);
+    __m256i any = _mm256_setzero_si256();
+    __m256i d[3];
+    for (int n = 0; n < 3; n++) {
+        __m256i va = _mm256_loadu_si256((const __m256i *)(a + n * 32));
+        __m256i vb = _mm256_loadu_si256((const __m256i *)(b + n * 32));
+        d[n] = _mm256_or_si256(_mm256_subs_epu8(va, vb),
+                               _mm256_subs_epu8(vb, va));
+        any = _mm256_or_si256(any, _mm256_subs_epu8(d[n], vlim));
+    }
+    if (_mm256_testz_si256(any, any))
+        return false;
+    for (int n = 0; n < 3; n++)
+        _mm256_storeu_si256((__m256i *)(ad + n * 32), d[n]);
+    return true;
+}
+
+__attribute__((target("avx2")))
+static int diff_row_avx2(const struct pf_diff_params *par, const uint8_t *cur,
+                         const uint8_t *prev, int w, int y, struct pf_span *out)
+{
+    return diff_row_template(par, cur, prev, w, y, out, block32_avx2, 32);
+}
+#endif
+
+#if defined(__aarch64__)
+static MP_ALWAYS_INLINE bool block16_neon(const uint8_t *a, const uint8_t *b,
+                                          uint8_t *ad, int lim)
+{
+    uint8x16x3_t va = vld1q_u8_x3(a);
+    uint8x16x3_t vb = vld1q_u8_x3(b);
+    uint8x16x3_t d;
+    d.val[0] = vabdq_u8(va.val[0], vb.val[0]);
+    d.val[1] = vabdq_u8(va.val[1], vb.val[1]);
+    d.val[2] = vabdq_u8(va.val[2], vb.val[2]);
+    uint8x16_t m = vmaxq_u8(vmaxq_u8(d.val[0], d.val[1]), d.val[2]);
+    if (vmaxvq_u8(m) <= lim)
+        return false;
+    vst1q_u8_x3(ad, d);
+    return true;
+}
+
+static int diff_row_neon(const struct pf_diff_params *par, const uint8_t *cur,
+                         const uint8_t *prev, int w, int y, struct pf_span *out)
+{
+    return diff_row_template(par, cur, prev, w, y, out, block16_neon, 16);
+}
+#endif
+
+typedef int (*row_fn)(const struct pf_diff_params *par, const uint8_t *cur,
+                      const uint8_t *prev, int w, int y, struct pf_span *out);
+
+static pthread_once_t kernel_init_once = PTHREAD_ONCE_INIT;
+static row_fn diff_row_kernel = diff_row_c;
+static const char *diff_row_kernel_name = "c";
+
+static void kernel_init(void)
+{
+#if DIFF_SSE2
+    diff_row_kernel = diff_row_sse2;
+    diff_row_kernel_name = "sse2";
+#endif
+#if DIFF_AVX2
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2")) {
+        diff_row_kernel = diff_row_avx2;
+        diff_row_kernel_name = "avx2";
+    }
+#endif
+#if defined(__aarch64__)
+    diff_row_kernel = diff_row_neon;
+    diff_row_kernel_name = "neon";
+#endif
+}
+
+const char *pf_diff_kernel_name(void)
+{
+    pthread_once(&kernel_init_once, kernel_init);
+    return diff_row_kernel_name;
+}
+
+int pf_diff_row(const struct pf_diff_params *par, const uint8_t *cur,
+                const uint8_t *prev, int w, int y, struct pf_span *out)
+{
+    if (par->full || !prev)
+        return diff_row_full(par, cur, w, y, out);
+    pthread_once(&kernel_init_once, kernel_init);
+    return diff_row_kernel(par, cur, prev, w, y, out);
+}
+
+int pf_diff_row_dirty(const struct pf_diff_params *par,
+                      const struct mp_dirty *dirty, const uint8_t *cur,
+                      const uint8_t *prev, int w, int y, struct pf_span *out)
+{
+    if (!dirty || !prev || par->full)
+        return pf_diff_row(par, cur, prev, w, y, out);
+
+    // Unchanged pixels are never dirty, and runs are separated by at least
+    // one unchanged tile, so the spans come out the same as for a full row.
+    const struct mp_dirty_run *runs;
+    int num_runs = mp_dirty_row_runs(dirty, y, &runs);
+    int num = 0;
+    for (int r = 0; r < num_runs; r++) {
+        int x0 = runs[r].x0;
+        int n = pf_diff_row(par, cur + x0 * 3, prev + x0 * 3,
+                            runs[r].x1 - x0, y, out + num);
+        for (int i = 0; i < n; i++)
+            out[num + i].x += x0;
+        num += n;
+    }
+    return num;
+}
+
+void pf_diff_image(const struct pf_diff_params *par, struct mp_image *cur,
+                   struct mp_image *prev, int y0, int y_step,
+                   struct pf_span_list *list)
+{
+    if (prev && (prev->w != cur->w || prev->h != cur->h ||
+                 prev->imgfmt != cur->imgfmt))
+        prev = NULL;
+    struct mp_dirty *dirty = mp_image_get_dirty(cur, prev);
+
+    for (int y = y0; y < cur->h; y += y_step) {
+        MP_TARRAY_GROW(list, list->spans, list->num_spans + cur->w);
+        struct pf_span *out = &list->spans[list->num_spans];
+        int n = pf_diff_row_dirty(par, dirty,
+                            cur->planes[0] + (ptrdiff_t)y * cur->stride[0],
+                            prev ? prev->planes[0] + (ptrdiff_t)y * prev->stride[0]
+                                 : NULL,
+                            cur->w, y, out);
+        for (int i = 0; i < n; i++)
+            list->num_pixels += out[i].len;
+        list->num_spans += n;
+    }
+}
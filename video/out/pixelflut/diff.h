@@ -0,0 +1,85 @@
+/*
+ * This file is part of mpv.
+ *
+ * mpv is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * mpv is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with mpv.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef MP_PIXELFLUT_DIFF_H
+#define MP_PIXELFLUT_DIFF_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+struct mp_dirty;
+struct mp_image;
+
+/*
+ * Changed-pixel extraction for the RGB24 network VOs. Compares the current
+ * frame against a reference (usually the previous frame) and returns runs of
+ * horizontally adjacent pixels that need to be (re)sent.
+ */
+
+struct pf_diff_params {
+    // A pixel is dirty if |dr| + |dg| + |db| > threshold.
+    int threshold;
+    // Colorkey as 0xBBGGRR (byte 0 of the pixel is compared to the low byte),
+    // or <0 to disable. A pixel whose distance to the colorkey is <=
+    // key_threshold is considered transparent.
+    int32_t colorkey;
+    int key_threshold;
+    // Report keyed dirty pixels as separate spans with pf_span.keyed set,
+    // instead of dropping them.
+    bool key_emit;
+    // Report all pixels as dirty, regardless of the reference.
+    bool full;
+};
+
+// A run of horizontally adjacent dirty pixels in row y.
+struct pf_span {
+    uint16_t x, y;
+    uint16_t len;
+    uint16_t keyed;
+};
+
+struct pf_span_list {
+    struct pf_span *spans;  // talloc'ed, child of the list
+    int num_spans;
+    int64_t num_pixels;     // sum of all span lengths
+};
+
+// Diff a single RGB24 row of w pixels. prev can be NULL, in which case all
+// pixels are dirty. out must have room for at least w spans.
+// Returns the number of spans written to out.
+int pf_diff_row(const struct pf_diff_params *par, const uint8_t *cur,
+                const uint8_t *prev, int w, int y, struct pf_span *out);
+
+// Like pf_diff_row(), but only compare the columns of row y which the map
+// dirty marks as changed (see mp_image_get_dirty()). The result is the same
+// as pf_diff_row()'s. dirty can be NULL.
+int pf_diff_row_dirty(const struct pf_diff_params *par,
+                      const struct mp_dirty *dirty, const uint8_t *cur,
+                      const uint8_t *prev, int w, int y, struct pf_span *out);
+
+// Diff rows y0, y0 + y_step, ... of cur against prev (IMGFMT_RGB24, or NULL),
+// and append the spans to list. If prev does not match cur's dimensions, all
+// pixels are dirty. Tiles which cur's dirty map marks as unchanged relative to
+// prev are skipped.
+void pf_diff_image(const struct pf_diff_params *par, struct mp_image *cur,
+                   struct mp_image *prev, int y0, int y_step,
+                   struct pf_span_list *list);
+
+// Return the name of the kernel in use ("avx2", "sse2", "neon", "c").
+const char *pf_diff_kernel_name(void);
+
+#endif
@@ -0,0 +1,152 @@
+/*
+ * This file is part of mpv.
+ *
+ * mpv is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * mpv is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with mpv.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <limits.h>
+#include <stdio.h>
+#include <string.h>
+#include <pthread.h>
+
+#include "mpv_talloc.h"
+#include "common/common.h"
+
+#include "format.h"
+
+static pthread_once_t hex_init_once = PTHREAD_ONCE_INIT;
+static char hex_tab[256][2];
+
+static void hex_init(void)
+{
+    static const char digits[] = "0123456789abcdef";
+    for (int n = 0; n < 256; n++) {
+        hex_tab[n][0] = digits[n >> 4];
+        hex_tab[n][1] = digits[n & 15];
+    }
+}
+
+// Whether the coordinates start..start+size-1 fit the protocol.
+static bool coords_valid(enum pf_protocol protocol, int64_t start, int size)
+{
+    int64_t end = start + MPMAX(size, 1) - 1;
+    if (protocol == PF_PROTO_BINARY)
+        return start >= 0 && end <= UINT16_MAX;
+    return start >= INT_MIN && end <= INT_MAX;
+}
+
+int pf_format_init(struct pf_format *f, void *ta_parent, int w, int h,
+                   const struct pf_format_opts *opts)
+{
+    pthread_once(&hex_init_once, hex_init);
+
+    int ox = opts->offset_cmd ? 0 : opts->offset_x;
+    int oy = opts->offset_cmd ? 0 : opts->offset_y;
+
+    if (!coords_valid(opts->protocol, (int64_t)ox, w) ||
+        !coords_valid(opts->protocol, (int64_t)oy, h))
+        return -1;
+
+    f->opts = *opts;
+    f->w = w;
+    f->h = h;
+
+    f->col = talloc_realloc(ta_parent, f->col, char,
+                            MPMAX(w, 1) * PF_FORMAT_SLOT);
+    f->col_len = talloc_realloc(ta_parent, f->col_len, uint8_t, MPMAX(w, 1));
+    for (int x = 0; x < w; x++) {
+        char *slot = &f->col[x * PF_FORMAT_SLOT];
+        memset(slot, 0, PF_FORMAT_SLOT);
+        f->col_len[x] = snprintf(slot, PF_FORMAT_SLOT, "PX %d ", x + ox);
+    }
+
+    f->row = talloc_realloc(ta_parent, f->row, char,
+                            MPMAX(h, 1) * PF_FORMAT_SLOT);
+    f->row_len = talloc_realloc(ta_parent, f->row_len, uint8_t, MPMAX(h, 1));
+    for (int y = 0; y < h; y++) {
+        char *slot = &f->row[y * PF_FORMAT_SLOT];
+        memset(slot, 0, PF_FORMAT_SLOT);
+        f->row_len[y] = snprintf(slot, PF_FORMAT_SLOT, "%d ", y + oy);
+    }
+    return 0;
+}
+
+size_t pf_format_header(struct pf_format *f, char *dst)
+{
+    if (!f->opts.offset_cmd)
+        return 0;
+    int len = snprintf(dst, PF_FORMAT_MAX_CMD, "OFFSET %d %d\n",
+                       f->opts.offset_x, f->opts.offset_y);
+    return MPMIN(len, PF_FORMAT_MAX_CMD - 1);
+}
+
+static size_t format_run_text(struct pf_format *f, char *dst, const uint8_t *px,
+                              int x, int y, int n)
+{
+    char *d = dst;
+    const char *row = &f->row[y * PF_FORMAT_SLOT];
+    size_t row_len = f->row_len[y];
+    bool grayscale = f->opts.grayscale;
+
+    for (int i = 0; i < n; i++) {
+        const uint8_t *c = px + i * 3;
+        memcpy(d, &f->col[(x + i) * PF_FORMAT_SLOT], PF_FORMAT_SLOT);
+        d += f->col_len[x + i];
+        memcpy(d, row, PF_FORMAT_SLOT);
+        d += row_len;
+        memcpy(d + 0, hex_tab[c[0]], 2);
+        memcpy(d + 2, hex_tab[c[1]], 2);
+        memcpy(d + 4, hex_tab[c[2]], 2);
+        d[6] = '\n';
+        // "gg\n" is a prefix of "gggggg\n" with the newline moved up.
+        bool gray = grayscale & (c[0] == c[1]) & (c[1] == c[2]);
+        d[2] = gray ? '\n' : d[2];
+        d += gray ? 3 : 7;
+    }
+    return d - dst;
+}
+
+static size_t format_run_binary(struct pf_format *f, char *dst,
+                                const uint8_t *px, int x, int y, int n)
+{
+    uint8_t *d = (uint8_t *)dst;
+    unsigned int ox = f->opts.offset_cmd ? 0 : f->opts.offset_x;
+    unsigned int oy = f->opts.offset_cmd ? 0 : f->opts.offset_y;
+    unsigned int cy = y + oy;
+
+    for (int i = 0; i < n; i++) {
+        const uint8_t *c = px + i * 3;
+        unsigned int cx = x + i + ox;
+        d[0] = 'P';
+        d[1] = 'B';
+        d[2] = cx & 0xFF;
+        d[3] = cx >> 8;
+        d[4] = cy & 0xFF;
+        d[5] = cy >> 8;
+        d[6] = c[0];
+        d[7] = c[1];
+        d[8] = c[2];
+        d[9] = 0xFF;
+        d += 10;
+    }
+    return (char *)d - dst;
+}
+
+size_t pf_format_run(struct pf_format *f, char *dst, const uint8_t *px,
+                     int x, int y, int n)
+{
+    if (f->opts.protocol == PF_PROTO_BINARY)
+        return format_run_binary(f, dst, px, x, y, n);
+    return format_run_text(f, dst, px, x, y, n);
+}
@@ -0,0 +1,82 @@
+/*
+ * This file is part of mpv.
+ *
+ * mpv is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * mpv is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with mpv.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef MP_PIXELFLUT_FORMAT_H
+#define MP_PIXELFLUT_FORMAT_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+enum pf_protocol {
+    PF_PROTO_TEXT,      // "PX x y rrggbb\n"
+    PF_PROTO_BINARY,    // "PB" x:u16le y:u16le r g b a
+};
+
+// Upper bound for the size of one formatted command. Formatting writes whole
+// table entries, so output buffers need this much room per pixel, even if
+// the command that ends up in the buffer is shorter.
+#define PF_FORMAT_MAX_CMD 40
+
+struct pf_format_opts {
+    enum pf_protocol protocol;
+    int offset_x, offset_y;
+    // Send the offset once with "OFFSET x y" (see pf_format_header()) and
+    // use canvas-relative coordinates in each command.
+    bool offset_cmd;
+    // Use "PX x y gg" for gray pixels (text protocol only).
+    bool grayscale;
+};
+
+/*
+ * Command formatter. Coordinate prefixes for every column and row are built
+ * once by pf_format_init(), so formatting a pixel is a few fixed-size copies
+ * and a hex table lookup.
+ */
+// Large enough for the prefixes of any int coordinate.
+#define PF_FORMAT_SLOT 16
+
+struct pf_format {
+    struct pf_format_opts opts;
+    int w, h;
+
+    // Text: "PX <x> " per column, "<y> " per row, each in PF_FORMAT_SLOT byte
+    // slots. Only the first *_len[] bytes of each slot are meaningful.
+    char *col;
+    uint8_t *col_len;
+    char *row;
+    uint8_t *row_len;
+};
+
+// (Re)build the tables for a w x h image. f must be zero-initialized before
+// the first call; the tables are allocated as children of ta_parent. Returns
+// -1 (and leaves f unchanged) if the coordinates can't be represented by the
+// protocol, 0 on success.
+int pf_format_init(struct pf_format *f, void *ta_parent, int w, int h,
+                    const struct pf_format_opts *opts);
+
+// Write the connection preamble (e.g. "OFFSET x y\n") to dst, which must have
+// room for PF_FORMAT_MAX_CMD bytes. Returns the number of bytes written.
+size_t pf_format_header(struct pf_format *f, char *dst);
+
+// Format n RGB24 pixels px[0..n-1], located at columns x..x+n-1 of row y.
+// dst must have room for n * PF_FORMAT_MAX_CMD bytes. Returns the number of
+// bytes written.
+size_t pf_format_run(struct pf_format *f, char *dst, const uint8_t *px,
+                     int x, int y, int n);
+
+#endif
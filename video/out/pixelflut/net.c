@@ -0,0 +1,470 @@
+/*
+ * This file is part of mpv.
+ *
+ * mpv is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * mpv is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with mpv.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <errno.h>
+#include <limits.h>
+#include <netdb.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/ioctl.h>
+#include <sys/socket.h>
+#include <linux/sockios.h>
+
+#include "mpv_talloc.h"
+#include "common/common.h"
+#include "common/msg.h"
+#include "osdep/atomic.h"
+#include "osdep/threads.h"
+#include "osdep/timer.h"
+
+#include "net.h"
+
+#define BACKOFF_MIN_US (100 * 1000)
+#define BACKOFF_MAX_US (5 * 1000 * 1000)
+// Drop a connection if connecting or sending makes no progress for this long.
+#define SEND_TIMEOUT_US (5 * 1000 * 1000)
+// Refills per connection and loop iteration, so a single fast connection
+// can't starve the others.
+#define MAX_FILLS 16
+// Interval for sampling the socket queues for pf_net_get_stats().
+#define STATS_INTERVAL_US (20 * 1000)
+
+#define WAKEUP_ID UINT32_MAX
+
+enum conn_state {
+    CONN_DISCONNECTED,
+    CONN_CONNECTING,
+    CONN_CONNECTED,
+};
+
+struct net_conn {
+    int fd;
+    enum conn_state state;
+    uint32_t events;            // currently registered epoll events
+    bool idle;                  // fill returned false, wait for wakeup
+
+    int64_t retry_at;           // reconnect time if disconnected
+    int64_t backoff;
+    int64_t last_progress;      // connect start or last successful send
+    int64_t timer;              // call fill at this time if idle, or 0
+
+    char *buf;                  // send queue: buf[off..len-1] is pending
+    size_t len, off;
+};
+
+struct pf_net {
+    struct mp_log *log;
+    struct pf_net_callbacks cb;
+
+    struct sockaddr_storage addr;
+    socklen_t addrlen;
+
+    struct net_conn *conns;
+    int num_conns;
+    atomic_int num_connected;
+
+    int epfd, wakeup_fd;
+    pthread_t thread;
+    bool thread_valid;
+    atomic_bool quit;
+
+    mp_atomic_int64 bytes_sent;
+    mp_atomic_int64 queued;     // sampled every STATS_INTERVAL_US
+    int64_t stats_time;
+};
+
+static void set_events(struct pf_net *n, int id, uint32_t events)
+{
+    struct net_conn *c = &n->conns[id];
+    if (c->events == events)
+        return;
+    struct epoll_event ev = {.events = events, .data.u32 = id};
+    if (epoll_ctl(n->epfd, EPOLL_CTL_MOD, c->fd, &ev) < 0)
+        MP_ERR(n, "epoll_ctl: %s\n", mp_strerror(errno));
+    c->events = events;
+}
+
+static void conn_fail(struct pf_net *n, int id, const char *what, int err)
+{
+    struct net_conn *c = &n->conns[id];
+    bool was_connected = c->state == CONN_CONNECTED;
+
+    if (was_connected) {
+        MP_WARN(n, "Connection %d: %s: %s\n", id, what, mp_strerror(err));
+    } else {
+        MP_VERBOSE(n, "Connection %d: %s: %s\n", id, what, mp_strerror(err));
+    }
+
+    if (c->fd >= 0)
+        close(c->fd); // also removes it from the epoll set
+    c->fd = -1;
+    c->state = CONN_DISCONNECTED;
+    c->events = 0;
+    c->timer = 0;
+    c->len = c->off = 0;
+
+    int64_t now = mp_time_us();
+    c->retry_at = now + c->backoff;
+    c->backoff = MPMIN(c->backoff * 2, BACKOFF_MAX_US);
+
+    if (was_connected) {
+        atomic_fetch_add(&n->num_connected, -1);
+        n->cb.state(n->cb.ctx, n, id, false);
+    }
+}
+
+// Write out the send queue and refill it until the socket would block.
+static void conn_pump(struct pf_net *n, int id)
+{
+    struct net_conn *c = &n->conns[id];
+    int fills = 0;
+
+    while (c->state == CONN_CONNECTED) {
+        if (c->off < c->len) {
+            ssize_t r = send(c->fd, c->buf + c->off, c->len - c->off,
+                             MSG_NOSIGNAL);
+            if (r < 0) {
+                if (errno == EINTR)
+                    continue;
+                if (errno == EAGAIN || errno == EWOULDBLOCK) {
+                    set_events(n, id, EPOLLIN | EPOLLOUT);
+                    return;
+                }
+                conn_fail(n, id, "send", errno);
+                return;
+            }
+            c->off += r;
+            c->last_progress = mp_time_us();
+            atomic_fetch_add(&n->bytes_sent, r);
+            continue;
+        }
+
+        c->len = c->off = 0;
+        if (fills++ >= MAX_FILLS) {
+            // Come back on the next iteration (the socket is writable).
+            set_events(n, id, EPOLLIN | EPOLLOUT);
+            return;
+        }
+        c->idle = false;
+        if (!n->cb.fill(n->cb.ctx, n, id)) {
+            c->idle = true;
+            set_events(n, id, EPOLLIN);
+            return;
+        }
+    }
+}
+
+static void conn_established(struct pf_net *n, int id)
+{
+    struct net_conn *c = &n->conns[id];
+    MP_VERBOSE(n, "Connection %d: connected\n", id);
+    c->state = CONN_CONNECTED;
+    c->backoff = BACKOFF_MIN_US;
+    c->last_progress = mp_time_us();
+    c->len = c->off = 0;
+    atomic_fetch_add(&n->num_connected, 1);
+    n->cb.state(n->cb.ctx, n, id, true);
+    conn_pump(n, id);
+}
+
+static void conn_start(struct pf_net *n, int id)
+{
+    struct net_conn *c = &n->conns[id];
+    c->fd = socket(n->addr.ss_family, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC,
+                   0);
+    if (c->fd < 0) {
+        conn_fail(n, id, "socket", errno);
+        return;
+    }
+
+    c->last_progress = mp_time_us();
+    c->events = EPOLLOUT;
+    struct epoll_event ev = {.events = c->events, .data.u32 = id};
+    if (epoll_ctl(n->epfd, EPOLL_CTL_ADD, c->fd, &ev) < 0) {
+        conn_fail(n, id, "epoll_ctl", errno);
+        return;
+    }
+
+    if (connect(c->fd, (struct sockaddr *)&n->addr, n->addrlen) == 0) {
+        conn_established(n, id);
+    } else if (errno == EINPROGRESS) {
+        c->state = CONN_CONNECTING;
+    } else {
+        conn_fail(n, id, "connect", errno);
+    }
+}
+
+static void conn_event(struct pf_net *n, int id, uint32_t events)
+{
+    struct net_conn *c = &n->conns[id];
+
+    if (c->state == CONN_CONNECTING) {
+        int err = 0;
+        socklen_t len = sizeof(err);
+        if (getsockopt(c->fd, SOL_SOCKET, SO_ERROR, &err, &len) < 0)
+            err = errno;
+        if (err) {
+            conn_fail(n, id, "connect", err);
+        } else {
+            conn_established(n, id);
+        }
+        return;
+    }
+
+    if (c->state != CONN_CONNECTED)
+        return;
+
+    if (events & (EPOLLIN | EPOLLHUP | EPOLLERR)) {
+        char tmp[16384];
+        ssize_t r = recv(c->fd, tmp, sizeof(tmp), MSG_DONTWAIT);
+        if (r == 0) {
+            conn_fail(n, id, "recv", ECONNRESET);
+            return;
+        }
+        if (r < 0 && errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR) {
+            conn_fail(n, id, "recv", errno);
+            return;
+        }
+        if (r > 0 && n->cb.recv) {
+            n->cb.recv(n->cb.ctx, n, id, tmp, r);
+            if (c->state != CONN_CONNECTED)
+                return;
+        }
+    }
+
+    if (events & EPOLLOUT)
+        conn_pump(n, id);
+}
+
+// Sum up the data that was queued but not acknowledged by the server yet:
+// the send queues, plus what the kernel holds (SIOCOUTQ).
+static void update_stats(struct pf_net *n, int64_t now)
+{
+    if (now - n->stats_time < STATS_INTERVAL_US)
+        return;
+    n->stats_time = now;
+
+    int64_t queued = 0;
+    for (int i = 0; i < n->num_conns; i++) {
+        struct net_conn *c = &n->conns[i];
+        if (c->state != CONN_CONNECTED)
+            continue;
+        queued += c->len - c->off;
+        int outq = 0;
+        if (ioctl(c->fd, SIOCOUTQ, &outq) == 0)
+            queued += outq;
+    }
+    atomic_store(&n->queued, queued);
+}
+
+static void *net_thread(void *arg)
+{
+    struct pf_net *n = arg;
+    mpthread_set_name("pixelflut/net");
+
+    struct epoll_event events[64];
+
+    while (!atomic_load(&n->quit)) {
+        int64_t now = mp_time_us();
+        int64_t deadline = INT64_MAX;
+        for (int i = 0; i < n->num_conns; i++) {
+            struct net_conn *c = &n->conns[i];
+            if (c->state == CONN_DISCONNECTED) {
+                if (c->retry_at <= now) {
+                    conn_start(n, i);
+                    if (c->state == CONN_DISCONNECTED)
+                        deadline = MPMIN(deadline, c->retry_at);
+                } else {
+                    deadline = MPMIN(deadline, c->retry_at);
+                }
+            } else if (c->state == CONN_CONNECTED && c->idle && c->timer) {
+                if (c->timer <= now) {
+                    c->timer = 0;
+                    conn_pump(n, i);
+                } else {
+                    deadline = MPMIN(deadline, c->timer);
+                }
+            } else if (c->state == CONN_CONNECTING ||
+                       (c->state == CONN_CONNECTED && c->off < c->len))
+            {
+                if (now - c->last_progress > SEND_TIMEOUT_US) {
+                    conn_fail(n, i, c->state == CONN_CONNECTING ? "connect"
+                                    : "send", ETIMEDOUT);
+                    deadline = MPMIN(deadline, c->retry_at);
+                } else {
+                    deadline = MPMIN(deadline, c->last_progress + SEND_TIMEOUT_US);
+                }
+            }
+        }
+
+        update_stats(n, now);
+        if (atomic_load(&n->queued)) // keep sampling while it drains
+            deadline = MPMIN(deadline, n->stats_time + STATS_INTERVAL_US);
+
+        int timeout = -1;
+        if (deadline != INT64_MAX)
+            timeout = MPCLAMP((deadline - now + 999) / 1000, 0, INT_MAX);
+
+        int num = epoll_wait(n->epfd, events, MP_ARRAY_SIZE(events), timeout);
+        if (num < 0) {
+            if (errno == EINTR)
+                continue;
+            MP_ERR(n, "epoll_wait: %s\n", mp_strerror(errno));
+            break;
+        }
+
+        bool wakeup = false;
+        for (int i = 0; i < num; i++) {
+            uint32_t id = events[i].data.u32;
+            if (id == WAKEUP_ID) {
+                uint64_t val;
+                if (read(n->wakeup_fd, &val, sizeof(val)) < 0) {
+                    // EAGAIN: somebody else read it already
+                }
+                wakeup = true;
+            } else {
+                conn_event(n, id, events[i].events);
+            }
+        }
+
+        if (wakeup) {
+            for (int i = 0; i < n->num_conns; i++) {
+                struct net_conn *c = &n->conns[i];
+                if (c->state == CONN_CONNECTED && c->idle)
+                    conn_pump(n, i);
+            }
+        }
+    }
+
+    for (int i = 0; i < n->num_conns; i++) {
+        if (n->conns[i].fd >= 0)
+            close(n->conns[i].fd);
+        n->conns[i].fd = -1;
+    }
+    return NULL;
+}
+
+static void destroy_net(void *ptr)
+{
+    struct pf_net *n = ptr;
+    if (n->thread_valid) {
+        atomic_store(&n->quit, true);
+        pf_net_wakeup(n);
+        pthread_join(n->thread, NULL);
+    }
+    if (n->wakeup_fd >= 0)
+        close(n->wakeup_fd);
+    if (n->epfd >= 0)
+        close(n->epfd);
+}
+
+struct pf_net *pf_net_create(void *ta_parent, struct mp_log *log,
+                             const char *host, int port, int num_conns,
+                             const struct pf_net_callbacks *cb)
+{
+    struct pf_net *n = talloc_zero(ta_parent, struct pf_net);
+    n->log = log;
+    n->cb = *cb;
+    n->epfd = n->wakeup_fd = -1;
+    atomic_store(&n->quit, false);
+    atomic_store(&n->num_connected, 0);
+    talloc_set_destructor(n, destroy_net);
+
+    char service[16];
+    snprintf(service, sizeof(service), "%d", port);
+    struct addrinfo hints = {
+        .ai_family = AF_UNSPEC,
+        .ai_socktype = SOCK_STREAM,
+    };
+    struct addrinfo *ai = NULL;
+    int r = getaddrinfo(host, service, &hints, &ai);
+    if (r || !ai) {
+        MP_ERR(n, "Could not resolve %s: %s\n", host, gai_strerror(r));
+        goto error;
+    }
+    memcpy(&n->addr, ai->ai_addr, MPMIN(ai->ai_addrlen, sizeof(n->addr)));
+    n->addrlen = ai->ai_addrlen;
+    freeaddrinfo(ai);
+
+    n->epfd = epoll_create1(EPOLL_CLOEXEC);
+    n->wakeup_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (n->epfd < 0 || n->wakeup_fd < 0) {
+        MP_ERR(n, "Could not create event loop: %s\n", mp_strerror(errno));
+        goto error;
+    }
+    struct epoll_event ev = {.events = EPOLLIN, .data.u32 = WAKEUP_ID};
+    if (epoll_ctl(n->epfd, EPOLL_CTL_ADD, n->wakeup_fd, &ev) < 0)
+        goto error;
+
+    n->num_conns = MPMAX(num_conns, 1);
+    n->conns = talloc_zero_array(n, struct net_conn, n->num_conns);
+    for (int i = 0; i < n->num_conns; i++) {
+        n->conns[i].fd = -1;
+        n->conns[i].backoff = BACKOFF_MIN_US;
+    }
+
+    if (pthread_create(&n->thread, NULL, net_thread, n))
+        goto error;
+    n->thread_valid = true;
+    return n;
+
+error:
+    talloc_free(n);
+    return NULL;
+}
+
+void pf_net_wakeup(struct pf_net *n)
+{
+    uint64_t val = 1;
+    if (write(n->wakeup_fd, &val, sizeof(val)) < 0) {
+        // EAGAIN: counter saturated, a wakeup is pending anyway
+    }
+}
+
+char *pf_net_reserve(struct pf_net *n, int conn, size_t size)
+{
+    struct net_conn *c = &n->conns[conn];
+    MP_TARRAY_GROW(n, c->buf, c->len + size);
+    return c->buf + c->len;
+}
+
+void pf_net_set_timer(struct pf_net *n, int conn, int64_t time)
+{
+    n->conns[conn].timer = time;
+}
+
+void pf_net_commit(struct pf_net *n, int conn, size_t len)
+{
+    n->conns[conn].len += len;
+}
+
+int pf_net_num_connected(struct pf_net *n)
+{
+    return atomic_load(&n->num_connected);
+}
+
+void pf_net_get_stats(struct pf_net *n, struct pf_net_stats *st)
+{
+    *st = (struct pf_net_stats){
+        .bytes_sent = atomic_load(&n->bytes_sent),
+        .queued = atomic_load(&n->queued),
+    };
+}
@@ -0,0 +1,82 @@
+/*
+ * This file is part of mpv.
+ *
+ * mpv is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * mpv is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with mpv.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef MP_PIXELFLUT_NET_H
+#define MP_PIXELFLUT_NET_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+struct mp_log;
+
+/*
+ * Event loop for many TCP connections to the same server. A single thread
+ * owns all sockets: connects are non-blocking, lost connections are
+ * re-established with exponential backoff, and every connection has a send
+ * queue that is refilled through a callback whenever it was written out.
+ */
+struct pf_net;
+
+struct pf_net_callbacks {
+    void *ctx;
+    // Connection conn was established (connected=true) or lost. On connect,
+    // data (e.g. a protocol preamble) may be queued with pf_net_reserve().
+    void (*state)(void *ctx, struct pf_net *n, int conn, bool connected);
+    // The send queue of conn is empty. Queue more data and return true, or
+    // return false if there is nothing to send; in that case fill is called
+    // again after the next pf_net_wakeup().
+    bool (*fill)(void *ctx, struct pf_net *n, int conn);
+    // Data received on conn (optional, otherwise it is discarded).
+    void (*recv)(void *ctx, struct pf_net *n, int conn, const char *data,
+                 size_t len);
+};
+
+// Resolve host and start the event loop thread with num_conns connections.
+// All callbacks run on that thread. Returns NULL on failure. Free with
+// talloc_free(), which stops the thread (no callbacks are running after).
+struct pf_net *pf_net_create(void *ta_parent, struct mp_log *log,
+                             const char *host, int port, int num_conns,
+                             const struct pf_net_callbacks *cb);
+
+// Make the event loop call fill on all idle connections. Thread-safe.
+void pf_net_wakeup(struct pf_net *n);
+
+// Return a buffer with room for size bytes at the end of the send queue of
+// conn, and queue the first len bytes of it with pf_net_commit(). Only valid
+// from within the callbacks.
+char *pf_net_reserve(struct pf_net *n, int conn, size_t size);
+void pf_net_commit(struct pf_net *n, int conn, size_t len);
+
+// Call fill on conn at the given time (mp_time_us()) if it is idle. Only
+// valid from within the callbacks.
+void pf_net_set_timer(struct pf_net *n, int conn, int64_t time);
+
+// Number of connections currently established.
+int pf_net_num_connected(struct pf_net *n);
+
+struct pf_net_stats {
+    int64_t bytes_sent;     // total written to the sockets
+    int64_t queued;         // bytes not acknowledged by the server yet: the
+                            // send queues plus the kernel's (SIOCOUTQ), at
+                            // most a few ms old
+};
+
+// Thread-safe.
+void pf_net_get_stats(struct pf_net *n, struct pf_net_stats *st);
+
+#endif
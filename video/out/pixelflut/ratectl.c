@@ -0,0 +1,183 @@
+/*
+ * This file is part of mpv.
+ *
+ * mpv is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * mpv is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with mpv.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <math.h>
+
+#include "mpv_talloc.h"
+#include "common/common.h"
+
+#include "ratectl.h"
+
+// Min. interval of the throughput measurements, and the weight of a new one.
+#define RATE_INTERVAL 0.1
+#define RATE_SMOOTH 0.3
+// Waiting for the previous frame longer than this fraction of a frame
+// duration counts as congestion.
+#define STALL_FRACTION 0.25
+// Congested frames in a row needed for a step down, and the min. time
+// between two steps down.
+#define DEGRADE_FRAMES 2
+#define HOLD_TIME 0.5
+// Time without congestion before a step up. Doubled when the link congests
+// within PROBE_FAIL of a step up, halved when a step up holds.
+#define PROBE_MIN 2.0
+#define PROBE_MAX 30.0
+#define PROBE_FAIL 2.0
+
+// Quality steps from best to cheapest. The threshold is added to the base
+// threshold. Only steps that shorten or drop commands are useful: the
+// protocol has no cheaper way to draw fewer colours or larger pixels.
+static const struct pf_ratectl_params steps[] = {
+    {.threshold = 0,  .depth = PF_DEPTH_24,   .skip = 1},
+    {.threshold = 8,  .depth = PF_DEPTH_24,   .skip = 1},
+    {.threshold = 16, .depth = PF_DEPTH_24,   .skip = 1},
+    {.threshold = 24, .depth = PF_DEPTH_GRAY, .skip = 1},
+    {.threshold = 32, .depth = PF_DEPTH_GRAY, .skip = 2},
+    {.threshold = 48, .depth = PF_DEPTH_GRAY, .skip = 3},
+    {.threshold = 48, .depth = PF_DEPTH_GRAY, .skip = 4},
+    {.threshold = 64, .depth = PF_DEPTH_GRAY, .skip = 6},
+};
+
+struct pf_ratectl {
+    struct pf_ratectl_opts opts;
+    struct pf_ratectl_params *levels;
+    int num_levels;
+    int level;
+    int skip;                   // levels[level].skip, limited by min_fps
+    int skip_count;
+
+    double rate, latency;
+    int64_t rate_time, rate_bytes;  // last throughput measurement
+
+    int congested;              // congested frames in a row
+    int64_t calm_since;         // start of the period without congestion
+    int64_t changed;            // time of the last level change
+    bool probing;               // the last change was a step up
+    double probe_wait;
+};
+
+struct pf_ratectl *pf_ratectl_create(void *ta_parent,
+                                     const struct pf_ratectl_opts *opts)
+{
+    struct pf_ratectl *c = talloc_zero(ta_parent, struct pf_ratectl);
+    c->opts = *opts;
+    c->skip = 1;
+    c->probe_wait = PROBE_MIN;
+
+    // Adapt the steps to the options, and merge the ones that end up equal.
+    for (int n = 0; n < MP_ARRAY_SIZE(steps); n++) {
+        struct pf_ratectl_params l = steps[n];
+        l.threshold = MPMIN(opts->base_threshold + l.threshold, 765);
+        if (l.depth == PF_DEPTH_GRAY && !opts->gray)
+            l.depth = PF_DEPTH_24;
+        if (c->num_levels) {
+            struct pf_ratectl_params *prev = &c->levels[c->num_levels - 1];
+            if (prev->threshold == l.threshold && prev->depth == l.depth &&
+                prev->skip == l.skip)
+                continue;
+        }
+        l.level = c->num_levels;
+        MP_TARRAY_APPEND(c, c->levels, c->num_levels, l);
+    }
+    return c;
+}
+
+bool pf_ratectl_want_frame(struct pf_ratectl *c)
+{
+    if (++c->skip_count < c->skip)
+        return false;
+    c->skip_count = 0;
+    return true;
+}
+
+static void set_level(struct pf_ratectl *c, int level, int64_t now, bool up)
+{
+    c->level = level;
+    c->changed = now;
+    c->probing = up;
+    c->congested = 0;
+    c->calm_since = now;
+}
+
+static void update_rate(struct pf_ratectl *c, const struct pf_ratectl_sample *s)
+{
+    if (!c->rate_time) {
+        c->rate_time = s->time;
+        c->rate_bytes = s->bytes_sent;
+        return;
+    }
+    double dt = (s->time - c->rate_time) / 1e6;
+    if (dt < RATE_INTERVAL)
+        return;
+    double r = (s->bytes_sent - c->rate_bytes) / dt;
+    // A link that ran out of data says nothing about its capacity.
+    if (s->queued > 0 || r > c->rate)
+        c->rate = c->rate ? c->rate + (r - c->rate) * RATE_SMOOTH : r;
+    c->rate_time = s->time;
+    c->rate_bytes = s->bytes_sent;
+}
+
+void pf_ratectl_update(struct pf_ratectl *c, const struct pf_ratectl_sample *s,
+                       struct pf_ratectl_params *params)
+{
+    int64_t now = s->time;
+    double frame_time = s->frame_time > 0 ? s->frame_time : 1 / 25.0;
+
+    update_rate(c, s);
+    c->latency = c->rate > 0 ? s->queued / c->rate : 0;
+
+    bool congested = c->latency > c->opts.target_latency || s->dropped ||
+                     s->stall > frame_time * STALL_FRACTION;
+    if (congested) {
+        c->calm_since = 0;
+        c->congested++;
+        if (c->congested >= DEGRADE_FRAMES && c->level < c->num_levels - 1 &&
+            now - c->changed >= HOLD_TIME * 1e6)
+        {
+            if (c->probing && now - c->changed < PROBE_FAIL * 1e6)
+                c->probe_wait = MPMIN(c->probe_wait * 2, PROBE_MAX);
+            set_level(c, c->level + 1, now, false);
+        }
+    } else {
+        c->congested = 0;
+        if (c->probing && now - c->changed >= PROBE_FAIL * 1e6) {
+            c->probe_wait = MPMAX(c->probe_wait / 2, PROBE_MIN);
+            c->probing = false;
+        }
+        // Only step up from a mostly empty queue.
+        if (!c->calm_since || c->latency > c->opts.target_latency / 4)
+            c->calm_since = now;
+        if (c->level > 0 && now - c->calm_since >= c->probe_wait * 1e6)
+            set_level(c, c->level - 1, now, true);
+    }
+
+    *params = c->levels[c->level];
+    int max_skip = c->opts.min_fps > 0 ? 1 / (frame_time * c->opts.min_fps) : 1;
+    c->skip = MPCLAMP(params->skip, 1, MPMAX(max_skip, 1));
+    params->skip = c->skip;
+}
+
+void pf_ratectl_get_state(struct pf_ratectl *c, struct pf_ratectl_state *st)
+{
+    *st = (struct pf_ratectl_state){
+        .params = c->levels[c->level],
+        .num_levels = c->num_levels,
+        .rate = c->rate,
+        .latency = c->latency,
+    };
+    st->params.skip = c->skip;
+}
@@ -0,0 +1,85 @@
+/*
+ * This file is part of mpv.
+ *
+ * mpv is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * mpv is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with mpv.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef MP_PIXELFLUT_RATECTL_H
+#define MP_PIXELFLUT_RATECTL_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+/*
+ * Feedback controller for the send rate of the pixelflut VOs. It measures
+ * the throughput the connections achieve and how much data waits for the
+ * server, and steps the output quality down (coarser diff, gray, skipped
+ * frames) while the link can't keep up. It steps back up after a while
+ * without congestion, and waits longer after every probe that congested the
+ * link again.
+ */
+
+enum pf_depth {
+    PF_DEPTH_24,        // full colour
+    PF_DEPTH_GRAY,      // gray, sent with the short command (grayscale=1)
+};
+
+struct pf_ratectl_opts {
+    double target_latency;  // max. seconds of data waiting for the server
+    double min_fps;         // frame skipping goes no lower than this
+    int base_threshold;     // diff threshold at the best quality
+    bool gray;              // the server takes the grayscale command
+};
+
+// Output settings.
+struct pf_ratectl_params {
+    int level;              // 0 is the best quality
+    int threshold;          // diff threshold
+    enum pf_depth depth;
+    int skip;               // every skip-th frame is sent
+};
+
+// Measurements taken when a frame arrives.
+struct pf_ratectl_sample {
+    int64_t time;           // mp_time_us()
+    int64_t bytes_sent;     // total
+    int64_t queued;         // bytes not acknowledged yet
+    double stall;           // seconds the VO waited for the previous frame
+    bool dropped;           // the previous frame was replaced before it was
+                            // drawn completely
+    double frame_time;      // source frame duration in seconds, 0 if unknown
+};
+
+// Measured state, for monitoring.
+struct pf_ratectl_state {
+    struct pf_ratectl_params params;
+    int num_levels;
+    double rate;            // bytes/second
+    double latency;         // seconds
+};
+
+struct pf_ratectl *pf_ratectl_create(void *ta_parent,
+                                     const struct pf_ratectl_opts *opts);
+
+// Whether the next frame is sent, or skipped to reduce the frame rate.
+bool pf_ratectl_want_frame(struct pf_ratectl *c);
+
+// Feed the measurements for a frame that is sent, and return the settings
+// for it in *params.
+void pf_ratectl_update(struct pf_ratectl *c, const struct pf_ratectl_sample *s,
+                       struct pf_ratectl_params *params);
+
+void pf_ratectl_get_state(struct pf_ratectl *c, struct pf_ratectl_state *st);
+
+#endif
@@ -0,0 +1,420 @@
+/*
+ * This file is part of mpv.
+ *
+ * mpv is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * mpv is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with mpv.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <pthread.h>
+
+#include "mpv_talloc.h"
+#include "common/common.h"
+
+#include "sched.h"
+
+// A tile range [begin, end) of one worker, tagged with the frame generation,
+// packed into a single atomic word: gen:24 | begin:20 | end:20.
+#define GEN_MASK ((1u << 24) - 1)
+#define IDX_MASK ((1u << 20) - 1)
+
+static uint64_t range_pack(uint32_t gen, uint32_t begin, uint32_t end)
+{
+    return ((uint64_t)(gen & GEN_MASK) << 40) | ((uint64_t)begin << 20) | end;
+}
+
+#define RANGE_GEN(r)   ((uint32_t)((r) >> 40) & GEN_MASK)
+#define RANGE_BEGIN(r) ((uint32_t)((r) >> 20) & IDX_MASK)
+#define RANGE_END(r)   ((uint32_t)(r) & IDX_MASK)
+
+struct sched_worker {
+    atomic_ullong range;
+    mp_atomic_int64 rate;       // bytes/s, exponential moving average
+    // Protected by pf_sched.lock.
+    bool active;
+    uint32_t seen_seq;          // pf_sched.seq when the frame was last taken
+};
+
+struct pf_sched {
+    pthread_mutex_t lock;
+    pthread_cond_t wakeup;      // new frame or termination
+    pthread_cond_t done;        // tile/frame completion or worker state change
+
+    struct sched_worker *workers;
+    int num_workers;
+    int num_active;
+    int64_t *weights;           // distribute() scratch, num_workers entries
+
+    // All protected by lock.
+    struct pf_sched_frame *frame;
+    uint32_t gen;
+    uint32_t seq;               // incremented to make idle workers rejoin
+    int busy;                   // number of frame references held by workers
+    bool quit;
+
+    void (*wakeup_cb)(void *ctx);
+    void *wakeup_ctx;
+};
+
+static void destroy_sched(void *ptr)
+{
+    struct pf_sched *s = ptr;
+    if (s->frame)
+        talloc_free(s->frame);
+    pthread_cond_destroy(&s->wakeup);
+    pthread_cond_destroy(&s->done);
+    pthread_mutex_destroy(&s->lock);
+}
+
+struct pf_sched *pf_sched_create(void *ta_parent, int num_workers)
+{
+    struct pf_sched *s = talloc_zero(ta_parent, struct pf_sched);
+    pthread_mutex_init(&s->lock, NULL);
+    pthread_cond_init(&s->wakeup, NULL);
+    pthread_cond_init(&s->done, NULL);
+    talloc_set_destructor(s, destroy_sched);
+
+    s->num_workers = MPMAX(num_workers, 1);
+    s->workers = talloc_zero_array(s, struct sched_worker, s->num_workers);
+    s->weights = talloc_zero_array(s, int64_t, s->num_workers);
+    for (int n = 0; n < s->num_workers; n++) {
+        atomic_store(&s->workers[n].range, range_pack(0, 0, 0));
+        atomic_store(&s->workers[n].rate, 0);
+    }
+    return s;
+}
+
+// Called with the lock held.
+static void wakeup_workers(struct pf_sched *s)
+{
+    pthread_cond_broadcast(&s->wakeup);
+    if (s->wakeup_cb)
+        s->wakeup_cb(s->wakeup_ctx);
+}
+
+void pf_sched_set_wakeup(struct pf_sched *s, void (*cb)(void *ctx), void *ctx)
+{
+    pthread_mutex_lock(&s->lock);
+    s->wakeup_cb = cb;
+    s->wakeup_ctx = ctx;
+    pthread_mutex_unlock(&s->lock);
+}
+
+void pf_sched_terminate(struct pf_sched *s)
+{
+    pthread_mutex_lock(&s->lock);
+    s->quit = true;
+    wakeup_workers(s);
+    pthread_cond_broadcast(&s->done);
+    pthread_mutex_unlock(&s->lock);
+}
+
+struct pf_sched_frame *pf_sched_frame_alloc(int h, int tile_h)
+{
+    struct pf_sched_frame *f = talloc_zero(NULL, struct pf_sched_frame);
+    f->tile_h = MPMAX(tile_h, 1);
+    f->num_tiles = MPMIN((h + f->tile_h - 1) / f->tile_h, PF_SCHED_MAX_TILES);
+    // Keep the tiles covering the whole image if the count was clamped.
+    if (f->num_tiles == PF_SCHED_MAX_TILES)
+        f->tile_h = (h + f->num_tiles - 1) / f->num_tiles;
+    atomic_store(&f->refcount, 1);
+    atomic_store(&f->tiles_done, 0);
+    atomic_store(&f->tiles_failed, 0);
+    atomic_store(&f->rounds, 0);
+    atomic_store(&f->passes, 0);
+    return f;
+}
+
+static void unref_frame(struct pf_sched_frame *f)
+{
+    if (f && atomic_fetch_add(&f->refcount, -1) == 1)
+        talloc_free(f);
+}
+
+// Split the tiles of s->frame across the workers proportionally to their
+// measured throughput, as generation s->gen. Called with the lock held.
+static void distribute(struct pf_sched *s)
+{
+    struct pf_sched_frame *f = s->frame;
+    int num_tiles = f ? f->num_tiles : 0;
+
+    // Workers without measurements yet get the average rate of the others.
+    int64_t total = 0, known = 0;
+    for (int n = 0; n < s->num_workers; n++) {
+        int64_t rate = atomic_load(&s->workers[n].rate);
+        if (s->workers[n].active && rate > 0) {
+            total += rate;
+            known++;
+        }
+    }
+    int64_t def_rate = known ? MPMAX(total / known, 1) : 1;
+
+    int64_t *weights = s->weights;
+    int64_t sum = 0;
+    for (int n = 0; n < s->num_workers; n++) {
+        int64_t rate = atomic_load(&s->workers[n].rate);
+        weights[n] = s->workers[n].active ? (rate > 0 ? rate : def_rate) : 0;
+        sum += weights[n];
+    }
+    // Nobody is connected: spread evenly, whoever connects first steals.
+    if (!sum) {
+        for (int n = 0; n < s->num_workers; n++)
+            weights[n] = 1;
+        sum = s->num_workers;
+    }
+
+    int64_t acc = 0;
+    uint32_t begin = 0;
+    for (int n = 0; n < s->num_workers; n++) {
+        acc += weights[n];
+        uint32_t end = n == s->num_workers - 1 ? num_tiles
+                     : (uint32_t)((double)num_tiles * acc / sum);
+        atomic_store(&s->workers[n].range, range_pack(s->gen, begin, end));
+        begin = end;
+    }
+}
+
+void pf_sched_publish(struct pf_sched *s, struct pf_sched_frame *f)
+{
+    pthread_mutex_lock(&s->lock);
+    unref_frame(s->frame);
+    s->frame = f;
+    s->gen++;
+    if (!f->num_tiles) {
+        atomic_store(&f->rounds, 1);
+        atomic_store(&f->passes, 1);
+    }
+    distribute(s);
+    wakeup_workers(s);
+    pthread_cond_broadcast(&s->done);
+    pthread_mutex_unlock(&s->lock);
+}
+
+bool pf_sched_wait_complete(struct pf_sched *s)
+{
+    pthread_mutex_lock(&s->lock);
+    while (s->frame && !atomic_load(&s->frame->rounds) && s->num_active > 0 &&
+           !s->quit)
+        pthread_cond_wait(&s->done, &s->lock);
+    bool complete = s->frame && atomic_load(&s->frame->passes) > 0;
+    pthread_mutex_unlock(&s->lock);
+    return complete;
+}
+
+bool pf_sched_frame_complete(struct pf_sched *s)
+{
+    pthread_mutex_lock(&s->lock);
+    bool complete = s->frame && atomic_load(&s->frame->passes) > 0;
+    pthread_mutex_unlock(&s->lock);
+    return complete;
+}
+
+void pf_sched_flush(struct pf_sched *s)
+{
+    pthread_mutex_lock(&s->lock);
+    unref_frame(s->frame);
+    s->frame = NULL;
+    s->gen++;
+    distribute(s);
+    wakeup_workers(s);
+    while (s->busy > 0)
+        pthread_cond_wait(&s->done, &s->lock);
+    pthread_mutex_unlock(&s->lock);
+}
+
+// Called with the lock held.
+static bool has_frame(struct pf_sched *s, int worker, uint32_t gen)
+{
+    return s->frame && (s->gen != gen || s->workers[worker].seen_seq != s->seq);
+}
+
+// Called with the lock held.
+static struct pf_sched_frame *get_frame(struct pf_sched *s, int worker,
+                                        uint32_t *gen)
+{
+    if (s->quit || !has_frame(s, worker, *gen))
+        return NULL;
+    atomic_fetch_add(&s->frame->refcount, 1);
+    s->busy++;
+    s->workers[worker].seen_seq = s->seq;
+    *gen = s->gen;
+    return s->frame;
+}
+
+struct pf_sched_frame *pf_sched_wait_frame(struct pf_sched *s, int worker,
+                                           uint32_t *gen)
+{
+    pthread_mutex_lock(&s->lock);
+    while (!s->quit && !has_frame(s, worker, *gen))
+        pthread_cond_wait(&s->wakeup, &s->lock);
+    struct pf_sched_frame *f = get_frame(s, worker, gen);
+    pthread_mutex_unlock(&s->lock);
+    return f;
+}
+
+struct pf_sched_frame *pf_sched_poll_frame(struct pf_sched *s, int worker,
+                                           uint32_t *gen)
+{
+    pthread_mutex_lock(&s->lock);
+    struct pf_sched_frame *f = get_frame(s, worker, gen);
+    pthread_mutex_unlock(&s->lock);
+    return f;
+}
+
+bool pf_sched_superseded(struct pf_sched *s, uint32_t gen)
+{
+    pthread_mutex_lock(&s->lock);
+    bool r = s->gen != gen;
+    pthread_mutex_unlock(&s->lock);
+    return r;
+}
+
+// Steal the back half of the largest remaining range of generation gen.
+// Returns the first stolen tile, the rest becomes the range of worker, whose
+// current (empty) range is own.
+static int steal(struct pf_sched *s, int worker, uint32_t gen, uint64_t own)
+{
+    while (1) {
+        int victim = -1;
+        uint32_t best = 0;
+        uint64_t vr = 0;
+        for (int n = 0; n < s->num_workers; n++) {
+            if (n == worker)
+                continue;
+            uint64_t r = atomic_load(&s->workers[n].range);
+            if (RANGE_GEN(r) != gen || RANGE_END(r) <= RANGE_BEGIN(r))
+                continue;
+            uint32_t rem = RANGE_END(r) - RANGE_BEGIN(r);
+            if (rem > best) {
+                best = rem;
+                victim = n;
+                vr = r;
+            }
+        }
+        if (victim < 0)
+            return -1;
+
+        uint32_t begin = RANGE_BEGIN(vr), end = RANGE_END(vr);
+        uint32_t mid = begin + best / 2;
+        uint64_t nr = range_pack(gen, begin, mid);
+        if (atomic_compare_exchange_strong(&s->workers[victim].range, &vr, nr)) {
+            // Only fails if a new frame was published meanwhile, in which
+            // case the stolen tiles are obsolete anyway.
+            atomic_compare_exchange_strong(&s->workers[worker].range, &own,
+                                           range_pack(gen, mid + 1, end));
+            return mid;
+        }
+        // Lost a race with the owner or another thief; look again.
+    }
+}
+
+int pf_sched_next_tile(struct pf_sched *s, int worker, uint32_t gen)
+{
+    gen &= GEN_MASK;
+    atomic_ullong *range = &s->workers[worker].range;
+    uint64_t r = atomic_load(range);
+    while (RANGE_GEN(r) == gen && RANGE_BEGIN(r) < RANGE_END(r)) {
+        uint32_t begin = RANGE_BEGIN(r);
+        if (atomic_compare_exchange_strong(range, &r,
+                range_pack(gen, begin + 1, RANGE_END(r))))
+            return begin;
+    }
+    if (RANGE_GEN(r) != gen)
+        return -1; // superseded
+    return steal(s, worker, gen, r);
+}
+
+static void tile_finished(struct pf_sched *s, struct pf_sched_frame *f)
+{
+    if (atomic_fetch_add(&f->tiles_done, 1) + 1 == f->num_tiles) {
+        pthread_mutex_lock(&s->lock);
+        if (!atomic_load(&f->tiles_failed))
+            atomic_fetch_add(&f->passes, 1);
+        atomic_fetch_add(&f->rounds, 1);
+        pthread_cond_broadcast(&s->done);
+        pthread_mutex_unlock(&s->lock);
+    }
+}
+
+void pf_sched_tile_done(struct pf_sched *s, int worker,
+                        struct pf_sched_frame *f, size_t bytes, int64_t us)
+{
+    if (us > 0 && bytes > 0) {
+        mp_atomic_int64 *rate = &s->workers[worker].rate;
+        int64_t cur = bytes * (int64_t)1000000 / us;
+        int64_t old = atomic_load(rate);
+        atomic_store(rate, old > 0 ? old - old / 8 + cur / 8 : cur);
+    }
+    tile_finished(s, f);
+}
+
+void pf_sched_tile_failed(struct pf_sched *s, struct pf_sched_frame *f)
+{
+    atomic_fetch_add(&f->tiles_failed, 1);
+    tile_finished(s, f);
+}
+
+bool pf_sched_repeat(struct pf_sched *s, struct pf_sched_frame *f)
+{
+    bool ok = false;
+    pthread_mutex_lock(&s->lock);
+    if (s->frame == f && !s->quit &&
+        atomic_load(&f->tiles_done) == f->num_tiles)
+    {
+        atomic_store(&f->tiles_done, 0);
+        atomic_store(&f->tiles_failed, 0);
+        s->gen++;
+        distribute(s);
+        wakeup_workers(s);
+        ok = true;
+    }
+    pthread_mutex_unlock(&s->lock);
+    return ok;
+}
+
+void pf_sched_release(struct pf_sched *s, struct pf_sched_frame *f)
+{
+    pthread_mutex_lock(&s->lock);
+    unref_frame(f);
+    s->busy--;
+    if (!s->busy)
+        pthread_cond_broadcast(&s->done);
+    pthread_mutex_unlock(&s->lock);
+}
+
+void pf_sched_set_active(struct pf_sched *s, int worker, bool active)
+{
+    pthread_mutex_lock(&s->lock);
+    if (s->workers[worker].active != active) {
+        s->workers[worker].active = active;
+        s->num_active += active ? 1 : -1;
+        if (!active) {
+            atomic_store(&s->workers[worker].rate, 0);
+            // Idle workers have to come back to steal the tiles left in the
+            // range of this one.
+            uint64_t r = atomic_load(&s->workers[worker].range);
+            if (s->frame && RANGE_GEN(r) == (s->gen & GEN_MASK) &&
+                RANGE_BEGIN(r) < RANGE_END(r))
+            {
+                s->seq++;
+                wakeup_workers(s);
+            }
+        }
+        pthread_cond_broadcast(&s->done);
+    }
+    pthread_mutex_unlock(&s->lock);
+}
+
+int64_t pf_sched_worker_rate(struct pf_sched *s, int worker)
+{
+    return atomic_load(&s->workers[worker].rate);
+}
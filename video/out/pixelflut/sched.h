@@ -0,0 +1,131 @@
+/*
+ * This file is part of mpv.
+ *
+ * mpv is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * mpv is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with mpv.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef MP_PIXELFLUT_SCHED_H
+#define MP_PIXELFLUT_SCHED_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "osdep/atomic.h"
+
+/*
+ * Work-stealing tile scheduler for the multi-connection pixelflut VOs.
+ *
+ * The VO thread publishes an immutable frame descriptor. Every worker owns a
+ * contiguous range of tiles of that frame, sized by its measured throughput.
+ * Workers take tiles from the front of their own range, and when it runs
+ * dry, steal the back half of the largest remaining range of another worker.
+ * Ranges are single atomic words, so taking and stealing tiles is lock-free.
+ * Idle workers sleep on a condition variable until the next frame.
+ */
+
+struct pf_sched;
+struct mp_image;
+
+struct pf_sched_frame {
+    // Set by the VO before publishing, read-only afterwards.
+    struct mp_image *cur;       // frame to draw
+    struct mp_image *ref;       // what the canvas shows already (or NULL)
+    int num_tiles;
+    int tile_h;                 // rows per tile
+    void *priv;                 // VO specific
+
+    // Internal.
+    atomic_int refcount;
+    atomic_int tiles_done;      // tiles of the current pass drawn or failed
+    atomic_int tiles_failed;
+    atomic_int rounds;          // number of passes with all tiles handled
+    atomic_int passes;          // number of passes drawn without failures
+};
+
+// Maximum number of tiles per frame.
+#define PF_SCHED_MAX_TILES ((1 << 20) - 1)
+
+struct pf_sched *pf_sched_create(void *ta_parent, int num_workers);
+
+// Wake up all workers and make pf_sched_wait_frame() return NULL.
+void pf_sched_terminate(struct pf_sched *s);
+
+// Allocate a frame descriptor with num_tiles = ceil(h / tile_h). The caller
+// fills in the remaining fields (allocating as talloc children of the frame)
+// and passes it to pf_sched_publish().
+struct pf_sched_frame *pf_sched_frame_alloc(int h, int tile_h);
+
+// Publish a new frame, transferring ownership to the scheduler. Tiles of the
+// previous frame that were not taken yet are abandoned.
+void pf_sched_publish(struct pf_sched *s, struct pf_sched_frame *f);
+
+// Block until all tiles of the most recently published frame were handled,
+// or no worker is active. Returns whether it was drawn completely (without
+// failed tiles).
+bool pf_sched_wait_complete(struct pf_sched *s);
+
+// Whether all tiles of the most recently published frame were drawn.
+bool pf_sched_frame_complete(struct pf_sched *s);
+
+// Drop the current frame and block until no worker uses any frame anymore.
+void pf_sched_flush(struct pf_sched *s);
+
+// Call cb(ctx) whenever a new frame generation becomes available or the
+// scheduler is terminated, for workers that use pf_sched_poll_frame() from
+// an event loop. cb is called with internal locks held and must not call
+// back into the scheduler.
+void pf_sched_set_wakeup(struct pf_sched *s, void (*cb)(void *ctx), void *ctx);
+
+// Worker API. Block until a frame generation other than *gen is published
+// (or tiles of an inactive worker are left over), and return a new reference
+// to it (updating *gen). Returns NULL on termination.
+struct pf_sched_frame *pf_sched_wait_frame(struct pf_sched *s, int worker,
+                                           uint32_t *gen);
+
+// Non-blocking variant of pf_sched_wait_frame(). Returns NULL if there is no
+// frame generation other than *gen.
+struct pf_sched_frame *pf_sched_poll_frame(struct pf_sched *s, int worker,
+                                           uint32_t *gen);
+
+// Whether a frame generation newer than gen was published (or flushed).
+bool pf_sched_superseded(struct pf_sched *s, uint32_t gen);
+
+// Take the next tile of generation gen for this worker, stealing from other
+// workers if needed. Returns -1 if no tiles are left, or if the frame was
+// superseded.
+int pf_sched_next_tile(struct pf_sched *s, int worker, uint32_t gen);
+
+// Report a drawn tile, with the number of bytes and microseconds it took.
+void pf_sched_tile_done(struct pf_sched *s, int worker,
+                        struct pf_sched_frame *f, size_t bytes, int64_t us);
+
+// Report a tile that could not be drawn (e.g. the connection was lost).
+void pf_sched_tile_failed(struct pf_sched *s, struct pf_sched_frame *f);
+
+// If f is still the current frame and all its tiles were handled, distribute
+// them again as a new generation (used to keep repainting a still image).
+// Returns false if f was superseded or still has tiles in flight.
+bool pf_sched_repeat(struct pf_sched *s, struct pf_sched_frame *f);
+
+void pf_sched_release(struct pf_sched *s, struct pf_sched_frame *f);
+
+// Inactive (e.g. disconnected) workers are not assigned tiles. Tiles assigned
+// to them earlier can still be stolen by others.
+void pf_sched_set_active(struct pf_sched *s, int worker, bool active);
+
+// Measured throughput of a worker in bytes/second.
+int64_t pf_sched_worker_rate(struct pf_sched *s, int worker);
+
+#endif
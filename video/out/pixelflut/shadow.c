@@ -0,0 +1,162 @@
+/*
+ * This file is part of mpv.
+ *
+ * mpv is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * mpv is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with mpv.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "mpv_talloc.h"
+#include "common/common.h"
+#include "video/mp_image.h"
+
+#include "shadow.h"
+
+#define NUM_KEYS 256
+
+void pf_shadow_init(struct pf_shadow *sh, void *ta_parent, int w, int h)
+{
+    talloc_free(sh->rgb);
+    talloc_free(sh->age);
+    talloc_free(sh->queue);
+    talloc_free(sh->spans);
+    talloc_free(sh->keys);
+    talloc_free(sh->tmp);
+
+    size_t num = (size_t)w * h;
+    *sh = (struct pf_shadow){
+        .w = w,
+        .h = h,
+        .rgb = talloc_zero_array(ta_parent, uint8_t, num * 3),
+        .age = talloc_zero_array(ta_parent, uint16_t, num),
+        .queue = talloc_array(ta_parent, uint32_t, num),
+        .spans = talloc_array(ta_parent, struct pf_span, MPMAX(w, 1)),
+        .keys = talloc_array(ta_parent, uint8_t, num),
+        .tmp = talloc_array(ta_parent, uint32_t, num),
+    };
+}
+
+static int gcd(int a, int b)
+{
+    while (b) {
+        int t = a % b;
+        a = b;
+        b = t;
+    }
+    return a;
+}
+
+// Priority of a dirty pixel, higher is sent first. The other criterion is
+// mixed in, so that pixels with a small error still get their turn.
+static uint8_t pixel_key(enum pf_order order, int err, int age)
+{
+    if (order == PF_ORDER_AGE)
+        return MPMIN(age, 15) * 16 + err * 15 / 765;
+    return MPMIN(err / 3 + age * 8, NUM_KEYS - 1);
+}
+
+void pf_shadow_rank(struct pf_shadow *sh, const struct pf_diff_params *par,
+                    struct mp_image *cur, enum pf_order order)
+{
+    int w = sh->w, h = sh->h;
+    sh->num_queue = sh->pos = 0;
+    if (cur->w != w || cur->h != h || !w || !h)
+        return;
+
+    if (!sh->valid) {
+        // Unknown canvas contents: make every pixel maximally different, so
+        // that it stays dirty until it was actually sent.
+        for (int y = 0; y < h; y++) {
+            uint8_t *src = cur->planes[0] + (ptrdiff_t)y * cur->stride[0];
+            uint8_t *dst = sh->rgb + (size_t)y * w * 3;
+            for (int i = 0; i < w * 3; i++)
+                dst[i] = ~src[i];
+        }
+        sh->valid = true;
+    }
+
+    // Visit rows in a scattered order, so that pixels of the same priority
+    // are not sent top to bottom either.
+    int step = MPMAX(h * 618 / 1000, 1);
+    while (gcd(step, h) != 1)
+        step--;
+
+    uint32_t counts[NUM_KEYS] = {0};
+    int num = 0;
+    int y = 0;
+    for (int n = 0; n < h; n++, y = (y + step) % h) {
+        const uint8_t *src = cur->planes[0] + (ptrdiff_t)y * cur->stride[0];
+        const uint8_t *shadow = sh->rgb + (size_t)y * w * 3;
+        uint16_t *age = sh->age + (size_t)y * w;
+        int num_spans = pf_diff_row(par, src, shadow, w, y, sh->spans);
+
+        int x = 0;
+        for (int s = 0; s < num_spans; s++) {
+            struct pf_span *sp = &sh->spans[s];
+            memset(&age[x], 0, (sp->x - x) * sizeof(age[0]));
+            for (x = sp->x; x < sp->x + sp->len; x++) {
+                const uint8_t *a = &src[x * 3], *b = &shadow[x * 3];
+                int err = abs(a[0] - b[0]) + abs(a[1] - b[1]) + abs(a[2] - b[2]);
+                uint8_t key = pixel_key(order, err, age[x]);
+                if (age[x] < UINT16_MAX)
+                    age[x]++;
+                sh->tmp[num] = (uint32_t)y * w + x;
+                sh->keys[num] = key;
+                counts[key]++;
+                num++;
+            }
+        }
+        memset(&age[x], 0, (w - x) * sizeof(age[0]));
+    }
+
+    // Counting sort by descending key; stable, so the scattered row order
+    // is kept within a key.
+    uint32_t start[NUM_KEYS];
+    uint32_t pos = 0;
+    for (int k = NUM_KEYS - 1; k >= 0; k--) {
+        start[k] = pos;
+        pos += counts[k];
+    }
+    for (int i = 0; i < num; i++)
+        sh->queue[start[sh->keys[i]]++] = sh->tmp[i];
+    sh->num_queue = num;
+}
+
+int pf_shadow_next_run(struct pf_shadow *sh, struct mp_image *cur, int max,
+                       int *x, int *y)
+{
+    if (sh->pos >= sh->num_queue || cur->w != sh->w || cur->h != sh->h)
+        return 0;
+
+    uint32_t first = sh->queue[sh->pos];
+    *x = first % sh->w;
+    *y = first / sh->w;
+    int n = 1;
+    while (n < max && sh->pos + n < sh->num_queue &&
+           sh->queue[sh->pos + n] == first + n && *x + n < sh->w)
+        n++;
+    sh->pos += n;
+
+    pf_shadow_store(sh, *x, *y,
+                    cur->planes[0] + (ptrdiff_t)*y * cur->stride[0] + *x * 3, n);
+    memset(&sh->age[first], 0, n * sizeof(sh->age[0]));
+    return n;
+}
+
+void pf_shadow_store(struct pf_shadow *sh, int x, int y, const uint8_t *rgb,
+                     int n)
+{
+    memcpy(sh->rgb + ((size_t)y * sh->w + x) * 3, rgb, n * 3);
+}
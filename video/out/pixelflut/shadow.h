@@ -0,0 +1,77 @@
+/*
+ * This file is part of mpv.
+ *
+ * mpv is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * mpv is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with mpv.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef MP_PIXELFLUT_SHADOW_H
+#define MP_PIXELFLUT_SHADOW_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "diff.h"
+
+struct mp_image;
+
+enum pf_order {
+    PF_ORDER_ROWS,      // scanline order (not handled here)
+    PF_ORDER_ERROR,     // largest color error first
+    PF_ORDER_AGE,       // longest waiting pixels first
+};
+
+/*
+ * Shadow canvas: what the remote canvas probably shows, as far as we know.
+ * pf_shadow_rank() compares a new frame against it and queues the dirty
+ * pixels in priority order; pixels taken from the queue are assumed to be
+ * drawn. Pixels that could not be sent before the next frame stay dirty and
+ * gain priority with age, so under saturation the error is spread over the
+ * whole image instead of the bottom rows never being updated.
+ */
+struct pf_shadow {
+    int w, h;
+    uint8_t *rgb;           // RGB24, stride w * 3
+    uint16_t *age;          // number of ranks a pixel stayed dirty
+    bool valid;             // rgb was initialized
+
+    // Transmission queue built by pf_shadow_rank(): pixel indices y * w + x.
+    uint32_t *queue;
+    int num_queue;
+    int pos;
+
+    // Scratch buffers.
+    struct pf_span *spans;
+    uint8_t *keys;
+    uint32_t *tmp;
+};
+
+// (Re)initialize for a w x h canvas. sh must be zero-initialized before the
+// first call. The shadow starts out unknown, i.e. everything is dirty.
+void pf_shadow_init(struct pf_shadow *sh, void *ta_parent, int w, int h);
+
+// Compare cur (IMGFMT_RGB24, same size) to the shadow and rebuild the queue.
+void pf_shadow_rank(struct pf_shadow *sh, const struct pf_diff_params *par,
+                    struct mp_image *cur, enum pf_order order);
+
+// Take the next run of up to max horizontally adjacent pixels from the queue
+// and mark them as drawn with the colors from cur. Returns the number of
+// pixels, and their position in *x, *y, or 0 if the queue is empty.
+int pf_shadow_next_run(struct pf_shadow *sh, struct mp_image *cur, int max,
+                       int *x, int *y);
+
+// Overwrite n shadow pixels starting at (x, y), e.g. with read back colors.
+void pf_shadow_store(struct pf_shadow *sh, int x, int y, const uint8_t *rgb,
+                     int n);
+
+#endif
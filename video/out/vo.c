@@ -40,6 +40,7 @@
 #include "options/m_config.h"
 #include "common/msg.h"
 #include "common/global.h"
+#include "common/frametrace.h"
 #include "video/hwdec.h"
 #include "video/mp_image.h"
 #include "sub/osd.h"
@@ -63,6 +64,9 @@ extern const struct vo_driver video_out_vaapi;
 extern const struct vo_driver video_out_rpi;
 //extern const struct vo_driver video_out_tkkr;
 extern const struct vo_driver video_out_matelight;
+extern const struct vo_driver video_out_led;
+extern const struct vo_driver video_out_laser;
+extern const struct vo_driver video_out_scope;
 extern const struct vo_driver video_out_pixelflut;
 extern const struct vo_driver video_out_pixelflut2;
 extern const struct vo_driver video_out_pixelflutudp;
@@ -111,7 +115,12 @@ const struct vo_driver *const video_out_drivers[] =
     &video_out_lavc,
 
     &video_out_matelight,
+    &video_out_led,
+    &video_out_laser,
+    &video_out_scope,
+#if HAVE_EPOLL
     &video_out_pixelflut,
+#endif
     &video_out_pixelflut2,
     &video_out_pixelflutudp,
     &video_out_pixelfluteth0,
@@ -797,6 +806,8 @@ void vo_queue_frame(struct vo *vo, struct vo_frame *frame)
     assert(vo->config_ok && !in->frame_queued &&
            (!in->current_frame || in->current_frame->num_vsyncs < 1));
     in->hasframe = true;
+    if (frame->current)
+        mp_frametrace(MP_FT_VO_QUEUE, frame->current->pts);
     frame->frame_id = ++(in->current_frame_id);
     in->frame_queued = frame;
     in->wakeup_pts = frame->display_synced
@@ -906,7 +917,10 @@ bool vo_render_frame_external(struct vo *vo)
         pthread_mutex_unlock(&in->lock);
         wakeup_core(vo); // core can queue new video now
 
+        double pts = frame->current ? frame->current->pts : MP_NOPTS_VALUE;
+
         MP_STATS(vo, "start video-draw");
+        mp_frametrace(MP_FT_VO_DRAW, pts);
 
         if (vo->driver->draw_frame) {
             vo->driver->draw_frame(vo, frame);
@@ -914,14 +928,17 @@ bool vo_render_frame_external(struct vo *vo)
             vo->driver->draw_image(vo, mp_image_new_ref(frame->current));
         }
 
+        mp_frametrace(MP_FT_VO_DRAW_END, pts);
         MP_STATS(vo, "end video-draw");
 
         wait_until(vo, target);
 
         MP_STATS(vo, "start video-flip");
+        mp_frametrace(MP_FT_VO_FLIP, pts);
 
         vo->driver->flip_page(vo);
 
+        mp_frametrace(MP_FT_VO_FLIP_END, pts);
         MP_STATS(vo, "end video-flip");
 
         pthread_mutex_lock(&in->lock);
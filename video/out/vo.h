@@ -125,6 +125,8 @@ enum mp_voctrl {
 
     VOCTRL_GET_PREF_DEINT,              // int*
 
+    VOCTRL_GET_RATE_CONTROL,            // struct voctrl_rate_control*
+
     /* private to vo_gpu */
     VOCTRL_EXTERNAL_RESIZE,
 };
@@ -183,6 +185,16 @@ struct voctrl_performance_data {
     struct mp_frame_perf fresh, redraw;
 };
 
+// VOCTRL_GET_RATE_CONTROL
+struct voctrl_rate_control {
+    int level, num_levels;      // 0 is the best quality
+    int threshold;              // diff threshold
+    const char *depth;          // colour depth, static string
+    int skip;                   // every skip-th frame is sent
+    double rate;                // measured throughput, bytes/second
+    double latency;             // seconds of data waiting to be sent
+};
+
 struct voctrl_screenshot {
     bool scaled, subs, osd, high_bit_depth;
     struct mp_image *res;
@@ -195,6 +207,8 @@ enum {
     VO_CAP_FRAMEDROP    = 1 << 1,
     // VO does not allow frames to be retained (vo_mediacodec_embed).
     VO_CAP_NORETAIN     = 1 << 2,
+    // VO wants dirty maps on its frames (video/dirty.h).
+    VO_CAP_DIRTY        = 1 << 3,
 };
 
 #define VO_MAX_REQ_FRAMES 10
@@ -0,0 +1,225 @@
+/*
+ * This file is part of mpv.
+ *
+ * mpv is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * mpv is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with mpv.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "config.h"
+#include "common/common.h"
+#include "common/msg.h"
+#include "options/m_option.h"
+#include "options/path.h"
+#include "video/mp_image.h"
+#include "video/points.h"
+#include "video/out/vo.h"
+#include "video/out/laser/etherdream.h"
+#include "video/out/laser/ilda.h"
+#include "video/out/laser/path.h"
+
+// Output of vf_vector point lists (vf=vector:points=yes) to laser projectors,
+// either streamed to an Ether Dream DAC or written to an ILDA file. The beam
+// path is resampled for the galvos here, so the number of points per frame
+// follows the hardware's point rate instead of an image size.
+
+struct priv {
+    // Options
+    char *file;
+    char *host;
+    int port;
+    int pps;
+    float size;
+    int max_step;
+    int blank_step;
+    int corner_dwell;
+    float corner_angle;
+    int blank_dwell;
+
+    struct laser_etherdream *dac;
+    FILE *fp;
+    uint8_t *ilda_buf;
+    int frame_number;
+
+    struct laser_transform transform;
+    struct laser_path path;
+    bool have_frame;
+};
+
+static void draw_image(struct vo *vo, mp_image_t *in)
+{
+    struct priv *p = vo->priv;
+    struct mp_point_list *list = mp_points_get(in);
+
+    if (list) {
+        struct laser_path_opts opts = {
+            .max_step = p->max_step,
+            .blank_step = p->blank_step,
+            .corner_dwell = p->corner_dwell,
+            .corner_angle = p->corner_angle,
+            .blank_dwell = p->blank_dwell,
+        };
+        laser_path_build(&p->path, p, &opts, &p->transform, list->points,
+                         list->num_points);
+        p->have_frame = true;
+    }
+
+    talloc_free(in);
+}
+
+static void write_ilda(struct vo *vo)
+{
+    struct priv *p = vo->priv;
+    int num = p->path.num_points;
+    if (num > LASER_ILDA_MAX_POINTS) {
+        MP_WARN(vo, "Frame has %d points, truncating to %d.\n", num,
+                LASER_ILDA_MAX_POINTS);
+        num = LASER_ILDA_MAX_POINTS;
+    }
+    MP_TARRAY_GROW(p, p->ilda_buf, LASER_ILDA_HEADER + num * LASER_ILDA_RECORD);
+    size_t size = laser_ilda_write_frame(p->ilda_buf, p->path.points, num,
+                                         p->frame_number);
+    if (fwrite(p->ilda_buf, size, 1, p->fp) != 1)
+        MP_ERR(vo, "Error writing %s: %s\n", p->file, mp_strerror(errno));
+    p->frame_number = (p->frame_number + 1) & 0xFFFF;
+}
+
+static void flip_page(struct vo *vo)
+{
+    struct priv *p = vo->priv;
+
+    if (!p->have_frame)
+        return;
+
+    if (p->dac)
+        laser_etherdream_set_frame(p->dac, p->path.points, p->path.num_points);
+    if (p->fp)
+        write_ilda(vo);
+    p->have_frame = false;
+}
+
+static int query_format(struct vo *vo, int fmt)
+{
+    return fmt == IMGFMT_POINTS;
+}
+
+static int reconfig(struct vo *vo, struct mp_image_params *params)
+{
+    struct priv *p = vo->priv;
+
+    // Fit the display size into the square deflection range, centered, with
+    // the y axis pointing up.
+    int d_w, d_h;
+    mp_image_params_get_dsize(params, &d_w, &d_h);
+    float scale = p->size * 65535.0f / MPMAX(MPMAX(d_w, d_h), 1);
+    float sx = scale * d_w / params->w;
+    float sy = -scale * d_h / params->h;
+    p->transform = (struct laser_transform){
+        .sx = sx,
+        .sy = sy,
+        .ox = -(params->w - 1) * sx / 2,
+        .oy = -(params->h - 1) * sy / 2,
+    };
+
+    vo->dwidth = d_w;
+    vo->dheight = d_h;
+    p->have_frame = false;
+    return 0;
+}
+
+static void uninit(struct vo *vo)
+{
+    struct priv *p = vo->priv;
+
+    talloc_free(p->dac);
+    p->dac = NULL;
+    if (p->fp) {
+        uint8_t end[LASER_ILDA_HEADER];
+        fwrite(end, laser_ilda_write_end(end, p->frame_number), 1, p->fp);
+        fclose(p->fp);
+    }
+    p->fp = NULL;
+}
+
+static int preinit(struct vo *vo)
+{
+    struct priv *p = vo->priv;
+    bool have_file = p->file && p->file[0];
+    bool have_host = p->host && p->host[0];
+
+    if (!have_file && !have_host) {
+        MP_ERR(vo, "Either an ILDA file or a DAC host is required.\n");
+        return -1;
+    }
+
+    if (have_file) {
+        char *path = mp_get_user_path(NULL, vo->global, p->file);
+        p->fp = fopen(path, "wb");
+        if (!p->fp)
+            MP_ERR(vo, "Could not open %s: %s\n", path, mp_strerror(errno));
+        talloc_free(path);
+        if (!p->fp)
+            return -1;
+    }
+
+    if (have_host) {
+        p->dac = laser_etherdream_create(p, vo->log, p->host, p->port, p->pps);
+        if (!p->dac) {
+            uninit(vo);
+            return -1;
+        }
+    }
+
+    return 0;
+}
+
+static int control(struct vo *vo, uint32_t request, void *data)
+{
+    return VO_NOTIMPL;
+}
+
+#define OPT_BASE_STRUCT struct priv
+
+const struct vo_driver video_out_laser =
+{
+    .description = "Laser projectors (Ether Dream DAC, ILDA files)",
+    .name = "laser",
+    .untimed = false,
+    .priv_size = sizeof(struct priv),
+    .options = (const struct m_option[]) {
+        OPT_STRING("file", file, M_OPT_FILE),
+        OPT_STRING("host", host, 0),
+        OPT_INTRANGE("port", port, 0, 1, 65535,
+                     OPTDEF_INT(LASER_ETHERDREAM_PORT)),
+        OPT_INTRANGE("pps", pps, 0, 1000, 100000, OPTDEF_INT(30000)),
+        OPT_FLOATRANGE("size", size, 0, 0, 1, OPTDEF_FLOAT(1)),
+        OPT_INTRANGE("step", max_step, 0, 1, 65535, OPTDEF_INT(1000)),
+        OPT_INTRANGE("blank-step", blank_step, 0, 1, 65535, OPTDEF_INT(3000)),
+        OPT_INTRANGE("corner-dwell", corner_dwell, 0, 0, 100, OPTDEF_INT(4)),
+        OPT_FLOATRANGE("corner-angle", corner_angle, 0, 0, 180,
+                       OPTDEF_FLOAT(60)),
+        OPT_INTRANGE("blank-dwell", blank_dwell, 0, 0, 100, OPTDEF_INT(4)),
+        {0},
+    },
+    .preinit = preinit,
+    .query_format = query_format,
+    .reconfig = reconfig,
+    .control = control,
+    .draw_image = draw_image,
+    .flip_page = flip_page,
+    .uninit = uninit,
+};
@@ -0,0 +1,450 @@
+/*
+ * This file is part of mpv.
+ *
+ * mpv is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * mpv is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with mpv.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include <unistd.h>
+
+#include <arpa/inet.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netdb.h>
+
+#include "config.h"
+#include "common/common.h"
+#include "common/msg.h"
+#include "video/out/vo.h"
+#include "video/mp_image.h"
+#include "video/sws_utils.h"
+#include "options/m_option.h"
+#include "sub/osd.h"
+#include "video/out/dgram.h"
+#include "video/out/led/color.h"
+#include "video/out/led/map.h"
+#include "video/out/led/proto.h"
+
+// Output to LED installations spanning many DMX universes. A mapping file
+// describes which canvas pixel drives which universe/channel; it is compiled
+// into a flat gather table, so each frame is one pass copying pixels into the
+// preallocated packets, which are then sent as one batch followed by a sync
+// packet. Colour correction (gamma, white balance, output limit) is applied
+// on the gathered LEDs, not on the frame.
+
+enum {
+    ORDER_RGB, ORDER_RBG, ORDER_GRB, ORDER_GBR, ORDER_BRG, ORDER_BGR,
+};
+
+// Source component for each output channel.
+static const uint8_t order_map[6][3] = {
+    [ORDER_RGB] = {0, 1, 2},
+    [ORDER_RBG] = {0, 2, 1},
+    [ORDER_GRB] = {1, 0, 2},
+    [ORDER_GBR] = {1, 2, 0},
+    [ORDER_BRG] = {2, 0, 1},
+    [ORDER_BGR] = {2, 1, 0},
+};
+
+struct priv {
+    // Options
+    char *hostname;
+    int port;
+    int protocol;
+    char *map_file;
+    int width, height;
+    int order;
+    int sync;
+    int sync_universe;
+    int64_t rate;
+    int64_t burst;
+    float gamma;
+    struct m_color white;
+    struct m_color limit;
+    int dither;
+
+    struct led_map *map;
+    struct led_proto proto;
+
+    int fd;
+    struct mp_dgram *tx;
+    struct sockaddr_storage dest;
+    socklen_t dest_len;
+    struct sockaddr_in *mcast;      // per packet (sACN without hostname)
+    struct sockaddr_in sync_mcast;
+
+    // One packet per universe: header, then the channel data
+    uint8_t *packets;
+    int packet_stride;
+    int header_size;
+    uint8_t sync_packet[LED_PROTO_MAX_SYNC];
+
+    // Gather table: byte offsets into the source image and into packets
+    uint32_t *gather_src;
+    uint32_t *gather_dst;
+    int gather_stride;              // source stride gather_src was built for
+
+    struct led_color color;
+    uint8_t *leds;                  // gathered RGB, in LED order
+
+    struct mp_sws_context *sws;
+    struct mp_image *canvas;        // scaled frame, if the video does not fit
+    struct mp_rect src_rc, dst_rc;
+    bool have_frame;
+};
+
+static void build_gather(struct priv *p, int stride)
+{
+    struct led_map *m = p->map;
+    for (int i = 0; i < m->num_leds; i++) {
+        struct led_map_entry *e = &m->leds[i];
+        p->gather_src[i] = e->y * stride + e->x * 3;
+    }
+    p->gather_stride = stride;
+}
+
+static void gather(struct priv *p, struct mp_image *img)
+{
+    if (img->stride[0] != p->gather_stride)
+        build_gather(p, img->stride[0]);
+
+    const uint8_t *src = img->planes[0];
+    const uint8_t *ord = order_map[p->order];
+    const uint32_t *gs = p->gather_src, *gd = p->gather_dst;
+    int num = p->map->num_leds;
+    if (p->color.identity) {
+        for (int i = 0; i < num; i++) {
+            const uint8_t *s = src + gs[i];
+            uint8_t *d = p->packets + gd[i];
+            d[0] = s[ord[0]];
+            d[1] = s[ord[1]];
+            d[2] = s[ord[2]];
+        }
+    } else {
+        uint8_t *leds = p->leds;
+        for (int i = 0; i < num; i++)
+            memcpy(leds + i * 3, src + gs[i], 3);
+        led_color_apply(&p->color, leds, 0, num);
+        for (int i = 0; i < num; i++) {
+            const uint8_t *s = leds + i * 3;
+            uint8_t *d = p->packets + gd[i];
+            d[0] = s[ord[0]];
+            d[1] = s[ord[1]];
+            d[2] = s[ord[2]];
+        }
+    }
+    p->have_frame = true;
+}
+
+static void draw_image(struct vo *vo, mp_image_t *in)
+{
+    struct priv *p = vo->priv;
+
+    if (p->canvas) {
+        struct mp_image src = *in, dst = *p->canvas;
+        mp_image_crop_rc(&src, p->src_rc);
+        mp_image_crop_rc(&dst, p->dst_rc);
+        mp_sws_scale(p->sws, &dst, &src);
+        gather(p, p->canvas);
+    } else {
+        gather(p, in);
+    }
+
+    talloc_free(in);
+}
+
+static void flip_page(struct vo *vo)
+{
+    struct priv *p = vo->priv;
+    struct led_map *m = p->map;
+
+    if (!p->have_frame)
+        return;
+
+    led_proto_next_frame(&p->proto);
+    for (int n = 0; n < m->num_packets; n++) {
+        uint8_t *pkt = p->packets + (size_t)n * p->packet_stride;
+        int size = led_proto_write_header(&p->proto, pkt, m->packets[n].universe,
+                                          m->packets[n].length,
+                                          n == m->num_packets - 1);
+        struct iovec iov = {pkt, size};
+        if (p->mcast) {
+            mp_dgram_add_to(p->tx, &iov, 1, &p->mcast[n], sizeof(p->mcast[n]));
+        } else {
+            mp_dgram_add(p->tx, &iov, 1);
+        }
+    }
+
+    int sync_size = led_proto_write_sync(&p->proto, p->sync_packet);
+    if (sync_size) {
+        struct iovec iov = {p->sync_packet, sync_size};
+        if (p->mcast) {
+            mp_dgram_add_to(p->tx, &iov, 1, &p->sync_mcast, sizeof(p->sync_mcast));
+        } else {
+            mp_dgram_add(p->tx, &iov, 1);
+        }
+    }
+
+    int failed = mp_dgram_flush(p->tx);
+    if (failed)
+        MP_VERBOSE(vo, "%d packets not sent\n", failed);
+}
+
+static int query_format(struct vo *vo, int fmt)
+{
+    return fmt == IMGFMT_RGB24;
+}
+
+static int reconfig(struct vo *vo, struct mp_image_params *params)
+{
+    struct priv *p = vo->priv;
+
+    vo->dwidth = p->map->w;
+    vo->dheight = p->map->h;
+
+    struct mp_osd_res osd;
+    vo_get_src_dst_rects(vo, &p->src_rc, &p->dst_rc, &osd);
+
+    talloc_free(p->canvas);
+    p->canvas = NULL;
+    p->have_frame = false;
+
+    // The gather reads the decoded frame directly if it already has the
+    // canvas size; otherwise it is scaled into a canvas image first.
+    bool direct = params->w == p->map->w && params->h == p->map->h &&
+                  p->src_rc.x0 == 0 && p->src_rc.y0 == 0 &&
+                  p->src_rc.x1 == params->w && p->src_rc.y1 == params->h &&
+                  p->dst_rc.x0 == 0 && p->dst_rc.y0 == 0 &&
+                  p->dst_rc.x1 == p->map->w && p->dst_rc.y1 == p->map->h;
+    if (!direct) {
+        p->canvas = mp_image_alloc(IMGFMT_RGB24, p->map->w, p->map->h);
+        if (!p->canvas)
+            return -1;
+        talloc_steal(p, p->canvas);
+        mp_image_clear(p->canvas, 0, 0, p->map->w, p->map->h);
+
+        mp_sws_set_from_cmdline(p->sws, vo->global);
+        p->sws->src = *params;
+        p->sws->src.w = p->src_rc.x1 - p->src_rc.x0;
+        p->sws->src.h = p->src_rc.y1 - p->src_rc.y0;
+        p->sws->dst = (struct mp_image_params) {
+            .imgfmt = IMGFMT_RGB24,
+            .w = p->dst_rc.x1 - p->dst_rc.x0,
+            .h = p->dst_rc.y1 - p->dst_rc.y0,
+            .p_w = 1,
+            .p_h = 1,
+        };
+        if (mp_sws_reinit(p->sws) < 0)
+            return -1;
+        MP_VERBOSE(vo, "Scaling %dx%d to the %dx%d canvas.\n", params->w,
+                   params->h, p->map->w, p->map->h);
+    }
+    p->gather_stride = -1;
+    return 0;
+}
+
+static void uninit(struct vo *vo)
+{
+    struct priv *p = vo->priv;
+
+    if (p->fd >= 0)
+        close(p->fd);
+    p->fd = -1;
+}
+
+static struct sockaddr_in sacn_multicast(int universe, int port)
+{
+    struct sockaddr_in sa = {
+        .sin_family = AF_INET,
+        .sin_port = htons(port),
+        .sin_addr.s_addr = htonl(0xEFFF0000 | (universe & 0xFFFF)),
+    };
+    return sa;
+}
+
+static bool open_socket(struct vo *vo)
+{
+    struct priv *p = vo->priv;
+    char service[16];
+    snprintf(service, sizeof(service), "%d", p->port);
+
+    if (!p->hostname || !p->hostname[0]) {
+        if (p->protocol != LED_PROTO_SACN) {
+            MP_ERR(vo, "No hostname given.\n");
+            return false;
+        }
+        // sACN: multicast to the per universe groups
+        p->fd = socket(AF_INET, SOCK_DGRAM, IPPROTO_UDP);
+        if (p->fd < 0)
+            return false;
+        p->mcast = talloc_array(p, struct sockaddr_in, p->map->num_packets);
+        for (int n = 0; n < p->map->num_packets; n++)
+            p->mcast[n] = sacn_multicast(p->map->packets[n].universe, p->port);
+        p->sync_mcast = sacn_multicast(p->proto.sync_universe, p->port);
+        return true;
+    }
+
+    struct addrinfo hints = {
+        .ai_family = AF_UNSPEC,
+        .ai_socktype = SOCK_DGRAM,
+        .ai_protocol = IPPROTO_UDP,
+    };
+    struct addrinfo *ai = NULL;
+    int r = getaddrinfo(p->hostname, service, &hints, &ai);
+    if (r || !ai) {
+        MP_ERR(vo, "Could not resolve %s: %s\n", p->hostname, gai_strerror(r));
+        return false;
+    }
+    p->fd = socket(ai->ai_family, SOCK_DGRAM, IPPROTO_UDP);
+    if (p->fd >= 0) {
+        // Art-Net installations often use the broadcast address.
+        int on = 1;
+        setsockopt(p->fd, SOL_SOCKET, SO_BROADCAST, &on, sizeof(on));
+        memcpy(&p->dest, ai->ai_addr, MPMIN(ai->ai_addrlen, sizeof(p->dest)));
+        p->dest_len = ai->ai_addrlen;
+    }
+    freeaddrinfo(ai);
+    return p->fd >= 0;
+}
+
+static int preinit(struct vo *vo)
+{
+    struct priv *p = vo->priv;
+    p->fd = -1;
+
+    int max_channels = led_proto_max_channels(p->protocol);
+    if (p->map_file && p->map_file[0]) {
+        p->map = led_map_load(p, vo->log, vo->global, p->map_file, max_channels);
+    } else if (p->width > 0 && p->height > 0) {
+        char *def = talloc_asprintf(p, "panel w=%d h=%d\n", p->width, p->height);
+        p->map = led_map_parse(p, vo->log, bstr0(def), "(default)", max_channels);
+    } else {
+        MP_ERR(vo, "Either a map file or width and height are required.\n");
+    }
+    if (!p->map)
+        return -1;
+
+    struct led_map *m = p->map;
+    int min_universe = p->protocol == LED_PROTO_SACN ? 1 : 0;
+    if (m->packets[0].universe < min_universe ||
+        m->packets[m->num_packets - 1].universe > led_proto_max_universe(p->protocol))
+    {
+        MP_ERR(vo, "Universes must be within %d-%d for this protocol.\n",
+               min_universe, led_proto_max_universe(p->protocol));
+        return -1;
+    }
+
+    p->proto = (struct led_proto){
+        .type = p->protocol,
+        .sync = p->sync,
+        .sync_universe = p->sync_universe ? p->sync_universe
+                                          : m->packets[0].universe,
+        .channels = m->channels,
+    };
+    led_proto_init(&p->proto);
+
+    if (!p->port)
+        p->port = led_proto_default_port(p->protocol);
+    if (!open_socket(vo)) {
+        MP_ERR(vo, "Could not open socket.\n");
+        return -1;
+    }
+    p->tx = mp_dgram_create(p, vo->log, p->fd);
+    if (!p->mcast)
+        mp_dgram_set_dest(p->tx, &p->dest, p->dest_len);
+    mp_dgram_set_rate(p->tx, p->rate, p->burst);
+
+    // Packet arena, zeroed so that unused and padding channels stay dark.
+    p->header_size = led_proto_header_size(p->protocol);
+    p->packet_stride = MP_ALIGN_UP(p->header_size + max_channels, 16);
+    p->packets = talloc_zero_size(p, (size_t)p->packet_stride * m->num_packets);
+
+    p->gather_src = talloc_array(p, uint32_t, m->num_leds);
+    p->gather_dst = talloc_array(p, uint32_t, m->num_leds);
+    for (int i = 0; i < m->num_leds; i++) {
+        struct led_map_entry *e = &m->leds[i];
+        p->gather_dst[i] = e->packet * p->packet_stride + p->header_size + e->channel;
+    }
+    p->gather_stride = -1;
+
+    struct led_color_params cp = {
+        .gamma = p->gamma,
+        .gain = {p->white.r / 255.0, p->white.g / 255.0, p->white.b / 255.0},
+        .limit = {p->limit.r / 255.0, p->limit.g / 255.0, p->limit.b / 255.0},
+        .dither = p->dither,
+    };
+    led_color_init(&p->color, p, &cp, m->num_leds);
+    p->leds = talloc_array(p, uint8_t, m->num_leds * 3);
+
+    p->sws = mp_sws_alloc(p);
+
+    MP_VERBOSE(vo, "%d LEDs in %d universes.\n", m->num_leds, m->num_packets);
+    return 0;
+}
+
+static int control(struct vo *vo, uint32_t request, void *data)
+{
+    return VO_NOTIMPL;
+}
+
+#define OPT_BASE_STRUCT struct priv
+
+const struct vo_driver video_out_led =
+{
+    .description = "Art-Net, sACN (E1.31) and DDP LED installations",
+    .name = "led",
+    .untimed = false,
+    .priv_size = sizeof(struct priv),
+    .options = (const struct m_option[]) {
+        OPT_STRING("hostname", hostname, 0),
+        OPT_INT("port", port, 0),
+        OPT_CHOICE("protocol", protocol, 0,
+                   ({"artnet", LED_PROTO_ARTNET},
+                    {"sacn", LED_PROTO_SACN},
+                    {"ddp", LED_PROTO_DDP})),
+        OPT_STRING("map", map_file, M_OPT_FILE),
+        OPT_INTRANGE("width", width, 0, 0, UINT16_MAX),
+        OPT_INTRANGE("height", height, 0, 0, UINT16_MAX),
+        OPT_CHOICE("order", order, 0,
+                   ({"rgb", ORDER_RGB}, {"rbg", ORDER_RBG},
+                    {"grb", ORDER_GRB}, {"gbr", ORDER_GBR},
+                    {"brg", ORDER_BRG}, {"bgr", ORDER_BGR})),
+        OPT_FLAG("sync", sync, 0, OPTDEF_INT(1)),
+        OPT_INTRANGE("sync-universe", sync_universe, 0, 0, 63999),
+        OPT_BYTE_SIZE("rate", rate, 0, 0, INT64_MAX),
+        OPT_BYTE_SIZE("burst", burst, 0, 1, INT64_MAX, OPTDEF_INT64(256 * 1024)),
+        OPT_FLOATRANGE("gamma", gamma, 0, 0.1, 10, OPTDEF_FLOAT(1)),
+        OPT_COLOR("white", white, 0,
+                  .defval = &(const struct m_color) {
+                      .r = 255, .g = 255, .b = 255, .a = 255,
+                  }),
+        OPT_COLOR("limit", limit, 0,
+                  .defval = &(const struct m_color) {
+                      .r = 255, .g = 255, .b = 255, .a = 255,
+                  }),
+        OPT_FLAG("dither", dither, 0, OPTDEF_INT(1)),
+        {0},
+    },
+    .preinit = preinit,
+    .query_format = query_format,
+    .reconfig = reconfig,
+    .control = control,
+    .draw_image = draw_image,
+    .flip_page = flip_page,
+    .uninit = uninit,
+};
@@ -31,6 +31,8 @@
 #include <pthread.h>
 
 #include <libswscale/swscale.h>
+#include <libavutil/buffer.h>
+#include <libavutil/mem.h>
 
 #include "config.h"
 #include "misc/bstr.h"
@@ -63,11 +65,20 @@ struct priv {
     
     int fd;
     matelight_frame_t msg;
+    
+    //Full size frames are sent in place, one iovec per row
+    struct mp_image* frame;
 };
 
 static void draw_image(struct vo *vo, mp_image_t *in){
     struct priv *p = vo->priv;
-    //Initialize Art-Net message
+    
+    talloc_free(p->frame);
+    p->frame = NULL;
+    if (in->imgfmt == IMGFMT_RGB24 && in->w == IMAGE_WIDTH && in->h == IMAGE_HEIGHT){
+        p->frame = in;
+        return;
+    }
     
     int nChannels = in->fmt.bpp[0] / 8; //Bytes per pixel
     
@@ -84,12 +95,49 @@ static void draw_image(struct vo *vo, mp_image_t *in){
             memcpy(dst,src,3);
         }
     }
+    talloc_free(in);
+}
+
+//Only full size frames are sent in place. The stride is rounded up to the
+//requested alignment; the padding at the end of the rows is not sent.
+static struct mp_image *get_image(struct vo *vo, int imgfmt, int w, int h,
+                                  int stride_align){
+    if (imgfmt != IMGFMT_RGB24 || w != IMAGE_WIDTH || h != IMAGE_HEIGHT) return NULL;
+    
+    int size = mp_image_get_alloc_size(imgfmt, w, h, stride_align);
+    if (size < 0) return NULL;
+    
+    int alloc_size = size + stride_align;
+    uint8_t* ptr = av_malloc(alloc_size);
+    if (!ptr) return NULL;
+    
+    struct mp_image* res = mp_image_from_buffer(imgfmt, w, h, stride_align,
+                                                ptr, alloc_size, NULL,
+                                                av_buffer_default_free);
+    if (!res) av_free(ptr);
+    return res;
 }
 
 static void flip_page(struct vo *vo){
     struct priv *p = vo->priv;
-    if (sendto(p->fd, &(p->msg), sizeof(matelight_frame_t), 0, &p->dest_addr, sizeof(p->dest_addr)) < 0){
-        perror("Sendto failed");
+    struct iovec iov[IMAGE_HEIGHT + 1];
+    int num_iov = 0;
+    if (p->frame){
+        for (int y = 0; y < IMAGE_HEIGHT; y++){
+            iov[num_iov++] = (struct iovec){p->frame->planes[0] + (ptrdiff_t)p->frame->stride[0] * y, IMAGE_WIDTH * 3};
+        }
+        iov[num_iov++] = (struct iovec){p->msg.padding, sizeof(p->msg.padding)};
+    } else {
+        iov[num_iov++] = (struct iovec){&p->msg, sizeof(p->msg)};
+    }
+    struct msghdr mh = {
+        .msg_name = &p->dest_addr,
+        .msg_namelen = sizeof(p->dest_addr),
+        .msg_iov = iov,
+        .msg_iovlen = num_iov,
+    };
+    if (sendmsg(p->fd, &mh, 0) < 0){
+        perror("Sendmsg failed");
     }
 }
 
@@ -106,6 +154,8 @@ static int reconfig(struct vo *vo, struct mp_image_params *params){
 static void uninit(struct vo *vo){
     struct priv *p = vo->priv;
 
+    talloc_free(p->frame);
+    p->frame = NULL;
     close(p->fd);
     p->fd = -1;
 }
@@ -150,6 +200,7 @@ const struct vo_driver video_out_matelight =
     .query_format = query_format,
     .reconfig = reconfig,
     .control = control,
+    .get_image = get_image,
     .draw_image = draw_image,
     .flip_page = flip_page,
     .uninit = uninit,
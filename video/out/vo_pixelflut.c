@@ -30,6 +30,7 @@
 
 #include <pthread.h>
 
+#include <libavutil/buffer.h>
 #include <libswscale/swscale.h>
 
 #include "config.h"
@@ -39,27 +40,36 @@
 #include "common/msg.h"
 #include "video/out/vo.h"
 #include "video/csputils.h"
+#include "video/dirty.h"
 #include "video/mp_image.h"
 #include "video/fmt-conversion.h"
 #include "video/sws_utils.h"
 #include "sub/osd.h"
 #include "options/m_option.h"
-
-#define MAX_RENDER_THREADS 1024
-
-struct priv;
-
-struct write_thread{
-    struct priv* vo;
-    
-    pthread_t pthread;
-    int id;
-    int field_y;
-    int field_step;
-    
-    char tx_buffer[40960];
-    int socket;
-    pthread_mutex_t frame_mutex;
+#include "video/out/pixelflut/diff.h"
+#include "video/out/pixelflut/format.h"
+#include "video/out/pixelflut/net.h"
+#include "video/out/pixelflut/ratectl.h"
+#include "video/out/pixelflut/sched.h"
+#include "video/out/pixelflut/shadow.h"
+#include "osdep/timer.h"
+
+#define MAX_CONNECTIONS 1024
+#define TILE_ROWS 4 //Rows per scheduler tile
+#define PRIO_CHUNK 256 //Pixels formatted per fill in priority order modes
+#define RERANK_INTERVAL (100 * 1000) //Minimum time between repair passes after readback
+#define READBACK_BATCH 64 //Pixel queries per fill of the readback connection
+#define READBACK_WINDOW 4096 //Maximum unanswered pixel queries
+
+//State of one connection, only accessed from the network thread
+struct connection{
+    struct pf_sched_frame* frame; //Frame being drawn, 0 if idle
+    uint32_t gen; //Generation of the last frame taken from the scheduler
+    int tile; //Tile being drawn, -1 if none
+    int y; //Next row of the tile to format
+    size_t bytes; //Bytes queued for the tile so far
+    int64_t start; //Time the tile was started, for throughput measurement
+    struct pf_span* spans; //Dirty spans of the row being formatted
 };
 
 struct priv {
@@ -67,91 +77,136 @@ struct priv {
     int port;
     
     int32_t cfg_colorkey;
+    int cfg_threshold; //Minimum sum of absolute channel differences to redraw a pixel
     int cfg_grayscale_optimize;
     int cfg_full_frames; //Always draw full frames, drop new ones until complete (default, use for video)
     int cfg_full_redraw; //Always write pixels even if not changed since last frame
+    int cfg_protocol;
+    int cfg_offset_cmd; //Server supports OFFSET, send canvas relative coordinates
+    int cfg_order; //Scanline order, or priority order from the shadow canvas
+    int64_t cfg_budget; //Maximum bytes per frame in priority order modes, 0 = unlimited
+    int cfg_adapt; //Adapt size, diff threshold, colours and frame rate to the link
+    float cfg_latency; //Target for the data waiting to be sent, in seconds
+    float cfg_min_fps;
     
     int offset_x;
     int offset_y;
     
-    mp_image_t* current;
-    mp_image_t* last;
-    
-    int frame_drawn;
-    int flip; //Requests threads to stop writing the current frame
-    int quit; //Requests threads to exit
+    struct pf_format fmt; //Command formatter, rebuilt on reconfig
     
-    int num_threads;
-    struct write_thread* threads[MAX_RENDER_THREADS];
+    mp_image_t* current;
+    mp_image_t* last; //Last frame that was drawn completely, reference for the diff
+    
+    struct pf_sched* sched; //Hands out tiles of the current frame to the connections
+    struct pf_net* net; //Owns all sockets, runs the callbacks below on its thread
+    
+    struct pf_ratectl* ratectl; //0 if adapt is off
+    struct pf_ratectl_params rate_params; //Settings of the current frame
+    
+    int num_conns;
+    struct connection* conns;
+    
+    //Priority order modes, only used by the network thread
+    struct pf_shadow shadow; //What the canvas probably shows
+    struct pf_sched_frame* prio_frame; //Frame being sent, 0 if idle
+    uint32_t prio_gen;
+    bool prio_tile; //Owns the single tile of prio_frame, reports completion
+    int64_t prio_bytes; //Bytes sent for prio_frame
+    int64_t prio_start;
+    bool rerank; //Shadow was corrected by readback, rank the frame again
+    int64_t rerank_time;
+    int num_drawing; //Connected draw connections
+    
+    //Readback connection, only used by the network thread
+    int cfg_readback; //Pixel queries per second, 0 = off
+    int reader_id; //Connection id, -1 if off
+    int reader_num;
+    int reader_step;
+    int reader_pos;
+    int reader_pending; //Queries without answer yet
+    int64_t reader_next; //Time of the next batch of queries
+    char reader_line[64];
+    int reader_line_len;
+    int64_t readback_fixed; //Pixels found overwritten
 };
 
-typedef struct point{
-    int x;
-    int y;
-} point_t;
-
-
-static struct write_thread* draw_thread_create(struct priv* vo, int id, int field_y, int field_step);
-static void* draw_thread(void* arg);
-static int draw_thread_connect(struct write_thread* thread);
-static int draw_thread_draw_frame(struct write_thread* thread);
-static int write_thread_write(struct write_thread* thread, char* buffer, int len);
 
+//Per frame settings, in pf_sched_frame.priv
+struct frame_priv {
+    int threshold;
+};
 
 
-static inline size_t itoa10(char* s, unsigned int i){
-    if (i == 0) {*s = '0'; return 1;}
-    int len = 0;
-    
-    unsigned int tmp = i;
-    while (tmp){
-         tmp /= 10;
-         len++;
+static const char* depth_name(enum pf_depth depth){
+    switch (depth){
+    case PF_DEPTH_GRAY: return "gray";
+    default: return "24";
     }
-    
-    s+=len-1;
-    
-    while (i){
-        unsigned int d = i / 10;
-        unsigned int r = i - (d * 10);
-        
-        *s = '0' + r;
-        i = d;
-        
-        s--;
+}
+
+//Reduce the frame to the rate control settings, in place
+static void reduce_frame(struct vo *vo, mp_image_t* img){
+    struct priv* p = (struct priv*)vo->priv;
+    if (p->rate_params.depth == PF_DEPTH_24 || !mp_image_make_writeable(img)) return;
+    //The pixels don't match the source anymore, neither does its dirty map
+    av_buffer_unref(&img->dirty);
+    for (int y = 0; y < img->h; y++){
+        uint8_t* px = img->planes[0] + y * img->stride[0];
+        for (int x = 0; x < img->w * 3; x += 3){
+            uint8_t v = (77 * px[x] + 150 * px[x + 1] + 29 * px[x + 2]) >> 8;
+            px[x] = px[x + 1] = px[x + 2] = v;
+        }
     }
-    return len;
 }
 
 static void draw_image(struct vo *vo, mp_image_t *new){
     struct priv* p = (struct priv*)vo->priv;
     
-    p->flip = 1; //Tell threads not to start rendering the current frame again.
+    if (p->ratectl && !pf_ratectl_want_frame(p->ratectl)){ //Frame rate reduced
+        talloc_free(new);
+        return;
+    }
     
-//     fprintf(stderr, "Draw: Flip...\n");
-    for (int i = 0; i < p->num_threads; i++){ //Wait for all threads to finish rendering the current frame
-        pthread_mutex_lock(&p->threads[i]->frame_mutex);
+    //In full frame mode, let the connections finish the previous frame first
+    int64_t start = mp_time_us();
+    bool drawn = p->cfg_full_frames ? pf_sched_wait_complete(p->sched) : pf_sched_frame_complete(p->sched);
+    
+    if (p->ratectl){
+        struct pf_net_stats stats;
+        pf_net_get_stats(p->net, &stats);
+        int64_t now = mp_time_us();
+        struct pf_ratectl_sample sample = {
+            .time = now,
+            .bytes_sent = stats.bytes_sent,
+            .queued = stats.queued,
+            .stall = (now - start) / 1e6,
+            .dropped = p->current && !drawn,
+            .frame_time = new->nominal_fps > 0 ? 1 / new->nominal_fps : 0,
+        };
+        pf_ratectl_update(p->ratectl, &sample, &p->rate_params);
+        reduce_frame(vo, new);
     }
     
     //Flip frame buffers
-    if (p->frame_drawn){ //update last frame only if the current frame was actually drawn, otherwise we mess up the reference for drawing only changed pixels.
+    if (drawn){ //update last frame only if the current frame was actually drawn, otherwise we mess up the reference for drawing only changed pixels.
         if (p->last) talloc_free(p->last);
         p->last = p->current;
     } else {
         talloc_free(p->current);
     }
     p->current = new;
-    p->frame_drawn = 0;
-
-//     fprintf(stderr, "Draw: Fliped\n");
-    
-    //Restart render threads
-    p->flip = 0;
-    for (int i = 0; i < p->num_threads; i++){
-        pthread_mutex_unlock(&p->threads[i]->frame_mutex);
-    }
     
-//     fprintf(stderr, "Draw: Resumed\n");
+    //Hand the new frame to the connections. The frame holds its own references,
+    //so the images above can be replaced while it is still being drawn.
+    //Priority modes send from one global queue, so the frame is a single tile
+    int tile_rows = p->cfg_order == PF_ORDER_ROWS ? TILE_ROWS : new->h;
+    struct pf_sched_frame* f = pf_sched_frame_alloc(new->h, tile_rows);
+    struct frame_priv* fp = talloc_zero(f, struct frame_priv);
+    fp->threshold = p->ratectl ? p->rate_params.threshold : p->cfg_threshold;
+    f->priv = fp;
+    f->cur = talloc_steal(f, mp_image_new_ref(new));
+    if (p->last) f->ref = talloc_steal(f, mp_image_new_ref(p->last));
+    pf_sched_publish(p->sched, f);
 }
 
 
@@ -159,177 +214,268 @@ static void flip_page(struct vo *vo){
     
 }
 
-static struct write_thread* draw_thread_create(struct priv* vo, int id, int field_y, int field_step){
-    struct write_thread* thread = malloc(sizeof(struct write_thread));
-    thread->id = id;
-    thread->field_y = field_y;
-    thread->field_step = field_step;
-    thread->socket = -1;
-    thread->vo = vo;
-    if (pthread_create(&thread->pthread, 0, draw_thread, thread) == 0){
-        fprintf(stderr, "Thread %i: Created\n", id);
-        return thread; //Ok
-    } else { //Error
-        fprintf(stderr, "Thread %i: Faild to create\n", id);
-        free(thread);
-        return 0;
-    }
+static void release_frame(struct priv* p, int id){
+    struct connection* c = &p->conns[id];
+    if (!c->frame) return;
+    //Keep painting a still image while there is no new frame, whoever draws the last tile restarts it
+    if (p->cfg_full_redraw) pf_sched_repeat(p->sched, c->frame);
+    pf_sched_release(p->sched, c->frame);
+    c->frame = 0;
 }
 
-static void* draw_thread(void* arg){
-    struct write_thread* thread = (struct write_thread*)arg;
-    pthread_mutex_init(&thread->frame_mutex, 0);
+//Report the frame as drawn (queue empty or budget used up)
+static void prio_done(struct priv* p){
+    if (!p->prio_tile) return;
+    pf_sched_tile_done(p->sched, 0, p->prio_frame, p->prio_bytes, mp_time_us() - p->prio_start);
+    p->prio_tile = false;
+}
 
-    fprintf(stderr, "Thread %i: Running...\n",thread->id);
-    
-//    double pts = -100;
-    
-    while (thread->vo->quit == 0) {
-        if ((thread->socket < 0) && (draw_thread_connect(thread) == 0)) sleep(1); //Connect until succesful or exit
-        if (thread->socket < 0) continue; //Not connected
-        if (thread->vo->current == 0) {usleep(100); continue;} //No frame to draw
-        if (thread->vo->flip) {usleep(10); continue;} //Wait for new frame from vo thread
-//         if ((thread->vo->cfg_full_redraw == 0) && (thread->vo->current->pts == pts)) {usleep(10); continue;}
-        
-//        pts = thread->vo->current->pts;
-        
-        pthread_mutex_lock(&thread->frame_mutex);
-        if (draw_thread_draw_frame(thread) == 0){
-            fprintf(stderr, "Thread %i: Write failed\n",thread->id);
-            close(thread->socket);
-            thread->socket = -1;
-        } else {
-            thread->vo->frame_drawn = 1;
-        }
-        pthread_mutex_unlock(&thread->frame_mutex);
-    }
-    
-    pthread_mutex_destroy(&thread->frame_mutex);
-    if (thread->socket >= 0 )close(thread->socket);
-    thread->socket = -1;
-    return 0;
+static void prio_release(struct priv* p){
+    if (!p->prio_frame) return;
+    pf_sched_release(p->sched, p->prio_frame);
+    p->prio_frame = 0;
+    p->prio_tile = false;
 }
 
-static int draw_thread_connect(struct write_thread* thread){
-    if (thread->socket >= 0) close(thread->socket);
-    thread->socket = -1;
-    
-    struct sockaddr_in dest_addr;
+static void net_state(void* ctx, struct pf_net* net, int id, bool connected){
+    struct priv* p = ctx;
     
-    int fd = socket(AF_INET, SOCK_STREAM|SOCK_NONBLOCK, IPPROTO_TCP);
-    fprintf(stderr, "Thread %i: Opened socket %i\n", thread->id, fd);
-    if (fd < 0) return 0;
-    
-    memset((char *) &dest_addr, 0, sizeof(struct sockaddr_in)); 
-    dest_addr.sin_family = AF_INET;
-    dest_addr.sin_port = htons(thread->vo->port);
-    if (inet_aton(thread->vo->hostname, &dest_addr.sin_addr)==0) return -1;
+    if (id == p->reader_id){
+        p->reader_pending = 0;
+        p->reader_line_len = 0;
+        return;
+    }
     
-    int ret = EINPROGRESS;
+    struct connection* c = &p->conns[id];
+    p->num_drawing += connected ? 1 : -1;
+    //Without connections, let go of the frame so reconfig doesn't wait for it
+    if (!p->num_drawing) prio_release(p);
     
-    while (ret == EINPROGRESS){
-        ret = 0;
-        if (connect(fd, &dest_addr, sizeof(struct sockaddr_in)) < 0) ret = errno;
+    if (connected){
+        c->gen = 0; //Join the current frame, there may be tiles left to steal
+        pf_sched_set_active(p->sched, id, true);
+        char* header = pf_net_reserve(net, id, PF_FORMAT_MAX_CMD);
+        pf_net_commit(net, id, pf_format_header(&p->fmt, header));
+    } else {
+        pf_sched_set_active(p->sched, id, false); //Don't get tiles assigned while disconnected
+        if (c->tile >= 0) pf_sched_tile_failed(p->sched, c->frame);
+        c->tile = -1;
+        release_frame(p, id);
     }
-    if (ret < 0){
-        fprintf(stderr, "Thread %i:", thread->id);
-        perror("Connect failed");
-        return 0;
+}
+
+static int gcd(int a, int b){
+    while (b){
+        int t = a % b;
+        a = b;
+        b = t;
     }
-    fprintf(stderr, "Thread %i: Connected\n", thread->id);
-    
-    thread->socket = fd;
-    return 1;
+    return a;
 }
 
-static int draw_thread_draw_frame(struct write_thread* thread){
-    struct priv *p = thread->vo;
+static struct pf_diff_params diff_params(struct priv* p, struct pf_sched_frame* f){
+    struct frame_priv* fp = f->priv;
+    return (struct pf_diff_params){
+        .threshold = fp->threshold,
+        .colorkey = p->cfg_colorkey,
+        .key_threshold = 3,
+        .full = p->cfg_full_redraw,
+    };
+}
+
+//Priority order modes: all connections take pixels from one queue, ranked
+//against the shadow canvas when a new frame arrives. Pixels that don't make
+//it out before the next frame (or exceed the budget) stay dirty in the shadow
+//and move up in the next ranking. The frame is kept until it is superseded,
+//so pixels found overwritten by readback can be repaired.
+static bool prio_fill(struct priv* p, struct pf_net* net, int id){
+    if (p->prio_frame && pf_sched_superseded(p->sched, p->prio_gen)) prio_release(p);
+    
+    int64_t now = mp_time_us();
+    if (!p->prio_frame){
+        struct pf_sched_frame* f = pf_sched_poll_frame(p->sched, 0, &p->prio_gen);
+        if (!f) return false; //Nothing new to draw
+        struct pf_diff_params diff = diff_params(p, f);
+        p->prio_frame = f;
+        p->prio_tile = pf_sched_next_tile(p->sched, 0, p->prio_gen) >= 0;
+        p->prio_bytes = 0;
+        p->prio_start = now;
+        
+        if ((p->shadow.w != f->cur->w) || (p->shadow.h != f->cur->h)) pf_shadow_init(&p->shadow, p, f->cur->w, f->cur->h);
+        pf_shadow_rank(&p->shadow, &diff, f->cur, p->cfg_order);
+        p->rerank = false;
+    } else if (p->rerank && (now >= p->rerank_time)){ //Readback found overwritten pixels
+        struct pf_diff_params diff = diff_params(p, p->prio_frame);
+        pf_shadow_rank(&p->shadow, &diff, p->prio_frame->cur, p->cfg_order);
+        p->rerank = false;
+        p->rerank_time = now + RERANK_INTERVAL;
+        p->prio_bytes = 0; //Repairs get their own budget
+    }
     
+    mp_image_t* cur = p->prio_frame->cur;
+    if ((cur->w > p->fmt.w) || (cur->h > p->fmt.h)) return false; //Not configured for this size yet
     
-    int line_step = p->current->stride[0];
-    uint8_t* img_data = p->current->planes[0];
+    char* dst = pf_net_reserve(net, id, PRIO_CHUNK * PF_FORMAT_MAX_CMD);
+    size_t len = 0;
+    int left = PRIO_CHUNK;
+    while (left > 0){
+        if (p->cfg_budget && (p->prio_bytes + (int64_t)len >= p->cfg_budget)) break;
+        int x, y;
+        int n = pf_shadow_next_run(&p->shadow, cur, left, &x, &y);
+        if (!n) break;
+        len += pf_format_run(&p->fmt, dst + len, cur->planes[0] + y * cur->stride[0] + x * 3, x, y, n);
+        left -= n;
+    }
+    pf_net_commit(net, id, len);
+    p->prio_bytes += len;
     
-    uint8_t* last_img_data = p->last ? p->last->planes[0] : 0;
+    if (left == PRIO_CHUNK){ //Queue empty or budget used up
+        prio_done(p);
+        return false;
+    }
+    return true;
+}
+
+//Readback connection: query pixels of the canvas in a scattered order, at
+//cfg_readback pixels per second, and correct the shadow with the answers.
+static bool reader_fill(struct priv* p, struct pf_net* net, int id){
+    int64_t now = mp_time_us();
+    int num = p->shadow.w * p->shadow.h;
+    if (!p->shadow.valid || !num || (p->reader_pending >= READBACK_WINDOW)){
+        pf_net_set_timer(net, id, now + 100 * 1000); //Nothing to compare with yet, or wait for answers
+        return false;
+    }
+    if (now < p->reader_next){
+        pf_net_set_timer(net, id, p->reader_next);
+        return false;
+    }
     
-//     fprintf(stderr, "Thread %i, Last %p\n", thread->id, p->last);
+    if (p->reader_num != num){ //Step through all pixels with a stride coprime to their number
+        p->reader_num = num;
+        p->reader_step = num * 618LL / 1000;
+        while ((p->reader_step > 1) && (gcd(p->reader_step, num) != 1)) p->reader_step--;
+        if (p->reader_step < 1) p->reader_step = 1;
+        p->reader_pos = 0;
+    }
     
-    char* d = thread->tx_buffer;
+    char* dst = pf_net_reserve(net, id, READBACK_BATCH * PF_FORMAT_MAX_CMD);
     size_t len = 0;
-    
-    for (int y = thread->field_y; y < p->current->h; y+=thread->field_step){
-        if ((thread->vo->cfg_full_frames == 0) && thread->vo->flip) return 1;
-        for (int x = 0; x < p->current->w; x++){
-            uint8_t* px = &img_data[(y * line_step) + (x * 3)];
-            uint8_t* last_px = last_img_data ? &last_img_data[(y * line_step) + (x * 3)] : 0;
-            if (p->cfg_full_redraw || ((last_px == 0) || (p->current->stride[0] != p->last->stride[0]) || (p->current->h != p->last->h)
-                || (abs((int)px[0] - (int)last_px[0]) + abs((int)px[1] - (int)last_px[1]) + abs((int)px[2] - (int)last_px[2]) ) > 4)
-            /*|| (rand() < (RAND_MAX/10))*/){
-                
-                size_t l= 0;
-                //if (x == 0 && y == 0) printf("%i %i %i %i\n", (p->cfg_colorkey & 0xFF) , (int)px[0], (p->cfg_colorkey & 0xFF) - (int)px[0], abs( (p->cfg_colorkey & 0xFF) - (int)px[0]));
-                if ((p->cfg_colorkey < 0) || (abs( (p->cfg_colorkey & 0xFF) - (int)px[0]) + abs( ((p->cfg_colorkey >> 8) & 0xFF) - (int)px[1]) + abs( ((p->cfg_colorkey >> 16) & 0xFF) - (int)px[2]) ) > 3){
-                    point_t t = {p->offset_x + x, p->offset_y + y};
-                    
-                    if (p->cfg_grayscale_optimize && (px[0] == px[1]) && (px[1] == px[2])){ //Grayscale optimize
-                        l = sprintf(d, "PX %i %i %02x\n", t.x, t.y, px[0]);
-                    } else {
-                        l = sprintf(d, "PX %i %i %02x%02x%02x\n", p->offset_x + x, p->offset_y + y, px[0], px[1], px[2]);
-                    }
-                    
-                } else {
-//                    l = sprintf(d, "PX %i %i 000000\n", p->offset_x + x, p->offset_y + y);
-                }
-                d+=l;
-                len +=l;
-                if (len > 4000){
-//                     fprintf(stderr, "Thread %i: Flush...\n", thread->id);
-                    int ok = (write_thread_write(thread, thread->tx_buffer, len) >= 0);
-//                     fprintf(stderr, "Thread %i: Flushed\n", thread->id);
-                    if (!ok) return 0;                    
-                    len = 0;
-                    d = thread->tx_buffer;
-                }
-            }
+    for (int i = 0; i < READBACK_BATCH; i++){
+        int x = p->reader_pos % p->shadow.w;
+        int y = p->reader_pos / p->shadow.w;
+        p->reader_pos = (p->reader_pos + p->reader_step) % num;
+        len += sprintf(dst + len, "PX %i %i\n", p->offset_x + x, p->offset_y + y);
+    }
+    pf_net_commit(net, id, len);
+    p->reader_pending += READBACK_BATCH;
+    p->reader_next = MPMAX(p->reader_next, now - 1000 * 1000) + READBACK_BATCH * (int64_t)1000000 / p->cfg_readback;
+    return true;
+}
+
+static void reader_line(struct priv* p, struct pf_net* net, const char* line){
+    int x, y;
+    char hex[9];
+    if (sscanf(line, "PX %d %d %8[0-9a-fA-F]", &x, &y, hex) != 3) return; //Not an answer to us
+    if (p->reader_pending > 0) p->reader_pending--;
+    x -= p->offset_x;
+    y -= p->offset_y;
+    if ((x < 0) || (y < 0) || (x >= p->shadow.w) || (y >= p->shadow.h) || (strlen(hex) < 6)) return;
+    
+    unsigned long v = strtoul(hex, 0, 16) >> ((strlen(hex) - 6) * 4); //Ignore alpha
+    uint8_t rgb[3] = {v >> 16, v >> 8, v};
+    const uint8_t* known = p->shadow.rgb + ((size_t)y * p->shadow.w + x) * 3;
+    int err = abs(rgb[0] - known[0]) + abs(rgb[1] - known[1]) + abs(rgb[2] - known[2]);
+    if (err <= p->cfg_threshold) return;
+    
+    pf_shadow_store(&p->shadow, x, y, rgb, 1);
+    p->readback_fixed++;
+    if (!p->rerank){
+        p->rerank = true;
+        pf_net_wakeup(net); //Let idle connections re-send
+    }
+}
+
+static void net_recv(void* ctx, struct pf_net* net, int id, const char* data, size_t len){
+    struct priv* p = ctx;
+    if (id != p->reader_id) return;
+    
+    for (size_t i = 0; i < len; i++){
+        if (data[i] == '\n'){
+            p->reader_line[p->reader_line_len] = 0;
+            reader_line(p, net, p->reader_line);
+            p->reader_line_len = 0;
+        } else if (p->reader_line_len < (int)sizeof(p->reader_line) - 1){
+            p->reader_line[p->reader_line_len++] = data[i];
         }
     }
-    
-//     fprintf(stderr, "Thread %i: Flush...\n", thread->id);
-    int ok = (write_thread_write(thread, thread->tx_buffer, len) >= 0);
-//     fprintf(stderr, "Thread %i: Flushed/Done\n", thread->id);
-    
-    return ok;
+    if (p->reader_pending < READBACK_WINDOW / 2) pf_net_set_timer(net, id, mp_time_us());
 }
 
-static int write_thread_write(struct write_thread* thread, char* buffer, int len){
-    char* b = buffer;
-    int timeout = 100*1000; //1000ms
-    int error = 0;
-    while (len && (error == 0) && (thread->vo->cfg_full_frames || !thread->vo->flip) && (thread->vo->quit == 0)){
-        int ret = write(thread->socket, b, len);
-        if (ret >= 0){
-            b += ret;
-            len -= ret;
-        } else {
-            if (errno != EAGAIN && errno != EWOULDBLOCK){
-                fprintf(stderr, "Thread %i:", thread->id);
-                perror("Write error");
-                error = 1;
-            } else { //Give more time
-                usleep(100);
-                timeout--;
-                if (timeout == 0){
-                    error = 1;
-                    fprintf(stderr, "Thread %i: Write timeout\n", thread->id);
-                }
+//Format the next row with changed pixels. Called by the network thread whenever
+//the previous data of this connection was written out.
+static bool net_fill(void* ctx, struct pf_net* net, int id){
+    struct priv* p = ctx;
+    struct connection* c = &p->conns[id];
+    
+    if (id == p->reader_id) return reader_fill(p, net, id);
+    if (p->cfg_order != PF_ORDER_ROWS) return prio_fill(p, net, id);
+    
+    while (1){
+        if (!c->frame){
+            c->frame = pf_sched_poll_frame(p->sched, id, &c->gen);
+            if (!c->frame) return false; //Nothing new to draw
+            c->tile = -1;
+        }
+        struct pf_sched_frame* f = c->frame;
+        
+        if (c->tile < 0){
+            c->tile = pf_sched_next_tile(p->sched, id, c->gen);
+            if (c->tile < 0){ //Frame done or superseded
+                release_frame(p, id);
+                continue;
             }
+            c->y = c->tile * f->tile_h;
+            c->bytes = 0;
+            c->start = mp_time_us();
         }
+        
+        mp_image_t* cur = f->cur;
+        mp_image_t* last = f->ref;
+        int y_end = MPMIN((c->tile + 1) * f->tile_h, cur->h);
+        if ((c->y >= y_end) || (cur->w > p->fmt.w) || (cur->h > p->fmt.h)){ //Tile written out (or not configured for this size yet)
+            pf_sched_tile_done(p->sched, id, f, c->bytes, mp_time_us() - c->start);
+            c->tile = -1;
+            continue;
+        }
+        if (last && ((last->w != cur->w) || (last->h != cur->h))) last = 0; //Size changed, redraw everything
+        
+        struct pf_diff_params diff = diff_params(p, f);
+        MP_TARRAY_GROW(p, c->spans, cur->w);
+        
+        int y = c->y++;
+        uint8_t* row = cur->planes[0] + y * cur->stride[0];
+        uint8_t* last_row = last ? last->planes[0] + y * last->stride[0] : 0;
+        int num_spans = pf_diff_row_dirty(&diff, mp_image_get_dirty(cur, last), row, last_row, cur->w, y, c->spans);
+        if (!num_spans) continue;
+        
+        int n = 0;
+        for (int s = 0; s < num_spans; s++) n += c->spans[s].len;
+        char* dst = pf_net_reserve(net, id, (size_t)n * PF_FORMAT_MAX_CMD);
+        size_t len = 0;
+        for (int s = 0; s < num_spans; s++){
+            int x = c->spans[s].x;
+            len += pf_format_run(&p->fmt, dst + len, &row[x * 3], x, y, c->spans[s].len);
+        }
+        pf_net_commit(net, id, len);
+        c->bytes += len;
+        return true;
     }
-    if (error){
-        return -1;
-    }
-    
-    return len;
-}           
+}
+
+static void sched_wakeup(void* ctx){
+    struct priv* p = ctx;
+    if (p->net) pf_net_wakeup(p->net);
+}
 
 
 static int query_format(struct vo *vo, int fmt){
@@ -339,33 +485,92 @@ static int query_format(struct vo *vo, int fmt){
 
 
 static int reconfig(struct vo *vo, struct mp_image_params *params){
+    struct priv *p = vo->priv;
+    
+    pf_sched_flush(p->sched); //Wait until no connection uses the formatter anymore
+    
+    //Frames of the old size are useless as diff reference
+    talloc_free(p->current);
+    talloc_free(p->last);
+    p->current = 0;
+    p->last = 0;
+    
+    struct pf_format_opts opts = {
+        .protocol = p->cfg_protocol,
+        .offset_x = p->offset_x,
+        .offset_y = p->offset_y,
+        .offset_cmd = p->cfg_offset_cmd,
+        .grayscale = p->cfg_grayscale_optimize,
+    };
+    if (pf_format_init(&p->fmt, p, params->w, params->h, &opts) < 0) {
+        MP_ERR(vo, "Coordinates don't fit the protocol (offset too large?).\n");
+        return -1;
+    }
+    
     return 0;
 }
 
 static void uninit(struct vo *vo){
     struct priv *p = vo->priv;
-    p->quit = 1;
     
-    for (int i = 0; i < p->num_threads; i++){
-        pthread_join(p->threads[i]->pthread, 0);
-        free(p->threads[i]);
+    pf_sched_set_wakeup(p->sched, 0, 0);
+    pf_sched_terminate(p->sched);
+    talloc_free(p->net); //Stops the network thread
+    p->net = 0;
+    for (int i = 0; i < p->num_conns; i++){
+        if (p->conns[i].frame) pf_sched_release(p->sched, p->conns[i].frame);
     }
+    prio_release(p);
+    if (p->reader_id >= 0) MP_VERBOSE(vo, "Readback: %lld overwritten pixels found\n", (long long)p->readback_fixed);
+    talloc_free(p->current);
+    talloc_free(p->last);
 }
 
 static int preinit(struct vo *vo){
     
     struct priv *p = vo->priv;
     if (!p->hostname){
-        printf("Pixeflut server not specified!");
+        MP_ERR(vo, "Pixeflut server not specified!\n");
         return -1;
     }
-    printf("Pixeflut server: %s\n", p->hostname);
-    printf("Colorkey: %06x\n", p->cfg_colorkey);
+    MP_INFO(vo, "Pixeflut server: %s\n", p->hostname);
+    MP_VERBOSE(vo, "Colorkey: %06x\n", p->cfg_colorkey);
+    MP_VERBOSE(vo, "Diff kernel: %s\n", pf_diff_kernel_name());
     p->last = 0;
     p->current = 0;
     
-    for (int i = 0; i < p->num_threads; i++){
-        p->threads[i] = draw_thread_create(p, i, i , p->num_threads);
+    if (p->num_conns < 1) p->num_conns = 1;
+    if (p->num_conns > MAX_CONNECTIONS) p->num_conns = MAX_CONNECTIONS;
+    p->conns = talloc_zero_array(p, struct connection, p->num_conns);
+    for (int i = 0; i < p->num_conns; i++) p->conns[i].tile = -1;
+    
+    //Readback needs the shadow canvas, which only the priority modes maintain
+    if (p->cfg_readback > 0 && p->cfg_order == PF_ORDER_ROWS){
+        MP_WARN(vo, "readback requires a priority order, using order=error\n");
+        p->cfg_order = PF_ORDER_ERROR;
+    }
+    p->reader_id = p->cfg_readback > 0 ? p->num_conns : -1;
+    
+    p->sched = pf_sched_create(p, p->num_conns);
+    pf_sched_set_wakeup(p->sched, sched_wakeup, p);
+    
+    struct pf_net_callbacks cb = {
+        .ctx = p,
+        .state = net_state,
+        .fill = net_fill,
+        .recv = net_recv,
+    };
+    p->net = pf_net_create(p, vo->log, p->hostname, p->port, p->num_conns + (p->reader_id >= 0), &cb);
+    if (!p->net) return -1;
+    
+    if (p->cfg_adapt){
+        struct pf_ratectl_opts opts = {
+            .target_latency = p->cfg_latency,
+            .min_fps = p->cfg_min_fps,
+            .base_threshold = p->cfg_threshold,
+            .gray = p->cfg_grayscale_optimize && p->cfg_protocol == PF_PROTO_TEXT,
+        };
+        p->ratectl = pf_ratectl_create(p, &opts);
     }
     
     return 0;
@@ -373,6 +578,25 @@ static int preinit(struct vo *vo){
 
 static int control(struct vo *vo, uint32_t request, void *data)
 {
+    struct priv* p = vo->priv;
+    
+    switch (request){
+    case VOCTRL_GET_RATE_CONTROL: {
+        if (!p->ratectl) return VO_NOTAVAIL;
+        struct pf_ratectl_state st;
+        pf_ratectl_get_state(p->ratectl, &st);
+        *(struct voctrl_rate_control*)data = (struct voctrl_rate_control){
+            .level = st.params.level,
+            .num_levels = st.num_levels,
+            .threshold = st.params.threshold,
+            .depth = depth_name(st.params.depth),
+            .skip = st.params.skip,
+            .rate = st.rate,
+            .latency = st.latency,
+        };
+        return VO_TRUE;
+    }
+    }
     return VO_NOTIMPL;
 }
 
@@ -383,17 +607,33 @@ const struct vo_driver video_out_pixelflut =
     .description = "Transmit video to Pixelflut canvas server",
     .name = "pixelflut",
     .untimed = false,
+    .caps = VO_CAP_DIRTY,
     .priv_size = sizeof(struct priv),
     .options = (const struct m_option[]) {
         OPT_STRING("server", hostname,        0),
         OPT_INT("x",           offset_x,        0),
         OPT_INT("y",           offset_y,        0),
         OPT_INT("colorkey",    cfg_colorkey,    0, OPTDEF_INT(-1)),
+        OPT_INTRANGE("threshold", cfg_threshold, 0, 0, 765, OPTDEF_INT(4)),
         OPT_INT("grayscale",   cfg_grayscale_optimize, 0),
         OPT_INT("port",        port,            0, OPTDEF_INT(1234)),
-        OPT_INT("threads",     num_threads,     0, OPTDEF_INT(1)),
+        OPT_INT("connections", num_conns,       0, OPTDEF_INT(1)),
+        OPT_REPLACED("threads", "connections"),
         OPT_INT("fullframe",   cfg_full_frames, 0, OPTDEF_INT(1)),
         OPT_INT("fullredraw",  cfg_full_redraw, 0, OPTDEF_INT(0)),
+        OPT_CHOICE("protocol", cfg_protocol,    0,
+                   ({"text",   PF_PROTO_TEXT},
+                    {"binary", PF_PROTO_BINARY})),
+        OPT_FLAG("offsetcmd",  cfg_offset_cmd,  0),
+        OPT_CHOICE("order",    cfg_order,       0,
+                   ({"rows",   PF_ORDER_ROWS},
+                    {"error",  PF_ORDER_ERROR},
+                    {"age",    PF_ORDER_AGE})),
+        OPT_BYTE_SIZE("budget", cfg_budget,     0, 0, INT64_MAX),
+        OPT_INTRANGE("readback", cfg_readback,  0, 0, 10000000),
+        OPT_FLAG("adapt",      cfg_adapt,       0),
+        OPT_FLOATRANGE("latency", cfg_latency,  0, 0.01, 10, OPTDEF_FLOAT(0.2)),
+        OPT_FLOATRANGE("minfps", cfg_min_fps,   0, 0, 1000, OPTDEF_FLOAT(10)),
         {0},
     },
     .preinit = preinit,
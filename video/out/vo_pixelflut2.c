@@ -30,26 +30,36 @@
 
 #include <pthread.h>
 
+#include <libavutil/cpu.h>
 #include <libswscale/swscale.h>
 
 #include "config.h"
 #include "misc/bstr.h"
+#include "misc/thread_pool.h"
+#include "osdep/atomic.h"
 #include "osdep/io.h"
+#include "osdep/timer.h"
 #include "common/common.h"
 #include "common/msg.h"
 #include "video/out/vo.h"
 #include "video/csputils.h"
+#include "video/dirty.h"
 #include "video/mp_image.h"
 #include "video/fmt-conversion.h"
 #include "video/sws_utils.h"
 #include "sub/osd.h"
 #include "options/m_option.h"
+#include "video/out/pixelflut/diff.h"
+#include "video/out/pixelflut/format.h"
 
 #define MAX_RENDER_THREADS   1000
-#define TX_BUFFER_BLOCKS     12000
-#define TX_BUFFER_BLOCK_SIZE 4096
+#define MAX_CONVERT_THREADS  64
+#define BANDS_PER_THREAD     4    //More bands than workers, so dense bands don't hold up the frame
+#define MIN_BAND_ROWS        16
+#define TX_CHUNK_SIZE        4096 //Maximum size of the blocks handed to the write threads
 
 struct priv;
+struct tx_set;
 
 struct pixel{
     uint8_t r;
@@ -69,158 +79,279 @@ struct write_thread{
     int socket;
 };
 
+struct tx_chunk{
+    char* data;
+    int len;
+};
+
+//A horizontal band of a frame, diffed and formatted by one pool worker
+struct tx_band{
+    struct priv* vo;
+    struct tx_set* set;
+    int y0, y1;
+    
+    void* ta; //Parent of the allocations below, only touched by the band's worker
+    struct pf_span* spans; //Dirty spans of the row being formatted
+    char* buf; //Commands of the band, grown as needed
+    size_t len;
+    size_t* ends; //End offset of each chunk in buf
+    int num_chunks;
+};
+
+//A converted frame. There are two of them: the write threads drain the front
+//one while draw_image converts the next frame into the back one.
+struct tx_set{
+    mp_image_t* img; //Frame converted into this set
+    mp_image_t* ref; //Diff reference, only valid during conversion
+    struct mp_dirty* dirty; //Changed tiles of img relative to ref, or 0
+    struct pf_diff_params diff;
+    
+    struct tx_band* bands;
+    int num_bands;
+    
+    struct tx_chunk* chunks; //Chunks of all bands in row order
+    int num_chunks;
+    int next_chunk; //Next chunk handed to a write thread
+    bool complete; //Every chunk was handed out at least once
+};
+
 struct priv {
     char *hostname;
     int port;
     
     int32_t cfg_colorkey;
+    int cfg_threshold; //Minimum sum of absolute channel differences to redraw a pixel
     int cfg_grayscale_optimize;
     int cfg_full_frames; //Always draw full frames, drop new ones until complete (default, use for video)
     int cfg_full_redraw; //Always write pixels even if not changed since last frame
+    int cfg_protocol;
+    int cfg_offset_cmd; //Server supports OFFSET, send canvas relative coordinates
+    int cfg_convert_threads; //Pool workers for the conversion, 0 = one per core
     
     int offset_x;
     int offset_y;
     
-    mp_image_t* current;
-    mp_image_t* last;
+    struct pf_format fmt; //Command formatter, rebuilt on reconfig (under lock)
     
-    char tx_buffer[TX_BUFFER_BLOCKS][TX_BUFFER_BLOCK_SIZE];
-    int  tx_len[TX_BUFFER_BLOCKS];
+    struct mp_thread_pool* pool; //Conversion workers, 0 if converting on the VO thread
+    int max_bands;
+    pthread_mutex_t convert_lock;
+    pthread_cond_t convert_done;
+    int convert_pending; //Bands not converted yet
     
-    int num_draw_blocks;
-    int current_draw_block;
-    pthread_rwlock_t lock;
+    struct tx_set sets[2];
+    pthread_mutex_t lock; //Protects the fields below
+    pthread_cond_t wakeup;
+    struct tx_set* front; //Sent by the write threads
+    struct tx_set* back; //Converted by draw_image
+    bool back_ready; //back holds a converted frame that was not sent yet
+    int front_users; //Write threads sending a chunk of front
     
-    int flip; //Requests threads to stop writing the current frame
-    int quit; //Requests threads to exit
+    atomic_bool flip; //Requests threads to stop writing the current frame
+    atomic_bool quit; //Requests threads to exit
     
     int num_threads;
     struct write_thread* threads[MAX_RENDER_THREADS];
 };
 
-typedef struct point{
-    int x;
-    int y;
-} point_t;
 
 
 static struct write_thread* draw_thread_create(struct priv* vo, int id);
 static void* draw_thread(void* arg);
 static int draw_thread_connect(struct write_thread* thread);
 static int write_thread_write(struct write_thread* thread, char* buffer, int len);
-static void convert_frame(struct priv* p);
+static void convert_frame(struct priv* p, struct tx_set* set);
 
 
-static inline size_t itoa10(char* s, unsigned int i){
-    if (i == 0) {*s = '0'; return 1;}
-    int len = 0;
-    
-    unsigned int tmp = i;
-    while (tmp){
-         tmp /= 10;
-         len++;
-    }
-    
-    s+=len-1;
-    
-    while (i){
-        unsigned int d = i / 10;
-        unsigned int r = i - (d * 10);
-        
-        *s = '0' + r;
-        i = d;
-        
-        s--;
-    }
-    return len;
-}
 
 static void draw_image(struct vo *vo, mp_image_t *new){
     struct priv* p = (struct priv*)vo->priv;
     
-    //Flip frame buffers
-    if (p->last) talloc_free(p->last);
-    p->last = p->current;
-    p->current = new;
-    
-    p->flip = 1; //Tell threads to stop writing and release the lock, so we can convert a new frame
-    printf("Flip...\n");
-//     pthread_rwlock_wrlock(&p->lock);
-    printf("Convert...\n");
-    convert_frame(p);
-//     pthread_rwlock_unlock(&p->lock);
-    printf("Done\n");
-    p->flip = 0;
+    //A frame still waiting in the back set is dropped, the new one is diffed
+    //against the frame the write threads are drawing
+    pthread_mutex_lock(&p->lock);
+    p->back_ready = false;
+    struct tx_set* set = p->back;
+    set->ref = p->front->img;
+    pthread_mutex_unlock(&p->lock);
+    
+    talloc_free(set->img);
+    set->img = new;
+    convert_frame(p, set);
+    set->ref = 0;
+    set->dirty = 0;
+    
+    pthread_mutex_lock(&p->lock);
+    p->back_ready = true;
+    if (!p->cfg_full_frames) atomic_store(&p->flip, true); //Cut the current frame short
+    pthread_cond_broadcast(&p->wakeup);
+    pthread_mutex_unlock(&p->lock);
+}
+
+static void close_chunk(struct tx_band* band){
+    MP_TARRAY_APPEND(band->ta, band->ends, band->num_chunks, band->len);
 }
 
 /***
- * @brief Convert frame buffer to ascii PX command string
+ * @brief Convert the rows of one band to PX command chunks, run by the thread pool
  */
-static void convert_frame(struct priv* p){
-    int line_step = p->current->stride[0];
-    uint8_t* img_data = p->current->planes[0];
-    
-    uint8_t* last_img_data = p->last ? p->last->planes[0] : 0;
-    
-    p->num_draw_blocks = 0;
-    int current_block = 0;
-    char* d = p->tx_buffer[current_block];
-    size_t len = 0;
+static void convert_band(void* arg){
+    struct tx_band* band = arg;
+    struct priv* p = band->vo;
+    struct tx_set* set = band->set;
+    mp_image_t* cur = set->img;
+    mp_image_t* ref = set->ref;
+    
+    static const uint8_t black[3] = {0, 0, 0};
+    
+    band->len = 0;
+    band->num_chunks = 0;
+    size_t start = 0; //Start of the open chunk
+    MP_TARRAY_GROW(band->ta, band->spans, cur->w);
+    
+    for (int y = band->y0; y < band->y1; y++){
+        uint8_t* row = cur->planes[0] + y * cur->stride[0];
+        uint8_t* ref_row = ref ? ref->planes[0] + y * ref->stride[0] : 0;
+        int num_spans = pf_diff_row_dirty(&set->diff, set->dirty, row, ref_row, cur->w, y, band->spans);
         
-    for (int y = 0; y < p->current->h; y += 1){
-        for (int x = 0; x < p->current->w; x++){
-            uint8_t* px = &img_data[(y * line_step) + (x * 3)];
-            uint8_t* last_px = last_img_data ? &last_img_data[(y * line_step) + (x * 3)] : 0;
-            if (p->cfg_full_redraw || ((last_px == 0) || (p->current->stride[0] != p->last->stride[0]) || (p->current->h != p->last->h)
-                || (abs(px[0] - last_px[0]) + abs(px[1] - last_px[1]) + abs(px[2] - last_px[2]) ) > 2)){
-                
-                size_t l= 0;
-                if ((p->cfg_colorkey < 0) || (abs( (p->cfg_colorkey & 0xFF) - px[0]) + abs( ((p->cfg_colorkey >> 8) & 0xFF) - px[1]) + abs( ((p->cfg_colorkey >> 16) & 0xFF) - px[2]) ) > 25){
-                    point_t t = {p->offset_x + x, p->offset_y + y};
-                    
-                    if (p->cfg_grayscale_optimize && (px[0] == px[1]) && (px[1] == px[2])){ //Grayscale optimize
-                        l = sprintf(d, "PX %i %i %02x\n", t.x, t.y, px[0]);
-                    } else {
-                        l = sprintf(d, "PX %i %i %02x%02x%02x\n", t.x, t.y, px[0], px[1], px[2]);
-                    }
-                    
-                } else {
-                    l = sprintf(d, "PX %i %i 000000\n", p->offset_x + x, p->offset_y + y);
+        for (int s = 0; s < num_spans; s++){
+            struct pf_span* span = &band->spans[s];
+            int x = span->x;
+            int n = span->len;
+            while (n){
+                int fit = (TX_CHUNK_SIZE - (int)(band->len - start)) / PF_FORMAT_MAX_CMD;
+                if (fit <= 0){
+                    close_chunk(band);
+                    start = band->len;
+                    continue;
                 }
-                d+=l;
-                len +=l;
-                if (len > TX_BUFFER_BLOCK_SIZE-125){
-                    p->tx_len[current_block] = len;
-                    current_block++;
-                    len = 0;
-                    if (current_block >= TX_BUFFER_BLOCKS) {fprintf(stderr, "Image too large for tx buffer\n"); break;}
-                    d = p->tx_buffer[current_block];
+                if (fit > n) fit = n;
+                MP_TARRAY_GROW(band->ta, band->buf, band->len + fit * PF_FORMAT_MAX_CMD);
+                char* d = band->buf + band->len;
+                if (span->keyed){ //Clear keyed pixels
+                    for (int i = 0; i < fit; i++) d += pf_format_run(&p->fmt, d, black, x + i, y, 1);
+                    band->len = d - band->buf;
+                } else {
+                    band->len += pf_format_run(&p->fmt, d, &row[x * 3], x, y, fit);
                 }
+                x += fit;
+                n -= fit;
             }
         }
-        if (current_block >= TX_BUFFER_BLOCKS) break;
+    }
+    if (band->len > start) close_chunk(band);
+    
+    pthread_mutex_lock(&p->convert_lock);
+    if (--p->convert_pending == 0) pthread_cond_signal(&p->convert_done);
+    pthread_mutex_unlock(&p->convert_lock);
+}
+
+/***
+ * @brief Convert frame buffer to ascii PX command string
+ */
+static void convert_frame(struct priv* p, struct tx_set* set){
+    mp_image_t* cur = set->img;
+    set->num_chunks = 0;
+    set->num_bands = 0;
+    if ((cur->w > p->fmt.w) || (cur->h > p->fmt.h)) return; //Not configured for this size
+    
+    mp_image_t* ref = set->ref;
+    if (ref && ((ref->w != cur->w) || (ref->h != cur->h) || (ref->imgfmt != cur->imgfmt))) set->ref = 0; //Size changed, redraw everything
+    set->dirty = mp_image_get_dirty(cur, set->ref); //Skip tiles known to be unchanged
+    
+    set->diff = (struct pf_diff_params){
+        .threshold = p->cfg_threshold,
+        .colorkey = p->cfg_colorkey,
+        .key_threshold = 25,
+        .key_emit = true, //Keyed pixels are cleared to black
+        .full = p->cfg_full_redraw,
+    };
+    
+    set->num_bands = MPCLAMP(cur->h / MIN_BAND_ROWS, 1, p->max_bands);
+    pthread_mutex_lock(&p->convert_lock);
+    p->convert_pending = set->num_bands;
+    pthread_mutex_unlock(&p->convert_lock);
+    
+    for (int i = 0; i < set->num_bands; i++){
+        struct tx_band* band = &set->bands[i];
+        band->set = set;
+        band->y0 = cur->h * i / set->num_bands;
+        band->y1 = cur->h * (i + 1) / set->num_bands;
+        if (p->pool){
+            mp_thread_pool_queue(p->pool, convert_band, band);
+        } else {
+            convert_band(band);
+        }
     }
     
-    if (len){
-        p->tx_len[current_block] = len;
-        current_block++;
+    pthread_mutex_lock(&p->convert_lock);
+    while (p->convert_pending) pthread_cond_wait(&p->convert_done, &p->convert_lock);
+    pthread_mutex_unlock(&p->convert_lock);
+    
+    //The band buffers don't move anymore, collect their chunks in row order
+    for (int i = 0; i < set->num_bands; i++){
+        struct tx_band* band = &set->bands[i];
+        size_t start = 0;
+        for (int c = 0; c < band->num_chunks; c++){
+            struct tx_chunk chunk = {band->buf + start, band->ends[c] - start};
+            MP_TARRAY_APPEND(p, set->chunks, set->num_chunks, chunk);
+            start = band->ends[c];
+        }
     }
-    printf("Convert blocks: %i\n", current_block);
-    p->num_draw_blocks = current_block;
 }
 
 static void flip_page(struct vo *vo){
     
 }
 
-static int get_next_draw_block(struct write_thread* thread){
-    pthread_rwlock_wrlock(&thread->vo->lock);
-    if (thread->vo->num_draw_blocks <= 0) {pthread_rwlock_unlock(&thread->vo->lock); return -1;} //No data yet
-    int block = thread->vo->current_draw_block++;
-    if (thread->vo->current_draw_block >= thread->vo->num_draw_blocks) thread->vo->current_draw_block = 0;
-    pthread_rwlock_unlock(&thread->vo->lock);
-    printf("Thread %i fetched block %i (size %i)\n", thread->id, block, thread->vo->tx_len[block]);
-    return block;
+//Make the converted back set the one that is sent. Called with the lock held,
+//while no thread writes from the front set.
+static void swap_sets(struct priv* p){
+    struct tx_set* set = p->back;
+    p->back = p->front;
+    p->front = set;
+    p->back_ready = false;
+    set->next_chunk = 0;
+    set->complete = set->num_chunks == 0;
+    atomic_store(&p->flip, false);
+    pthread_cond_broadcast(&p->wakeup);
+}
+
+//Get the next chunk to write. Waits for up to 100ms if there is nothing to do.
+//Frames are sent once in full before the next frame is started, unless they
+//may be cut short. With fullredraw the frame is repeated until the next one
+//is ready.
+static bool get_next_draw_block(struct priv* p, struct tx_chunk* chunk){
+    struct timespec until = mp_time_us_to_timespec(mp_time_us() + 100 * 1000);
+    pthread_mutex_lock(&p->lock);
+    while (!atomic_load(&p->quit)){
+        struct tx_set* set = p->front;
+        if (p->back_ready && (set->complete || !p->cfg_full_frames)){
+            if (p->front_users == 0){
+                swap_sets(p);
+                continue;
+            }
+        } else if (set->next_chunk < set->num_chunks){
+            *chunk = set->chunks[set->next_chunk++];
+            if (set->next_chunk == set->num_chunks){
+                set->complete = true;
+                if (p->cfg_full_redraw) set->next_chunk = 0;
+            }
+            p->front_users++;
+            pthread_mutex_unlock(&p->lock);
+            return true;
+        }
+        if (pthread_cond_timedwait(&p->wakeup, &p->lock, &until)) break;
+    }
+    pthread_mutex_unlock(&p->lock);
+    return false;
+}
+
+static void put_draw_block(struct priv* p){
+    pthread_mutex_lock(&p->lock);
+    p->front_users--;
+    if (p->front_users == 0) pthread_cond_broadcast(&p->wakeup);
+    pthread_mutex_unlock(&p->lock);
 }
 
 
@@ -244,29 +375,21 @@ static void* draw_thread(void* arg){
 
     fprintf(stderr, "Thread %i: Running...\n",thread->id);
     
-    double pts = -100;
-    
     struct priv* vo = thread->vo;
     
-    while (vo->quit == 0) {
+    while (!atomic_load(&vo->quit)) {
         if ((thread->socket < 0) && (draw_thread_connect(thread) == 0)) sleep(1); //Connect until succesful or exit
         if (thread->socket < 0) continue; //Not connected
-        if (vo->current == 0) {usleep(100); continue;} //No frame to draw
-        if ((vo->cfg_full_redraw == 0) && (vo->current->pts == pts)) {usleep(10); continue;}
         
-        int block = get_next_draw_block(thread);
-        if (block < 0) {usleep(10); continue;}
+        struct tx_chunk chunk;
+        if (!get_next_draw_block(vo, &chunk)) continue; //Nothing to draw
         
-        pts = vo->current->pts;
-        
-        pthread_rwlock_rdlock(&vo->lock);
-        
-        if (write_thread_write(thread, vo->tx_buffer[block], vo->tx_len[block]) != 0){
+        if (write_thread_write(thread, chunk.data, chunk.len) != 0){
             fprintf(stderr, "Thread %i: Write failed\n",thread->id);
             close(thread->socket);
             thread->socket = -1;
         }
-        pthread_rwlock_unlock(&vo->lock);
+        put_draw_block(vo);
     }
     
     if (thread->socket >= 0) close(thread->socket);
@@ -303,6 +426,16 @@ static int draw_thread_connect(struct write_thread* thread){
     fprintf(stderr, "Thread %i: Connected\n", thread->id);
     
     thread->socket = fd;
+    
+    char header[PF_FORMAT_MAX_CMD];
+    pthread_mutex_lock(&thread->vo->lock); //reconfig may rebuild the formatter
+    size_t len = pf_format_header(&thread->vo->fmt, header);
+    pthread_mutex_unlock(&thread->vo->lock);
+    if (len && (write_thread_write(thread, header, len) != 0)){
+        close(fd);
+        thread->socket = -1;
+        return 0;
+    }
     return 1;
 }
 
@@ -311,19 +444,9 @@ static int write_thread_write(struct write_thread* thread, char* buffer, int len
     char* b = buffer;
     int timeout = 100*100; //100ms
     int error = 0;
-    struct timespec tstart;
-    clock_gettime(CLOCK_MONOTONIC , &tstart);
     
-    while (len && (error == 0) && (thread->vo->cfg_full_frames || !thread->vo->flip) && (thread->vo->quit == 0)){
-        clock_gettime(CLOCK_MONOTONIC , &tstart);
-        
+    while (len && (error == 0) && (thread->vo->cfg_full_frames || !atomic_load(&thread->vo->flip)) && !atomic_load(&thread->vo->quit)){
         int ret = write(thread->socket, b, len);
-        
-        struct timespec tend;
-        clock_gettime(CLOCK_MONOTONIC , &tend);
-        long ms = (tend.tv_sec - tstart.tv_sec) * 1000L + (tend.tv_nsec / 1000000L - tstart.tv_nsec / 1000000L);
-        fprintf(stderr, "Thread %i: Blocked for %lu ns\n", thread->id, ms);
-    
         if (ret >= 0){
             b += ret;
             len -= ret;
@@ -360,31 +483,83 @@ static int query_format(struct vo *vo, int fmt){
 
 
 static int reconfig(struct vo *vo, struct mp_image_params *params){
+    struct priv *p = vo->priv;
+    
+    struct pf_format_opts opts = {
+        .protocol = p->cfg_protocol,
+        .offset_x = p->offset_x,
+        .offset_y = p->offset_y,
+        .offset_cmd = p->cfg_offset_cmd,
+        .grayscale = p->cfg_grayscale_optimize,
+    };
+    //The write threads read the formatter when they (re)connect
+    pthread_mutex_lock(&p->lock);
+    int r = pf_format_init(&p->fmt, p, params->w, params->h, &opts);
+    pthread_mutex_unlock(&p->lock);
+    if (r < 0) {
+        MP_ERR(vo, "Coordinates don't fit the protocol (offset too large?).\n");
+        return -1;
+    }
     return 0;
 }
 
 static void uninit(struct vo *vo){
     struct priv *p = vo->priv;
-    p->quit = 1;
+    
+    pthread_mutex_lock(&p->lock);
+    atomic_store(&p->quit, true);
+    pthread_cond_broadcast(&p->wakeup);
+    pthread_mutex_unlock(&p->lock);
     
     for (int i = 0; i < p->num_threads; i++){
+        if (!p->threads[i]) continue;
         pthread_join(p->threads[i]->pthread, 0);
         free(p->threads[i]);
     }
+    
+    talloc_free(p->pool);
+    for (int i = 0; i < 2; i++) talloc_free(p->sets[i].img);
+    pthread_cond_destroy(&p->wakeup);
+    pthread_mutex_destroy(&p->lock);
+    pthread_cond_destroy(&p->convert_done);
+    pthread_mutex_destroy(&p->convert_lock);
 }
 
 static int preinit(struct vo *vo){
     
     struct priv *p = vo->priv;
     if (!p->hostname) return -1;
-    p->last = 0;
-    p->current = 0;
     
-    if (pthread_rwlock_init(&p->lock, NULL)){
-        perror("Lock create failed");
-        return 1;
+    int convert_threads = p->cfg_convert_threads;
+    if (convert_threads == 0) convert_threads = MPCLAMP(av_cpu_count(), 1, MAX_CONVERT_THREADS);
+    if (convert_threads > 1){
+        p->pool = mp_thread_pool_create(p, convert_threads);
+        if (!p->pool){
+            MP_ERR(vo, "Could not create conversion threads\n");
+            return -1;
+        }
     }
+    MP_VERBOSE(vo, "Converting with %d threads\n", convert_threads);
+    
+    p->max_bands = convert_threads > 1 ? convert_threads * BANDS_PER_THREAD : 1;
+    for (int i = 0; i < 2; i++){
+        struct tx_set* set = &p->sets[i];
+        set->bands = talloc_zero_array(p, struct tx_band, p->max_bands);
+        for (int b = 0; b < p->max_bands; b++){
+            set->bands[b].vo = p;
+            set->bands[b].ta = talloc_new(p);
+        }
+    }
+    p->front = &p->sets[0];
+    p->back = &p->sets[1];
+    p->front->complete = true;
+    
+    pthread_mutex_init(&p->lock, NULL);
+    pthread_cond_init(&p->wakeup, NULL);
+    pthread_mutex_init(&p->convert_lock, NULL);
+    pthread_cond_init(&p->convert_done, NULL);
     
+    p->num_threads = MPCLAMP(p->num_threads, 0, MAX_RENDER_THREADS);
     for (int i = 0; i < p->num_threads; i++){
         p->threads[i] = draw_thread_create(p, i);
     }
@@ -404,17 +579,24 @@ const struct vo_driver video_out_pixelflut2 =
     .description = "Transmit video to Pixelflut canvas server",
     .name = "pixelflut2",
     .untimed = false,
+    .caps = VO_CAP_DIRTY,
     .priv_size = sizeof(struct priv),
     .options = (const struct m_option[]) {
         OPT_STRING("hostname", hostname,        0),
         OPT_INT("x",           offset_x,        0),
         OPT_INT("y",           offset_y,        0),
         OPT_INT("colorkey",    cfg_colorkey,    0, OPTDEF_INT(-1)),
+        OPT_INTRANGE("threshold", cfg_threshold, 0, 0, 765, OPTDEF_INT(2)),
         OPT_INT("grayscale",   cfg_grayscale_optimize, 0),
         OPT_INT("port",        port,            0, OPTDEF_INT(1234)),
         OPT_INT("threads",     num_threads,     0, OPTDEF_INT(1)),
+        OPT_INTRANGE("convert-threads", cfg_convert_threads, 0, 0, MAX_CONVERT_THREADS),
         OPT_INT("fullframe",   cfg_full_frames, 0, OPTDEF_INT(1)),
         OPT_INT("fullredraw",  cfg_full_redraw, 0, OPTDEF_INT(0)),
+        OPT_CHOICE("protocol", cfg_protocol,    0,
+                   ({"text",   PF_PROTO_TEXT},
+                    {"binary", PF_PROTO_BINARY})),
+        OPT_FLAG("offsetcmd",  cfg_offset_cmd,  0),
         {0},
     },
     .preinit = preinit,
@@ -43,6 +43,9 @@
 #include "video/sws_utils.h"
 #include "sub/osd.h"
 #include "options/m_option.h"
+#include "video/out/dgram.h"
+#include "video/out/pixelflut/diff.h"
+#include "video/out/pixelflut/format.h"
 
 
 struct priv {
@@ -50,57 +53,53 @@ struct priv {
     int port;
     struct sockaddr_in dest_addr;
     int32_t cfg_colorkey;
+    int cfg_threshold;
     
     int offset_x;
     int offset_y;
-    int delay;
+    int64_t rate; //Bytes per second, 0 = unlimited
+    int64_t burst;
+    int gso;
     
     mp_image_t* last;
+    struct pf_span_list* spans;
+    struct pf_format fmt;
     
     int fd;
+    struct mp_dgram* tx;
+    char* cmds; //Formatted commands of the current frame, PF_FORMAT_MAX_CMD bytes each
 };
 
-struct RGB{
-    union{
-        struct{
-            uint8_t r;
-            uint8_t g;
-            uint8_t b;
-        };
-        uint8_t color[3];
-    };
-} __attribute__((packed));
-
-static char buffer[64];
-
 static void draw_image(struct vo *vo, mp_image_t *in){
     struct priv *p = vo->priv;
-    useconds_t delay = p->delay;
     
     int line_step     = in->stride[0];
     uint8_t* img_data = in->planes[0];
     
-    uint8_t* last_img_data = p->last ? p->last->planes[0] : 0;
-    
-    for (int y = 0; y < in->h; y++){
-        for (int x = 0; x < in->w; x++){
-            struct RGB*   src  = (struct RGB*)&img_data[(y * line_step) + (x * 3)];
-            
-            int update = 1;
-            if (last_img_data){
-                struct RGB* last = (struct RGB*)&last_img_data[(y * line_step) + (x * 3)];
-                update = (last->r != src->r) || (last->g |= src->g) || (last->b != src->b);
-            }
-            
-            if (update){
-                unsigned int dstx = x + p->offset_x;
-                unsigned int dsty = y + p->offset_y;                
-                size_t l = sprintf(buffer, "PX %i %i %02x%02x%02x\n", dstx, dsty, src->r, src->g, src->b);
-                send(p->fd, &buffer, l, 0);
-                if (delay) usleep(delay);
-            }
+    struct pf_diff_params diff = {
+        .threshold = p->cfg_threshold,
+        .colorkey = p->cfg_colorkey,
+        .key_threshold = 3,
+    };
+    p->spans->num_spans = 0;
+    p->spans->num_pixels = 0;
+    if ((in->w > p->fmt.w) || (in->h > p->fmt.h)) {talloc_free(in); return;} //Not configured for this size
+    pf_diff_image(&diff, in, p->last, 0, 1, p->spans);
+    
+    //One command per datagram
+    MP_TARRAY_GROW(p, p->cmds, p->spans->num_pixels * PF_FORMAT_MAX_CMD);
+    char* cmd = p->cmds;
+    
+    for (int s = 0; s < p->spans->num_spans; s++){
+        struct pf_span* span = &p->spans->spans[s];
+        int y = span->y;
+        for (int x = span->x; x < span->x + span->len; x++){
+            size_t l = pf_format_run(&p->fmt, cmd, &img_data[(y * line_step) + (x * 3)], x, y, 1);
+            mp_dgram_add(p->tx, &(struct iovec){cmd, l}, 1);
+            cmd += PF_FORMAT_MAX_CMD;
         }
     }
+    mp_dgram_flush(p->tx);
     
     if (p->last) talloc_free(p->last);
     p->last = in;
@@ -117,6 +116,16 @@ static int query_format(struct vo *vo, int fmt){
 
 
 static int reconfig(struct vo *vo, struct mp_image_params *params){
+    struct priv *p = vo->priv;
+    
+    struct pf_format_opts opts = {
+        .offset_x = p->offset_x,
+        .offset_y = p->offset_y,
+    };
+    if (pf_format_init(&p->fmt, p, params->w, params->h, &opts) < 0) {
+        MP_ERR(vo, "Coordinates don't fit the protocol (offset too large?).\n");
+        return -1;
+    }
     return 0;
 }
 
@@ -133,6 +142,7 @@ static int preinit(struct vo *vo){
     if (!p->hostname) return -1;
     if (!p->port) p->port = 1234;
     p->last = 0;
+    p->spans = talloc_zero(p, struct pf_span_list);
     
     p->fd = socket(AF_INET, SOCK_DGRAM, IPPROTO_UDP);
     printf("Opened socket %i sdsdsfd\n", p->fd);
@@ -148,6 +158,10 @@ static int preinit(struct vo *vo){
         return -1;
     }
     
+    p->tx = mp_dgram_create(p, vo->log, p->fd);
+    mp_dgram_set_rate(p->tx, p->rate, p->burst);
+    mp_dgram_set_gso(p->tx, p->gso);
+    
     return 0;
 }
 
@@ -163,13 +177,19 @@ const struct vo_driver video_out_pixelflutentropia =
     .description = "Transmit video to Entropia UDP Pixelflut canvas server",
     .name = "pixelfluteth0",
     .untimed = false,
+    .caps = VO_CAP_DIRTY,
     .priv_size = sizeof(struct priv),
     .options = (const struct m_option[]) {
         OPT_STRING("hostname", hostname, 0),
         OPT_INT("x", offset_x, 0),
         OPT_INT("y", offset_y, 0),
         OPT_INT("port", port, 0, OPTDEF_INT(5005)),
-        OPT_INT("delay", delay, 0),
+        OPT_INT("colorkey", cfg_colorkey, 0, OPTDEF_INT(-1)),
+        OPT_INTRANGE("threshold", cfg_threshold, 0, 0, 765),
+        OPT_BYTE_SIZE("rate", rate, 0, 0, INT64_MAX),
+        OPT_BYTE_SIZE("burst", burst, 0, 1, INT64_MAX, OPTDEF_INT64(16 * 1024)),
+        OPT_FLAG("gso", gso, 0, OPTDEF_INT(1)),
+        OPT_REMOVED("delay", "use rate and burst to limit the send rate"),
         {0},
     },
     .preinit = preinit,
@@ -43,6 +43,8 @@
 #include "video/sws_utils.h"
 #include "sub/osd.h"
 #include "options/m_option.h"
+#include "video/out/dgram.h"
+#include "video/out/pixelflut/diff.h"
 
 
 struct priv {
@@ -50,14 +52,21 @@ struct priv {
     int port;
     struct sockaddr_in dest_addr;
     int32_t cfg_colorkey;
+    int cfg_threshold;
     
     int offset_x;
     int offset_y;
-    int delay;
+    int64_t rate; //Bytes per second, 0 = unlimited
+    int64_t burst;
+    int gso;
     
     mp_image_t* last;
+    struct pf_span_list* spans;
     
     int fd;
+    struct mp_dgram* tx;
+    struct message* msgs; //Packets of the current frame
+    int num_msgs;
 };
 
 struct header {
@@ -94,49 +103,56 @@ struct message {
 #define MSG_SIZE(msg) (sizeof(struct header)+((msg)->count*sizeof(struct pixel)))
 
 
+static struct message* next_message(struct priv *p){
+    MP_TARRAY_GROW(p, p->msgs, p->num_msgs);
+    struct message* msg = &p->msgs[p->num_msgs++];
+    msg->header.format = 2;
+    msg->header.version = 1;
+    msg->count = 0;
+    return msg;
+}
+
 static void draw_image(struct vo *vo, mp_image_t *in){
     struct priv *p = vo->priv;
-    useconds_t delay = p->delay;
     
     int line_step     = in->stride[0];
     uint8_t* img_data = in->planes[0];
     
-    uint8_t* last_img_data = p->last ? p->last->planes[0] : 0;
+    struct pf_diff_params diff = {
+        .threshold = p->cfg_threshold,
+        .colorkey = p->cfg_colorkey,
+        .key_threshold = 3,
+    };
+    p->spans->num_spans = 0;
+    p->spans->num_pixels = 0;
+    pf_diff_image(&diff, in, p->last, 0, 1, p->spans);
 
-    struct message msg = {{2,1}};
-    msg.count = 0;
+    //Build all packets of the frame first, the arena may move while growing
+    p->num_msgs = 0;
+    struct message* msg = 0;
     
-    for (int y = 0; y < in->h; y++){
-        for (int x = 0; x < in->w; x++){
+    for (int s = 0; s < p->spans->num_spans; s++){
+        struct pf_span* span = &p->spans->spans[s];
+        int y = span->y;
+        for (int x = span->x; x < span->x + span->len; x++){
+            if (!msg || (msg->count == MAX_PIXELS)) msg = next_message(p);
             struct RGB*   src  = (struct RGB*)&img_data[(y * line_step) + (x * 3)];
-            
-            int update = 1;
-            if (last_img_data){
-                struct RGB* last = (struct RGB*)&last_img_data[(y * line_step) + (x * 3)];
-                update = (last->r != src->r) || (last->g |= src->g) || (last->b != src->b);
-            }
-            
-            if (update){
-                struct pixel* dst = &msg.pixel[msg.count];
-                unsigned int dstx = x + p->offset_x;
-                unsigned int dsty = y + p->offset_y;
-                dst->xl = dstx;
-                dst->xhyl = ((dstx >> 8) & 0xF) | ((dsty << 4) & 0xF0);
-                dst->yh = dsty >> 8;
-                dst->color = *src;
-                msg.count++;
-                if (msg.count == MAX_PIXELS){
-//                  printf("Send: %i,%i %i\n", ((uint8_t*)&msg)[0], ((uint8_t*)&msg)[1] , MSG_SIZE(&msg));
-                    send(p->fd, &msg, MSG_SIZE(&msg), 0);
-                    msg.count = 0;
-                    usleep(delay);
-                }
-            }
+            struct pixel* dst = &msg->pixel[msg->count];
+            unsigned int dstx = x + p->offset_x;
+            unsigned int dsty = y + p->offset_y;
+            dst->xl = dstx;
+            dst->xhyl = ((dstx >> 8) & 0xF) | ((dsty << 4) & 0xF0);
+            dst->yh = dsty >> 8;
+            dst->color = *src;
+            msg->count++;
         }
     }
-    if (msg.count){ //Send remainder
-        send(p->fd, &msg, MSG_SIZE(&msg), 0);
+    
+    for (int i = 0; i < p->num_msgs; i++){
+        mp_dgram_add(p->tx, &(struct iovec){&p->msgs[i], MSG_SIZE(&p->msgs[i])}, 1);
     }
+    int failed = mp_dgram_flush(p->tx);
+    if (failed) MP_VERBOSE(vo, "%d packets not sent\n", failed);
     
     if (p->last) talloc_free(p->last);
     p->last = in;
@@ -169,6 +185,7 @@ static int preinit(struct vo *vo){
     if (!p->hostname) return -1;
     if (!p->port) p->port = 5005;
     p->last = 0;
+    p->spans = talloc_zero(p, struct pf_span_list);
     
     p->fd = socket(AF_INET, SOCK_DGRAM, IPPROTO_UDP);
     printf("Opened socket %i sdsdsfd\n", p->fd);
@@ -184,6 +201,10 @@ static int preinit(struct vo *vo){
         return -1;
     }
     
+    p->tx = mp_dgram_create(p, vo->log, p->fd);
+    mp_dgram_set_rate(p->tx, p->rate, p->burst);
+    mp_dgram_set_gso(p->tx, p->gso);
+    
     return 0;
 }
 
@@ -199,13 +220,19 @@ const struct vo_driver video_out_pixelfluteth0 =
     .description = "Transmit video to eth0 Pixelflut canvas server",
     .name = "pixelfluteth0",
     .untimed = false,
+    .caps = VO_CAP_DIRTY,
     .priv_size = sizeof(struct priv),
     .options = (const struct m_option[]) {
         OPT_STRING("hostname", hostname, 0),
         OPT_INT("x", offset_x, 0),
         OPT_INT("y", offset_y, 0),
         OPT_INT("port", port, 0, OPTDEF_INT(5005)),
-        OPT_INT("delay", delay, 0),
+        OPT_INT("colorkey", cfg_colorkey, 0, OPTDEF_INT(-1)),
+        OPT_INTRANGE("threshold", cfg_threshold, 0, 0, 765),
+        OPT_BYTE_SIZE("rate", rate, 0, 0, INT64_MAX),
+        OPT_BYTE_SIZE("burst", burst, 0, 1, INT64_MAX, OPTDEF_INT64(16 * 1024)),
+        OPT_FLAG("gso", gso, 0, OPTDEF_INT(1)),
+        OPT_REMOVED("delay", "use rate and burst to limit the send rate"),
         {0},
     },
     .preinit = preinit,
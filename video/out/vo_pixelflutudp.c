@@ -30,6 +30,8 @@
 #include <netinet/in.h>
 
 #include <libswscale/swscale.h>
+#include <libavutil/buffer.h>
+#include <libavutil/mem.h>
 
 #include "config.h"
 #include "misc/bstr.h"
@@ -43,6 +45,7 @@
 #include "video/sws_utils.h"
 #include "sub/osd.h"
 #include "options/m_option.h"
+#include "video/out/dgram.h"
 
 
 struct priv {
@@ -54,7 +57,14 @@ struct priv {
     int offset_x;
     int offset_y;
     
+    int64_t rate; //Bytes per second, 0 = unlimited
+    int64_t burst;
+    int gso;
+    
     int fd;
+    struct mp_dgram* tx;
+    struct header* headers; //One per datagram, referenced until flushed
+    struct iovec* iov;
 };
 
 struct header {
@@ -63,34 +73,77 @@ struct header {
     uint16_t width;
 };
 
-#define BUFFER_SIZE 65535
-static char buffer[BUFFER_SIZE];
+#define MAX_DATAGRAM 65507 //Maximum UDP payload
 
 static void draw_image(struct vo *vo, mp_image_t *in){
     struct priv *p = vo->priv;
     
-    int widthStep = in->stride[0];
-    uint8_t* img_data = in->planes[0];
-    int lines_per_datagram = BUFFER_SIZE / in->w / 3;
-
-    struct header head;
-    head.x = p->offset_x;
-    head.width = in->w;
-
-    for (int y = 0; y < in->h; y+=lines_per_datagram){
-        head.y = y + p->offset_y;
-        if ((in->h - y) < lines_per_datagram) lines_per_datagram = in->h - y;
+    int line_size = in->w * 3;
+    int lines_per_datagram = (MAX_DATAGRAM - sizeof(struct header)) / line_size;
+    if (lines_per_datagram < 1){
+        MP_ERR(vo, "Image too wide for a datagram\n");
+        talloc_free(in);
+        return;
+    }
+    if (lines_per_datagram > in->h) lines_per_datagram = in->h;
+    int num_datagrams = (in->h + lines_per_datagram - 1) / lines_per_datagram;
+    
+    MP_TARRAY_GROW(p, p->headers, num_datagrams);
+    MP_TARRAY_GROW(p, p->iov, lines_per_datagram + 1);
+    
+    //Without padding between lines, the payload of a datagram is one
+    //contiguous block
+    bool packed = in->stride[0] == line_size;
+    
+    //Datagrams point straight into the image: header, then the lines
+    for (int i = 0; i < num_datagrams; i++){
+        int y = i * lines_per_datagram;
+        int lines = MPMIN(lines_per_datagram, in->h - y);
+        uint8_t* first = in->planes[0] + (ptrdiff_t)in->stride[0] * y;
+        
+        struct header* head = &p->headers[i];
+        head->x = p->offset_x;
+        head->y = y + p->offset_y;
+        head->width = in->w;
         
-        memcpy(buffer, &head, sizeof(head));
-        for (int y2 = 0; y2 < lines_per_datagram; y2++){
-            memcpy(buffer + sizeof(head) + (in->w * 3 * y2) , img_data + (widthStep * (y+y2)), (in->w * 3));
+        p->iov[0] = (struct iovec){head, sizeof(*head)};
+        if (packed){
+            p->iov[1] = (struct iovec){first, (size_t)line_size * lines};
+            mp_dgram_add(p->tx, p->iov, 2);
+            continue;
         }
-        send(p->fd, buffer, sizeof(head) + (in->w * 3 * lines_per_datagram), 0);
+        for (int l = 0; l < lines; l++){
+            p->iov[l + 1] = (struct iovec){first + (ptrdiff_t)in->stride[0] * l, line_size};
+        }
+        mp_dgram_add(p->tx, p->iov, lines + 1);
     }
     
+    int failed = mp_dgram_flush(p->tx);
+    if (failed) MP_VERBOSE(vo, "%d datagrams not sent\n", failed);
+    
     talloc_free(in);
 }
 
+//Let the conversion in front of the VO write into the frames the datagrams
+//point to. Lines padded to the requested alignment are sent as one iovec each.
+static struct mp_image *get_image(struct vo *vo, int imgfmt, int w, int h,
+                                  int stride_align){
+    if (imgfmt != IMGFMT_RGB24) return NULL;
+    
+    int size = mp_image_get_alloc_size(imgfmt, w, h, stride_align);
+    if (size < 0) return NULL;
+    
+    int alloc_size = size + stride_align;
+    uint8_t* ptr = av_malloc(alloc_size);
+    if (!ptr) return NULL;
+    
+    struct mp_image* res = mp_image_from_buffer(imgfmt, w, h, stride_align,
+                                                ptr, alloc_size, NULL,
+                                                av_buffer_default_free);
+    if (!res) av_free(ptr);
+    return res;
+}
+
 static void flip_page(struct vo *vo){
     
 }
@@ -132,6 +185,10 @@ static int preinit(struct vo *vo){
         return -1;
     }
     
+    p->tx = mp_dgram_create(p, vo->log, p->fd);
+    mp_dgram_set_rate(p->tx, p->rate, p->burst);
+    mp_dgram_set_gso(p->tx, p->gso);
+    
     return 0;
 }
 
@@ -153,12 +210,16 @@ const struct vo_driver video_out_pixelflutudp =
         OPT_INT("x", offset_x, 0),
         OPT_INT("y", offset_y, 0),
         OPT_INT("port", port, 0, OPTDEF_INT(1234)),
+        OPT_BYTE_SIZE("rate", rate, 0, 0, INT64_MAX),
+        OPT_BYTE_SIZE("burst", burst, 0, 1, INT64_MAX, OPTDEF_INT64(256 * 1024)),
+        OPT_FLAG("gso", gso, 0, OPTDEF_INT(1)),
         {0},
     },
     .preinit = preinit,
     .query_format = query_format,
     .reconfig = reconfig,
     .control = control,
+    .get_image = get_image,
     .draw_image = draw_image,
     .flip_page = flip_page,
     .uninit = uninit,
@@ -0,0 +1,306 @@
+/*
+ * This file is part of mpv.
+ *
+ * mpv is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * mpv is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with mpv.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "config.h"
+#include "audio/format.h"
+#include "audio/out/ao.h"
+#include "common/common.h"
+#include "common/msg.h"
+#include "options/m_option.h"
+#include "video/mp_image.h"
+#include "video/points.h"
+#include "video/out/vo.h"
+#include "video/out/laser/path.h"
+#include "video/out/laser/scope.h"
+
+// XY oscilloscope output through a sound card. The frames of vf_vector or
+// vf_vectorraster (vector_t rasters, or point lists with points=yes) are
+// rendered as X/Y (and optionally Z) audio samples at the sample rate of the
+// AO, which is opened separately from the player's audio output. Each frame
+// gets as many samples as it is shown; the count is trimmed a little per
+// frame so the AO latency stays at the configured value, which keeps the beam
+// in lockstep with the video. The AO buffers the samples, for pull AOs like
+// jack in its lock-free ring.
+
+// Fraction of the latency error corrected per frame, and the max. change of
+// the sample count per frame.
+#define LATENCY_GAIN 0.1
+#define MAX_CORRECTION 0.05
+
+struct priv {
+    // Options
+    char *ao_spec;
+    int rate;
+    int z;
+    int z_invert;
+    float size;
+    float blank_time;
+    float latency;
+
+    struct ao *ao;
+    int ao_format;
+    int ao_channels;
+
+    struct scope_render render;
+    struct laser_transform transform;
+
+    float *samples;             // rendered frame, interleaved float
+    uint8_t *out;               // the same in the AO's sample format
+    int num_samples;
+    double frac;                // samples owed to the next frame
+    bool started;
+};
+
+static void wakeup(void *ctx)
+{
+}
+
+// Number of samples for a frame shown for the given time, corrected towards
+// the target latency.
+static int frame_samples(struct vo *vo, double seconds)
+{
+    struct priv *p = vo->priv;
+    double want = seconds * p->rate + p->frac;
+    if (p->started) {
+        double err = ao_get_delay(p->ao) - p->latency;
+        double max = seconds * p->rate * MAX_CORRECTION;
+        want -= MPCLAMP(err * p->rate * LATENCY_GAIN, -max, max);
+    } else {
+        want += p->latency * p->rate;
+    }
+    int num = MPMAX(want, 0);
+    p->frac = MPMAX(want - num, 0);
+    return num;
+}
+
+static void convert(struct priv *p, int num)
+{
+    int ch = p->render.channels;
+    int out_ch = p->ao_channels;
+    int fmt = af_fmt_from_planar(p->ao_format);
+    bool planar = af_fmt_is_planar(p->ao_format);
+    int bytes = af_fmt_to_bytes(p->ao_format);
+
+    MP_TARRAY_GROW(p, p->out, (size_t)num * out_ch * bytes);
+    for (int c = 0; c < out_ch; c++) {
+        uint8_t *d = p->out + (planar ? (size_t)c * num * bytes : c * bytes);
+        size_t step = planar ? bytes : out_ch * bytes;
+        for (int j = 0; j < num; j++, d += step) {
+            float v = c < ch ? p->samples[j * ch + c] : 0;
+            v = MPCLAMP(v, -1.0f, 1.0f);
+            switch (fmt) {
+            case AF_FORMAT_FLOAT:
+                *(float *)d = v;
+                break;
+            case AF_FORMAT_S16:
+                *(int16_t *)d = lrintf(v * INT16_MAX);
+                break;
+            case AF_FORMAT_S32:
+                *(int32_t *)d = llrint(v * (double)INT32_MAX);
+                break;
+            }
+        }
+    }
+}
+
+static void draw_frame(struct vo *vo, struct vo_frame *frame)
+{
+    struct priv *p = vo->priv;
+    struct mp_image *img = frame->current;
+
+    p->num_samples = 0;
+    if (!img || frame->still || (frame->repeat && !frame->display_synced))
+        return;
+
+    double seconds = frame->display_synced ? frame->vsync_interval
+                   : frame->duration > 0 ? frame->duration / 1e6
+                   : frame->ideal_frame_duration > 0 ? frame->ideal_frame_duration
+                   : 1.0 / 25;
+    int num = frame_samples(vo, seconds);
+    MP_TARRAY_GROW(p, p->samples, (size_t)num * p->render.channels);
+
+    struct mp_point_list *list = mp_points_get(img);
+    if (list) {
+        scope_render_points(&p->render, p, &p->transform, list->points,
+                            list->num_points, p->samples, num);
+    } else {
+        size_t num_vectors = (size_t)img->stride[0] * img->h / 4;
+        scope_render_vectors(&p->render, img->planes[0], num_vectors,
+                             p->samples, num);
+    }
+    convert(p, num);
+    p->num_samples = num;
+}
+
+static void flip_page(struct vo *vo)
+{
+    struct priv *p = vo->priv;
+
+    if (!p->num_samples)
+        return;
+
+    int bytes = af_fmt_to_bytes(p->ao_format);
+    void *planes[MP_NUM_CHANNELS];
+    for (int c = 0; c < p->ao_channels; c++)
+        planes[c] = p->out + (size_t)c * p->num_samples * bytes;
+    int done = ao_play(p->ao, planes, p->num_samples, 0);
+    if (done < p->num_samples)
+        MP_VERBOSE(vo, "AO buffer full, %d samples dropped.\n",
+                   p->num_samples - done);
+    p->num_samples = 0;
+    p->started = true;
+}
+
+static int query_format(struct vo *vo, int fmt)
+{
+    return fmt == IMGFMT_RGB0 || fmt == IMGFMT_POINTS;
+}
+
+static int reconfig(struct vo *vo, struct mp_image_params *params)
+{
+    struct priv *p = vo->priv;
+
+    // Point lists: fit the display size into [-1, 1], y pointing up.
+    int d_w, d_h;
+    mp_image_params_get_dsize(params, &d_w, &d_h);
+    float scale = 2.0f / MPMAX(MPMAX(d_w, d_h) - 1, 1);
+    float sx = scale * d_w / params->w;
+    float sy = -scale * d_h / params->h;
+    p->transform = (struct laser_transform){
+        .sx = sx,
+        .sy = sy,
+        .ox = -(params->w - 1) * sx / 2,
+        .oy = -(params->h - 1) * sy / 2,
+    };
+
+    vo->dwidth = d_w;
+    vo->dheight = d_h;
+    return 0;
+}
+
+static int control(struct vo *vo, uint32_t request, void *data)
+{
+    struct priv *p = vo->priv;
+
+    switch (request) {
+    case VOCTRL_PAUSE:
+        ao_pause(p->ao);
+        return VO_TRUE;
+    case VOCTRL_RESUME:
+        ao_resume(p->ao);
+        return VO_TRUE;
+    case VOCTRL_RESET:
+        ao_reset(p->ao);
+        p->started = false;
+        p->frac = 0;
+        return VO_TRUE;
+    }
+    return VO_NOTIMPL;
+}
+
+static void uninit(struct vo *vo)
+{
+    struct priv *p = vo->priv;
+
+    ao_uninit(p->ao);
+    p->ao = NULL;
+}
+
+static int preinit(struct vo *vo)
+{
+    struct priv *p = vo->priv;
+
+    // The player's --ao is meant for the sound, not for the scope.
+    if (!p->ao_spec || !p->ao_spec[0]) {
+        MP_ERR(vo, "No audio output set, use --vo-scope-ao.\n");
+        return -1;
+    }
+
+    struct mp_chmap map;
+    mp_chmap_from_channels(&map, p->z ? 3 : 2);
+    p->ao = ao_init_device(vo->global, 0, wakeup, vo, p->ao_spec, p->rate,
+                           AF_FORMAT_FLOAT, map);
+    if (!p->ao) {
+        MP_ERR(vo, "Could not open the audio output.\n");
+        return -1;
+    }
+
+    ao_get_format(p->ao, &p->rate, &p->ao_format, &map);
+    p->ao_channels = map.num;
+    int fmt = af_fmt_from_planar(p->ao_format);
+    if (fmt != AF_FORMAT_FLOAT && fmt != AF_FORMAT_S16 && fmt != AF_FORMAT_S32) {
+        MP_ERR(vo, "Unsupported sample format %s.\n",
+               af_fmt_to_str(p->ao_format));
+        goto error;
+    }
+    if (p->ao_channels < 2) {
+        MP_ERR(vo, "The audio output needs at least 2 channels.\n");
+        goto error;
+    }
+    if (p->z && p->ao_channels < 3)
+        MP_WARN(vo, "No third channel for Z.\n");
+
+    p->render = (struct scope_render){
+        .opts = {
+            .size = p->size,
+            .blank_time = p->blank_time,
+            .z_invert = p->z_invert,
+        },
+        .channels = p->z && p->ao_channels >= 3 ? 3 : 2,
+    };
+
+    MP_VERBOSE(vo, "Output to %s at %d Hz, %d channels, %s.\n",
+               ao_get_name(p->ao), p->rate, p->ao_channels,
+               af_fmt_to_str(p->ao_format));
+    return 0;
+
+error:
+    uninit(vo);
+    return -1;
+}
+
+#define OPT_BASE_STRUCT struct priv
+
+const struct vo_driver video_out_scope =
+{
+    .description = "XY oscilloscope through an audio output",
+    .name = "scope",
+    .untimed = false,
+    .priv_size = sizeof(struct priv),
+    .options = (const struct m_option[]) {
+        OPT_STRING("ao", ao_spec, 0),
+        OPT_INTRANGE("rate", rate, 0, 8000, 768000, OPTDEF_INT(96000)),
+        OPT_FLAG("z", z, 0),
+        OPT_FLAG("z-invert", z_invert, 0),
+        OPT_FLOATRANGE("size", size, 0, 0, 1, OPTDEF_FLOAT(1)),
+        OPT_FLOATRANGE("blank-time", blank_time, 0, 0, 1, OPTDEF_FLOAT(0.25)),
+        OPT_FLOATRANGE("latency", latency, 0, 0.01, 2, OPTDEF_FLOAT(0.1)),
+        {0},
+    },
+    .preinit = preinit,
+    .query_format = query_format,
+    .reconfig = reconfig,
+    .control = control,
+    .draw_frame = draw_frame,
+    .flip_page = flip_page,
+    .uninit = uninit,
+};
@@ -43,6 +43,7 @@
 #include "video/sws_utils.h"
 #include "sub/osd.h"
 #include "options/m_option.h"
+#include "video/out/led/color.h"
 
 #define IMAGE_WIDTH 17
 #define IMAGE_HEIGHT 10
@@ -69,14 +70,13 @@ struct priv {
     unsigned int port;
     struct sockaddr_in dest_addr;
     
+    float gamma;
+    int dither;
+
     int fd;
     artnet_message_t msg;
-};
-
-//WS2101 leds are very non-linear. Bringing things down to 5 bit colordepth
-const uint8_t led_lookup[32] = {
-    0, 1, 2, 2, 2, 3, 3, 4, 5, 6, 7, 8, 10, 11, 13, 16, 19, 23,
-    27, 32, 38, 45, 54, 64, 76, 91, 108, 128, 152, 181, 215, 255
+    //WS2101 leds are very non-linear; the dithering keeps dark fades smooth
+    struct led_color color;
 };
 
 static void draw_image(struct vo *vo, mp_image_t *in){
@@ -105,13 +105,14 @@ static void draw_image(struct vo *vo, mp_image_t *in){
             
             uint8_t* dst = &p->msg.data[snake_pos];
             uint8_t* src = &in->planes[0][(y * widthStep) + (x*nChannels)];
-            dst[0] = led_lookup[src[0] * 32 / 256];
-            dst[1] = led_lookup[src[1] * 32 / 256];
-            dst[2] = led_lookup[src[2] * 32 / 256];
+            dst[0] = src[0];
+            dst[1] = src[1];
+            dst[2] = src[2];
             
         }
         
     }
+    led_color_apply(&p->color, p->msg.data, 0, IMAGE_WIDTH * IMAGE_HEIGHT);
 }
 
 static void flip_page(struct vo *vo){
@@ -154,6 +155,14 @@ static int preinit(struct vo *vo)
     if (inet_aton(p->hostname, &p->dest_addr.sin_addr)==0) return -1;
     
     p->msg.header.seq = rand();
+
+    struct led_color_params cp = {
+        .gamma = p->gamma,
+        .gain = {1, 1, 1},
+        .limit = {1, 1, 1},
+        .dither = p->dither,
+    };
+    led_color_init(&p->color, p, &cp, IMAGE_WIDTH * IMAGE_HEIGHT);
     
     return 0;
 }
@@ -174,6 +183,8 @@ const struct vo_driver video_out_tkkr =
     .options = (const struct m_option[]) {
         OPT_STRING("hostname", hostname, 0),
 //         OPT_INT("port", port, 0, OPTDEF_INT(6454)),
+        OPT_FLOATRANGE("gamma", gamma, 0, 0.1, 10, OPTDEF_FLOAT(3)),
+        OPT_FLAG("dither", dither, 0, OPTDEF_INT(1)),
         {0},
     },
     .preinit = preinit,
@@ -0,0 +1,47 @@
+/*
+ * This file is part of mpv.
+ *
+ * mpv is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation; either version 2.1 of the License, or
+ * (at your option) any later version.
+ *
+ * mpv is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with mpv.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "mpv_talloc.h"
+
+#include "img_format.h"
+#include "mp_image.h"
+#include "points.h"
+
+static void free_list(void *arg)
+{
+    talloc_free(arg);
+}
+
+struct mp_image *mp_points_wrap(struct mp_point_list *list, int w, int h)
+{
+    struct mp_image *img = mp_image_new_custom_ref(NULL, list, free_list);
+    if (!img) {
+        talloc_free(list);
+        return NULL;
+    }
+    mp_image_setfmt(img, IMGFMT_POINTS);
+    mp_image_set_size(img, w, h);
+    img->planes[0] = (void *)list;
+    return img;
+}
+
+struct mp_point_list *mp_points_get(struct mp_image *img)
+{
+    if (!img || img->imgfmt != IMGFMT_POINTS)
+        return NULL;
+    return (struct mp_point_list *)img->planes[0];
+}
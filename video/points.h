@@ -0,0 +1,51 @@
+/*
+ * This file is part of mpv.
+ *
+ * mpv is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation; either version 2.1 of the License, or
+ * (at your option) any later version.
+ *
+ * mpv is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with mpv.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef MP_POINTS_H_
+#define MP_POINTS_H_
+
+#include <stdint.h>
+
+struct mp_image;
+
+// Beam paths for vector displays (lasers, scopes), as produced by vf_vector.
+// They travel through the video chain as IMGFMT_POINTS images; the image size
+// is the coordinate space of the points, so the normal aspect handling works.
+
+enum {
+    MP_POINT_BLANK = 1 << 0,    // the beam moves to this point switched off
+};
+
+struct mp_point {
+    int16_t x, y;               // image pixels, y pointing down
+    uint8_t r, g, b;            // beam colour on the way to this point
+    uint8_t flags;              // MP_POINT_*
+};
+
+struct mp_point_list {
+    struct mp_point *points;
+    int num_points;
+};
+
+// Wrap list (a talloc allocation, which is taken over) into a w x h
+// IMGFMT_POINTS image. Returns NULL and frees list on failure.
+struct mp_image *mp_points_wrap(struct mp_point_list *list, int w, int h);
+
+// The point list of an IMGFMT_POINTS image, or NULL for other formats.
+struct mp_point_list *mp_points_get(struct mp_image *img);
+
+#endif
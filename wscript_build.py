@@ -257,12 +257,14 @@ def build(ctx):
         ( "common/common.c" ),
         ( "common/encode_lavc.c" ),
         ( "common/msg.c" ),
+        ( "common/frametrace.c" ),
         ( "common/playlist.c" ),
         ( "common/recorder.c" ),
         ( "common/tags.c" ),
         ( "common/version.c" ),
 
         ## Demuxers
+        ( "demux/cache.c" ),
         ( "demux/codec_tags.c" ),
         ( "demux/cue.c" ),
         ( "demux/demux.c" ),
@@ -281,6 +283,7 @@ def build(ctx):
         ( "demux/demux_timeline.c" ),
         ( "demux/demux_tv.c",                    "tv" ),
         ( "demux/ebml.c" ),
+        ( "demux/mkv_index.c" ),
         ( "demux/packet.c" ),
         ( "demux/timeline.c" ),
 
@@ -395,8 +398,11 @@ def build(ctx):
         ( "video/csputils.c" ),
         ( "video/d3d.c",                         "d3d-hwaccel" ),
         ( "video/decode/vd_lavc.c" ),
+        ( "video/dirty.c" ),
+        ( "video/filter/beampath.c" ),
+        ( "video/filter/contour.c" ),
         #( "video/filter/vf_canny.c",             "opencv" ),
-        ( "video/filter/vf_vector.c",            "opencv" ),
+        ( "video/filter/vf_vector.c" ),
         ( "video/filter/vf_vectorraster.c" ),
         ( "video/filter/refqueue.c" ),
         ( "video/filter/vf_d3d11vpp.c",          "d3d-hwaccel" ),
@@ -422,6 +428,7 @@ def build(ctx):
         ( "video/out/d3d11/hwdec_d3d11va.c",     "d3d11 && d3d-hwaccel" ),
         ( "video/out/d3d11/hwdec_dxva2dxgi.c",   "d3d11 && d3d9-hwaccel" ),
         ( "video/out/d3d11/ra_d3d11.c",          "d3d11" ),
+        ( "video/out/dgram.c" ),
         ( "video/out/dither.c" ),
         ( "video/out/dr_helper.c" ),
         ( "video/out/drm_atomic.c",              "drm" ),
@@ -473,6 +480,19 @@ def build(ctx):
         ( "video/out/opengl/libmpv_gl.c",        "gl" ),
         ( "video/out/opengl/ra_gl.c",            "gl" ),
         ( "video/out/opengl/utils.c",            "gl" ),
+        ( "video/out/laser/etherdream.c" ),
+        ( "video/out/laser/ilda.c" ),
+        ( "video/out/laser/path.c" ),
+        ( "video/out/laser/scope.c" ),
+        ( "video/out/led/color.c" ),
+        ( "video/out/led/map.c" ),
+        ( "video/out/led/proto.c" ),
+        ( "video/out/pixelflut/diff.c" ),
+        ( "video/out/pixelflut/format.c" ),
+        ( "video/out/pixelflut/net.c",           "epoll" ),
+        ( "video/out/pixelflut/ratectl.c" ),
+        ( "video/out/pixelflut/sched.c" ),
+        ( "video/out/pixelflut/shadow.c" ),
         ( "video/out/vo.c" ),
         ( "video/out/vo_caca.c",                 "caca" ),
         ( "video/out/vo_direct3d.c",             "direct3d" ),
@@ -490,12 +510,15 @@ def build(ctx):
         ( "video/out/vo_vdpau.c",                "vdpau" ),
         ( "video/out/vo_x11.c" ,                 "x11" ),
         ( "video/out/vo_xv.c",                   "xv" ),
-        ( "video/out/vo_pixelflut.c" ),
+        ( "video/out/vo_pixelflut.c",            "epoll" ),
         ( "video/out/vo_pixelflut2.c" ),
         ( "video/out/vo_pixelflutudp.c" ),
         ( "video/out/vo_pixelfluteth0.c" ),
         ( "video/out/vo_pixelflutentropia.c" ),
         ( "video/out/vo_matelight.c" ),
+        ( "video/out/vo_laser.c" ),
+        ( "video/out/vo_led.c" ),
+        ( "video/out/vo_scope.c" ),
         ( "video/out/vulkan/context.c",          "vulkan" ),
         ( "video/out/vulkan/context_wayland.c",  "vulkan && wayland" ),
         ( "video/out/vulkan/context_win.c",      "vulkan && win32-desktop" ),
@@ -514,6 +537,7 @@ def build(ctx):
         ( "video/out/win32/droptarget.c",        "win32-desktop" ),
         ( "video/out/win_state.c"),
         ( "video/out/x11_common.c",              "x11" ),
+        ( "video/points.c" ),
         ( "video/sws_utils.c" ),
         ( "video/vaapi.c",                       "vaapi" ),
         ( "video/vdpau.c",                       "vdpau" ),